@@ -51,6 +51,7 @@ def toClassPath(deps):
 DEPS = (
   ('org.apache.lucene', 'lucene-core', '4.3.0'),
   ('org.apache.lucene', 'lucene-facet', '4.3.0'),
+  ('org.apache.lucene', 'lucene-grouping', '4.3.0'),
   )
 
 TEST_DEPS = (
@@ -79,12 +80,13 @@ if not os.path.exists('dist'):
   os.makedirs('dist')
 genBulkPacked = 'src/c/org/apache/lucene/search/gen_BulkPacked.py'
 common = 'src/c/org/apache/lucene/search/common.cpp'
-if newer(genBulkPacked, common):
+facets = 'src/c/org/apache/lucene/search/facets.cpp'
+if newer(genBulkPacked, common) or newer(genBulkPacked, facets):
   print('\nGenerated packed decode functions')
   run('%s %s' % (sys.executable, genBulkPacked))
 
 cSources = [common,
-            'src/c/org/apache/lucene/search/facets.cpp',
+            facets,
             'src/c/org/apache/lucene/search/NativeSearch.cpp',
             'src/c/org/apache/lucene/search/BooleanQueryOnlyShould.cpp',
             'src/c/org/apache/lucene/search/DrillSideways.cpp',
@@ -92,6 +94,12 @@ cSources = [common,
             'src/c/org/apache/lucene/search/BooleanQueryShouldMustNot.cpp',
             'src/c/org/apache/lucene/search/BooleanQueryShouldMust.cpp',
             'src/c/org/apache/lucene/search/BooleanQueryShouldMustMustNot.cpp',
+            'src/c/org/apache/lucene/search/SpanQuery.cpp',
+            'src/c/org/apache/lucene/search/BlockTreeTermsReader.cpp',
+            'src/c/org/apache/lucene/search/TermStateCache.cpp',
+            'src/c/org/apache/lucene/search/FilterBitmap.cpp',
+            'src/c/org/apache/lucene/search/NumericSort.cpp',
+            'src/c/org/apache/lucene/search/Grouping.cpp',
             ]
 
 nativeSearchLib = 'dist/libNativeSearch.so'
@@ -99,7 +107,7 @@ if newer(cSources, nativeSearchLib):
   # -ftree-vectorizer-verbose=3
   # -march=corei7
   print('\nCompile NativeSearch.cpp')
-  run('g++ -g -fPIC -O3 -ffast-math -shared -o %s -I%s/include -I%s/include/linux %s' % (nativeSearchLib, JAVA_HOME, JAVA_HOME, ' '.join(cSources)))
+  run('g++ -g -fPIC -O3 -ffast-math -pthread -shared -o %s -I%s/include -I%s/include/linux %s' % (nativeSearchLib, JAVA_HOME, JAVA_HOME, ' '.join(cSources)))
 
 mmapSource = 'src/c/org/apache/lucene/store/NativeMMapDirectory.cpp'
 mmapLib = 'dist/libNativeMMapDirectory.so'
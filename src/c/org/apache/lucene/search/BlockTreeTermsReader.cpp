@@ -0,0 +1,639 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Seeks terms in Lucene 4.3's BlockTree terms dict (.tim),
+// decoding the term's stats and Lucene41PostingsReader
+// metadata, without using the FST terms index (.tip).
+//
+// Each block holds up to ~48 entries sharing a prefix; an
+// entry is either a term suffix or a pointer to a sub-block
+// holding all terms with a longer prefix.  A block with too
+// many entries is split into "floor" blocks, which are
+// always written one after another, so we can scan them in
+// order without the floor data from the index.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+// Same order as BytesRef.compareTo (unsigned bytes):
+static int
+compareBytes(unsigned char *a, int aLength, unsigned char *b, int bLength) {
+  int limit = aLength < bLength ? aLength : bLength;
+  for(int i=0;i<limit;i++) {
+    int diff = a[i] - b[i];
+    if (diff != 0) {
+      return diff;
+    }
+  }
+  return aLength - bLength;
+}
+
+void
+initTermsDict(TermsDict *dict, unsigned char *tim, long rootBlockFP, bool hasFreqs, bool hasPositions, bool hasPayloadsOrOffsets) {
+  dict->tim = tim;
+  dict->rootBlockFP = rootBlockFP;
+  dict->hasFreqs = hasFreqs;
+  dict->hasPositions = hasPositions;
+  dict->hasPayloadsOrOffsets = hasPayloadsOrOffsets;
+  dict->lastTerm = 0;
+  dict->lastTermLength = 0;
+  dict->lastBlockFP = rootBlockFP;
+  dict->lastPrefixLength = 0;
+}
+
+// Decodes the next term's stats and metadata in the
+// current block; same as SegmentTermsEnum.Frame.decodeMetaData
+// plus Lucene41PostingsReader.nextTerm:
+static void
+nextTermMetaData(TermsDict *dict, unsigned char **stats, unsigned char **meta, bool isFirstTerm, TermMetaData *state, long *payStartFP) {
+  state->docFreq = readVInt(stats);
+  if (dict->hasFreqs) {
+    state->totalTermFreq = state->docFreq + readVLong(stats);
+  } else {
+    state->totalTermFreq = -1;
+  }
+
+  if (isFirstTerm) {
+    state->docStartFP = 0;
+    state->posStartFP = 0;
+    *payStartFP = -1;
+  }
+
+  if (state->docFreq == 1) {
+    state->singletonDocID = readVInt(meta);
+  } else {
+    state->singletonDocID = -1;
+    state->docStartFP += readVLong(meta);
+  }
+  if (dict->hasPositions) {
+    state->posStartFP += readVLong(meta);
+    if (state->totalTermFreq > BLOCK_SIZE) {
+      // lastPosBlockOffset
+      readVLong(meta);
+    }
+    if (dict->hasPayloadsOrOffsets && state->totalTermFreq >= BLOCK_SIZE) {
+      long delta = readVLong(meta);
+      if (*payStartFP == -1) {
+        *payStartFP = delta;
+      } else {
+        *payStartFP += delta;
+      }
+    }
+  }
+  if (state->docFreq > BLOCK_SIZE) {
+    // skipOffset
+    readVLong(meta);
+  }
+}
+
+bool
+seekTermsDict(TermsDict *dict, unsigned char *term, int termLength, TermMetaData *meta) {
+  long fp;
+  int prefixLength;
+
+  if (dict->lastTerm != 0 &&
+      termLength >= dict->lastPrefixLength &&
+      memcmp(term, dict->lastTerm, dict->lastPrefixLength) == 0 &&
+      compareBytes(term, termLength, dict->lastTerm, dict->lastTermLength) > 0) {
+    // Term is after the last term, and within the last
+    // block (or one of its later floor blocks):
+    fp = dict->lastBlockFP;
+    prefixLength = dict->lastPrefixLength;
+  } else {
+    fp = dict->rootBlockFP;
+    prefixLength = 0;
+  }
+  dict->lastTerm = term;
+  dict->lastTermLength = termLength;
+
+  while (true) {
+    dict->lastBlockFP = fp;
+    dict->lastPrefixLength = prefixLength;
+
+    unsigned char *p = dict->tim + fp;
+    unsigned int code = readVInt(&p);
+    int entCount = code >> 1;
+    bool isLastInFloor = (code & 1) != 0;
+
+    code = readVInt(&p);
+    bool isLeafBlock = (code & 1) != 0;
+    unsigned char *suffixes = p;
+    p += code >> 1;
+
+    unsigned int numBytes = readVInt(&p);
+    unsigned char *stats = p;
+    p += numBytes;
+
+    numBytes = readVInt(&p);
+    unsigned char *metaBytes = p;
+    // Next floor block, if any, starts here:
+    unsigned char *blockEnd = p + numBytes;
+
+    unsigned char *target = term + prefixLength;
+    int targetLength = termLength - prefixLength;
+    int termBlockOrd = 0;
+    long payStartFP = -1;
+    bool descend = false;
+
+    for(int ent=0;ent<entCount;ent++) {
+      unsigned int suffixLength;
+      bool isSubBlock;
+      if (isLeafBlock) {
+        suffixLength = readVInt(&suffixes);
+        isSubBlock = false;
+      } else {
+        code = readVInt(&suffixes);
+        suffixLength = code >> 1;
+        isSubBlock = (code & 1) != 0;
+      }
+      unsigned char *suffix = suffixes;
+      suffixes += suffixLength;
+
+      if (isSubBlock) {
+        long subCode = readVLong(&suffixes);
+        if ((int) suffixLength <= targetLength && memcmp(target, suffix, suffixLength) == 0) {
+          // All terms with this prefix, including the prefix
+          // itself, are in the sub-block:
+          fp -= subCode;
+          prefixLength += suffixLength;
+          descend = true;
+          break;
+        }
+        if (compareBytes(target, targetLength, suffix, suffixLength) < 0) {
+          return false;
+        }
+      } else {
+        nextTermMetaData(dict, &stats, &metaBytes, termBlockOrd == 0, meta, &payStartFP);
+        termBlockOrd++;
+        int cmp = compareBytes(target, targetLength, suffix, suffixLength);
+        if (cmp == 0) {
+          return true;
+        } else if (cmp < 0) {
+          return false;
+        }
+      }
+    }
+
+    if (!descend) {
+      if (isLastInFloor) {
+        return false;
+      }
+      fp = blockEnd - dict->tim;
+    }
+  }
+}
+
+static bool
+addTermStats(TermStatsList *out, TermMetaData *meta) {
+  if (out->count + 2 > out->capacity) {
+    int newCapacity = out->capacity < 64 ? 64 : out->capacity * 2;
+    long *newValues = (long *) realloc(out->values, newCapacity * sizeof(long));
+    if (newValues == 0) {
+      return false;
+    }
+    out->values = newValues;
+    out->capacity = newCapacity;
+  }
+  out->values[out->count++] = meta->docFreq;
+  out->values[out->count++] = meta->docFreq == 1 ? meta->singletonDocID : meta->docStartFP;
+  return true;
+}
+
+// Runs the DFA over the bytes; returns -1 once it's dead:
+static int
+runDFA(int *transitions, int state, unsigned char *bytes, int length) {
+  for(int i=0;i<length && state != -1;i++) {
+    state = transitions[(state << 8) | bytes[i]];
+  }
+  return state;
+}
+
+// Intersects one block (and its following floor blocks);
+// state is the DFA state after the block's prefix.  Whole
+// sub-blocks are skipped once the DFA is dead on their
+// prefix:
+static bool
+intersectBlock(TermsDict *dict, long fp, int state, int *transitions, unsigned char *accept, TermStatsList *out) {
+  TermMetaData meta;
+
+  while (true) {
+    unsigned char *p = dict->tim + fp;
+    unsigned int code = readVInt(&p);
+    int entCount = code >> 1;
+    bool isLastInFloor = (code & 1) != 0;
+
+    code = readVInt(&p);
+    bool isLeafBlock = (code & 1) != 0;
+    unsigned char *suffixes = p;
+    p += code >> 1;
+
+    unsigned int numBytes = readVInt(&p);
+    unsigned char *stats = p;
+    p += numBytes;
+
+    numBytes = readVInt(&p);
+    unsigned char *metaBytes = p;
+    unsigned char *blockEnd = p + numBytes;
+
+    int termBlockOrd = 0;
+    long payStartFP = -1;
+
+    for(int ent=0;ent<entCount;ent++) {
+      unsigned int suffixLength;
+      bool isSubBlock;
+      if (isLeafBlock) {
+        suffixLength = readVInt(&suffixes);
+        isSubBlock = false;
+      } else {
+        code = readVInt(&suffixes);
+        suffixLength = code >> 1;
+        isSubBlock = (code & 1) != 0;
+      }
+      unsigned char *suffix = suffixes;
+      suffixes += suffixLength;
+
+      if (isSubBlock) {
+        long subCode = readVLong(&suffixes);
+        int subState = runDFA(transitions, state, suffix, suffixLength);
+        if (subState != -1 && !intersectBlock(dict, fp - subCode, subState, transitions, accept, out)) {
+          return false;
+        }
+      } else {
+        // Must decode every term, since metadata is delta
+        // coded within the block:
+        nextTermMetaData(dict, &stats, &metaBytes, termBlockOrd == 0, &meta, &payStartFP);
+        termBlockOrd++;
+        int termState = runDFA(transitions, state, suffix, suffixLength);
+        if (termState != -1 && accept[termState] && !addTermStats(out, &meta)) {
+          return false;
+        }
+      }
+    }
+
+    if (isLastInFloor) {
+      return true;
+    }
+    fp = blockEnd - dict->tim;
+  }
+}
+
+bool
+intersectTermsDict(TermsDict *dict, int *transitions, unsigned char *accept, int initialState, TermStatsList *out) {
+  return intersectBlock(dict, dict->rootBlockFP, initialState, transitions, accept, out);
+}
+
+// Numeric terms are at most 11 bytes (NumericUtils.BUF_SIZE_LONG):
+#define MAX_NUMERIC_TERM_LENGTH 16
+
+// Adds terms of one block (and its floor blocks) within
+// [lower, upper]; prefix holds the block's prefix bytes.
+// Returns 1 once a term past upper is seen (so are all
+// later terms), 0 to keep going, -1 if malloc failed:
+static int
+rangeBlock(TermsDict *dict, long fp, unsigned char *prefix, int prefixLength,
+           unsigned char *lower, int lowerLength, unsigned char *upper, int upperLength, TermStatsList *out) {
+  TermMetaData meta;
+
+  while (true) {
+    unsigned char *p = dict->tim + fp;
+    unsigned int code = readVInt(&p);
+    int entCount = code >> 1;
+    bool isLastInFloor = (code & 1) != 0;
+
+    code = readVInt(&p);
+    bool isLeafBlock = (code & 1) != 0;
+    unsigned char *suffixes = p;
+    p += code >> 1;
+
+    unsigned int numBytes = readVInt(&p);
+    unsigned char *stats = p;
+    p += numBytes;
+
+    numBytes = readVInt(&p);
+    unsigned char *metaBytes = p;
+    unsigned char *blockEnd = p + numBytes;
+
+    int termBlockOrd = 0;
+    long payStartFP = -1;
+
+    for(int ent=0;ent<entCount;ent++) {
+      unsigned int suffixLength;
+      bool isSubBlock;
+      if (isLeafBlock) {
+        suffixLength = readVInt(&suffixes);
+        isSubBlock = false;
+      } else {
+        code = readVInt(&suffixes);
+        suffixLength = code >> 1;
+        isSubBlock = (code & 1) != 0;
+      }
+      unsigned char *suffix = suffixes;
+      suffixes += suffixLength;
+
+      int length = prefixLength + suffixLength;
+      if (length > MAX_NUMERIC_TERM_LENGTH) {
+        // Not a numeric term; comparing only its first bytes
+        // still orders it correctly against lower and upper,
+        // which are shorter:
+        length = MAX_NUMERIC_TERM_LENGTH;
+      }
+      memcpy(prefix + prefixLength, suffix, length - prefixLength);
+
+      if (isSubBlock) {
+        long subCode = readVLong(&suffixes);
+        if (compareBytes(prefix, length, upper, upperLength) > 0) {
+          return 1;
+        }
+        int n = length < lowerLength ? length : lowerLength;
+        if (compareBytes(prefix, length, lower, n) >= 0) {
+          // Some terms under this prefix may be in range:
+          int result = rangeBlock(dict, fp - subCode, prefix, length, lower, lowerLength, upper, upperLength, out);
+          if (result != 0) {
+            return result;
+          }
+        }
+      } else {
+        nextTermMetaData(dict, &stats, &metaBytes, termBlockOrd == 0, &meta, &payStartFP);
+        termBlockOrd++;
+        if (compareBytes(prefix, length, upper, upperLength) > 0) {
+          return 1;
+        }
+        if (compareBytes(prefix, length, lower, lowerLength) >= 0 && !addTermStats(out, &meta)) {
+          return -1;
+        }
+      }
+    }
+
+    if (isLastInFloor) {
+      return 0;
+    }
+    fp = blockEnd - dict->tim;
+  }
+}
+
+// Same as NumericUtils.long/intToPrefixCodedBytes; returns
+// the number of bytes:
+static int
+prefixCode(int valSize, long value, int shift, unsigned char *bytes) {
+  int nChars;
+  if (valSize == 64) {
+    nChars = (((63-shift)*37)>>8) + 1;
+    bytes[0] = 0x20 + shift;
+    unsigned long sortableBits = ((unsigned long) value ^ 0x8000000000000000UL) >> shift;
+    for(int i=nChars;i>0;i--) {
+      bytes[i] = sortableBits & 0x7f;
+      sortableBits >>= 7;
+    }
+  } else {
+    nChars = (((31-shift)*37)>>8) + 1;
+    bytes[0] = 0x60 + shift;
+    unsigned int sortableBits = ((unsigned int) (int) value ^ 0x80000000U) >> shift;
+    for(int i=nChars;i>0;i--) {
+      bytes[i] = sortableBits & 0x7f;
+      sortableBits >>= 7;
+    }
+  }
+  return nChars+1;
+}
+
+static bool
+addNumericRange(TermsDict *dict, int valSize, long minBound, long maxBound, int shift, TermStatsList *out) {
+  unsigned char lower[MAX_NUMERIC_TERM_LENGTH];
+  unsigned char upper[MAX_NUMERIC_TERM_LENGTH];
+  unsigned char prefix[MAX_NUMERIC_TERM_LENGTH];
+
+  // Set all lower bits that were shifted away, like
+  // NumericUtils.addRange:
+  maxBound |= (1L << shift) - 1L;
+  int lowerLength = prefixCode(valSize, minBound, shift, lower);
+  int upperLength = prefixCode(valSize, maxBound, shift, upper);
+  return rangeBlock(dict, dict->rootBlockFP, prefix, 0, lower, lowerLength, upper, upperLength, out) != -1;
+}
+
+// Port of NumericUtils.splitRange, walking the terms dict
+// for each sub-range:
+bool
+numericRangeTermsDict(TermsDict *dict, int valSize, int precisionStep, long minBound, long maxBound, TermStatsList *out) {
+  for(int shift=0;;shift+=precisionStep) {
+    if (shift + precisionStep >= valSize) {
+      // Lowest precision:
+      return addNumericRange(dict, valSize, minBound, maxBound, shift, out);
+    }
+
+    // Unsigned math, since Java wraps on overflow:
+    unsigned long diff = 1UL << (shift+precisionStep);
+    unsigned long mask = ((1UL << precisionStep) - 1UL) << shift;
+    bool hasLower = ((unsigned long) minBound & mask) != 0;
+    bool hasUpper = ((unsigned long) maxBound & mask) != mask;
+    long nextMinBound = (long) ((hasLower ? (unsigned long) minBound + diff : (unsigned long) minBound) & ~mask);
+    long nextMaxBound = (long) ((hasUpper ? (unsigned long) maxBound - diff : (unsigned long) maxBound) & ~mask);
+    bool lowerWrapped = nextMinBound < minBound;
+    bool upperWrapped = nextMaxBound > maxBound;
+
+    if (nextMinBound > nextMaxBound || lowerWrapped || upperWrapped) {
+      // Next precision is not available:
+      return addNumericRange(dict, valSize, minBound, maxBound, shift, out);
+    }
+
+    if (hasLower && !addNumericRange(dict, valSize, minBound, (long) ((unsigned long) minBound | mask), shift, out)) {
+      return false;
+    }
+    if (hasUpper && !addNumericRange(dict, valSize, (long) ((unsigned long) maxBound & ~mask), maxBound, shift, out)) {
+      return false;
+    }
+
+    minBound = nextMinBound;
+    maxBound = nextMaxBound;
+  }
+}
+
+// State of one fuzzyTermsDict walk:
+typedef struct {
+  TermsDict *dict;
+  int numDFAs;
+  int *transitions;
+  unsigned char *accept;
+
+  // Current block's prefix, followed by the current
+  // entry's suffix:
+  unsigned char *term;
+  int termCapacity;
+
+  TermStatsList *out;
+  ByteList *termBytes;
+} FuzzyWalk;
+
+static bool
+growBytes(unsigned char **bytes, int *capacity, int minCapacity) {
+  if (minCapacity > *capacity) {
+    int newCapacity = *capacity < 64 ? 64 : *capacity * 2;
+    if (newCapacity < minCapacity) {
+      newCapacity = minCapacity;
+    }
+    unsigned char *newBytes = (unsigned char *) realloc(*bytes, newCapacity);
+    if (newBytes == 0) {
+      return false;
+    }
+    *bytes = newBytes;
+    *capacity = newCapacity;
+  }
+  return true;
+}
+
+static bool
+addFuzzyTerm(FuzzyWalk *walk, int ed, int termLength, TermMetaData *meta) {
+  TermStatsList *out = walk->out;
+  if (out->count + FUZZY_TERM_STATS > out->capacity) {
+    int newCapacity = out->capacity < 64 ? 64 : out->capacity * 2;
+    long *newValues = (long *) realloc(out->values, newCapacity * sizeof(long));
+    if (newValues == 0) {
+      return false;
+    }
+    out->values = newValues;
+    out->capacity = newCapacity;
+  }
+
+  ByteList *termBytes = walk->termBytes;
+  if (!growBytes(&termBytes->bytes, &termBytes->capacity, termBytes->length + termLength)) {
+    return false;
+  }
+  memcpy(termBytes->bytes + termBytes->length, walk->term, termLength);
+  termBytes->length += termLength;
+
+  out->values[out->count++] = ed;
+  out->values[out->count++] = termLength;
+  out->values[out->count++] = meta->docFreq;
+  out->values[out->count++] = meta->totalTermFreq;
+  out->values[out->count++] = meta->docFreq == 1 ? meta->singletonDocID : meta->docStartFP;
+  return true;
+}
+
+// Same as intersectBlock, but runs all Levenshtein DFAs at
+// once; only the last (largest edit distance) one decides
+// which sub-blocks and terms are visited, and the others
+// give each term's exact edit distance:
+static bool
+fuzzyBlock(FuzzyWalk *walk, long fp, int *states, int prefixLength) {
+  TermsDict *dict = walk->dict;
+  int lastDFA = walk->numDFAs-1;
+  int subStates[MAX_FUZZY_DFAS];
+  TermMetaData meta;
+
+  while (true) {
+    unsigned char *p = dict->tim + fp;
+    unsigned int code = readVInt(&p);
+    int entCount = code >> 1;
+    bool isLastInFloor = (code & 1) != 0;
+
+    code = readVInt(&p);
+    bool isLeafBlock = (code & 1) != 0;
+    unsigned char *suffixes = p;
+    p += code >> 1;
+
+    unsigned int numBytes = readVInt(&p);
+    unsigned char *stats = p;
+    p += numBytes;
+
+    numBytes = readVInt(&p);
+    unsigned char *metaBytes = p;
+    unsigned char *blockEnd = p + numBytes;
+
+    int termBlockOrd = 0;
+    long payStartFP = -1;
+
+    for(int ent=0;ent<entCount;ent++) {
+      unsigned int suffixLength;
+      bool isSubBlock;
+      if (isLeafBlock) {
+        suffixLength = readVInt(&suffixes);
+        isSubBlock = false;
+      } else {
+        code = readVInt(&suffixes);
+        suffixLength = code >> 1;
+        isSubBlock = (code & 1) != 0;
+      }
+      unsigned char *suffix = suffixes;
+      suffixes += suffixLength;
+
+      long subCode = 0;
+      if (isSubBlock) {
+        subCode = readVLong(&suffixes);
+      } else {
+        nextTermMetaData(dict, &stats, &metaBytes, termBlockOrd == 0, &meta, &payStartFP);
+        termBlockOrd++;
+      }
+
+      subStates[lastDFA] = runDFA(walk->transitions, states[lastDFA], suffix, suffixLength);
+      if (subStates[lastDFA] == -1 || (!isSubBlock && !walk->accept[subStates[lastDFA]])) {
+        continue;
+      }
+      for(int i=0;i<lastDFA;i++) {
+        subStates[i] = runDFA(walk->transitions, states[i], suffix, suffixLength);
+      }
+
+      int length = prefixLength + suffixLength;
+      if (!growBytes(&walk->term, &walk->termCapacity, length)) {
+        return false;
+      }
+      memcpy(walk->term + prefixLength, suffix, suffixLength);
+
+      if (isSubBlock) {
+        if (!fuzzyBlock(walk, fp - subCode, subStates, length)) {
+          return false;
+        }
+      } else {
+        // Same as FuzzyTermsEnum: step down while the next
+        // smaller edit distance still matches:
+        int ed = lastDFA;
+        while (ed > 0 && subStates[ed-1] != -1 && walk->accept[subStates[ed-1]]) {
+          ed--;
+        }
+        if (!addFuzzyTerm(walk, ed, length, &meta)) {
+          return false;
+        }
+      }
+    }
+
+    if (isLastInFloor) {
+      return true;
+    }
+    fp = blockEnd - dict->tim;
+  }
+}
+
+bool
+fuzzyTermsDict(TermsDict *dict, int numDFAs, int *transitions, unsigned char *accept, int *initialStates,
+               TermStatsList *out, ByteList *termBytes) {
+  FuzzyWalk walk;
+  walk.dict = dict;
+  walk.numDFAs = numDFAs;
+  walk.transitions = transitions;
+  walk.accept = accept;
+  walk.term = 0;
+  walk.termCapacity = 0;
+  walk.out = out;
+  walk.termBytes = termBytes;
+
+  bool result = fuzzyBlock(&walk, dict->rootBlockFP, initialStates, 0);
+  if (walk.term != 0) {
+    free(walk.term);
+  }
+  return result;
+}
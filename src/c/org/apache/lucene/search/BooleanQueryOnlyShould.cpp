@@ -98,91 +98,6 @@ orFirstChunk(PostingsState *sub,
   return numFilled;
 }
 
-static int
-orFirstChunkDeletes(PostingsState *sub,
-                    double *tsCache,
-                    float termWeight,
-                    int endDoc,
-                    unsigned int *filled,
-                    int *docIDs,
-                    float *scores,
-                    unsigned int *coords,
-                    unsigned char *liveDocBytes) {
-
-  int nextDocID = sub->nextDocID;
-  unsigned int *docDeltas = sub->docDeltas;
-  unsigned int *freqs = sub->freqs;
-
-  int blockLastRead = sub->docFreqBlockLastRead;
-  int blockEnd = sub->docFreqBlockEnd;
-
-  int numFilled = 0;
-
-  // First scorer is different because we know slot is
-  // "new" for every hit:
-  if (scores == 0) {
-    //printf("scorers[0]\n");
-    while (nextDocID < endDoc) {
-      if (isSet(liveDocBytes, nextDocID)) {
-        //printf("  docID=%d\n", nextDocID);
-        int slot = nextDocID & MASK;
-        docIDs[slot] = nextDocID;
-        filled[numFilled++] = slot;
-      }
-
-      // Inlined nextDoc:
-      if (blockLastRead == blockEnd) {
-        if (sub->docsLeft == 0) {
-          nextDocID = NO_MORE_DOCS;
-          break;
-        } else {
-          nextDocFreqBlock(sub);
-          blockLastRead = -1;
-          blockEnd = sub->docFreqBlockEnd;
-        }
-      }
-      nextDocID += docDeltas[++blockLastRead];
-    }
-  } else {
-
-    // First scorer is different because we know slot is
-    // "new" for every hit:
-    //printf("scorers[0]\n");
-    while (nextDocID < endDoc) {
-      if (isSet(liveDocBytes, nextDocID)) {
-        int slot = nextDocID & MASK;
-        int freq = freqs[blockLastRead];
-        docIDs[slot] = nextDocID;
-        if (freq < TERM_SCORES_CACHE_SIZE) {
-          scores[slot] = tsCache[freq];
-        } else {
-          scores[slot] = sqrt(freq) * termWeight;
-        }
-        coords[slot] = 1;
-        filled[numFilled++] = slot;
-      }
-
-      // Inlined nextDoc:
-      if (blockLastRead == blockEnd) {
-        if (sub->docsLeft == 0) {
-          nextDocID = NO_MORE_DOCS;
-          break;
-        } else {
-          nextDocFreqBlock(sub);
-          blockLastRead = -1;
-          blockEnd = sub->docFreqBlockEnd;
-        }
-      }
-      nextDocID += docDeltas[++blockLastRead];
-    }
-  }
-
-  sub->nextDocID = nextDocID;
-  sub->docFreqBlockLastRead = blockLastRead;
-
-  return numFilled;
-}
-
 static int
 orChunk(PostingsState *sub,
         double *tsCache,
@@ -269,100 +184,10 @@ orChunk(PostingsState *sub,
   return numFilled;
 }
 
-static int
-orChunkDeletes(PostingsState *sub,
-               double *tsCache,
-               float termWeight,
-               int endDoc,
-               unsigned int *filled,
-               int numFilled,
-               int *docIDs,
-               float *scores,
-               unsigned int *coords,
-               unsigned char *liveDocBytes) {
-
-  int nextDocID = sub->nextDocID;
-  unsigned int *docDeltas = sub->docDeltas;
-  unsigned int *freqs = sub->freqs;
-
-  int blockLastRead = sub->docFreqBlockLastRead;
-  int blockEnd = sub->docFreqBlockEnd;
-
-  if (scores == 0) {
-    //printf("term=%d nextDoc=%d\n", i, sub->nextDocID);
-    while (nextDocID < endDoc) {
-      //printf("  docID=%d\n", nextDocID);
-      if (isSet(liveDocBytes, nextDocID)) {
-        int slot = nextDocID & MASK;
-
-        if (docIDs[slot] != nextDocID) {
-          docIDs[slot] = nextDocID;
-          filled[numFilled++] = slot;
-        }
-      }
-
-      // Inlined nextDoc:
-      if (blockLastRead == blockEnd) {
-        if (sub->docsLeft == 0) {
-          nextDocID = NO_MORE_DOCS;
-          break;
-        } else {
-          nextDocFreqBlock(sub);
-          blockLastRead = -1;
-          blockEnd = sub->docFreqBlockEnd;
-        }
-      }
-      nextDocID += docDeltas[++blockLastRead];
-    }
-  } else {
-
-    //printf("term=%d nextDoc=%d\n", i, sub->nextDocID);
-    while (nextDocID < endDoc) {
-      //printf("  docID=%d\n", nextDocID);
-      if (isSet(liveDocBytes, nextDocID)) {
-        int slot = nextDocID & MASK;
-        int freq = freqs[blockLastRead];
-        double score;
-        if (freq < TERM_SCORES_CACHE_SIZE) {
-          score = tsCache[freq];
-        } else {
-          score = sqrt(freq) * termWeight;
-        }
-
-        if (docIDs[slot] != nextDocID) {
-          docIDs[slot] = nextDocID;
-          scores[slot] = score;
-          coords[slot] = 1;
-          filled[numFilled++] = slot;
-        } else {
-          scores[slot] += score;
-          coords[slot]++;
-        }
-      }
-
-      // Inlined nextDoc:
-      if (blockLastRead == blockEnd) {
-        if (sub->docsLeft == 0) {
-          nextDocID = NO_MORE_DOCS;
-          break;
-        } else {
-          nextDocFreqBlock(sub);
-          blockLastRead = -1;
-          blockEnd = sub->docFreqBlockEnd;
-        }
-      }
-      nextDocID += docDeltas[++blockLastRead];
-    }
-  }
-
-  sub->nextDocID = nextDocID;
-  sub->docFreqBlockLastRead = blockLastRead;
-
-  return numFilled;
-}
-
 int booleanQueryOnlyShould(PostingsState* subs,
                            unsigned char *liveDocsBytes,
+                           FilterBitmap *filter,
+                           unsigned char *acceptBits,
                            double **termScoreCache,
                            float *termWeights,
                            int maxDoc,
@@ -375,6 +200,8 @@ int booleanQueryOnlyShould(PostingsState* subs,
                            unsigned int *coords,
                            float *topScores,
                            int *topDocIDs,
+                           NumericSort *sort,
+                           GroupCollector *groups,
                            float *coordFactors,
                            float *normTable,
                            unsigned char *norms,
@@ -385,7 +212,8 @@ int booleanQueryOnlyShould(PostingsState* subs,
                            unsigned int *dsTotalHits,
                            unsigned int *dsTermsPerDim,
                            unsigned long *dsHitBits,
-                           unsigned long **dsNearMissBits)
+                           unsigned long **dsNearMissBits,
+                           FacetCounter *dsFacets)
 {
   int docUpto = 0;
   int hitCount = 0;
@@ -393,22 +221,40 @@ int booleanQueryOnlyShould(PostingsState* subs,
     int endDoc = docUpto + CHUNK;
     //printf("cycle endDoc=%d\n", endDoc);fflush(stdout);
 
-    int numFilled = 0;
-
-    if (liveDocsBytes != 0) {
-      // Collect first sub without if, since we know every
-      // slot will be stale:
-      numFilled = orFirstChunkDeletes(&subs[0], termScoreCache[0], termWeights[0], endDoc, filled, docIDs, scores, coords, liveDocsBytes);
-      for(int i=1;i<numScorers;i++) {
-        numFilled = orChunkDeletes(&subs[i], termScoreCache[i], termWeights[i], endDoc, filled, numFilled, docIDs, scores, coords, liveDocsBytes);
-      }
+    unsigned char *chunkLiveDocs = liveDocsBytes;
+    bool chunkEmpty;
+    if (filter != 0) {
+      // Only this chunk's bytes of acceptBits are filled:
+      chunkEmpty = !fillFilterChunk(filter, liveDocsBytes, acceptBits, docUpto);
+      chunkLiveDocs = acceptBits;
     } else {
-      // Collect first sub without if, since we know every
-      // slot will be stale:
-      numFilled = orFirstChunk(&subs[0], termScoreCache[0], termWeights[0], endDoc, filled, docIDs, scores, coords);
-      for(int i=1;i<numScorers;i++) {
-        numFilled = orChunk(&subs[i], termScoreCache[i], termWeights[i], endDoc, filled, numFilled, docIDs, scores, coords);
+      chunkEmpty = liveDocsBytes != 0 && isChunkEmpty(liveDocsBytes, docUpto, maxDoc);
+    }
+    if (chunkEmpty) {
+      // No live (or filter accepted) docs here:
+      for(int i=0;i<numScorers;i++) {
+        skipChunk(&subs[i], endDoc);
       }
+      if (dsNumDims > 0) {
+        drillSidewaysSkipChunk(dsSubs, dsNumDims, dsTermsPerDim, endDoc);
+      }
+      docUpto += CHUNK;
+      continue;
+    }
+
+    int numFilled = 0;
+
+    // Collect first sub without if, since we know every
+    // slot will be stale:
+    numFilled = orFirstChunk(&subs[0], termScoreCache[0], termWeights[0], endDoc, filled, docIDs, scores, coords);
+    for(int i=1;i<numScorers;i++) {
+      numFilled = orChunk(&subs[i], termScoreCache[i], termWeights[i], endDoc, filled, numFilled, docIDs, scores, coords);
+    }
+
+    if (chunkLiveDocs != 0) {
+      // Deletions (and filter) applied once per hit, not per
+      // clause posting:
+      numFilled = andChunkBits(chunkLiveDocs, docUpto, maxDoc, filled, numFilled);
     }
 
     int docChunkBase = docBase + docUpto;
@@ -435,7 +281,29 @@ int booleanQueryOnlyShould(PostingsState* subs,
                                        dsTermsPerDim,
                                        dsTotalHits,
                                        dsHitBits,
-                                       dsNearMissBits);
+                                       dsNearMissBits,
+                                       dsFacets);
+    } else if (sort != 0) {
+      hitCount += numFilled;
+      if (scores != 0) {
+        // Sorting by score too:
+        for(int i=0;i<numFilled;i++) {
+          int slot = filled[i];
+          scores[slot] = scores[slot] * coordFactors[coords[slot]] * normTable[norms[docIDs[slot]]];
+        }
+      }
+      if (sortCollect(sort, topN, docBase, docUpto, filled, numFilled, 0, scores, topDocIDs)) {
+        // Index-sorted segment: no later doc is competitive,
+        // so hitCount is only a lower bound:
+        break;
+      }
+    } else if (groups != 0) {
+      hitCount += numFilled;
+      for(int i=0;i<numFilled;i++) {
+        int slot = filled[i];
+        scores[slot] = scores[slot] * coordFactors[coords[slot]] * normTable[norms[docIDs[slot]]];
+      }
+      groupCollect(groups, topN, docBase, docUpto, filled, numFilled, 0, scores, topDocIDs, topScores);
     } else if (topScores == 0) {
       hitCount += numFilled;
       for(int i=0;i<numFilled;i++) {
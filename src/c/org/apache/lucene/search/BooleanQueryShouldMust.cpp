@@ -101,89 +101,6 @@ orFirstMustChunk(PostingsState *sub,
   return numFilled;
 }
 
-static int
-orFirstMustChunkWithDeletes(PostingsState *sub,
-                            double *tsCache,
-                            float termWeight,
-                            int endDoc,
-                            unsigned int *filled,
-                            int *docIDs,
-                            float *scores,
-                            unsigned int *coords,
-                            unsigned char *liveDocsBytes) {
-
-  int nextDocID = sub->nextDocID;
-  unsigned int *docDeltas = sub->docDeltas;
-  unsigned int *freqs = sub->freqs;
-
-  int blockLastRead = sub->docFreqBlockLastRead;
-  int blockEnd = sub->docFreqBlockEnd;
-
-  int numFilled = 0;
-
-  // First scorer is different because we know slot is
-  // "new" for every hit:
-  if (scores == 0) {
-    while (nextDocID < endDoc) {
-      if (isSet(liveDocsBytes, nextDocID)) {
-        //printf("  docID=%d\n", nextDocID);
-        int slot = nextDocID & MASK;
-        docIDs[slot] = nextDocID;
-        coords[slot] = 1;
-        filled[numFilled++] = slot;
-      }
-
-      // Inlined nextDoc:
-      if (blockLastRead == blockEnd) {
-        if (sub->docsLeft == 0) {
-          nextDocID = NO_MORE_DOCS;
-          break;
-        } else {
-          nextDocFreqBlock(sub);
-          blockLastRead = -1;
-          blockEnd = sub->docFreqBlockEnd;
-        }
-      }
-      nextDocID += docDeltas[++blockLastRead];
-    }
-  } else {
-
-    //printf("scorers[0]\n");fflush(stdout);
-    while (nextDocID < endDoc) {
-      //printf("  docID=%d\n", nextDocID);
-      if (isSet(liveDocsBytes, nextDocID)) {
-        int slot = nextDocID & MASK;
-        int freq = freqs[blockLastRead];
-        docIDs[slot] = nextDocID;
-        if (freq < TERM_SCORES_CACHE_SIZE) {
-          scores[slot] = tsCache[freq];
-        } else {
-          scores[slot] = sqrt(freq) * termWeight;
-        }
-        coords[slot] = 1;
-        filled[numFilled++] = slot;
-      }
-      // Inlined nextDoc:
-      if (blockLastRead == blockEnd) {
-        if (sub->docsLeft == 0) {
-          nextDocID = NO_MORE_DOCS;
-          break;
-        } else {
-          nextDocFreqBlock(sub);
-          blockLastRead = -1;
-          blockEnd = sub->docFreqBlockEnd;
-        }
-      }
-      nextDocID += docDeltas[++blockLastRead];
-    }
-  }
-
-  sub->nextDocID = nextDocID;
-  sub->docFreqBlockLastRead = blockLastRead;
-  //printf("return numFilled=%d\n", numFilled);
-  return numFilled;
-}
-
 static int
 orMustChunk(PostingsState *sub,
             double *tsCache,
@@ -321,6 +238,8 @@ orShouldChunk(PostingsState *sub,
 
 int booleanQueryShouldMust(PostingsState* subs,
                            unsigned char *liveDocsBytes,
+                           FilterBitmap *filter,
+                           unsigned char *acceptBits,
                            double **termScoreCache,
                            float *termWeights,
                            int maxDoc,
@@ -334,6 +253,8 @@ int booleanQueryShouldMust(PostingsState* subs,
                            unsigned int *coords,
                            float *topScores,
                            int *topDocIDs,
+                           NumericSort *sort,
+                           GroupCollector *groups,
                            float *coordFactors,
                            float *normTable,
                            unsigned char *norms,
@@ -344,7 +265,8 @@ int booleanQueryShouldMust(PostingsState* subs,
                            unsigned int *dsTotalHits,
                            unsigned int *dsTermsPerDim,
                            unsigned long *dsHitBits,
-                           unsigned long **dsNearMissBits)
+                           unsigned long **dsNearMissBits,
+                           FacetCounter *dsFacets)
 {
   int docUpto = 0;
   int hitCount = 0;
@@ -355,19 +277,43 @@ int booleanQueryShouldMust(PostingsState* subs,
     int endDoc = docUpto + CHUNK;
     //printf("cycle endDoc=%d\n", endDoc);fflush(stdout);
 
-    int numFilled;
-
-    if (liveDocsBytes != 0) {
-      numFilled = orFirstMustChunkWithDeletes(&subs[0], termScoreCache[0], termWeights[0], endDoc, filled, docIDs, scores, coords, liveDocsBytes);
+    unsigned char *chunkLiveDocs = liveDocsBytes;
+    bool chunkEmpty;
+    if (filter != 0) {
+      // Only this chunk's bytes of acceptBits are filled:
+      chunkEmpty = !fillFilterChunk(filter, liveDocsBytes, acceptBits, docUpto);
+      chunkLiveDocs = acceptBits;
     } else {
-      numFilled = orFirstMustChunk(&subs[0], termScoreCache[0], termWeights[0], endDoc, filled, docIDs, scores, coords);
+      chunkEmpty = liveDocsBytes != 0 && isChunkEmpty(liveDocsBytes, docUpto, maxDoc);
+    }
+    if (chunkEmpty) {
+      // No live (or filter accepted) docs here:
+      int numSkip = scores != 0 ? numScorers : numMust;
+      for(int i=0;i<numSkip;i++) {
+        skipChunk(&subs[i], endDoc);
+      }
+      if (dsNumDims > 0) {
+        drillSidewaysSkipChunk(dsSubs, dsNumDims, dsTermsPerDim, endDoc);
+      }
+      docUpto += CHUNK;
+      continue;
     }
+
+    int numFilled;
+
+    numFilled = orFirstMustChunk(&subs[0], termScoreCache[0], termWeights[0], endDoc, filled, docIDs, scores, coords);
     //printf("  numFilled=%d\n", numFilled);
     for(int i=1;i<numMust;i++) {
       numFilled = orMustChunk(&subs[i], termScoreCache[i], termWeights[i], endDoc, filled, docIDs, scores, coords, i);
     }
 
-    if (topScores != 0) {
+    if (chunkLiveDocs != 0) {
+      // Deletions (and filter) applied once per hit, not per
+      // clause posting:
+      numFilled = andChunkBits(chunkLiveDocs, docUpto, maxDoc, filled, numFilled);
+    }
+
+    if (scores != 0) {
       for(int i=numMust;i<numScorers;i++) {
         orShouldChunk(&subs[i], termScoreCache[i], termWeights[i], endDoc, docIDs, scores, coords, numMust);
       }
@@ -396,7 +342,29 @@ int booleanQueryShouldMust(PostingsState* subs,
                                        dsTermsPerDim,
                                        dsTotalHits,
                                        dsHitBits,
-                                       dsNearMissBits);
+                                       dsNearMissBits,
+                                       dsFacets);
+    } else if (sort != 0) {
+      hitCount += numFilled;
+      if (scores != 0) {
+        // Sorting by score too:
+        for(int i=0;i<numFilled;i++) {
+          int slot = filled[i];
+          scores[slot] = scores[slot] * coordFactors[coords[slot]] * normTable[norms[docIDs[slot]]];
+        }
+      }
+      if (sortCollect(sort, topN, docBase, docUpto, filled, numFilled, 0, scores, topDocIDs)) {
+        // Index-sorted segment: no later doc is competitive,
+        // so hitCount is only a lower bound:
+        break;
+      }
+    } else if (groups != 0) {
+      hitCount += numFilled;
+      for(int i=0;i<numFilled;i++) {
+        int slot = filled[i];
+        scores[slot] = scores[slot] * coordFactors[coords[slot]] * normTable[norms[docIDs[slot]]];
+      }
+      groupCollect(groups, topN, docBase, docUpto, filled, numFilled, 0, scores, topDocIDs, topScores);
     } else if (topScores == 0) {
       hitCount += numFilled;
       for(int i=0;i<numFilled;i++) {
@@ -139,94 +139,6 @@ orFirstMustChunk(PostingsState *sub,
   return numFilled;
 }
 
-static int
-orFirstMustChunkWithDeletes(PostingsState *sub,
-                            double *tsCache,
-                            float termWeight,
-                            int endDoc,
-                            unsigned int *filled,
-                            int *docIDs,
-                            float *scores,
-                            unsigned int *coords,
-                            unsigned char *liveDocsBytes) {
-
-  int nextDocID = sub->nextDocID;
-  unsigned int *docDeltas = sub->docDeltas;
-  unsigned int *freqs = sub->freqs;
-
-  int blockLastRead = sub->docFreqBlockLastRead;
-  int blockEnd = sub->docFreqBlockEnd;
-
-  int numFilled = 0;
-
-  // First scorer is different because we know slot is
-  // "new" for every hit:
-  if (scores == 0) {
-    while (nextDocID < endDoc) {
-      if (isSet(liveDocsBytes, nextDocID)) {
-        //printf("  docID=%d\n", nextDocID);
-        int slot = nextDocID & MASK;
-        if (docIDs[slot] != nextDocID) {
-          docIDs[slot] = nextDocID;
-          coords[slot] = 1;
-          filled[numFilled++] = slot;
-        }
-      }
-
-      // Inlined nextDoc:
-      if (blockLastRead == blockEnd) {
-        if (sub->docsLeft == 0) {
-          nextDocID = NO_MORE_DOCS;
-          break;
-        } else {
-          nextDocFreqBlock(sub);
-          blockLastRead = -1;
-          blockEnd = sub->docFreqBlockEnd;
-        }
-      }
-      nextDocID += docDeltas[++blockLastRead];
-    }
-  } else {
-
-    //printf("scorers[0]\n");fflush(stdout);
-    while (nextDocID < endDoc) {
-      //printf("  docID=%d\n", nextDocID);
-      if (isSet(liveDocsBytes, nextDocID)) {
-        int slot = nextDocID & MASK;
-        if (docIDs[slot] != nextDocID) {
-          int freq = freqs[blockLastRead];
-          docIDs[slot] = nextDocID;
-          if (freq < TERM_SCORES_CACHE_SIZE) {
-            scores[slot] = tsCache[freq];
-          } else {
-            scores[slot] = sqrt(freq) * termWeight;
-          }
-          coords[slot] = 1;
-          filled[numFilled++] = slot;
-        }
-      }
-      // Inlined nextDoc:
-      if (blockLastRead == blockEnd) {
-        if (sub->docsLeft == 0) {
-          nextDocID = NO_MORE_DOCS;
-          break;
-        } else {
-          nextDocFreqBlock(sub);
-          blockLastRead = -1;
-          blockEnd = sub->docFreqBlockEnd;
-        }
-      }
-      nextDocID += docDeltas[++blockLastRead];
-    }
-  }
-
-  sub->nextDocID = nextDocID;
-  sub->docFreqBlockLastRead = blockLastRead;
-  //printf("return numFilled=%d\n", numFilled);
-  return numFilled;
-}
-
-
 static void
 orShouldChunk(PostingsState *sub,
               double *tsCache,
@@ -365,6 +277,8 @@ orMustChunk(PostingsState *sub,
 
 int booleanQueryShouldMustMustNot(PostingsState* subs,
                                   unsigned char *liveDocsBytes,
+                                  FilterBitmap *filter,
+                                  unsigned char *acceptBits,
                                   double **termScoreCache,
                                   float *termWeights,
                                   int maxDoc,
@@ -379,6 +293,8 @@ int booleanQueryShouldMustMustNot(PostingsState* subs,
                                   unsigned int *coords,
                                   float *topScores,
                                   int *topDocIDs,
+                                  NumericSort *sort,
+                                  GroupCollector *groups,
                                   float *coordFactors,
                                   float *normTable,
                                   unsigned char *norms,
@@ -389,7 +305,8 @@ int booleanQueryShouldMustMustNot(PostingsState* subs,
                                   unsigned int *dsTotalHits,
                                   unsigned int *dsTermsPerDim,
                                   unsigned long *dsHitBits,
-                                  unsigned long **dsNearMissBits)
+                                  unsigned long **dsNearMissBits,
+                                  FacetCounter *dsFacets)
 {
   int docUpto = 0;
   int hitCount = 0;
@@ -398,6 +315,28 @@ int booleanQueryShouldMustMustNot(PostingsState* subs,
     int endDoc = docUpto + CHUNK;
     //printf("cycle endDoc=%d dels=%lx\n", endDoc, liveDocBytes);fflush(stdout);
 
+    unsigned char *chunkLiveDocs = liveDocsBytes;
+    bool chunkEmpty;
+    if (filter != 0) {
+      // Only this chunk's bytes of acceptBits are filled:
+      chunkEmpty = !fillFilterChunk(filter, liveDocsBytes, acceptBits, docUpto);
+      chunkLiveDocs = acceptBits;
+    } else {
+      chunkEmpty = liveDocsBytes != 0 && isChunkEmpty(liveDocsBytes, docUpto, maxDoc);
+    }
+    if (chunkEmpty) {
+      // No live (or filter accepted) docs here:
+      int numSkip = scores != 0 ? numScorers : numMustNot + numMust;
+      for(int i=0;i<numSkip;i++) {
+        skipChunk(&subs[i], endDoc);
+      }
+      if (dsNumDims > 0) {
+        drillSidewaysSkipChunk(dsSubs, dsNumDims, dsTermsPerDim, endDoc);
+      }
+      docUpto += CHUNK;
+      continue;
+    }
+
     // MUST_NOT:
     for(int i=0;i<numMustNot;i++) {
       orMustNotChunk(&subs[i], endDoc, docIDs, coords);
@@ -405,17 +344,19 @@ int booleanQueryShouldMustMustNot(PostingsState* subs,
 
     // MUST:
     int numFilled;
-    if (liveDocsBytes != 0) {
-      numFilled = orFirstMustChunkWithDeletes(&subs[numMustNot], termScoreCache[numMustNot], termWeights[numMustNot], endDoc, filled, docIDs, scores, coords, liveDocsBytes);
-    } else {
-      numFilled = orFirstMustChunk(&subs[numMustNot], termScoreCache[numMustNot], termWeights[numMustNot], endDoc, filled, docIDs, scores, coords);
-    }
+    numFilled = orFirstMustChunk(&subs[numMustNot], termScoreCache[numMustNot], termWeights[numMustNot], endDoc, filled, docIDs, scores, coords);
     //printf("numFilled=%d\n", numFilled);
     for(int i=numMustNot+1;i<numMustNot + numMust;i++) {
       numFilled = orMustChunk(&subs[i], termScoreCache[i], termWeights[i], endDoc, filled, docIDs, scores, coords, i-numMustNot);
     }
 
-    if (topScores != 0) {
+    if (chunkLiveDocs != 0) {
+      // Deletions (and filter) applied once per hit, not per
+      // clause posting:
+      numFilled = andChunkBits(chunkLiveDocs, docUpto, maxDoc, filled, numFilled);
+    }
+
+    if (scores != 0) {
       // SHOULD
       for(int i=numMustNot + numMust;i<numScorers;i++) {
         orShouldChunk(&subs[i], termScoreCache[i], termWeights[i], endDoc, docIDs, scores, coords, numMust);
@@ -445,7 +386,29 @@ int booleanQueryShouldMustMustNot(PostingsState* subs,
                                        dsTermsPerDim,
                                        dsTotalHits,
                                        dsHitBits,
-                                       dsNearMissBits);
+                                       dsNearMissBits,
+                                       dsFacets);
+    } else if (sort != 0) {
+      hitCount += numFilled;
+      if (scores != 0) {
+        // Sorting by score too:
+        for(int i=0;i<numFilled;i++) {
+          int slot = filled[i];
+          scores[slot] = scores[slot] * coordFactors[coords[slot]] * normTable[norms[docIDs[slot]]];
+        }
+      }
+      if (sortCollect(sort, topN, docBase, docUpto, filled, numFilled, 0, scores, topDocIDs)) {
+        // Index-sorted segment: no later doc is competitive,
+        // so hitCount is only a lower bound:
+        break;
+      }
+    } else if (groups != 0) {
+      hitCount += numFilled;
+      for(int i=0;i<numFilled;i++) {
+        int slot = filled[i];
+        scores[slot] = scores[slot] * coordFactors[coords[slot]] * normTable[norms[docIDs[slot]]];
+      }
+      groupCollect(groups, topN, docBase, docUpto, filled, numFilled, 0, scores, topDocIDs, topScores);
     } else if (topScores == 0) {
       hitCount += numFilled;
       for(int i=0;i<numFilled;i++) {
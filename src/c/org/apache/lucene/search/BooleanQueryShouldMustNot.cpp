@@ -56,103 +56,6 @@ orMustNotChunk(PostingsState *sub,
   sub->docFreqBlockLastRead = blockLastRead;
 }
 
-static int
-orChunkDeletesWithSkip(PostingsState *sub,
-                       double *tsCache,
-                       float termWeight,
-                       int endDoc,
-                       unsigned int *filled,
-                       int numFilled,
-                       int *docIDs,
-                       float *scores,
-                       unsigned int *coords,
-                       unsigned char *liveDocBytes,
-                       unsigned char *skips) {
-
-  int nextDocID = sub->nextDocID;
-  unsigned int *docDeltas = sub->docDeltas;
-  unsigned int *freqs = sub->freqs;
-
-  int blockLastRead = sub->docFreqBlockLastRead;
-  int blockEnd = sub->docFreqBlockEnd;
-
-  if (scores == 0) {
-    //printf("term=%d nextDoc=%d\n", i, sub->nextDocID);
-    while (nextDocID < endDoc) {
-      //printf("  docID=%d\n", nextDocID);
-      if (isSet(liveDocBytes, nextDocID)) {
-        int slot = nextDocID & MASK;
-
-        if (docIDs[slot] != nextDocID) {
-          docIDs[slot] = nextDocID;
-          skips[slot] = 0;
-          filled[numFilled++] = slot;
-        }
-      }
-
-      // Inlined nextDoc:
-      if (blockLastRead == blockEnd) {
-        if (sub->docsLeft == 0) {
-          nextDocID = NO_MORE_DOCS;
-          break;
-        } else {
-          nextDocFreqBlock(sub);
-          blockLastRead = -1;
-          blockEnd = sub->docFreqBlockEnd;
-        }
-      }
-      nextDocID += docDeltas[++blockLastRead];
-    }
-  } else {
-
-    //printf("term=%d nextDoc=%d\n", i, sub->nextDocID);
-    while (nextDocID < endDoc) {
-      //printf("  docID=%d\n", nextDocID);
-      if (isSet(liveDocBytes, nextDocID)) {
-        int slot = nextDocID & MASK;
-        if (docIDs[slot] != nextDocID || skips[slot] == 0) {
-          int freq = freqs[blockLastRead];
-          double score;
-          if (freq < TERM_SCORES_CACHE_SIZE) {
-            score = tsCache[freq];
-          } else {
-            score = sqrt(freq) * termWeight;
-          }
-
-          if (docIDs[slot] != nextDocID) {
-            docIDs[slot] = nextDocID;
-            scores[slot] = score;
-            coords[slot] = 1;
-            skips[slot] = 0;
-            filled[numFilled++] = slot;
-          } else {
-            scores[slot] += score;
-            coords[slot]++;
-          }
-        }
-      }
-
-      // Inlined nextDoc:
-      if (blockLastRead == blockEnd) {
-        if (sub->docsLeft == 0) {
-          nextDocID = NO_MORE_DOCS;
-          break;
-        } else {
-          nextDocFreqBlock(sub);
-          blockLastRead = -1;
-          blockEnd = sub->docFreqBlockEnd;
-        }
-      }
-      nextDocID += docDeltas[++blockLastRead];
-    }
-  }
-
-  sub->nextDocID = nextDocID;
-  sub->docFreqBlockLastRead = blockLastRead;
-
-  return numFilled;
-}
-
 // Like orChunk, but is "aware" of skip (from previous
 // MUST_NOT clauses):
 
@@ -253,6 +156,8 @@ orChunkWithSkip(PostingsState *sub,
 
 int booleanQueryShouldMustNot(PostingsState* subs,
                               unsigned char *liveDocsBytes,
+                              FilterBitmap *filter,
+                              unsigned char *acceptBits,
                               double **termScoreCache,
                               float *termWeights,
                               int maxDoc,
@@ -266,6 +171,8 @@ int booleanQueryShouldMustNot(PostingsState* subs,
                               unsigned int *coords,
                               float *topScores,
                               int *topDocIDs,
+                              NumericSort *sort,
+                              GroupCollector *groups,
                               float *coordFactors,
                               float *normTable,
                               unsigned char *norms,
@@ -277,7 +184,8 @@ int booleanQueryShouldMustNot(PostingsState* subs,
                               unsigned int *dsTotalHits,
                               unsigned int *dsTermsPerDim,
                               unsigned long *dsHitBits,
-                              unsigned long **dsNearMissBits)
+                              unsigned long **dsNearMissBits,
+                              FacetCounter *dsFacets)
 {
   int docUpto = 0;
   int hitCount = 0;
@@ -287,18 +195,40 @@ int booleanQueryShouldMustNot(PostingsState* subs,
     int endDoc = docUpto + CHUNK;
     //printf("cycle endDoc=%d dels=%lx\n", endDoc, liveDocBytes);fflush(stdout);
 
+    unsigned char *chunkLiveDocs = liveDocsBytes;
+    bool chunkEmpty;
+    if (filter != 0) {
+      // Only this chunk's bytes of acceptBits are filled:
+      chunkEmpty = !fillFilterChunk(filter, liveDocsBytes, acceptBits, docUpto);
+      chunkLiveDocs = acceptBits;
+    } else {
+      chunkEmpty = liveDocsBytes != 0 && isChunkEmpty(liveDocsBytes, docUpto, maxDoc);
+    }
+    if (chunkEmpty) {
+      // No live (or filter accepted) docs here:
+      for(int i=0;i<numScorers;i++) {
+        skipChunk(&subs[i], endDoc);
+      }
+      if (dsNumDims > 0) {
+        drillSidewaysSkipChunk(dsSubs, dsNumDims, dsTermsPerDim, endDoc);
+      }
+      docUpto += CHUNK;
+      continue;
+    }
+
     int numFilled = 0;
 
     for(int i=0;i<numMustNot;i++) {
       orMustNotChunk(&subs[i], endDoc, docIDs, skips);
     }
     for(int i=numMustNot;i<numScorers;i++) {
-      if (liveDocsBytes != 0) {
-        numFilled = orChunkDeletesWithSkip(&subs[i], termScoreCache[i], termWeights[i], endDoc, filled, numFilled, docIDs, scores, coords,
-                                           liveDocsBytes, skips);
-      } else {
-        numFilled = orChunkWithSkip(&subs[i], termScoreCache[i], termWeights[i], endDoc, filled, numFilled, docIDs, scores, coords, skips);
-      }
+      numFilled = orChunkWithSkip(&subs[i], termScoreCache[i], termWeights[i], endDoc, filled, numFilled, docIDs, scores, coords, skips);
+    }
+
+    if (chunkLiveDocs != 0) {
+      // Deletions (and filter) applied once per hit, not per
+      // clause posting:
+      numFilled = andChunkBits(chunkLiveDocs, docUpto, maxDoc, filled, numFilled);
     }
 
     int docChunkBase = docBase + docUpto;
@@ -324,7 +254,29 @@ int booleanQueryShouldMustNot(PostingsState* subs,
                                        dsTermsPerDim,
                                        dsTotalHits,
                                        dsHitBits,
-                                       dsNearMissBits);
+                                       dsNearMissBits,
+                                       dsFacets);
+    } else if (sort != 0) {
+      hitCount += numFilled;
+      if (scores != 0) {
+        // Sorting by score too:
+        for(int i=0;i<numFilled;i++) {
+          int slot = filled[i];
+          scores[slot] = scores[slot] * coordFactors[coords[slot]] * normTable[norms[docIDs[slot]]];
+        }
+      }
+      if (sortCollect(sort, topN, docBase, docUpto, filled, numFilled, skips, scores, topDocIDs)) {
+        // Index-sorted segment: no later doc is competitive,
+        // so hitCount is only a lower bound:
+        break;
+      }
+    } else if (groups != 0) {
+      hitCount += numFilled;
+      for(int i=0;i<numFilled;i++) {
+        int slot = filled[i];
+        scores[slot] = scores[slot] * coordFactors[coords[slot]] * normTable[norms[docIDs[slot]]];
+      }
+      groupCollect(groups, topN, docBase, docUpto, filled, numFilled, skips, scores, topDocIDs, topScores);
     } else if (topScores == 0) {
       hitCount += numFilled;
       for(int i=0;i<numFilled;i++) {
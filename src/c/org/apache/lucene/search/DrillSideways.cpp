@@ -16,11 +16,21 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "common.h"
 
 // Collects one CHUNK of docs into facet bitsets; ported
 // from DrillSidewaysScorer.doUnionScoring:
+void drillSidewaysSkipChunk(PostingsState *subs, int numDims, unsigned int *termsPerDim, unsigned int endDoc) {
+  int subUpto = 0;
+  for(int dim=0;dim<numDims;dim++) {
+    for(int i=0;i<termsPerDim[dim];i++) {
+      skipChunk(subs + subUpto++, endDoc);
+    }
+  }
+}
+
 unsigned int drillSidewaysCollect(unsigned int topN,
                                   unsigned int docBase,
                                   int *topDocIDs,
@@ -41,7 +51,8 @@ unsigned int drillSidewaysCollect(unsigned int topN,
                                   unsigned int *termsPerDim,
                                   unsigned int *totalHits,
                                   unsigned long *hitBits,
-                                  unsigned long **nearMissBits)
+                                  unsigned long **nearMissBits,
+                                  FacetCounter *facets)
 {
   int subUpto = 0;
   unsigned int hitCount = 0;
@@ -141,6 +152,12 @@ unsigned int drillSidewaysCollect(unsigned int topN,
     }
   }
 
+  if (facets != 0 && facets->aggregation != FACET_AGGREGATION_COUNT) {
+    // Float sums depend on the order they're added in, so
+    // collect in docID order, same as Java:
+    sortSlots(filled, numFilled);
+  }
+
   // Collect:
   int docChunkBase = docBase + docUpto;
   for(int i=0;i<numFilled;i++) {
@@ -149,22 +166,31 @@ unsigned int drillSidewaysCollect(unsigned int topN,
     //printf("  slot: %d\n", slot);fflush(stdout);
     unsigned int docID = docUpto + slot;
     unsigned int topDocID = docChunkBase + slot;
+    // Hits and near misses have the base query's score:
+    float score = 0;
+    if (scores != 0 && counts[slot] >= numDims) {
+      if (coordFactors != 0) {
+        score = scores[slot] * normTable[norms[docID]] * coordFactors[coords[slot]];
+      } else {
+        score = scores[slot] * normTable[norms[docID]];
+      }
+    }
     if (counts[slot] == 1+numDims) {
       hitCount++;
       //printf("  hit: %d\n", docID);fflush(stdout);
       // A real hit
-      setLongBit(hitBits, docID);
-      for(int j=0;j<numDims;j++) {
-        setLongBit(nearMissBits[j], docID);
+      if (facets != 0) {
+        // Counts toward drill down and every dim's sideways
+        // counts:
+        countDocFacets(facets, docID, facets->counts, 1+numDims, score);
+      } else {
+        setLongBit(hitBits, docID);
+        for(int j=0;j<numDims;j++) {
+          setLongBit(nearMissBits[j], docID);
+        }
       }
       (*(totalHits))++;
       if (scores != 0) {
-        float score;
-        if (coordFactors != 0) {
-          score = scores[slot] * normTable[norms[docID]] * coordFactors[coords[slot]];
-        } else {
-          score = scores[slot] * normTable[norms[docID]];
-        }
         if (score > topScores[1] || (score == topScores[1] && topDocID < topDocIDs[1])) {
           // Hit is competitive   
           topDocIDs[1] = topDocID;
@@ -186,7 +212,11 @@ unsigned int drillSidewaysCollect(unsigned int topN,
       //printf("  miss: %d\n", docID);fflush(stdout);
       unsigned int dim = missingDims[slot];
       (*(totalHits+dim+1))++;
-      setLongBit(nearMissBits[dim], docID);
+      if (facets != 0) {
+        countDocFacets(facets, docID, facets->counts+1+dim, 1, score);
+      } else {
+        setLongBit(nearMissBits[dim], docID);
+      }
     } else {
       //printf("  nothing: %d vs %d\n", counts[slot], numDims);fflush(stdout);
     }
@@ -74,13 +74,10 @@ orFirstMustChunk(PostingsState *sub,
   //printf("return numFilled=%d\n", numFilled);
 }
 
+// Same as skipChunk, but also adds the skipped docs' freqs
+// to tfSum, so later docs still find their positions:
 static void
-orFirstMustChunkWithDeletes(PostingsState *sub,
-                            int endDoc,
-                            int *docIDs,
-                            unsigned int *coords,
-                            unsigned char *liveDocsBytes) {
-
+skipPhraseChunk(PostingsState *sub, int endDoc) {
   int nextDocID = sub->nextDocID;
   unsigned int *docDeltas = sub->docDeltas;
   unsigned int *freqs = sub->freqs;
@@ -89,22 +86,9 @@ orFirstMustChunkWithDeletes(PostingsState *sub,
   int blockEnd = sub->docFreqBlockEnd;
 
   long tfSum = sub->tfSum;
-  unsigned long *tfSums = sub->tfSums;
-  unsigned int *tfs = sub->tfs;
 
-  // First scorer is different because we know slot is
-  // "new" for every hit:
   while (nextDocID < endDoc) {
-    unsigned int freq = freqs[blockLastRead];
-    if (isSet(liveDocsBytes, nextDocID)) {
-      //printf("  docID=%d\n", nextDocID);
-      int slot = nextDocID & MASK;
-      docIDs[slot] = nextDocID;
-      tfSums[slot] = tfSum;
-      tfs[slot] = freq;
-      coords[slot] = 1;
-    }
-    tfSum += freq;
+    tfSum += freqs[blockLastRead];
 
     // Inlined nextDoc:
     if (blockLastRead == blockEnd) {
@@ -240,6 +224,8 @@ orLastMustChunk(PostingsState *sub,
 
 int phraseQuery(PostingsState* subs,
                 unsigned char *liveDocsBytes,
+                FilterBitmap *filter,
+                unsigned char *acceptBits,
                 double *termScoreCache,
                 float termWeight,
                 int maxDoc,
@@ -253,7 +239,11 @@ int phraseQuery(PostingsState* subs,
                 int *topDocIDs,
                 float *normTable,
                 unsigned char *norms,
-                int *posOffsets) {
+                int *posOffsets,
+                // If non-null, matching docs and their phrase
+                // freqs are recorded here instead of collected:
+                int *matchDocIDs,
+                unsigned int *matchFreqs) {
 
   bool failed = false;
   unsigned int *posCounts = 0;
@@ -287,17 +277,35 @@ int phraseQuery(PostingsState* subs,
     printf("cycle docUpto=%d\n", docUpto);
 #endif
     int endDoc = docUpto + CHUNK;
-    if (liveDocsBytes != 0) {
-      orFirstMustChunkWithDeletes(&subs[0], endDoc, docIDs, coords, liveDocsBytes);
+    unsigned char *chunkLiveDocs = liveDocsBytes;
+    bool chunkEmpty;
+    if (filter != 0) {
+      // Only this chunk's bytes of acceptBits are filled:
+      chunkEmpty = !fillFilterChunk(filter, liveDocsBytes, acceptBits, docUpto);
+      chunkLiveDocs = acceptBits;
     } else {
-      orFirstMustChunk(&subs[0], endDoc, docIDs, coords);
+      chunkEmpty = liveDocsBytes != 0 && isChunkEmpty(liveDocsBytes, docUpto, maxDoc);
+    }
+    if (chunkEmpty) {
+      // No live (or filter accepted) docs here:
+      for(int i=0;i<numScorers;i++) {
+        skipPhraseChunk(&subs[i], endDoc);
+      }
+      docUpto += CHUNK;
+      continue;
     }
+    orFirstMustChunk(&subs[0], endDoc, docIDs, coords);
     for(int i=1;i<numScorers-1;i++) {
       orMustChunk(&subs[i], endDoc, docIDs, coords, i);
     }
     // TODO: we could check positions inside orLastMustChunk
     // instead, saves one pass:
     int numFilled = orLastMustChunk(&subs[numScorers-1], endDoc, filled, docIDs, coords, numScorers-1);
+    if (chunkLiveDocs != 0) {
+      // Deletions (and filter) applied once per doc having
+      // all terms, before checking positions:
+      numFilled = andChunkBits(chunkLiveDocs, docUpto, maxDoc, filled, numFilled);
+    }
 #ifdef DEBUG
     printf("  numFilled=%d\n", numFilled);
 #endif
@@ -367,7 +375,11 @@ int phraseQuery(PostingsState* subs,
 
       bool doStopAfterFirstPhrase;
       bool doSkipCollect;
-      if (topScores == 0) {
+      if (matchDocIDs != 0) {
+        // Caller needs the exact phraseFreq of every match:
+        doStopAfterFirstPhrase = false;
+        doSkipCollect = false;
+      } else if (topScores == 0) {
         doStopAfterFirstPhrase = true;
         doSkipCollect = false;
       } else {
@@ -551,6 +563,13 @@ int phraseQuery(PostingsState* subs,
         printf("  phraseFreq=%d topScores=%lx\n", phraseFreq, topScores);fflush(stdout);
 #endif
 
+        if (matchDocIDs != 0) {
+          matchDocIDs[hitCount] = docIDs[slot];
+          matchFreqs[hitCount] = phraseFreq;
+          hitCount++;
+          continue;
+        }
+
         hitCount++;
 
         if (doSkipCollect) {
@@ -0,0 +1,283 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compressed (Roaring-style) docs of a cached filter, for
+// one segment.  Each 65536-doc range is its own container,
+// stored as whichever of a sorted array, a bitmap or a list
+// of runs is smallest.
+//
+// Kernels never decode a whole bitmap up front: they ask for
+// one CHUNK at a time (a CHUNK never crosses a container), ANDed
+// with the segment's liveDocs, and skip chunks the filter
+// rejects entirely.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+#define CONTAINER_DOCS (1 << FILTER_CONTAINER_BITS)
+#define CONTAINER_WORDS (CONTAINER_DOCS >> 6)
+#define CHUNK_WORDS (CHUNK >> 6)
+
+static void
+freeContainers(FilterBitmap *filter) {
+  for(int i=0;i<filter->numContainers;i++) {
+    FilterContainer *c = filter->containers + i;
+    if (c->values != 0) {
+      free(c->values);
+    }
+    if (c->words != 0) {
+      free(c->words);
+    }
+  }
+  free(filter->containers);
+}
+
+static bool
+initContainer(FilterContainer *c, unsigned long *words, int numWords, long *ramBytesUsed) {
+  unsigned int card = 0;
+  unsigned int numRuns = 0;
+  unsigned long prevHighBit = 0;
+  for(int i=0;i<numWords;i++) {
+    unsigned long word = words[i];
+    card += __builtin_popcountl(word);
+    // A run starts at each set bit whose previous bit is clear:
+    numRuns += __builtin_popcountl(word & ~((word << 1) | prevHighBit));
+    prevHighBit = word >> 63;
+  }
+
+  c->values = 0;
+  c->words = 0;
+  c->count = 0;
+  if (card == 0) {
+    c->type = FILTER_ARRAY_CONTAINER;
+    return true;
+  }
+
+  unsigned int arrayBytes = card * sizeof(short);
+  unsigned int runBytes = numRuns * 2 * sizeof(short);
+  unsigned int bitmapBytes = CONTAINER_WORDS * sizeof(long);
+
+  if (arrayBytes <= runBytes && arrayBytes <= bitmapBytes) {
+    c->type = FILTER_ARRAY_CONTAINER;
+    c->values = (unsigned short *) malloc(arrayBytes);
+    if (c->values == 0) {
+      return false;
+    }
+    for(int i=0;i<numWords;i++) {
+      unsigned long word = words[i];
+      while (word != 0) {
+        c->values[c->count++] = (unsigned short) ((i << 6) + __builtin_ctzl(word));
+        word &= word-1;
+      }
+    }
+    *ramBytesUsed += arrayBytes;
+  } else if (runBytes <= bitmapBytes) {
+    c->type = FILTER_RUN_CONTAINER;
+    c->values = (unsigned short *) malloc(runBytes);
+    if (c->values == 0) {
+      return false;
+    }
+    int doc = 0;
+    int end = numWords << 6;
+    while (doc < end) {
+      if ((words[doc >> 6] & (1UL << (doc & 63))) == 0) {
+        doc++;
+        continue;
+      }
+      int start = doc;
+      while (doc < end && (words[doc >> 6] & (1UL << (doc & 63))) != 0) {
+        doc++;
+      }
+      c->values[2*c->count] = (unsigned short) start;
+      c->values[2*c->count+1] = (unsigned short) (doc - start - 1);
+      c->count++;
+    }
+    *ramBytesUsed += runBytes;
+  } else {
+    c->type = FILTER_BITMAP_CONTAINER;
+    c->words = (unsigned long *) calloc(CONTAINER_WORDS, sizeof(long));
+    if (c->words == 0) {
+      return false;
+    }
+    memcpy(c->words, words, numWords * sizeof(long));
+    *ramBytesUsed += bitmapBytes;
+  }
+  return true;
+}
+
+// words is a FixedBitSet's bits for the segment; returns 0 if
+// we ran out of memory.  The caller holds the first
+// reference:
+FilterBitmap *
+newFilterBitmap(unsigned long *words, int numWords, int maxDoc) {
+  FilterBitmap *filter = (FilterBitmap *) malloc(sizeof(FilterBitmap));
+  if (filter == 0) {
+    return 0;
+  }
+  filter->refCount = 1;
+  filter->maxDoc = maxDoc;
+  filter->numContainers = (maxDoc + CONTAINER_DOCS - 1) >> FILTER_CONTAINER_BITS;
+  filter->containers = (FilterContainer *) calloc(filter->numContainers, sizeof(FilterContainer));
+  if (filter->containers == 0) {
+    free(filter);
+    return 0;
+  }
+  filter->ramBytesUsed = sizeof(FilterBitmap) + filter->numContainers * sizeof(FilterContainer);
+
+  for(int i=0;i<filter->numContainers;i++) {
+    int wordStart = i * CONTAINER_WORDS;
+    int wordEnd = wordStart + CONTAINER_WORDS;
+    if (wordEnd > numWords) {
+      wordEnd = numWords;
+    }
+    if (wordStart > wordEnd) {
+      wordStart = wordEnd;
+    }
+    if (!initContainer(filter->containers + i, words + wordStart, wordEnd - wordStart, &filter->ramBytesUsed)) {
+      freeContainers(filter);
+      free(filter);
+      return 0;
+    }
+  }
+
+  return filter;
+}
+
+void
+retainFilterBitmap(FilterBitmap *filter) {
+  __sync_add_and_fetch(&filter->refCount, 1);
+}
+
+void
+releaseFilterBitmap(FilterBitmap *filter) {
+  if (__sync_sub_and_fetch(&filter->refCount, 1) == 0) {
+    freeContainers(filter);
+    free(filter);
+  }
+}
+
+// Sets bits [from, to) of a CHUNK window:
+static void
+setRange(unsigned long *window, int from, int to) {
+  while (from < to) {
+    int wordEnd = (from | 63) + 1;
+    if (wordEnd > to) {
+      wordEnd = to;
+    }
+    unsigned long bits = ~0UL << (from & 63);
+    if ((wordEnd & 63) != 0) {
+      bits &= ~0UL >> (64 - (wordEnd & 63));
+    }
+    window[from >> 6] |= bits;
+    from = wordEnd;
+  }
+}
+
+// Index of the first value >= target, in sorted values
+// spaced stride apart:
+static unsigned int
+lowerBound(unsigned short *values, unsigned int count, int stride, int target) {
+  unsigned int lo = 0;
+  unsigned int hi = count;
+  while (lo < hi) {
+    unsigned int mid = (lo + hi) >> 1;
+    if (values[mid*stride] < target) {
+      lo = mid+1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// Writes the accepted docs in [docUpto, docUpto+CHUNK) to
+// acceptBits (same layout as liveDocsBytes), ANDed with
+// liveDocsBytes if it's non-null.  Returns false, possibly
+// without writing acceptBits, if no doc in the chunk is
+// accepted:
+bool
+fillFilterChunk(FilterBitmap *filter, unsigned char *liveDocsBytes, unsigned char *acceptBits, int docUpto) {
+  FilterContainer *c = filter->containers + (docUpto >> FILTER_CONTAINER_BITS);
+  if (c->type == FILTER_ARRAY_CONTAINER && c->count == 0) {
+    return false;
+  }
+
+  int lo = docUpto & (CONTAINER_DOCS-1);
+  int hi = lo + CHUNK;
+
+  unsigned long window[CHUNK_WORDS];
+  if (c->type == FILTER_BITMAP_CONTAINER) {
+    memcpy(window, c->words + (lo >> 6), sizeof(window));
+  } else {
+    memset(window, 0, sizeof(window));
+    if (c->type == FILTER_ARRAY_CONTAINER) {
+      for(unsigned int i=lowerBound(c->values, c->count, 1, lo);i<c->count && c->values[i] < hi;i++) {
+        int bit = c->values[i] - lo;
+        window[bit >> 6] |= 1UL << (bit & 63);
+      }
+    } else {
+      // First run that could reach lo:
+      unsigned int i = lowerBound(c->values, c->count, 2, lo);
+      if (i > 0 && c->values[2*(i-1)] + c->values[2*(i-1)+1] >= lo) {
+        i--;
+      }
+      for(;i<c->count && c->values[2*i] < hi;i++) {
+        int start = c->values[2*i];
+        int end = start + c->values[2*i+1] + 1;
+        setRange(window, (start < lo ? lo : start) - lo, (end > hi ? hi : end) - lo);
+      }
+    }
+  }
+
+  // Last chunk may be partial:
+  int numBytes = ((filter->maxDoc >> 3) + 1) - (docUpto >> 3);
+  if (numBytes > CHUNK/8) {
+    numBytes = CHUNK/8;
+  }
+
+  if (liveDocsBytes != 0) {
+    unsigned long liveWords[CHUNK_WORDS];
+    memset(liveWords, 0, sizeof(liveWords));
+    memcpy(liveWords, liveDocsBytes + (docUpto >> 3), numBytes);
+    if (!andChunkWords(window, liveWords)) {
+      return false;
+    }
+  } else {
+    unsigned long any = 0;
+    for(int i=0;i<CHUNK_WORDS;i++) {
+      any |= window[i];
+    }
+    if (any == 0) {
+      return false;
+    }
+  }
+
+  memcpy(acceptBits + (docUpto >> 3), window, numBytes);
+  return true;
+}
+
+// Fills all of acceptBits ((maxDoc>>3)+1 bytes), for code
+// that doesn't work chunk by chunk:
+void
+fillFilterBits(FilterBitmap *filter, unsigned char *liveDocsBytes, unsigned char *acceptBits) {
+  memset(acceptBits, 0, (filter->maxDoc >> 3) + 1);
+  for(int docUpto=0;docUpto<filter->maxDoc;docUpto+=CHUNK) {
+    fillFilterChunk(filter, liveDocsBytes, acceptBits, docUpto);
+  }
+}
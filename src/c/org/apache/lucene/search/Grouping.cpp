@@ -0,0 +1,110 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Collapsing hits by a SortedDocValues field: instead of the
+// top hits, we keep one segment's top groups (by their best
+// hit's score) in a PQ keyed by the field's ordinal, which
+// Lucene42DocValuesFormat stores as numeric DocValues we
+// decode from the mapped .dvd file.  The group's best hit
+// lives in topDocIDs/topScores, same as ungrouped hits.
+// Ordinals are per-segment, so the Java side merges
+// segments by term.
+
+#include "common.h"
+
+// Moves the group at index down until the PQ is valid again,
+// keeping ordToIndex in sync:
+static void
+downHeapGroups(GroupCollector *groups, int heapSize, int index, int *topDocIDs, float *topScores) {
+  int *topOrds = groups->topOrds;
+  int *ordToIndex = groups->ordToIndex;
+  int i = index;
+  // save node
+  int savDocID = topDocIDs[i];
+  float savScore = topScores[i];
+  int savOrd = topOrds[i];
+  int j = i << 1;            // find smaller child
+  int k = j + 1;
+  if (k <= heapSize && (topScores[k] < topScores[j] || (topScores[k] == topScores[j] && topDocIDs[k] > topDocIDs[j]))) {
+    j = k;
+  }
+  while (j <= heapSize && (topScores[j] < savScore || (topScores[j] == savScore && topDocIDs[j] > savDocID))) {
+    // shift up child
+    topDocIDs[i] = topDocIDs[j];
+    topScores[i] = topScores[j];
+    topOrds[i] = topOrds[j];
+    if (topOrds[i] != -1) {
+      ordToIndex[topOrds[i]] = i;
+    }
+    i = j;
+    j = i << 1;
+    k = j + 1;
+    if (k <= heapSize && (topScores[k] < topScores[j] || (topScores[k] == topScores[j] && topDocIDs[k] > topDocIDs[j]))) {
+      j = k;
+    }
+  }
+  // install saved node
+  topDocIDs[i] = savDocID;
+  topScores[i] = savScore;
+  topOrds[i] = savOrd;
+  if (savOrd != -1) {
+    ordToIndex[savOrd] = i;
+  }
+}
+
+// Collects one chunk's hits (slots relative to docUpto);
+// skips, if non-null, marks MUST_NOT matches; scores holds
+// each hit's final score:
+void
+groupCollect(GroupCollector *groups, int topN, int docBase, int docUpto, unsigned int *filled, int numFilled,
+             unsigned char *skips, float *scores, int *topDocIDs, float *topScores) {
+  int *topOrds = groups->topOrds;
+  int *ordToIndex = groups->ordToIndex;
+  int docChunkBase = docBase + docUpto;
+  for(int i=0;i<numFilled;i++) {
+    int slot = filled[i];
+    if (skips != 0 && skips[slot]) {
+      continue;
+    }
+    int ord = (int) getNumericDocValue(&groups->ords, docUpto + slot);
+    groups->ordCounts[ord]++;
+
+    float score = scores[slot];
+    int docID = docChunkBase + slot;
+    int index = ordToIndex[ord];
+    if (index != 0) {
+      // Group is already in the PQ; on a tie the lower docID
+      // is its best doc.  Kernels with several SHOULD clauses
+      // don't fill slots in docID order:
+      if (score > topScores[index] || (score == topScores[index] && docID < topDocIDs[index])) {
+        topDocIDs[index] = docID;
+        topScores[index] = score;
+        downHeapGroups(groups, topN, index, topDocIDs, topScores);
+      }
+    } else if (score > topScores[1] || (score == topScores[1] && docID < topDocIDs[1])) {
+      // New competitive group replaces the worst one:
+      if (topOrds[1] != -1) {
+        ordToIndex[topOrds[1]] = 0;
+      }
+      topDocIDs[1] = docID;
+      topScores[1] = score;
+      topOrds[1] = ord;
+      ordToIndex[ord] = 1;
+      downHeapGroups(groups, topN, 1, topDocIDs, topScores);
+    }
+  }
+}
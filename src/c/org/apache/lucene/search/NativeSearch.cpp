@@ -28,8 +28,12 @@
 #include <errno.h>
 #include <jni.h>
 #include <math.h> // for sqrt
+#include <pthread.h>
 #include <stdlib.h> // malloc
 #include <string.h> // memcpy
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "common.h"
 
@@ -103,6 +107,342 @@ static bool initSub(int id,
   return true;
 }
 
+// Inits the per-term subs of an exact phrase, positioned
+// on their first doc and first position block:
+static bool initPhraseSubs(PostingsState *subs,
+                           int numScorers,
+                           int *singletonDocIDs,
+                           long *totalTermFreqs,
+                           int *docFreqs,
+                           long *docTermStartFPs,
+                           long *posTermStartFPs,
+                           long docFileAddress,
+                           long posFileAddress,
+                           bool indexHasPayloads,
+                           bool indexHasOffsets) {
+  for(int i=0;i<numScorers;i++) {
+    PostingsState *sub = &(subs[i]);
+    sub->indexHasPayloads = indexHasPayloads;
+    sub->indexHasOffsets = indexHasOffsets;
+    sub->docsOnly = false;
+    sub->id = i;
+    //printf("\ninit scorers[%d] of %d\n", i, numScorers);fflush(stdout);
+
+    if (singletonDocIDs[i] != -1) {
+      //printf("  singleton: %d\n", singletonDocIDs[i]);
+      sub->nextDocID = singletonDocIDs[i];
+      sub->docsLeft = 0;
+      sub->docFreqBlockLastRead = 0;
+      sub->docFreqBlockEnd = 0;
+      sub->docDeltas = 0;
+      sub->freqs = (unsigned int *) malloc(sizeof(int));
+      if (sub->freqs == 0) {
+        return false;
+      }
+      sub->freqs[0] = (int) totalTermFreqs[i];
+    } else {
+      sub->docsLeft = docFreqs[i];
+      sub->docDeltas = (unsigned int *) malloc(2*BLOCK_SIZE*sizeof(int));
+      if (sub->docDeltas == 0) {
+        return false;
+      }
+      // Locality seemed to help here:
+      sub->freqs = sub->docDeltas + BLOCK_SIZE;
+      //printf("docFileAddress=%ld startFP=%ld\n", docFileAddress, docTermStartFPs[i]);fflush(stdout);
+      sub->docFreqs = ((unsigned char *) docFileAddress) + docTermStartFPs[i];
+      //printf("  not singleton\n");
+      nextDocFreqBlock(sub);
+      sub->nextDocID = sub->docDeltas[0];
+      //printf("docDeltas[0]=%d\n", sub->docDeltas[0]);
+      sub->docFreqBlockLastRead = 0;
+    }
+    sub->pos = ((unsigned char *) posFileAddress) + posTermStartFPs[i];
+    sub->posLeft = totalTermFreqs[i];
+    sub->posDeltas = (unsigned int *) malloc(BLOCK_SIZE*sizeof(int));
+    if (sub->posDeltas == 0) {
+      return false;
+    }
+    nextPosBlock(sub);
+    sub->posBlockLastRead = 0;
+    //printf("init i=%d nextDocID=%d freq=%d blockEnd=%d singleton=%d\n", i, sub->nextDocID, sub->nextFreq, sub->blockEnd, singletonDocIDs[i]);fflush(stdout);
+  }
+
+  return true;
+}
+
+static void freePhraseSubs(PostingsState *subs, int numScorers) {
+  for(int i=0;i<numScorers;i++) {
+    PostingsState *sub = &(subs[i]);
+    if (sub->docDeltas != 0) {
+      free(sub->docDeltas);
+    } else if (sub->freqs != 0) {
+      free(sub->freqs);
+    }
+    if (sub->posDeltas != 0) {
+      free(sub->posDeltas);
+    }
+  }
+
+  free(subs);
+}
+
+// Runs an exact phrase clause over the whole segment, and
+// loads the matching docs and phrase freqs into sub as one
+// in-memory block, so the BooleanQuery chunk kernels
+// consume it just like a term clause:
+static bool initPhraseClauseSub(int id,
+                                PostingsState *sub,
+                                int numTerms,
+                                unsigned char *liveDocsBytes,
+                                int maxDoc,
+                                int *singletonDocIDs,
+                                long *totalTermFreqs,
+                                int *docFreqs,
+                                long *docTermStartFPs,
+                                long *posTermStartFPs,
+                                int *posOffsets,
+                                long docFileAddress,
+                                long posFileAddress,
+                                bool indexHasPayloads,
+                                bool indexHasOffsets) {
+  bool failed = false;
+  PostingsState *subs = 0;
+  int *docIDs = 0;
+  unsigned int *coords = 0;
+  unsigned int *filled = 0;
+  int maxMatches = maxDoc;
+  int numMatches = 0;
+
+  sub->id = id;
+  sub->docsOnly = false;
+  sub->docsLeft = 0;
+  sub->docFreqBlockLastRead = 0;
+
+  // Phrase can match no more docs than its rarest term:
+  for(int i=0;i<numTerms;i++) {
+    int docFreq = singletonDocIDs[i] != -1 ? 1 : docFreqs[i];
+    if (docFreq < maxMatches) {
+      maxMatches = docFreq;
+    }
+  }
+
+  sub->docDeltas = (unsigned int *) malloc((1+2*maxMatches)*sizeof(int));
+  if (sub->docDeltas == 0) {
+    failed = true;
+    goto end;
+  }
+  sub->freqs = sub->docDeltas + maxMatches;
+
+  subs = (PostingsState *) calloc(numTerms, sizeof(PostingsState));
+  if (subs == 0) {
+    failed = true;
+    goto end;
+  }
+  docIDs = (int *) malloc(CHUNK * sizeof(int));
+  if (docIDs == 0) {
+    failed = true;
+    goto end;
+  }
+  for(int i=0;i<CHUNK;i++) {
+    docIDs[i] = -1;
+  }
+  coords = (unsigned int *) malloc(CHUNK * sizeof(int));
+  if (coords == 0) {
+    failed = true;
+    goto end;
+  }
+  filled = (unsigned int *) malloc(CHUNK * sizeof(int));
+  if (filled == 0) {
+    failed = true;
+    goto end;
+  }
+
+  if (!initPhraseSubs(subs, numTerms, singletonDocIDs, totalTermFreqs, docFreqs,
+                      docTermStartFPs, posTermStartFPs, docFileAddress, posFileAddress,
+                      indexHasPayloads, indexHasOffsets)) {
+    failed = true;
+    goto end;
+  }
+
+  // Not scoring or collecting here, so no scores, norms or
+  // queue:
+  numMatches = phraseQuery(subs, liveDocsBytes, 0, 0, 0, 0.0f, maxDoc, 0, numTerms, 0,
+                           filled, docIDs, coords, 0, 0, 0, 0, posOffsets,
+                           (int *) sub->docDeltas, sub->freqs);
+  if (numMatches == -1) {
+    failed = true;
+    goto end;
+  }
+
+  if (numMatches == 0) {
+    sub->nextDocID = NO_MORE_DOCS;
+    sub->docFreqBlockEnd = 0;
+  } else {
+    // Convert docIDs to deltas, like a decoded block:
+    for(int i=numMatches-1;i>0;i--) {
+      sub->docDeltas[i] -= sub->docDeltas[i-1];
+    }
+    sub->nextDocID = sub->docDeltas[0];
+    sub->docFreqBlockEnd = numMatches-1;
+  }
+
+ end:
+  if (subs != 0) {
+    freePhraseSubs(subs, numTerms);
+  }
+  if (docIDs != 0) {
+    free(docIDs);
+  }
+  if (coords != 0) {
+    free(coords);
+  }
+  if (filled != 0) {
+    free(filled);
+  }
+
+  return !failed;
+}
+
+// Copies the per-SortField arrays from Java and pins the
+// PQ's sort values; sort must be released with releaseSort
+// even if this returns false:
+static bool
+initSort(JNIEnv *env, NumericSort *sort, jlongArray jtopSortValues, jintArray jsortKeys, jbooleanArray jsortReverse,
+         jlongArray jsortDVAddresses, jintArray jsortDVFormats, jlongArray jsortAfterValues, jint sortAfterDocID,
+         bool earlyTerminate, int maxDoc) {
+  memset(sort, 0, sizeof(NumericSort));
+  sort->numKeys = env->GetArrayLength(jsortKeys);
+
+  jboolean reverse[MAX_SORT_KEYS];
+  jlong dvAddresses[MAX_SORT_KEYS];
+  jint dvFormats[MAX_SORT_KEYS];
+  env->GetIntArrayRegion(jsortKeys, 0, sort->numKeys, (jint *) sort->keyTypes);
+  env->GetBooleanArrayRegion(jsortReverse, 0, sort->numKeys, reverse);
+  env->GetLongArrayRegion(jsortDVAddresses, 0, sort->numKeys, dvAddresses);
+  env->GetIntArrayRegion(jsortDVFormats, 0, sort->numKeys, dvFormats);
+
+  for(int i=0;i<sort->numKeys;i++) {
+    int keyType = sort->keyTypes[i];
+    // Higher scores sort first unless reversed:
+    sort->descending[i] = keyType == SORT_KEY_SCORE ? !reverse[i] : reverse[i];
+    if (keyType == SORT_KEY_LONG || keyType == SORT_KEY_INT) {
+      if (!initNumericDocValues(sort->values+i, (unsigned char *) dvAddresses[i], dvFormats[i], maxDoc)) {
+        return false;
+      }
+    }
+  }
+
+  if (jsortAfterValues != 0) {
+    sort->hasAfter = true;
+    env->GetLongArrayRegion(jsortAfterValues, 0, sort->numKeys, (jlong *) sort->afterValues);
+    sort->afterDocID = sortAfterDocID;
+  }
+  sort->earlyTerminate = earlyTerminate;
+
+  sort->topValues = (long *) env->GetLongArrayElements(jtopSortValues, 0);
+  return sort->topValues != 0;
+}
+
+static void
+releaseSort(JNIEnv *env, NumericSort *sort, jlongArray jtopSortValues) {
+  if (sort->topValues != 0) {
+    env->ReleaseLongArrayElements(jtopSortValues, (jlong *) sort->topValues, 0);
+  }
+  for(int i=0;i<sort->numKeys;i++) {
+    freeNumericDocValues(sort->values+i);
+  }
+}
+
+// Pins the PQ's group ordinals and the per-ordinal hit
+// counts; groups must be released with releaseGroups even
+// if this returns false:
+static bool
+initGroups(JNIEnv *env, GroupCollector *groups, jintArray jtopGroupOrds, jintArray jgroupOrdCounts,
+           jlong groupDVAddress, jint groupDVFormat, int maxDoc) {
+  memset(groups, 0, sizeof(GroupCollector));
+  if (!initNumericDocValues(&groups->ords, (unsigned char *) groupDVAddress, groupDVFormat, maxDoc)) {
+    return false;
+  }
+  groups->ordToIndex = (int *) calloc(env->GetArrayLength(jgroupOrdCounts), sizeof(int));
+  if (groups->ordToIndex == 0) {
+    return false;
+  }
+  groups->topOrds = env->GetIntArrayElements(jtopGroupOrds, 0);
+  if (groups->topOrds == 0) {
+    return false;
+  }
+  groups->ordCounts = env->GetIntArrayElements(jgroupOrdCounts, 0);
+  return groups->ordCounts != 0;
+}
+
+static void
+releaseGroups(JNIEnv *env, GroupCollector *groups, jintArray jtopGroupOrds, jintArray jgroupOrdCounts) {
+  if (groups->topOrds != 0) {
+    env->ReleaseIntArrayElements(jtopGroupOrds, groups->topOrds, 0);
+  }
+  if (groups->ordCounts != 0) {
+    env->ReleaseIntArrayElements(jgroupOrdCounts, groups->ordCounts, 0);
+  }
+  if (groups->ordToIndex != 0) {
+    free(groups->ordToIndex);
+  }
+  freeNumericDocValues(&groups->ords);
+}
+
+// Looks up the drill down and per-dim drill sideways
+// FacetCounts and pins the segment's Facet42BinaryDocValues,
+// so hits and near misses are counted as they're collected;
+// facets must be released with releaseDSFacets even if this
+// returns false:
+static bool
+initDSFacets(JNIEnv *env, FacetCounter *facets, int numDims, jlongArray jfacetCounts, jarray jfacetAddresses,
+             jint facetAddressFormat, jint facetAddressBitsPerValue, jbyteArray jfacetBytes, int maxDoc) {
+  memset(facets, 0, sizeof(FacetCounter));
+  facets->counts = (FacetCounts **) calloc(numDims+1, sizeof(FacetCounts *));
+  if (facets->counts == 0) {
+    return false;
+  }
+  env->GetLongArrayRegion(jfacetCounts, 0, numDims+1, (jlong *) facets->counts);
+  for(int i=0;i<=numDims;i++) {
+    if (facets->counts[i] != 0) {
+      facets->aggregation = facets->counts[i]->aggregation;
+    }
+  }
+  if (jfacetBytes != 0) {
+    facets->docToAddress = env->GetPrimitiveArrayCritical(jfacetAddresses, 0);
+    if (facets->docToAddress == 0) {
+      return false;
+    }
+    facets->facetBytes = (unsigned char *) env->GetPrimitiveArrayCritical(jfacetBytes, 0);
+    if (facets->facetBytes == 0) {
+      return false;
+    }
+  }
+  return initFacetCounter(facets, facetAddressFormat, facetAddressBitsPerValue, maxDoc);
+}
+
+// Returns false if a FacetCounts ran out of memory while
+// counting:
+static bool
+releaseDSFacets(JNIEnv *env, FacetCounter *facets, int numDims, jarray jfacetAddresses, jbyteArray jfacetBytes) {
+  bool ok = true;
+  if (facets->counts != 0) {
+    for(int i=0;i<=numDims;i++) {
+      if (facets->counts[i] != 0 && facets->counts[i]->failed) {
+        ok = false;
+      }
+    }
+    free(facets->counts);
+  }
+  if (facets->docToAddress != 0) {
+    env->ReleasePrimitiveArrayCritical(jfacetAddresses, facets->docToAddress, JNI_ABORT);
+  }
+  if (facets->facetBytes != 0) {
+    env->ReleasePrimitiveArrayCritical(jfacetBytes, facets->facetBytes, JNI_ABORT);
+  }
+  return ok;
+}
+
 extern "C" JNIEXPORT jint JNICALL
 Java_org_apache_lucene_search_NativeSearch_searchSegmentBooleanQuery
   (JNIEnv *env,
@@ -113,6 +453,53 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentBooleanQuery
    jintArray jtopDocIDs,
    jfloatArray jtopScores,
 
+   // Sort values of the hits in the PQ (one per SortField
+   // for each hit), or null to sort by score:
+   jlongArray jtopSortValues,
+
+   // SORT_KEY_* of each SortField:
+   jintArray jsortKeys,
+
+   // SortField.getReverse() of each SortField:
+   jbooleanArray jsortReverse,
+
+   // Per SortField, address in memory where the field's
+   // numeric DocValues begin (in the mapped .dvd file), or 0
+   // if no doc in this segment has a value or the SortField
+   // is not by a field:
+   jlongArray jsortDVAddresses,
+
+   // Per SortField, Lucene42DocValuesConsumer format of the
+   // field:
+   jintArray jsortDVFormats,
+
+   // searchAfter: sort values of the last hit of the
+   // previous page, or null:
+   jlongArray jsortAfterValues,
+
+   // searchAfter: docID of the last hit of the previous
+   // page:
+   jint sortAfterDocID,
+
+   // True if the segment's docIDs are already in sort order,
+   // so collection may stop once no later doc can compete:
+   jboolean sortEarlyTerminate,
+
+   // Grouping: ordinal of each group in the PQ (topDocIDs
+   // and topScores hold each group's best hit), or null:
+   jintArray jtopGroupOrds,
+
+   // Grouping: hit count of each ordinal in this segment:
+   jintArray jgroupOrdCounts,
+
+   // Grouping: address in memory where the group field's
+   // ordinals (numeric DocValues) begin in the mapped .dvd
+   // file:
+   jlong groupDVAddress,
+
+   // Lucene42DocValuesConsumer format of the ordinals:
+   jint groupDVFormat,
+
    // Current segment's maxDoc
    jint maxDoc,
 
@@ -122,6 +509,10 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentBooleanQuery
    // Current segment's liveDocs, or null:
    jbyteArray jliveDocsBytes,
 
+   // Handle from newFilterBitmap for the search's cached
+   // filter, or 0:
+   jlong filterBitmap,
+
    // weightValue from each TermWeight:
    jfloatArray jtermWeights,
 
@@ -166,13 +557,59 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentBooleanQuery
 
    jobjectArray jdsNearMissBits,
 
+   // If non-null, hits and near misses are counted here
+   // instead of set in jdsHitBits/jdsNearMissBits: handles
+   // from newFacetCounts for the drill down counts (or 0),
+   // then each dim's drill sideways counts:
+   jlongArray jdsFacetCounts,
+
+   // Segment's Facet42BinaryDocValues docToAddress
+   // PackedInts.Reader's array:
+   jarray jdsFacetAddresses,
+
+   // Which PackedInts.Reader implementation it is
+   // (FACET_ADDRESS_*):
+   jint dsFacetAddressFormat,
+
+   jint dsFacetAddressBitsPerValue,
+
+   // Facet42BinaryDocValues bytes, or null if no doc in the
+   // segment has facets:
+   jbyteArray jdsFacetBytes,
+
    jintArray jdsSingletonDocIDs,
 
    jintArray jdsDocFreqs,
 
    jlongArray jdsDocTermStartFPs,
 
-   jlong dsDocFileAddress)
+   jlong dsDocFileAddress,
+
+   // Number of terms in each clause that is an exact
+   // PhraseQuery, else 0; null if there are no phrase
+   // clauses:
+   jintArray jphraseTermCounts,
+
+   // Per-term postings of all phrase clauses, in clause
+   // order:
+   jintArray jphraseSingletonDocIDs,
+
+   jlongArray jphraseTotalTermFreqs,
+
+   jintArray jphraseDocFreqs,
+
+   jlongArray jphraseDocTermStartFPs,
+
+   jlongArray jphrasePosTermStartFPs,
+
+   jintArray jphrasePosOffsets,
+
+   // Address in memory where .pos file is mapped:
+   jlong posFileAddress,
+
+   jboolean indexHasPayloads,
+
+   jboolean indexHasOffsets)
 {
 
   // Clauses come in sorted MUST_NOT (docFreq descending),
@@ -193,10 +630,16 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentBooleanQuery
   float *termWeights = 0;
   float *coordFactors = 0;
   unsigned char *liveDocsBytes = 0;
+  FilterBitmap *filter = (FilterBitmap *) filterBitmap;
+  unsigned char *acceptBits = 0;
   unsigned char* norms = 0;
   float *normTable = 0;
   int *topDocIDs = 0;
   float *topScores = 0;
+  NumericSort sortState;
+  NumericSort *sort = 0;
+  GroupCollector groupState;
+  GroupCollector *groups = 0;
   unsigned int *filled = 0;
   double **termScoreCache = 0;
   unsigned char isCopy = 0;
@@ -208,10 +651,20 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentBooleanQuery
   unsigned int *dsTermsPerDim = 0;
   unsigned long *dsHitBits = 0;
   unsigned long **dsNearMissBits = 0;
+  FacetCounter dsFacetState;
+  FacetCounter *dsFacets = 0;
   unsigned long *dsDocTermStartFPs = 0;
   unsigned int *dsDocFreqs = 0;
   int *dsSingletonDocIDs = 0;
   unsigned int *dsTotalHits = 0;
+  int *phraseTermCounts = 0;
+  int *phraseSingletonDocIDs = 0;
+  long *phraseTotalTermFreqs = 0;
+  int *phraseDocFreqs = 0;
+  long *phraseDocTermStartFPs = 0;
+  long *phrasePosTermStartFPs = 0;
+  int *phrasePosOffsets = 0;
+  int phraseTermUpto = 0;
 
   if (dsNumDims > 0) {
     dsCounts = (unsigned int *) malloc(CHUNK * sizeof(int));
@@ -243,23 +696,32 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentBooleanQuery
       failed = true;
       goto end;
     }
-    dsHitBits = (unsigned long *) env->GetPrimitiveArrayCritical(jdsHitBits, 0);
-    if (dsHitBits == 0) {
-      failed = true;
-      goto end;
-    }
-    dsNearMissBits = (unsigned long **) calloc(dsNumDims, sizeof(long *));
-    if (dsNearMissBits == 0) {
-      failed = true;
-      goto end;
-    }
-    for(int i=0;i<dsNumDims;i++) {
-      jlongArray jbits = (jlongArray) env->GetObjectArrayElement(jdsNearMissBits, i);
-      dsNearMissBits[i] = (unsigned long *) env->GetPrimitiveArrayCritical(jbits, 0);
-      if (dsNearMissBits[i] == 0) {
+    if (jdsFacetCounts != 0) {
+      dsFacets = &dsFacetState;
+      if (!initDSFacets(env, dsFacets, dsNumDims, jdsFacetCounts, jdsFacetAddresses, dsFacetAddressFormat,
+                        dsFacetAddressBitsPerValue, jdsFacetBytes, maxDoc)) {
+        failed = true;
+        goto end;
+      }
+    } else {
+      dsHitBits = (unsigned long *) env->GetPrimitiveArrayCritical(jdsHitBits, 0);
+      if (dsHitBits == 0) {
+        failed = true;
+        goto end;
+      }
+      dsNearMissBits = (unsigned long **) calloc(dsNumDims, sizeof(long *));
+      if (dsNearMissBits == 0) {
         failed = true;
         goto end;
       }
+      for(int i=0;i<dsNumDims;i++) {
+        jlongArray jbits = (jlongArray) env->GetObjectArrayElement(jdsNearMissBits, i);
+        dsNearMissBits[i] = (unsigned long *) env->GetPrimitiveArrayCritical(jbits, 0);
+        if (dsNearMissBits[i] == 0) {
+          failed = true;
+          goto end;
+        }
+      }
     }
 
     dsDocFreqs = (unsigned int *) env->GetIntArrayElements(jdsDocFreqs, 0);
@@ -295,7 +757,24 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentBooleanQuery
     }
   }
 
-  if (jtopScores == 0) {
+  if (jtopSortValues != 0) {
+    sort = &sortState;
+    if (!initSort(env, sort, jtopSortValues, jsortKeys, jsortReverse, jsortDVAddresses, jsortDVFormats,
+                  jsortAfterValues, sortAfterDocID, sortEarlyTerminate, maxDoc)) {
+      failed = true;
+      goto end;
+    }
+  }
+
+  if (jtopGroupOrds != 0) {
+    groups = &groupState;
+    if (!initGroups(env, groups, jtopGroupOrds, jgroupOrdCounts, groupDVAddress, groupDVFormat, maxDoc)) {
+      failed = true;
+      goto end;
+    }
+  }
+
+  if (jtopScores == 0 && (sort == 0 || !sortNeedsScores(sort))) {
     scores = 0;
   } else {
     scores = (float *) malloc(CHUNK * sizeof(float));
@@ -367,6 +846,44 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentBooleanQuery
     goto end;
   }
 
+  if (jphraseTermCounts != 0) {
+    phraseTermCounts = env->GetIntArrayElements(jphraseTermCounts, 0);
+    if (phraseTermCounts == 0) {
+      failed = true;
+      goto end;
+    }
+    phraseSingletonDocIDs = env->GetIntArrayElements(jphraseSingletonDocIDs, 0);
+    if (phraseSingletonDocIDs == 0) {
+      failed = true;
+      goto end;
+    }
+    phraseTotalTermFreqs = env->GetLongArrayElements(jphraseTotalTermFreqs, 0);
+    if (phraseTotalTermFreqs == 0) {
+      failed = true;
+      goto end;
+    }
+    phraseDocFreqs = env->GetIntArrayElements(jphraseDocFreqs, 0);
+    if (phraseDocFreqs == 0) {
+      failed = true;
+      goto end;
+    }
+    phraseDocTermStartFPs = env->GetLongArrayElements(jphraseDocTermStartFPs, 0);
+    if (phraseDocTermStartFPs == 0) {
+      failed = true;
+      goto end;
+    }
+    phrasePosTermStartFPs = env->GetLongArrayElements(jphrasePosTermStartFPs, 0);
+    if (phrasePosTermStartFPs == 0) {
+      failed = true;
+      goto end;
+    }
+    phrasePosOffsets = env->GetIntArrayElements(jphrasePosOffsets, 0);
+    if (phrasePosOffsets == 0) {
+      failed = true;
+      goto end;
+    }
+  }
+
   liveDocsBytes;
   if (jliveDocsBytes == 0) {
     liveDocsBytes = 0;
@@ -379,6 +896,15 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentBooleanQuery
     //printf("liveDocs isCopy=%d\n", isCopy);fflush(stdout);
   }
 
+  if (filter != 0) {
+    // Kernels fill this one chunk at a time:
+    acceptBits = (unsigned char *) malloc((maxDoc >> 3) + 1);
+    if (acceptBits == 0) {
+      failed = true;
+      goto end;
+    }
+  }
+
   isCopy = 0;
   norms = (unsigned char *) env->GetPrimitiveArrayCritical(jnorms, &isCopy);
   if (norms == 0) {
@@ -394,8 +920,23 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentBooleanQuery
   }
 
   for(int i=0;i<numScorers;i++) {
-    if (!initSub(i, subs+i, false, singletonDocIDs[i], totalTermFreqs[i], docFreqs[i],
-                 scores == 0 || i < numMustNot, docFileAddress, docTermStartFPs[i], true)) {
+    if (phraseTermCounts != 0 && phraseTermCounts[i] != 0) {
+      int numTerms = phraseTermCounts[i];
+      if (!initPhraseClauseSub(i, subs+i, numTerms, liveDocsBytes, maxDoc,
+                               phraseSingletonDocIDs + phraseTermUpto,
+                               phraseTotalTermFreqs + phraseTermUpto,
+                               phraseDocFreqs + phraseTermUpto,
+                               phraseDocTermStartFPs + phraseTermUpto,
+                               phrasePosTermStartFPs + phraseTermUpto,
+                               phrasePosOffsets + phraseTermUpto,
+                               docFileAddress, posFileAddress,
+                               indexHasPayloads, indexHasOffsets)) {
+        failed = true;
+        goto end;
+      }
+      phraseTermUpto += numTerms;
+    } else if (!initSub(i, subs+i, false, singletonDocIDs[i], totalTermFreqs[i], docFreqs[i],
+                        scores == 0 || i < numMustNot, docFileAddress, docTermStartFPs[i], true)) {
       failed = true;
       goto end;
     }
@@ -444,32 +985,35 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentBooleanQuery
 
   if (numMustNot == 0 && numMust == 0) {
     // Only SHOULD
-    hitCount = booleanQueryOnlyShould(subs, liveDocsBytes, termScoreCache, termWeights,
+    hitCount = booleanQueryOnlyShould(subs, liveDocsBytes, filter, acceptBits, termScoreCache, termWeights,
                                       maxDoc, topN, numScorers, docBase, filled, docIDs, scores, coords,
-                                      topScores, topDocIDs, coordFactors, normTable,
-                                      norms, dsSubs, dsCounts, dsMissingDims, dsNumDims, dsTotalHits, dsTermsPerDim, dsHitBits, dsNearMissBits);
+                                      topScores, topDocIDs, sort, groups, coordFactors, normTable,
+                                      norms, dsSubs, dsCounts, dsMissingDims, dsNumDims, dsTotalHits, dsTermsPerDim, dsHitBits, dsNearMissBits, dsFacets);
   } else if (numMust == 0) {
     // At least one MUST_NOT and at least one SHOULD:
-    hitCount = booleanQueryShouldMustNot(subs, liveDocsBytes, termScoreCache, termWeights,
+    hitCount = booleanQueryShouldMustNot(subs, liveDocsBytes, filter, acceptBits, termScoreCache, termWeights,
                                          maxDoc, topN, numScorers, docBase, numMustNot, filled, docIDs, scores, coords,
-                                         topScores, topDocIDs, coordFactors, normTable,
-                                         norms, skips, dsSubs, dsCounts, dsMissingDims, dsNumDims, dsTotalHits, dsTermsPerDim, dsHitBits, dsNearMissBits);
+                                         topScores, topDocIDs, sort, groups, coordFactors, normTable,
+                                         norms, skips, dsSubs, dsCounts, dsMissingDims, dsNumDims, dsTotalHits, dsTermsPerDim, dsHitBits, dsNearMissBits, dsFacets);
   } else if (numMustNot == 0) {
     // At least one MUST and zero or more SHOULD:
-    hitCount = booleanQueryShouldMust(subs, liveDocsBytes, termScoreCache, termWeights,
+    hitCount = booleanQueryShouldMust(subs, liveDocsBytes, filter, acceptBits, termScoreCache, termWeights,
                                       maxDoc, topN, numScorers, docBase, numMust, filled, docIDs, scores, coords,
-                                      topScores, topDocIDs, coordFactors, normTable,
-                                      norms, dsSubs, dsCounts, dsMissingDims, dsNumDims, dsTotalHits, dsTermsPerDim, dsHitBits, dsNearMissBits);
+                                      topScores, topDocIDs, sort, groups, coordFactors, normTable,
+                                      norms, dsSubs, dsCounts, dsMissingDims, dsNumDims, dsTotalHits, dsTermsPerDim, dsHitBits, dsNearMissBits, dsFacets);
   } else {
     // At least one MUST_NOT, at least one MUST and zero or more SHOULD:
-    hitCount = booleanQueryShouldMustMustNot(subs, liveDocsBytes, termScoreCache, termWeights,
+    hitCount = booleanQueryShouldMustMustNot(subs, liveDocsBytes, filter, acceptBits, termScoreCache, termWeights,
                                              maxDoc, topN, numScorers, docBase, numMust, numMustNot, filled, docIDs, scores, coords,
-                                             topScores, topDocIDs, coordFactors, normTable,
-                                             norms, dsSubs, dsCounts, dsMissingDims, dsNumDims, dsTotalHits, dsTermsPerDim, dsHitBits, dsNearMissBits);
+                                             topScores, topDocIDs, sort, groups, coordFactors, normTable,
+                                             norms, dsSubs, dsCounts, dsMissingDims, dsNumDims, dsTotalHits, dsTermsPerDim, dsHitBits, dsNearMissBits, dsFacets);
   }
 
  end:
 
+  if (acceptBits != 0) {
+    free(acceptBits);
+  }
   if (norms != 0) {
     env->ReleasePrimitiveArrayCritical(jnorms, norms, JNI_ABORT);
   }
@@ -497,12 +1041,39 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentBooleanQuery
   if (coordFactors != 0) {
     env->ReleaseFloatArrayElements(jcoordFactors, coordFactors, JNI_ABORT);
   }
+  if (phraseTermCounts != 0) {
+    env->ReleaseIntArrayElements(jphraseTermCounts, phraseTermCounts, JNI_ABORT);
+  }
+  if (phraseSingletonDocIDs != 0) {
+    env->ReleaseIntArrayElements(jphraseSingletonDocIDs, phraseSingletonDocIDs, JNI_ABORT);
+  }
+  if (phraseTotalTermFreqs != 0) {
+    env->ReleaseLongArrayElements(jphraseTotalTermFreqs, phraseTotalTermFreqs, JNI_ABORT);
+  }
+  if (phraseDocFreqs != 0) {
+    env->ReleaseIntArrayElements(jphraseDocFreqs, phraseDocFreqs, JNI_ABORT);
+  }
+  if (phraseDocTermStartFPs != 0) {
+    env->ReleaseLongArrayElements(jphraseDocTermStartFPs, phraseDocTermStartFPs, JNI_ABORT);
+  }
+  if (phrasePosTermStartFPs != 0) {
+    env->ReleaseLongArrayElements(jphrasePosTermStartFPs, phrasePosTermStartFPs, JNI_ABORT);
+  }
+  if (phrasePosOffsets != 0) {
+    env->ReleaseIntArrayElements(jphrasePosOffsets, phrasePosOffsets, JNI_ABORT);
+  }
   if (topDocIDs != 0) {
     env->ReleaseIntArrayElements(jtopDocIDs, topDocIDs, 0);
   }
   if (topScores != 0) {
     env->ReleaseFloatArrayElements(jtopScores, topScores, 0);
   }
+  if (sort != 0) {
+    releaseSort(env, sort, jtopSortValues);
+  }
+  if (groups != 0) {
+    releaseGroups(env, groups, jtopGroupOrds, jgroupOrdCounts);
+  }
 
   if (termScoreCache != 0) {
     for(int i=0;i<numScorers;i++) {
@@ -563,6 +1134,9 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentBooleanQuery
     }
     free(dsNearMissBits);
   }
+  if (dsFacets != 0 && !releaseDSFacets(env, dsFacets, dsNumDims, jdsFacetAddresses, jdsFacetBytes)) {
+    failed = true;
+  }
   if (dsDocFreqs != 0) {
     env->ReleaseIntArrayElements(jdsDocFreqs, (int *) dsDocFreqs, JNI_ABORT);
   }
@@ -602,6 +1176,53 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentTermQuery
    jintArray jtopDocIDs,
    jfloatArray jtopScores,
 
+   // Sort values of the hits in the PQ (one per SortField
+   // for each hit), or null to sort by score:
+   jlongArray jtopSortValues,
+
+   // SORT_KEY_* of each SortField:
+   jintArray jsortKeys,
+
+   // SortField.getReverse() of each SortField:
+   jbooleanArray jsortReverse,
+
+   // Per SortField, address in memory where the field's
+   // numeric DocValues begin (in the mapped .dvd file), or 0
+   // if no doc in this segment has a value or the SortField
+   // is not by a field:
+   jlongArray jsortDVAddresses,
+
+   // Per SortField, Lucene42DocValuesConsumer format of the
+   // field:
+   jintArray jsortDVFormats,
+
+   // searchAfter: sort values of the last hit of the
+   // previous page, or null:
+   jlongArray jsortAfterValues,
+
+   // searchAfter: docID of the last hit of the previous
+   // page:
+   jint sortAfterDocID,
+
+   // True if the segment's docIDs are already in sort order,
+   // so collection may stop once no later doc can compete:
+   jboolean sortEarlyTerminate,
+
+   // Grouping: ordinal of each group in the PQ (topDocIDs
+   // and topScores hold each group's best hit), or null:
+   jintArray jtopGroupOrds,
+
+   // Grouping: hit count of each ordinal in this segment:
+   jintArray jgroupOrdCounts,
+
+   // Grouping: address in memory where the group field's
+   // ordinals (numeric DocValues) begin in the mapped .dvd
+   // file:
+   jlong groupDVAddress,
+
+   // Lucene42DocValuesConsumer format of the ordinals:
+   jint groupDVFormat,
+
    // Current segment's maxDoc
    jint maxDoc,
 
@@ -611,6 +1232,10 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentTermQuery
    // Current segment's liveDocs, or null:
    jbyteArray jliveDocBytes,
 
+   // Handle from newFilterBitmap for the search's cached
+   // filter, or 0:
+   jlong filterBitmap,
+
    jboolean docsOnly,
 
    // weightValue from each TermWeight:
@@ -648,6 +1273,26 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentTermQuery
 
    jobjectArray jdsNearMissBits,
 
+   // If non-null, hits and near misses are counted here
+   // instead of set in jdsHitBits/jdsNearMissBits: handles
+   // from newFacetCounts for the drill down counts (or 0),
+   // then each dim's drill sideways counts:
+   jlongArray jdsFacetCounts,
+
+   // Segment's Facet42BinaryDocValues docToAddress
+   // PackedInts.Reader's array:
+   jarray jdsFacetAddresses,
+
+   // Which PackedInts.Reader implementation it is
+   // (FACET_ADDRESS_*):
+   jint dsFacetAddressFormat,
+
+   jint dsFacetAddressBitsPerValue,
+
+   // Facet42BinaryDocValues bytes, or null if no doc in the
+   // segment has facets:
+   jbyteArray jdsFacetBytes,
+
    jintArray jdsSingletonDocIDs,
 
    jintArray jdsDocFreqs,
@@ -661,10 +1306,19 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentTermQuery
   //printf("topN=%d\n", topN);
 
   unsigned char *liveDocBytes = 0;
+  unsigned char *liveDocsArray = 0;
+  FilterBitmap *filter = (FilterBitmap *) filterBitmap;
+  unsigned char *acceptBits = 0;
   unsigned char* norms = 0;
   float *normTable = 0;
   int *topDocIDs = 0;
   float *topScores = 0;
+  NumericSort sortState;
+  NumericSort *sort = 0;
+  GroupCollector groupState;
+  GroupCollector *groups = 0;
+  // Score each hit for sortCollect/groupCollect:
+  bool collectScores = false;
   double *termScoreCache = 0;
   PostingsState *sub = 0;
   int totalHits = 0;
@@ -678,6 +1332,8 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentTermQuery
   unsigned int *dsTermsPerDim = 0;
   unsigned long *dsHitBits = 0;
   unsigned long **dsNearMissBits = 0;
+  FacetCounter dsFacetState;
+  FacetCounter *dsFacets = 0;
   unsigned long *dsDocTermStartFPs = 0;
   unsigned int *dsDocFreqs = 0;
   int *dsSingletonDocIDs = 0;
@@ -714,23 +1370,32 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentTermQuery
       failed = true;
       goto end;
     }
-    dsHitBits = (unsigned long *) env->GetPrimitiveArrayCritical(jdsHitBits, 0);
-    if (dsHitBits == 0) {
-      failed = true;
-      goto end;
-    }
-    dsNearMissBits = (unsigned long **) calloc(dsNumDims, sizeof(long *));
-    if (dsNearMissBits == 0) {
-      failed = true;
-      goto end;
-    }
-    for(int i=0;i<dsNumDims;i++) {
-      jlongArray jbits = (jlongArray) env->GetObjectArrayElement(jdsNearMissBits, i);
-      dsNearMissBits[i] = (unsigned long *) env->GetPrimitiveArrayCritical(jbits, 0);
-      if (dsNearMissBits[i] == 0) {
+    if (jdsFacetCounts != 0) {
+      dsFacets = &dsFacetState;
+      if (!initDSFacets(env, dsFacets, dsNumDims, jdsFacetCounts, jdsFacetAddresses, dsFacetAddressFormat,
+                        dsFacetAddressBitsPerValue, jdsFacetBytes, maxDoc)) {
+        failed = true;
+        goto end;
+      }
+    } else {
+      dsHitBits = (unsigned long *) env->GetPrimitiveArrayCritical(jdsHitBits, 0);
+      if (dsHitBits == 0) {
+        failed = true;
+        goto end;
+      }
+      dsNearMissBits = (unsigned long **) calloc(dsNumDims, sizeof(long *));
+      if (dsNearMissBits == 0) {
         failed = true;
         goto end;
       }
+      for(int i=0;i<dsNumDims;i++) {
+        jlongArray jbits = (jlongArray) env->GetObjectArrayElement(jdsNearMissBits, i);
+        dsNearMissBits[i] = (unsigned long *) env->GetPrimitiveArrayCritical(jbits, 0);
+        if (dsNearMissBits[i] == 0) {
+          failed = true;
+          goto end;
+        }
+      }
     }
 
     dsDocFreqs = (unsigned int *) env->GetIntArrayElements(jdsDocFreqs, 0);
@@ -769,11 +1434,23 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentTermQuery
   if (jliveDocBytes == 0) {
     liveDocBytes = 0;
   } else {
-    liveDocBytes = (unsigned char *) env->GetPrimitiveArrayCritical(jliveDocBytes, &isCopy);
-    if (liveDocBytes == 0) {
+    liveDocsArray = (unsigned char *) env->GetPrimitiveArrayCritical(jliveDocBytes, &isCopy);
+    if (liveDocsArray == 0) {
+      failed = true;
+      goto end;
+    }
+    liveDocBytes = liveDocsArray;
+  }
+
+  if (filter != 0) {
+    // Checked per posting, so decode the whole filter:
+    acceptBits = (unsigned char *) malloc((maxDoc >> 3) + 1);
+    if (acceptBits == 0) {
       failed = true;
       goto end;
     }
+    fillFilterBits(filter, liveDocBytes, acceptBits);
+    liveDocBytes = acceptBits;
   }
 
   isCopy = 0;
@@ -806,6 +1483,25 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentTermQuery
     }
   }
 
+  if (jtopSortValues != 0) {
+    sort = &sortState;
+    if (!initSort(env, sort, jtopSortValues, jsortKeys, jsortReverse, jsortDVAddresses, jsortDVFormats,
+                  jsortAfterValues, sortAfterDocID, sortEarlyTerminate, maxDoc)) {
+      failed = true;
+      goto end;
+    }
+    collectScores = sortNeedsScores(sort);
+  }
+
+  if (jtopGroupOrds != 0) {
+    groups = &groupState;
+    if (!initGroups(env, groups, jtopGroupOrds, jgroupOrdCounts, groupDVAddress, groupDVFormat, maxDoc)) {
+      failed = true;
+      goto end;
+    }
+    collectScores = true;
+  }
+
   termScoreCache = (double *) malloc(TERM_SCORES_CACHE_SIZE*sizeof(double));
   if (termScoreCache == 0) {
     failed = true;
@@ -818,7 +1514,23 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentTermQuery
   if (singletonDocID != -1) {
     if (liveDocBytes == 0 || isSet(liveDocBytes, singletonDocID)) {
       int docID = docBase + singletonDocID;
-      if (jtopScores != 0) {
+      if (sort != 0 || groups != 0) {
+        float score = 0;
+        if (collectScores) {
+          if (totalTermFreq < TERM_SCORES_CACHE_SIZE) {
+            score = termScoreCache[totalTermFreq];
+          } else {
+            score = sqrt(totalTermFreq) * termWeight;
+          }
+          score *= normTable[norms[singletonDocID]];
+        }
+        unsigned int slot = 0;
+        if (groups != 0) {
+          groupCollect(groups, topN, docBase, singletonDocID, &slot, 1, 0, &score, topDocIDs, topScores);
+        } else {
+          sortCollect(sort, topN, docBase, singletonDocID, &slot, 1, 0, &score, topDocIDs);
+        }
+      } else if (jtopScores != 0) {
         float score;
         if (totalTermFreq < TERM_SCORES_CACHE_SIZE) {
           score = termScoreCache[totalTermFreq];
@@ -986,7 +1698,7 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentTermQuery
       failed = true;
       goto end;
     }
-    initSub(0, sub, docsOnly, -1, 0, docFreq, jtopScores == 0 || docsOnly, docFileAddress, docTermStartFP, true);
+    initSub(0, sub, docsOnly, -1, 0, docFreq, (jtopScores == 0 && !collectScores) || docsOnly, docFileAddress, docTermStartFP, true);
 
     int nextDocID = sub->nextDocID;
     unsigned int *docDeltas = sub->docDeltas;
@@ -1076,7 +1788,74 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentTermQuery
                                           dsTermsPerDim,
                                           dsTotalHits,
                                           dsHitBits,
-                                          dsNearMissBits);
+                                          dsNearMissBits,
+                                          dsFacets);
+        docUpto += CHUNK;
+      }
+    } else if (sort != 0 || groups != 0) {
+      filled = (unsigned int *) malloc(CHUNK * sizeof(int));
+      if (filled == 0) {
+        failed = true;
+        goto end;
+      }
+      if (collectScores) {
+        scores = (float *) malloc(CHUNK * sizeof(float));
+        if (scores == 0) {
+          failed = true;
+          goto end;
+        }
+      }
+
+      // Collect a chunk at a time, so values are looked up
+      // only for live docs:
+      int docUpto = 0;
+      while (nextDocID != NO_MORE_DOCS) {
+        int endDoc = docUpto + CHUNK;
+        int numFilled = 0;
+        while (nextDocID < endDoc) {
+          if (liveDocBytes == 0 || isSet(liveDocBytes, nextDocID)) {
+            int slot = nextDocID & MASK;
+            filled[numFilled++] = slot;
+            if (collectScores) {
+              float score;
+              if (docsOnly) {
+                score = termScoreCache[1];
+              } else {
+                int freq = freqs[blockLastRead];
+                if (freq < TERM_SCORES_CACHE_SIZE) {
+                  score = termScoreCache[freq];
+                } else {
+                  score = sqrt(freq) * termWeight;
+                }
+              }
+              score *= normTable[norms[nextDocID]];
+              scores[slot] = score;
+            }
+          }
+
+          // Inlined nextDoc:
+          if (blockLastRead == blockEnd) {
+            if (sub->docsLeft == 0) {
+              nextDocID = NO_MORE_DOCS;
+              break;
+            } else {
+              nextDocFreqBlock(sub);
+              blockLastRead = -1;
+              blockEnd = sub->docFreqBlockEnd;
+            }
+          }
+
+          nextDocID += docDeltas[++blockLastRead];
+        }
+
+        totalHits += numFilled;
+        if (groups != 0) {
+          groupCollect(groups, topN, docBase, docUpto, filled, numFilled, 0, scores, topDocIDs, topScores);
+        } else if (sortCollect(sort, topN, docBase, docUpto, filled, numFilled, 0, scores, topDocIDs)) {
+          // Index-sorted segment: no later doc is competitive,
+          // so totalHits is only a lower bound:
+          break;
+        }
         docUpto += CHUNK;
       }
     } else if (liveDocBytes != 0) {
@@ -1308,8 +2087,11 @@ end:
   if (norms != 0) {
     env->ReleasePrimitiveArrayCritical(jnorms, norms, JNI_ABORT);
   }
-  if (liveDocBytes != 0) {
-    env->ReleasePrimitiveArrayCritical(jliveDocBytes, liveDocBytes, JNI_ABORT);
+  if (liveDocsArray != 0) {
+    env->ReleasePrimitiveArrayCritical(jliveDocBytes, liveDocsArray, JNI_ABORT);
+  }
+  if (acceptBits != 0) {
+    free(acceptBits);
   }
   if (normTable != 0) {
     env->ReleasePrimitiveArrayCritical(jnormTable, normTable, JNI_ABORT);
@@ -1321,6 +2103,12 @@ end:
   if (topScores != 0) {
     env->ReleaseFloatArrayElements(jtopScores, topScores, 0);
   }
+  if (sort != 0) {
+    releaseSort(env, sort, jtopSortValues);
+  }
+  if (groups != 0) {
+    releaseGroups(env, groups, jtopGroupOrds, jgroupOrdCounts);
+  }
   if (filled != 0) {
     free(filled);
   }
@@ -1355,6 +2143,9 @@ end:
     }
     free(dsNearMissBits);
   }
+  if (dsFacets != 0 && !releaseDSFacets(env, dsFacets, dsNumDims, jdsFacetAddresses, jdsFacetBytes)) {
+    failed = true;
+  }
   if (dsDocFreqs != 0) {
     env->ReleaseIntArrayElements(jdsDocFreqs, (int *) dsDocFreqs, JNI_ABORT);
   }
@@ -1384,85 +2175,959 @@ end:
   return totalHits;
 }
 
+// ORs one block of docIDs, each docDeltas[j] added to the
+// previous docID, into bits; docIDs only increase, so all
+// docs landing in the same 64-bit word are first combined
+// into one mask, instead of a read-modify-write per doc.
+// docDeltas is overwritten with the docIDs.  Returns the
+// last docID:
+static int
+orDocDeltas(unsigned long *bits, unsigned int *docDeltas, int count, int docID) {
+  int j = 0;
+#ifdef __SSE2__
+  // Prefix sum 4 deltas at a time, carrying the last
+  // docID forward, like accum in facets.cpp:
+  __m128i carry = _mm_set1_epi32(docID);
+  for(;j+4<=count;j+=4) {
+    __m128i x = _mm_loadu_si128((__m128i *) (docDeltas + j));
+    x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+    x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+    x = _mm_add_epi32(x, carry);
+    _mm_storeu_si128((__m128i *) (docDeltas + j), x);
+    carry = _mm_shuffle_epi32(x, 0xFF);
+  }
+  if (j > 0) {
+    docID = docDeltas[j-1];
+  }
+#endif
+  for(;j<count;j++) {
+    docID += docDeltas[j];
+    docDeltas[j] = docID;
+  }
+
+  unsigned int *docIDs = docDeltas;
+  int wordNum = docIDs[0] >> 6;
+  unsigned long mask = 0;
+  for(j=0;j<count;j++) {
+    int nextWordNum = docIDs[j] >> 6;
+    if (nextWordNum != wordNum) {
+      bits[wordNum] |= mask;
+      wordNum = nextWordNum;
+      mask = 0;
+    }
+    mask |= 1UL << (docIDs[j] & 0x3f);
+  }
+  bits[wordNum] |= mask;
+  return docID;
+}
+
+// ANDs the segment's liveDocs into bits.  liveDocsBytes
+// uses the same bit order as FixedBitSet's longs on a
+// little-endian CPU, so whole words can be ANDed:
+static void
+andLiveDocs(unsigned long *bits, int numWords, unsigned char *liveDocsBytes, int numLiveDocsBytes) {
+  int fullWords = numLiveDocsBytes >> 3;
+  if (fullWords > numWords) {
+    fullWords = numWords;
+  }
+  unsigned long *liveDocsWords = (unsigned long *) liveDocsBytes;
+  int i = 0;
+#ifdef __SSE2__
+  // Two words at a time; neither array need be 16-byte
+  // aligned:
+  for(;i+2<=fullWords;i+=2) {
+    __m128i x = _mm_and_si128(_mm_loadu_si128((__m128i *) (bits + i)), _mm_loadu_si128((__m128i *) (liveDocsWords + i)));
+    _mm_storeu_si128((__m128i *) (bits + i), x);
+  }
+#endif
+  for(;i<fullWords;i++) {
+    bits[i] &= liveDocsWords[i];
+  }
+  if (fullWords < numWords) {
+    // Trailing partial word; docs past maxDoc are never set:
+    unsigned long lastWord = 0;
+    memcpy(&lastWord, liveDocsBytes + (fullWords << 3), numLiveDocsBytes - (fullWords << 3));
+    bits[fullWords] &= lastWord;
+    for(i=fullWords+1;i<numWords;i++) {
+      bits[i] = 0;
+    }
+  }
+}
+
+// ORs all docs of termStats[start..end) (docFreq, docStartFP
+// pairs) into bits; returns false if malloc failed:
+static bool
+fillTerms(unsigned long *bits, long address, long *termStats, int start, int end, bool docsOnly) {
+  PostingsState *sub = (PostingsState *) malloc(sizeof(PostingsState));
+  if (sub == 0) {
+    return false;
+  }
+  sub->docsOnly = docsOnly;
+  sub->docDeltas = (unsigned int *) malloc(BLOCK_SIZE * sizeof(int));
+  if (sub->docDeltas == 0) {
+    free(sub);
+    return false;
+  }
+  sub->freqs = 0;
+
+  unsigned int *docDeltas = sub->docDeltas;
+
+  int i = start;
+  while (i < end) {
+    sub->docsLeft = (int) termStats[i++];
+    sub->docFreqs = (unsigned char *) (address + termStats[i++]);
+    nextDocFreqBlock(sub);
+    int lastDocID = 0;
+
+    //printf("do term %d docFreq=%d\n", i, sub->docsLeft);fflush(stdout);
+
+    while (true) {
+      lastDocID = orDocDeltas(bits, docDeltas, sub->docFreqBlockEnd+1, lastDocID);
+      if (sub->docsLeft == 0) {
+        break;
+      } else {
+        nextDocFreqBlock(sub);
+      }
+    }
+  }
+
+  free(sub->docDeltas);
+  free(sub);
+  return true;
+}
+
+// One worker's share of a parallel fillMultiTermFilter:
+// first a slice of the terms, decoded into a private bitset
+// (worker 0 uses the shared one), then a range of words, ORed
+// together from all private bitsets:
+typedef struct {
+  unsigned long *bits;
+  long address;
+  long *termStats;
+  int termStart;
+  int termEnd;
+  bool docsOnly;
+  bool failed;
+
+  unsigned long **allBits;
+  int numThreads;
+  int wordStart;
+  int wordEnd;
+  unsigned char *liveDocsBytes;
+  int numLiveDocsBytes;
+} FillJob;
+
+static void *
+fillTermsThread(void *arg) {
+  FillJob *job = (FillJob *) arg;
+  job->failed = !fillTerms(job->bits, job->address, job->termStats, job->termStart, job->termEnd, job->docsOnly);
+  return 0;
+}
+
+static void *
+mergeBitsThread(void *arg) {
+  FillJob *job = (FillJob *) arg;
+  unsigned long *bits = job->allBits[0];
+  for(int t=1;t<job->numThreads;t++) {
+    unsigned long *other = job->allBits[t];
+    for(int i=job->wordStart;i<job->wordEnd;i++) {
+      bits[i] |= other[i];
+    }
+  }
+  if (job->liveDocsBytes != 0) {
+    int numBytes = job->numLiveDocsBytes - (job->wordStart << 3);
+    if (numBytes < 0) {
+      numBytes = 0;
+    }
+    andLiveDocs(bits + job->wordStart, job->wordEnd - job->wordStart, job->liveDocsBytes + (job->wordStart << 3), numBytes);
+  }
+  return 0;
+}
+
 extern "C" JNIEXPORT void JNICALL
 Java_org_apache_lucene_search_NativeSearch_fillMultiTermFilter
   (JNIEnv *env,
    jclass cl,
    jlongArray jbits,
    jbyteArray jliveDocsBytes,
+   jlong filterBitmap,
    jlong address,
    jlongArray jtermStats,
-   jboolean docsOnly) {
+   jboolean docsOnly,
+
+   // Max threads to decode terms with; the terms are split
+   // into slices with about the same total docFreq:
+   jint maxThreads,
+
+   // Don't bother with a thread for fewer postings than this:
+   jint minPostingsPerThread) {
 
   unsigned char isCopy = 0;
+  bool failed = false;
+  FillJob *jobs = 0;
+  unsigned long **allBits = 0;
+  int numThreads = 1;
+  long totalDocFreq = 0;
+  FilterBitmap *filter = (FilterBitmap *) filterBitmap;
+  unsigned char *acceptBits = 0;
+
+  int numWords = env->GetArrayLength(jbits);
+  int numTerms = env->GetArrayLength(jtermStats);
 
   unsigned char *liveDocsBytes;
+  int numLiveDocsBytes;
   if (jliveDocsBytes == 0) {
     liveDocsBytes = 0;
+    numLiveDocsBytes = 0;
   } else {
+    numLiveDocsBytes = env->GetArrayLength(jliveDocsBytes);
     liveDocsBytes = (unsigned char *) env->GetPrimitiveArrayCritical(jliveDocsBytes, &isCopy);
   }
 
   isCopy = 0;
-  long *bits = (long *) env->GetPrimitiveArrayCritical(jbits, &isCopy);
+  unsigned long *bits = (unsigned long *) env->GetPrimitiveArrayCritical(jbits, &isCopy);
 
   long *termStats = (long *) env->GetPrimitiveArrayCritical(jtermStats, 0);
 
-  PostingsState *sub = (PostingsState *) malloc(sizeof(PostingsState));
-  sub->docsOnly = (bool) docsOnly;
-  sub->docDeltas = (unsigned int *) malloc(BLOCK_SIZE * sizeof(int));
-  sub->freqs = 0;
+  //printf("numTerms=%d\n", numTerms);
 
-  unsigned int *docDeltas = sub->docDeltas;
+  if (filter != 0) {
+    // Applied along with deletions, once the bits are filled:
+    acceptBits = (unsigned char *) malloc((filter->maxDoc >> 3) + 1);
+    if (acceptBits == 0) {
+      failed = true;
+      goto end;
+    }
+    fillFilterBits(filter, liveDocsBytes, acceptBits);
+  }
 
-  int numTerms = env->GetArrayLength(jtermStats);
-  //printf("numTerms=%d\n", numTerms);
-  int i = 0;
-  while (i < numTerms) {
-    sub->docsLeft = (int) termStats[i++];
-    sub->docFreqs = (unsigned char *) (address + termStats[i++]);
-    nextDocFreqBlock(sub);
-    int nextDocID = 0;
+  for(int i=0;i<numTerms;i+=2) {
+    totalDocFreq += termStats[i];
+  }
+  if (maxThreads > 1 && numTerms > 2) {
+    long n = totalDocFreq / minPostingsPerThread;
+    if (n > numTerms/2) {
+      n = numTerms/2;
+    }
+    numThreads = n < maxThreads ? (int) n : maxThreads;
+    if (numThreads < 1) {
+      numThreads = 1;
+    }
+  }
 
-    //printf("do term %d docFreq=%d\n", i, sub->docsLeft);fflush(stdout);
+  if (numThreads > 1) {
+    jobs = (FillJob *) calloc(numThreads, sizeof(FillJob));
+    allBits = (unsigned long **) calloc(numThreads, sizeof(unsigned long *));
+    if (jobs == 0 || allBits == 0) {
+      failed = true;
+      goto end;
+    }
+    allBits[0] = bits;
+    for(int t=1;t<numThreads;t++) {
+      allBits[t] = (unsigned long *) calloc(numWords, sizeof(long));
+      if (allBits[t] == 0) {
+        failed = true;
+        goto end;
+      }
+    }
 
-    while (true) {
-      int limit = sub->docFreqBlockEnd+1;
-      //printf("  limit %d\n", limit);fflush(stdout);
-      if (liveDocsBytes == 0) {
-        for(int j=0;j<limit;j++) {
-          nextDocID += docDeltas[j];
-          setLongBit(bits, nextDocID);
-        }
+    // Split terms by docFreq:
+    long docFreqUpto = 0;
+    int termUpto = 0;
+    for(int t=0;t<numThreads;t++) {
+      FillJob *job = jobs + t;
+      job->bits = allBits[t];
+      job->address = address;
+      job->termStats = termStats;
+      job->docsOnly = (bool) docsOnly;
+      job->termStart = termUpto;
+      if (t == numThreads-1) {
+        termUpto = numTerms;
       } else {
-        for(int j=0;j<limit;j++) {
-          nextDocID += docDeltas[j];
-          if (isSet(liveDocsBytes, nextDocID)) {
-            setLongBit(bits, nextDocID);
-          }
+        long target = totalDocFreq * (t+1) / numThreads;
+        while (termUpto < numTerms && docFreqUpto < target) {
+          docFreqUpto += termStats[termUpto];
+          termUpto += 2;
         }
       }
-      if (sub->docsLeft == 0) {
-        break;
+      job->termEnd = termUpto;
+    }
+    runJobs(jobs, sizeof(FillJob), numThreads, fillTermsThread);
+    for(int t=0;t<numThreads;t++) {
+      if (jobs[t].failed) {
+        failed = true;
+        goto end;
+      }
+    }
+
+    // OR private bitsets into the shared one, and apply
+    // deletions, by word ranges:
+    for(int t=0;t<numThreads;t++) {
+      FillJob *job = jobs + t;
+      job->allBits = allBits;
+      job->numThreads = numThreads;
+      job->wordStart = (int) ((long) numWords * t / numThreads);
+      job->wordEnd = (int) ((long) numWords * (t+1) / numThreads);
+      if (acceptBits != 0) {
+        job->liveDocsBytes = acceptBits;
+        job->numLiveDocsBytes = (filter->maxDoc >> 3) + 1;
       } else {
-        nextDocFreqBlock(sub);
+        job->liveDocsBytes = liveDocsBytes;
+        job->numLiveDocsBytes = numLiveDocsBytes;
       }
     }
+    runJobs(jobs, sizeof(FillJob), numThreads, mergeBitsThread);
+  } else {
+    if (!fillTerms(bits, address, termStats, 0, numTerms, (bool) docsOnly)) {
+      failed = true;
+      goto end;
+    }
+
+    // Apply deletions once, instead of per posting:
+    if (acceptBits != 0) {
+      andLiveDocs(bits, numWords, acceptBits, (filter->maxDoc >> 3) + 1);
+    } else if (liveDocsBytes != 0) {
+      andLiveDocs(bits, numWords, liveDocsBytes, numLiveDocsBytes);
+    }
   }
 
-  free(sub->docDeltas);
-  free(sub);
+ end:
+  if (allBits != 0) {
+    for(int t=1;t<numThreads;t++) {
+      if (allBits[t] != 0) {
+        free(allBits[t]);
+      }
+    }
+    free(allBits);
+  }
+  if (jobs != 0) {
+    free(jobs);
+  }
+  if (acceptBits != 0) {
+    free(acceptBits);
+  }
   
   if (jliveDocsBytes != 0) {
     env->ReleasePrimitiveArrayCritical(jliveDocsBytes, liveDocsBytes, JNI_ABORT);
   }
   env->ReleasePrimitiveArrayCritical(jtermStats, termStats, JNI_ABORT);
-  env->ReleasePrimitiveArrayCritical(jbits, bits, JNI_ABORT);
+  // Copy back, in case the JVM gave us a copy:
+  env->ReleasePrimitiveArrayCritical(jbits, bits, 0);
+
+  if (failed) {
+    jclass c = env->FindClass("java/lang/OutOfMemoryError");
+    env->ThrowNew(c, "failed to allocate temporary memory");
+  }
+}
+
+
+// Steps a term's postings to its next docID, or
+// NO_MORE_DOCS:
+static void
+nextMergeDoc(PostingsState *sub) {
+  if (sub->docFreqBlockLastRead == sub->docFreqBlockEnd) {
+    if (sub->docsLeft == 0) {
+      sub->nextDocID = NO_MORE_DOCS;
+      return;
+    }
+    nextDocFreqBlock(sub);
+  }
+  sub->nextDocID += sub->docDeltas[++sub->docFreqBlockLastRead];
 }
 
+// 1-based min-heap of sub indices, by nextDocID; sifts
+// down from heap[i]:
+static void
+downMergeHeap(int *heap, int heapSize, PostingsState *subs, int i) {
+  int node = heap[i];
+  int docID = subs[node].nextDocID;
+  int j = i << 1;
+  int k = j + 1;
+  if (k <= heapSize && subs[heap[k]].nextDocID < subs[heap[j]].nextDocID) {
+    j = k;
+  }
+  while (j <= heapSize && subs[heap[j]].nextDocID < docID) {
+    heap[i] = heap[j];
+    i = j;
+    j = i << 1;
+    k = j + 1;
+    if (k <= heapSize && subs[heap[k]].nextDocID < subs[heap[j]].nextDocID) {
+      j = k;
+    }
+  }
+  heap[i] = node;
+}
 
 extern "C" JNIEXPORT jint JNICALL
-Java_org_apache_lucene_search_NativeSearch_searchSegmentExactPhraseQuery
+Java_org_apache_lucene_search_NativeSearch_collectMultiTermDocs
+  (JNIEnv *env,
+   jclass cl,
+
+   // Output: sorted, unique live docIDs; must have room for
+   // the sum of all docFreqs plus the singletons:
+   jintArray jdocIDs,
+
+   // Current segment's liveDocs, or null:
+   jbyteArray jliveDocsBytes,
+
+   // Handle from newFilterBitmap for the search's cached
+   // filter, or 0:
+   jlong filterBitmap,
+
+   // Address in memory where .doc file is mapped:
+   jlong address,
+
+   // docFreq, docStartFP pairs:
+   jlongArray jtermStats,
+
+   // Sorted docIDs of terms with docFreq=1:
+   jintArray jsingletonDocIDs,
+
+   jboolean docsOnly) {
+
+  bool failed = false;
+  unsigned char isCopy = 0;
+  PostingsState *subs = 0;
+  unsigned int *docDeltas = 0;
+  int *heap = 0;
+  int heapSize = 0;
+  int count = 0;
+  int lastDocID = -1;
+  FilterBitmap *filter = (FilterBitmap *) filterBitmap;
+  unsigned char *acceptBits = 0;
+
+  int numTerms = env->GetArrayLength(jtermStats) / 2;
+  int numSingletons = env->GetArrayLength(jsingletonDocIDs);
+
+  unsigned char *liveDocsArray;
+  if (jliveDocsBytes == 0) {
+    liveDocsArray = 0;
+  } else {
+    liveDocsArray = (unsigned char *) env->GetPrimitiveArrayCritical(jliveDocsBytes, &isCopy);
+  }
+  unsigned char *liveDocsBytes = liveDocsArray;
+  int *docIDs = (int *) env->GetPrimitiveArrayCritical(jdocIDs, 0);
+  long *termStats = (long *) env->GetPrimitiveArrayCritical(jtermStats, 0);
+  int *singletonDocIDs = (int *) env->GetPrimitiveArrayCritical(jsingletonDocIDs, 0);
+
+  if (filter != 0) {
+    // Checked per posting, so decode the whole filter:
+    acceptBits = (unsigned char *) malloc((filter->maxDoc >> 3) + 1);
+    if (acceptBits == 0) {
+      failed = true;
+      goto end;
+    }
+    fillFilterBits(filter, liveDocsBytes, acceptBits);
+    liveDocsBytes = acceptBits;
+  }
+
+  // +1 so we never malloc 0 bytes when there are only
+  // singletons:
+  subs = (PostingsState *) calloc(numTerms+1, sizeof(PostingsState));
+  docDeltas = (unsigned int *) malloc((numTerms+1) * BLOCK_SIZE * sizeof(int));
+  heap = (int *) malloc((numTerms+1) * sizeof(int));
+  if (subs == 0 || docDeltas == 0 || heap == 0) {
+    failed = true;
+    goto end;
+  }
+
+  for(int i=0;i<numTerms;i++) {
+    PostingsState *sub = subs + i;
+    sub->docsOnly = (bool) docsOnly;
+    sub->docDeltas = docDeltas + i * BLOCK_SIZE;
+    sub->docsLeft = (int) termStats[2*i];
+    sub->docFreqs = (unsigned char *) (address + termStats[2*i+1]);
+    sub->nextDocID = 0;
+    nextDocFreqBlock(sub);
+    nextMergeDoc(sub);
+    heap[++heapSize] = i;
+  }
+
+  // Heapify:
+  for(int i=heapSize>>1;i>=1;i--) {
+    downMergeHeap(heap, heapSize, subs, i);
+  }
+
+  {
+    int singletonUpto = 0;
+    while (true) {
+      int docID;
+      if (heapSize > 0 && (singletonUpto == numSingletons || subs[heap[1]].nextDocID < singletonDocIDs[singletonUpto])) {
+        PostingsState *sub = subs + heap[1];
+        docID = sub->nextDocID;
+        nextMergeDoc(sub);
+        if (sub->nextDocID == NO_MORE_DOCS) {
+          heap[1] = heap[heapSize--];
+        }
+        if (heapSize > 0) {
+          downMergeHeap(heap, heapSize, subs, 1);
+        }
+      } else if (singletonUpto < numSingletons) {
+        docID = singletonDocIDs[singletonUpto++];
+      } else {
+        break;
+      }
+      if (docID != lastDocID) {
+        lastDocID = docID;
+        if (liveDocsBytes == 0 || isSet(liveDocsBytes, docID)) {
+          docIDs[count++] = docID;
+        }
+      }
+    }
+  }
+
+ end:
+  if (subs != 0) {
+    free(subs);
+  }
+  if (docDeltas != 0) {
+    free(docDeltas);
+  }
+  if (heap != 0) {
+    free(heap);
+  }
+
+  env->ReleasePrimitiveArrayCritical(jsingletonDocIDs, singletonDocIDs, JNI_ABORT);
+  env->ReleasePrimitiveArrayCritical(jtermStats, termStats, JNI_ABORT);
+  env->ReleasePrimitiveArrayCritical(jdocIDs, docIDs, 0);
+  if (jliveDocsBytes != 0) {
+    env->ReleasePrimitiveArrayCritical(jliveDocsBytes, liveDocsArray, JNI_ABORT);
+  }
+  if (acceptBits != 0) {
+    free(acceptBits);
+  }
+
+  if (failed) {
+    jclass c = env->FindClass("java/lang/OutOfMemoryError");
+    env->ThrowNew(c, "failed to allocate temporary memory");
+    return -1;
+  }
+  return count;
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_org_apache_lucene_search_NativeSearch_lookupTerms
+  (JNIEnv *env,
+   jclass cl,
+
+   // Address in memory where .tim file is mapped:
+   jlong timFileAddress,
+
+   // FieldReader.rootBlockFP for the field:
+   jlong rootBlockFP,
+
+   jboolean hasFreqs,
+
+   jboolean hasPositions,
+
+   jboolean hasPayloadsOrOffsets,
+
+   // Handle from newTermStateCache for this segment and
+   // field, or 0 to not use a cache:
+   jlong termStateCache,
+
+   // All terms' bytes, concatenated:
+   jbyteArray jtermBytes,
+
+   // Start of each term in termBytes, plus the end of the
+   // last term:
+   jintArray jtermOffsets,
+
+   // Outputs; docFreq is 0 if the term does not exist:
+   jintArray jdocFreqs,
+   jlongArray jtotalTermFreqs,
+   jlongArray jdocTermStartFPs,
+   jlongArray jposTermStartFPs,
+   jintArray jsingletonDocIDs)
+{
+  bool failed = false;
+  unsigned char *termBytes = 0;
+  int *termOffsets = 0;
+  int *docFreqs = 0;
+  long *totalTermFreqs = 0;
+  long *docTermStartFPs = 0;
+  long *posTermStartFPs = 0;
+  int *singletonDocIDs = 0;
+  int numTerms;
+  int numFound = 0;
+  TermsDict dict;
+  TermMetaData meta;
+  TermStateCache *cache = (TermStateCache *) termStateCache;
+
+  numTerms = env->GetArrayLength(jdocFreqs);
+
+  termBytes = (unsigned char *) env->GetByteArrayElements(jtermBytes, 0);
+  if (termBytes == 0) {
+    failed = true;
+    goto end;
+  }
+  termOffsets = env->GetIntArrayElements(jtermOffsets, 0);
+  if (termOffsets == 0) {
+    failed = true;
+    goto end;
+  }
+  docFreqs = env->GetIntArrayElements(jdocFreqs, 0);
+  if (docFreqs == 0) {
+    failed = true;
+    goto end;
+  }
+  totalTermFreqs = env->GetLongArrayElements(jtotalTermFreqs, 0);
+  if (totalTermFreqs == 0) {
+    failed = true;
+    goto end;
+  }
+  docTermStartFPs = env->GetLongArrayElements(jdocTermStartFPs, 0);
+  if (docTermStartFPs == 0) {
+    failed = true;
+    goto end;
+  }
+  posTermStartFPs = env->GetLongArrayElements(jposTermStartFPs, 0);
+  if (posTermStartFPs == 0) {
+    failed = true;
+    goto end;
+  }
+  singletonDocIDs = env->GetIntArrayElements(jsingletonDocIDs, 0);
+  if (singletonDocIDs == 0) {
+    failed = true;
+    goto end;
+  }
+
+  initTermsDict(&dict, (unsigned char *) timFileAddress, rootBlockFP, hasFreqs, hasPositions, hasPayloadsOrOffsets);
+
+  for(int i=0;i<numTerms;i++) {
+    unsigned char *term = termBytes + termOffsets[i];
+    int termLength = termOffsets[i+1] - termOffsets[i];
+    if (cache == 0 || !getTermStateCache(cache, term, termLength, &meta)) {
+      if (!seekTermsDict(&dict, term, termLength, &meta)) {
+        meta.docFreq = 0;
+      }
+      if (cache != 0) {
+        // Also cache missing terms:
+        putTermStateCache(cache, term, termLength, &meta);
+      }
+    }
+    if (meta.docFreq != 0) {
+      docFreqs[i] = meta.docFreq;
+      totalTermFreqs[i] = meta.totalTermFreq;
+      docTermStartFPs[i] = meta.docStartFP;
+      posTermStartFPs[i] = meta.posStartFP;
+      singletonDocIDs[i] = meta.singletonDocID;
+      numFound++;
+    } else {
+      docFreqs[i] = 0;
+      totalTermFreqs[i] = 0;
+      docTermStartFPs[i] = 0;
+      posTermStartFPs[i] = 0;
+      singletonDocIDs[i] = -1;
+    }
+  }
+
+ end:
+  if (termBytes != 0) {
+    env->ReleaseByteArrayElements(jtermBytes, (jbyte *) termBytes, JNI_ABORT);
+  }
+  if (termOffsets != 0) {
+    env->ReleaseIntArrayElements(jtermOffsets, termOffsets, JNI_ABORT);
+  }
+  if (docFreqs != 0) {
+    env->ReleaseIntArrayElements(jdocFreqs, docFreqs, 0);
+  }
+  if (totalTermFreqs != 0) {
+    env->ReleaseLongArrayElements(jtotalTermFreqs, totalTermFreqs, 0);
+  }
+  if (docTermStartFPs != 0) {
+    env->ReleaseLongArrayElements(jdocTermStartFPs, docTermStartFPs, 0);
+  }
+  if (posTermStartFPs != 0) {
+    env->ReleaseLongArrayElements(jposTermStartFPs, posTermStartFPs, 0);
+  }
+  if (singletonDocIDs != 0) {
+    env->ReleaseIntArrayElements(jsingletonDocIDs, singletonDocIDs, 0);
+  }
+
+  if (failed) {
+    jclass c = env->FindClass("java/lang/OutOfMemoryError");
+    env->ThrowNew(c, "failed to allocate temporary memory");
+    return -1;
+  }
+  return numFound;
+}
+
+// Copies the term stats into a new long[] and frees them,
+// or throws OutOfMemoryError if collecting them failed:
+static jlongArray
+toTermStatsArray(JNIEnv *env, TermStatsList *out, bool failed) {
+  jlongArray result = 0;
+  if (!failed) {
+    // NOTE: if this fails, it already threw OutOfMemoryError
+    result = env->NewLongArray(out->count);
+    if (result != 0) {
+      env->SetLongArrayRegion(result, 0, out->count, (jlong *) out->values);
+    }
+  }
+
+  if (out->values != 0) {
+    free(out->values);
+  }
+
+  if (failed) {
+    jclass c = env->FindClass("java/lang/OutOfMemoryError");
+    env->ThrowNew(c, "failed to allocate temporary memory");
+  }
+  return result;
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_org_apache_lucene_search_NativeSearch_intersectTerms
+  (JNIEnv *env,
+   jclass cl,
+
+   // Address in memory where .tim file is mapped:
+   jlong timFileAddress,
+
+   // FieldReader.rootBlockFP for the field:
+   jlong rootBlockFP,
+
+   jboolean hasFreqs,
+
+   jboolean hasPositions,
+
+   jboolean hasPayloadsOrOffsets,
+
+   // DFA over term bytes: 256 entries per state, -1 for
+   // the dead state:
+   jintArray jtransitions,
+
+   jbooleanArray jaccept,
+
+   jint initialState)
+{
+  TermsDict dict;
+  TermStatsList out;
+  out.values = 0;
+  out.count = 0;
+  out.capacity = 0;
+  bool failed = false;
+
+  int *transitions = (int *) env->GetPrimitiveArrayCritical(jtransitions, 0);
+  unsigned char *accept = (unsigned char *) env->GetPrimitiveArrayCritical(jaccept, 0);
+
+  initTermsDict(&dict, (unsigned char *) timFileAddress, rootBlockFP, hasFreqs, hasPositions, hasPayloadsOrOffsets);
+  if (!intersectTermsDict(&dict, transitions, accept, initialState, &out)) {
+    failed = true;
+  }
+
+  env->ReleasePrimitiveArrayCritical(jaccept, accept, JNI_ABORT);
+  env->ReleasePrimitiveArrayCritical(jtransitions, transitions, JNI_ABORT);
+
+  return toTermStatsArray(env, &out, failed);
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_org_apache_lucene_search_NativeSearch_fuzzyTerms
+  (JNIEnv *env,
+   jclass cl,
+
+   // Address in memory where .tim file is mapped:
+   jlong timFileAddress,
+
+   // FieldReader.rootBlockFP for the field:
+   jlong rootBlockFP,
+
+   jboolean hasFreqs,
+
+   jboolean hasPositions,
+
+   jboolean hasPayloadsOrOffsets,
+
+   // Levenshtein DFAs for 0..maxEdits edits, sharing one
+   // table: 256 entries per state, -1 for the dead state:
+   jintArray jtransitions,
+
+   jbooleanArray jaccept,
+
+   // Initial state of each DFA:
+   jintArray jinitialStates,
+
+   // Set to all matching terms' bytes, concatenated:
+   jobjectArray jtermBytesOut)
+{
+  TermsDict dict;
+  TermStatsList out;
+  out.values = 0;
+  out.count = 0;
+  out.capacity = 0;
+  ByteList termBytes;
+  termBytes.bytes = 0;
+  termBytes.length = 0;
+  termBytes.capacity = 0;
+  bool failed = false;
+  jbyteArray jtermBytes;
+
+  int initialStates[MAX_FUZZY_DFAS];
+  int numDFAs = env->GetArrayLength(jinitialStates);
+  env->GetIntArrayRegion(jinitialStates, 0, numDFAs, initialStates);
+
+  int *transitions = (int *) env->GetPrimitiveArrayCritical(jtransitions, 0);
+  unsigned char *accept = (unsigned char *) env->GetPrimitiveArrayCritical(jaccept, 0);
+
+  initTermsDict(&dict, (unsigned char *) timFileAddress, rootBlockFP, hasFreqs, hasPositions, hasPayloadsOrOffsets);
+  if (!fuzzyTermsDict(&dict, numDFAs, transitions, accept, initialStates, &out, &termBytes)) {
+    failed = true;
+  }
+
+  env->ReleasePrimitiveArrayCritical(jaccept, accept, JNI_ABORT);
+  env->ReleasePrimitiveArrayCritical(jtransitions, transitions, JNI_ABORT);
+
+  if (!failed) {
+    // NOTE: if this fails, it already threw OutOfMemoryError
+    jtermBytes = env->NewByteArray(termBytes.length);
+    if (jtermBytes == 0) {
+      if (termBytes.bytes != 0) {
+        free(termBytes.bytes);
+      }
+      if (out.values != 0) {
+        free(out.values);
+      }
+      return 0;
+    }
+    env->SetByteArrayRegion(jtermBytes, 0, termBytes.length, (jbyte *) termBytes.bytes);
+    env->SetObjectArrayElement(jtermBytesOut, 0, jtermBytes);
+  }
+
+  if (termBytes.bytes != 0) {
+    free(termBytes.bytes);
+  }
+
+  return toTermStatsArray(env, &out, failed);
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_org_apache_lucene_search_NativeSearch_numericRangeTerms
+  (JNIEnv *env,
+   jclass cl,
+
+   // Address in memory where .tim file is mapped:
+   jlong timFileAddress,
+
+   // FieldReader.rootBlockFP for the field:
+   jlong rootBlockFP,
+
+   jboolean hasFreqs,
+
+   jboolean hasPositions,
+
+   jboolean hasPayloadsOrOffsets,
+
+   // 32 for int/float, 64 for long/double:
+   jint valSize,
+
+   jint precisionStep,
+
+   // Inclusive bounds, already converted to sortable
+   // int/long like NumericRangeTermsEnum does:
+   jlong minBound,
+   jlong maxBound)
+{
+  TermsDict dict;
+  TermStatsList out;
+  out.values = 0;
+  out.count = 0;
+  out.capacity = 0;
+
+  initTermsDict(&dict, (unsigned char *) timFileAddress, rootBlockFP, hasFreqs, hasPositions, hasPayloadsOrOffsets);
+  bool failed = !numericRangeTermsDict(&dict, valSize, precisionStep, minBound, maxBound, &out);
+
+  return toTermStatsArray(env, &out, failed);
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_org_apache_lucene_search_NativeSearch_newTermStateCache
+  (JNIEnv *env,
+   jclass cl,
+
+   // Max number of terms to cache; rounded up to a power of
+   // 2 times TERM_CACHE_WAYS:
+   jint maxEntries)
+{
+  TermStateCache *cache = newTermStateCache(maxEntries);
+  if (cache == 0) {
+    jclass c = env->FindClass("java/lang/OutOfMemoryError");
+    env->ThrowNew(c, "failed to allocate term state cache");
+    return 0;
+  }
+  return (jlong) cache;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_org_apache_lucene_search_NativeSearch_freeTermStateCache
+  (JNIEnv *env,
+   jclass cl,
+   jlong termStateCache)
+{
+  freeTermStateCache((TermStateCache *) termStateCache);
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_org_apache_lucene_search_NativeSearch_newFilterBitmap
+  (JNIEnv *env,
+   jclass cl,
+
+   // FixedBitSet's bits for the docs the filter accepts in
+   // this segment:
+   jlongArray jbits,
+
+   // Current segment's maxDoc
+   jint maxDoc)
+{
+  int numWords = env->GetArrayLength(jbits);
+  unsigned long *bits = (unsigned long *) env->GetPrimitiveArrayCritical(jbits, 0);
+  if (bits == 0) {
+    jclass c = env->FindClass("java/lang/OutOfMemoryError");
+    env->ThrowNew(c, "failed to allocate filter bitmap");
+    return 0;
+  }
+  FilterBitmap *filter = newFilterBitmap(bits, numWords, maxDoc);
+  env->ReleasePrimitiveArrayCritical(jbits, bits, JNI_ABORT);
+  if (filter == 0) {
+    jclass c = env->FindClass("java/lang/OutOfMemoryError");
+    env->ThrowNew(c, "failed to allocate filter bitmap");
+    return 0;
+  }
+  return (jlong) filter;
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_org_apache_lucene_search_NativeSearch_getFilterBitmapRamBytesUsed
+  (JNIEnv *env,
+   jclass cl,
+   jlong filterBitmap)
+{
+  return ((FilterBitmap *) filterBitmap)->ramBytesUsed;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_org_apache_lucene_search_NativeSearch_retainFilterBitmap
+  (JNIEnv *env,
+   jclass cl,
+   jlong filterBitmap)
+{
+  retainFilterBitmap((FilterBitmap *) filterBitmap);
+}
+
+// Frees the bitmap once the last reference is released:
+extern "C" JNIEXPORT void JNICALL
+Java_org_apache_lucene_search_NativeSearch_releaseFilterBitmap
+  (JNIEnv *env,
+   jclass cl,
+   jlong filterBitmap)
+{
+  releaseFilterBitmap((FilterBitmap *) filterBitmap);
+}
+
+
+extern "C" JNIEXPORT jint JNICALL
+Java_org_apache_lucene_search_NativeSearch_searchSegmentExactPhraseQuery
   (JNIEnv *env,
    jclass cl,
 
@@ -1480,6 +3145,10 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentExactPhraseQuery
    // Current segment's liveDocs, or null:
    jbyteArray jliveDocsBytes,
 
+   // Handle from newFilterBitmap for the search's cached
+   // filter, or 0:
+   jlong filterBitmap,
+
    // weightValue from each TermWeight:
    jfloat termWeight,
 
@@ -1528,6 +3197,8 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentExactPhraseQuery
   long *posTermStartFPs = 0;
   int *docFreqs = 0;
   unsigned char *liveDocsBytes = 0;
+  FilterBitmap *filter = (FilterBitmap *) filterBitmap;
+  unsigned char *acceptBits = 0;
   unsigned char* norms = 0;
   float *normTable = 0;
   int *topDocIDs = 0;
@@ -1564,18 +3235,322 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentExactPhraseQuery
     docIDs[i] = -1;
   }
 
-  numScorers = env->GetArrayLength(jdocFreqs);
+  numScorers = env->GetArrayLength(jdocFreqs);
+
+  topN = env->GetArrayLength(jtopDocIDs) - 1;
+  //printf("topN=%d\n", topN);
+
+  subs = (PostingsState *) calloc(numScorers, sizeof(PostingsState));
+  if (subs == 0) {
+    failed = true;
+    goto end;
+  }
+  posOffsets = env->GetIntArrayElements(jposOffsets, 0);
+  if (posOffsets == 0) {
+    failed = true;
+    goto end;
+  }
+  singletonDocIDs = env->GetIntArrayElements(jsingletonDocIDs, 0);
+  if (singletonDocIDs == 0) {
+    failed = true;
+    goto end;
+  }
+  totalTermFreqs = env->GetLongArrayElements(jtotalTermFreqs, 0);
+  if (totalTermFreqs == 0) {
+    failed = true;
+    goto end;
+  }
+  docTermStartFPs = env->GetLongArrayElements(jdocTermStartFPs, 0);
+  if (docTermStartFPs == 0) {
+    failed = true;
+    goto end;
+  }
+  posTermStartFPs = env->GetLongArrayElements(jposTermStartFPs, 0);
+  if (posTermStartFPs == 0) {
+    failed = true;
+    goto end;
+  }
+  docFreqs = env->GetIntArrayElements(jdocFreqs, 0);
+  if (docFreqs == 0) {
+    failed = true;
+    goto end;
+  }
+
+  liveDocsBytes;
+  if (jliveDocsBytes == 0) {
+    liveDocsBytes = 0;
+  } else {
+    liveDocsBytes = (unsigned char *) env->GetPrimitiveArrayCritical(jliveDocsBytes, &isCopy);
+    if (liveDocsBytes == 0) {
+      failed = true;
+      goto end;
+    }
+    //printf("liveDocs isCopy=%d\n", isCopy);fflush(stdout);
+  }
+
+  if (filter != 0) {
+    // phraseQuery fills this one chunk at a time:
+    acceptBits = (unsigned char *) malloc((maxDoc >> 3) + 1);
+    if (acceptBits == 0) {
+      failed = true;
+      goto end;
+    }
+  }
+
+  isCopy = 0;
+  norms = (unsigned char *) env->GetPrimitiveArrayCritical(jnorms, &isCopy);
+  if (norms == 0) {
+    failed = true;
+    goto end;
+  }
+
+  isCopy = 0;
+  normTable = (float *) env->GetPrimitiveArrayCritical(jnormTable, &isCopy);
+  if (normTable == 0) {
+    failed = true;
+    goto end;
+  }
+
+  if (!initPhraseSubs(subs, numScorers, singletonDocIDs, totalTermFreqs, docFreqs,
+                      docTermStartFPs, posTermStartFPs, docFileAddress, posFileAddress,
+                      indexHasPayloads, indexHasOffsets)) {
+    failed = true;
+    goto end;
+  }
+
+  // PQ holding top hits:
+  topDocIDs = (int *) env->GetIntArrayElements(jtopDocIDs, 0);
+  if (topDocIDs == 0) {
+    failed = true;
+    goto end;
+  }
+
+  if (jtopScores != 0) {
+    topScores = (float *) env->GetFloatArrayElements(jtopScores, 0);
+    if (topScores == 0) {
+      failed = true;
+      goto end;
+    }
+  } else {
+    topScores = 0;
+  }
+
+  filled = (unsigned int *) malloc(CHUNK * sizeof(int));
+  if (filled == 0) {
+    failed = true;
+    goto end;
+  }
+  termScoreCache = (double *) malloc(TERM_SCORES_CACHE_SIZE*sizeof(double));
+  if (termScoreCache == 0) {
+    failed = true;
+    goto end;
+  }
+  for(int j=0;j<TERM_SCORES_CACHE_SIZE;j++) {
+    termScoreCache[j] = termWeight * sqrt(j);
+  }
+
+  hitCount = phraseQuery(subs,
+                         liveDocsBytes,
+                         filter,
+                         acceptBits,
+                         termScoreCache,
+                         termWeight,
+                         maxDoc,
+                         topN,
+                         numScorers,
+                         docBase,
+                         filled,
+                         docIDs,
+                         coords,
+                         topScores,
+                         topDocIDs,
+                         normTable,
+                         norms,
+                         posOffsets,
+                         0,
+                         0);
+
+  if (hitCount == -1) {
+    failed = true;
+  }
+
+ end:
+  if (acceptBits != 0) {
+    free(acceptBits);
+  }
+  if (norms != 0) {
+    env->ReleasePrimitiveArrayCritical(jnorms, norms, JNI_ABORT);
+  }
+  if (liveDocsBytes != 0) {
+    env->ReleasePrimitiveArrayCritical(jliveDocsBytes, liveDocsBytes, JNI_ABORT);
+  }
+  if (normTable != 0) {
+    env->ReleasePrimitiveArrayCritical(jnormTable, normTable, JNI_ABORT);
+  }
+  if (posOffsets != 0) {
+    env->ReleaseIntArrayElements(jposOffsets, posOffsets, JNI_ABORT);
+  }
+  if (singletonDocIDs != 0) {
+    env->ReleaseIntArrayElements(jsingletonDocIDs, singletonDocIDs, JNI_ABORT);
+  }
+  if (totalTermFreqs != 0) {
+    env->ReleaseLongArrayElements(jtotalTermFreqs, totalTermFreqs, JNI_ABORT);
+  }
+  if (docTermStartFPs != 0) {
+    env->ReleaseLongArrayElements(jdocTermStartFPs, docTermStartFPs, JNI_ABORT);
+  }
+  if (posTermStartFPs != 0) {
+    env->ReleaseLongArrayElements(jposTermStartFPs, posTermStartFPs, JNI_ABORT);
+  }
+  if (docFreqs != 0) {
+    env->ReleaseIntArrayElements(jdocFreqs, docFreqs, JNI_ABORT);
+  }
+  if (topDocIDs != 0) {
+    env->ReleaseIntArrayElements(jtopDocIDs, topDocIDs, 0);
+  }
+  if (topScores != 0) {
+    env->ReleaseFloatArrayElements(jtopScores, topScores, 0);
+  }
+  if (termScoreCache != 0) {
+    free(termScoreCache);
+  }
+  if (filled != 0) {
+    free(filled);
+  }
+  if (docIDs != 0) {
+    free(docIDs);
+  }
+  if (scores != 0) {
+    free(scores);
+  }
+  if (coords != 0) {
+    free(coords);
+  }
+  if (subs != 0) {
+    freePhraseSubs(subs, numScorers);
+  }
+
+  if (failed) {
+    jclass c = env->FindClass("java/lang/OutOfMemoryError");
+    env->ThrowNew(c, "failed to allocate temporary memory");
+    return -1;
+  }
+  return hitCount;
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_org_apache_lucene_search_NativeSearch_searchSegmentSpanQuery
+  (JNIEnv *env,
+   jclass cl,
+
+   // PQ holding top hits so far, pre-filled with sentinel
+   // values: 
+   jintArray jtopDocIDs,
+   jfloatArray jtopScores,
+
+   // Current segment's maxDoc
+   jint maxDoc,
+
+   // Current segment's docBase
+   jint docBase,
+
+   // Current segment's liveDocs, or null:
+   jbyteArray jliveDocsBytes,
+
+   // Handle from newFilterBitmap for the search's cached
+   // filter, or 0:
+   jlong filterBitmap,
+
+   // weightValue from the SpanScorer's docScorer:
+   jfloat spanWeight,
+
+   // Norms for the field (all SpanTermQuery must be against a single field):
+   jbyteArray jnorms,
+
+   // Cache, mapping byte norm -> float
+   jfloatArray jnormTable,
+
+   // Span tree, in pre-order: SPAN_* type of each node
+   jintArray jnodeTypes,
+
+   // Leaf index for SPAN_TERM nodes, slop for SPAN_NEAR_*
+   // nodes:
+   jintArray jnodeArgs,
+
+   // How many child nodes follow each node:
+   jintArray jnodeChildCounts,
+
+   // If the leaf's term has only one docID in this segment
+   // (it was "pulsed") then its set here, else -1:
+   jintArray jsingletonDocIDs,
+
+   jlongArray jtotalTermFreqs,
+
+   // docFreq of each leaf's term, or 0 if it does not occur
+   // in this segment:
+   jintArray jdocFreqs,
+
+   // Offset in the .doc file where this term's docs+freqs begin:
+   jlongArray jdocTermStartFPs,
+
+   // Offset in the .pos file where this term's positions begin:
+   jlongArray jposTermStartFPs,
+
+   // Address in memory where .doc file is mapped:
+   jlong docFileAddress,
+
+   // Address in memory where .pos file is mapped:
+   jlong posFileAddress,
+
+   jboolean indexHasPayloads,
+
+   jboolean indexHasOffsets)
+{
+  bool failed = false;
+  PostingsState *subs = 0;
+  int *nodeTypes = 0;
+  int *nodeArgs = 0;
+  int *nodeChildCounts = 0;
+  int *singletonDocIDs = 0;
+  long *totalTermFreqs = 0;
+  long *docTermStartFPs = 0;
+  long *posTermStartFPs = 0;
+  int *docFreqs = 0;
+  unsigned char *liveDocsBytes = 0;
+  FilterBitmap *filter = (FilterBitmap *) filterBitmap;
+  unsigned char *acceptBits = 0;
+  unsigned char* norms = 0;
+  float *normTable = 0;
+  int *topDocIDs = 0;
+  float *topScores = 0;
+  unsigned char isCopy = 0;
+  int numLeaves;
+  int numNodes;
+  int topN;
+  int hitCount;
+
+  numLeaves = env->GetArrayLength(jdocFreqs);
+  numNodes = env->GetArrayLength(jnodeTypes);
 
   topN = env->GetArrayLength(jtopDocIDs) - 1;
-  //printf("topN=%d\n", topN);
 
-  subs = (PostingsState *) calloc(numScorers, sizeof(PostingsState));
+  subs = (PostingsState *) calloc(numLeaves, sizeof(PostingsState));
   if (subs == 0) {
     failed = true;
     goto end;
   }
-  posOffsets = env->GetIntArrayElements(jposOffsets, 0);
-  if (posOffsets == 0) {
+  nodeTypes = env->GetIntArrayElements(jnodeTypes, 0);
+  if (nodeTypes == 0) {
+    failed = true;
+    goto end;
+  }
+  nodeArgs = env->GetIntArrayElements(jnodeArgs, 0);
+  if (nodeArgs == 0) {
+    failed = true;
+    goto end;
+  }
+  nodeChildCounts = env->GetIntArrayElements(jnodeChildCounts, 0);
+  if (nodeChildCounts == 0) {
     failed = true;
     goto end;
   }
@@ -1605,16 +3580,22 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentExactPhraseQuery
     goto end;
   }
 
-  liveDocsBytes;
-  if (jliveDocsBytes == 0) {
-    liveDocsBytes = 0;
-  } else {
+  if (jliveDocsBytes != 0) {
     liveDocsBytes = (unsigned char *) env->GetPrimitiveArrayCritical(jliveDocsBytes, &isCopy);
     if (liveDocsBytes == 0) {
       failed = true;
       goto end;
     }
-    //printf("liveDocs isCopy=%d\n", isCopy);fflush(stdout);
+  }
+
+  if (filter != 0) {
+    // Checked per posting, so decode the whole filter:
+    acceptBits = (unsigned char *) malloc((maxDoc >> 3) + 1);
+    if (acceptBits == 0) {
+      failed = true;
+      goto end;
+    }
+    fillFilterBits(filter, liveDocsBytes, acceptBits);
   }
 
   isCopy = 0;
@@ -1631,54 +3612,17 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentExactPhraseQuery
     goto end;
   }
 
-  for(int i=0;i<numScorers;i++) {
-    PostingsState *sub = &(subs[i]);
-    sub->indexHasPayloads = indexHasPayloads;
-    sub->indexHasOffsets = indexHasOffsets;
-    sub->docsOnly = false;
-    sub->id = i;
-    //printf("\ninit scorers[%d] of %d\n", i, numScorers);fflush(stdout);
-
-    if (singletonDocIDs[i] != -1) {
-      //printf("  singleton: %d\n", singletonDocIDs[i]);
-      sub->nextDocID = singletonDocIDs[i];
-      sub->docsLeft = 0;
-      sub->docFreqBlockLastRead = 0;
-      sub->docFreqBlockEnd = 0;
-      sub->docDeltas = 0;
-      sub->freqs = (unsigned int *) malloc(sizeof(int));
-      if (sub->freqs == 0) {
-        failed = true;
-        goto end;
-      }
-      sub->freqs[0] = (int) totalTermFreqs[i];
-    } else {
-      sub->docsLeft = docFreqs[i];
-      sub->docDeltas = (unsigned int *) malloc(2*BLOCK_SIZE*sizeof(int));
-      if (sub->docDeltas == 0) {
-        failed = true;
-        goto end;
-      }
-      // Locality seemed to help here:
-      sub->freqs = sub->docDeltas + BLOCK_SIZE;
-      //printf("docFileAddress=%ld startFP=%ld\n", docFileAddress, docTermStartFPs[i]);fflush(stdout);
-      sub->docFreqs = ((unsigned char *) docFileAddress) + docTermStartFPs[i];
-      //printf("  not singleton\n");
-      nextDocFreqBlock(sub);
-      sub->nextDocID = sub->docDeltas[0];
-      //printf("docDeltas[0]=%d\n", sub->docDeltas[0]);
-      sub->docFreqBlockLastRead = 0;
-    }
-    sub->pos = ((unsigned char *) posFileAddress) + posTermStartFPs[i];
-    sub->posLeft = totalTermFreqs[i];
-    sub->posDeltas = (unsigned int *) malloc(BLOCK_SIZE*sizeof(int));
-    if (sub->posDeltas == 0) {
-      failed = true;
-      goto end;
+  if (!initPhraseSubs(subs, numLeaves, singletonDocIDs, totalTermFreqs, docFreqs,
+                      docTermStartFPs, posTermStartFPs, docFileAddress, posFileAddress,
+                      indexHasPayloads, indexHasOffsets)) {
+    failed = true;
+    goto end;
+  }
+  for(int i=0;i<numLeaves;i++) {
+    if (singletonDocIDs[i] == -1 && docFreqs[i] == 0) {
+      // Term does not occur in this segment:
+      subs[i].nextDocID = NO_MORE_DOCS;
     }
-    nextPosBlock(sub);
-    sub->posBlockLastRead = 0;
-    //printf("init i=%d nextDocID=%d freq=%d blockEnd=%d singleton=%d\n", i, sub->nextDocID, sub->nextFreq, sub->blockEnd, singletonDocIDs[i]);fflush(stdout);
   }
 
   // PQ holding top hits:
@@ -1694,46 +3638,32 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentExactPhraseQuery
       failed = true;
       goto end;
     }
-  } else {
-    topScores = 0;
-  }
-
-  filled = (unsigned int *) malloc(CHUNK * sizeof(int));
-  if (filled == 0) {
-    failed = true;
-    goto end;
-  }
-  termScoreCache = (double *) malloc(TERM_SCORES_CACHE_SIZE*sizeof(double));
-  if (termScoreCache == 0) {
-    failed = true;
-    goto end;
-  }
-  for(int j=0;j<TERM_SCORES_CACHE_SIZE;j++) {
-    termScoreCache[j] = termWeight * sqrt(j);
   }
 
-  hitCount = phraseQuery(subs,
-                         liveDocsBytes,
-                         termScoreCache,
-                         termWeight,
-                         maxDoc,
-                         topN,
-                         numScorers,
-                         docBase,
-                         filled,
-                         docIDs,
-                         coords,
-                         topScores,
-                         topDocIDs,
-                         normTable,
-                         norms,
-                         posOffsets);
+  hitCount = spanQuery(subs,
+                       numLeaves,
+                       nodeTypes,
+                       nodeArgs,
+                       nodeChildCounts,
+                       numNodes,
+                       acceptBits != 0 ? acceptBits : liveDocsBytes,
+                       spanWeight,
+                       maxDoc,
+                       topN,
+                       docBase,
+                       topScores,
+                       topDocIDs,
+                       normTable,
+                       norms);
 
   if (hitCount == -1) {
     failed = true;
   }
 
  end:
+  if (acceptBits != 0) {
+    free(acceptBits);
+  }
   if (norms != 0) {
     env->ReleasePrimitiveArrayCritical(jnorms, norms, JNI_ABORT);
   }
@@ -1743,8 +3673,14 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentExactPhraseQuery
   if (normTable != 0) {
     env->ReleasePrimitiveArrayCritical(jnormTable, normTable, JNI_ABORT);
   }
-  if (posOffsets != 0) {
-    env->ReleaseIntArrayElements(jposOffsets, posOffsets, JNI_ABORT);
+  if (nodeTypes != 0) {
+    env->ReleaseIntArrayElements(jnodeTypes, nodeTypes, JNI_ABORT);
+  }
+  if (nodeArgs != 0) {
+    env->ReleaseIntArrayElements(jnodeArgs, nodeArgs, JNI_ABORT);
+  }
+  if (nodeChildCounts != 0) {
+    env->ReleaseIntArrayElements(jnodeChildCounts, nodeChildCounts, JNI_ABORT);
   }
   if (singletonDocIDs != 0) {
     env->ReleaseIntArrayElements(jsingletonDocIDs, singletonDocIDs, JNI_ABORT);
@@ -1767,35 +3703,8 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentExactPhraseQuery
   if (topScores != 0) {
     env->ReleaseFloatArrayElements(jtopScores, topScores, 0);
   }
-  if (termScoreCache != 0) {
-    free(termScoreCache);
-  }
-  if (filled != 0) {
-    free(filled);
-  }
-  if (docIDs != 0) {
-    free(docIDs);
-  }
-  if (scores != 0) {
-    free(scores);
-  }
-  if (coords != 0) {
-    free(coords);
-  }
   if (subs != 0) {
-    for(int i=0;i<numScorers;i++) {
-      PostingsState *sub = &(subs[i]);
-      if (sub->docDeltas != 0) {
-        free(sub->docDeltas);
-      } else if (sub->freqs != 0) {
-        free(sub->freqs);
-      }
-      if (sub->posDeltas != 0) {
-        free(sub->posDeltas);
-      }
-    }
-
-    free(subs);
+    freePhraseSubs(subs, numLeaves);
   }
 
   if (failed) {
@@ -1806,76 +3715,327 @@ Java_org_apache_lucene_search_NativeSearch_searchSegmentExactPhraseQuery
   return hitCount;
 }
 
+// Stops the library's worker threads and sets how many
+// threads, counting the caller's, may run parallel jobs;
+// workers start again on first use:
+extern "C" JNIEXPORT void JNICALL
+Java_org_apache_lucene_search_NativeSearch_setWorkerThreads
+  (JNIEnv *env,
+   jclass cl,
+   jint numThreads)
+{
+  setWorkerThreads(numThreads);
+}
+
 extern "C" JNIEXPORT jint JNICALL
 Java_org_apache_lucene_search_NativeSearch_countFacets
   (JNIEnv *env,
    jclass cl,
 
-   jlongArray jbits,
+   // Each segment's hits (FixedBitSet bits):
+   jobjectArray jbits,
 
-   jint maxDoc,
+   jintArray jmaxDocs,
 
-   jintArray jfacetCounts,
+   // Backing array of each segment's Facet42BinaryDocValues
+   // docToAddress PackedInts.Reader:
+   jobjectArray jdvDocToAddresses,
 
-   jlongArray jdvDocToAddress,
+   // Which PackedInts.Reader implementation each is
+   // (FACET_ADDRESS_*):
+   jintArray jdvAddressFormats,
 
-   jbyteArray jdvFacetBytes)
+   jintArray jdvAddressBitsPerValue,
+
+   // Each segment's Facet42BinaryDocValues bytes, or null
+   // if no doc in the segment has facets:
+   jobjectArray jdvFacetBytes,
+
+   // Handle from newFacetCounts, counting all segments; the
+   // counts are made dense first:
+   jlong facetCountsHandle,
+
+   // Max threads to count with; segments are split into
+   // chunks with about the same total hits:
+   jint maxThreads,
+
+   // Don't bother with a thread for fewer hits than this:
+   jint minHitsPerThread)
 
 {
-  //printf("do natvie search\n");fflush(stdout);
-  unsigned long *bits = 0;
-  unsigned int *facetCounts = 0;
-  unsigned long *dvDocToAddress = 0;
-  unsigned char *dvFacetBytes = 0;
-  unsigned char isCopy = 0;
+  FacetSegment *segments = 0;
+  jobject *arrays = 0;
+  FacetCounts *facetCounts = (FacetCounts *) facetCountsHandle;
   bool failed = false;
-
-  bits = (unsigned long *) env->GetPrimitiveArrayCritical(jbits, &isCopy);
-  if (bits == 0) {
+  int result = 0;
+  int numSegments = env->GetArrayLength(jmaxDocs);
+  int *ints = 0;
+
+  segments = (FacetSegment *) calloc(numSegments, sizeof(FacetSegment));
+  // Each segment's bits, docToAddress and bytes:
+  arrays = (jobject *) calloc(3*numSegments, sizeof(jobject));
+  ints = (int *) malloc(numSegments * sizeof(int));
+  if (segments == 0 || arrays == 0 || ints == 0 || env->EnsureLocalCapacity(3*numSegments) != 0 ||
+      !makeDenseFacetCounts(facetCounts)) {
     failed = true;
     goto end;
   }
 
-  facetCounts = (unsigned int *) env->GetPrimitiveArrayCritical(jfacetCounts, &isCopy);
-  if (facetCounts == 0) {
-    failed = true;
-    goto end;
+  // Copy everything that's not pinned before pinning, since
+  // no other JNI calls may be made while arrays are pinned:
+  env->GetIntArrayRegion(jmaxDocs, 0, numSegments, ints);
+  for(int i=0;i<numSegments;i++) {
+    segments[i].maxDoc = ints[i];
+  }
+  env->GetIntArrayRegion(jdvAddressFormats, 0, numSegments, ints);
+  for(int i=0;i<numSegments;i++) {
+    segments[i].addressFormat = ints[i];
+  }
+  env->GetIntArrayRegion(jdvAddressBitsPerValue, 0, numSegments, ints);
+  for(int i=0;i<numSegments;i++) {
+    segments[i].addressBitsPerValue = ints[i];
+  }
+  for(int i=0;i<numSegments;i++) {
+    arrays[3*i] = env->GetObjectArrayElement(jbits, i);
+    arrays[3*i+1] = env->GetObjectArrayElement(jdvDocToAddresses, i);
+    arrays[3*i+2] = env->GetObjectArrayElement(jdvFacetBytes, i);
   }
 
-  dvDocToAddress = (unsigned long *) env->GetPrimitiveArrayCritical(jdvDocToAddress, &isCopy);
-  if (dvDocToAddress == 0) {
-    failed = true;
-    goto end;
+  for(int i=0;i<numSegments;i++) {
+    FacetSegment *segment = segments + i;
+    if (arrays[3*i+2] == 0) {
+      // No facets in this segment
+      continue;
+    }
+    segment->bits = (unsigned long *) env->GetPrimitiveArrayCritical((jarray) arrays[3*i], 0);
+    if (segment->bits == 0) {
+      failed = true;
+      goto end;
+    }
+    segment->docToAddress = env->GetPrimitiveArrayCritical((jarray) arrays[3*i+1], 0);
+    if (segment->docToAddress == 0) {
+      failed = true;
+      goto end;
+    }
+    segment->facetBytes = (unsigned char *) env->GetPrimitiveArrayCritical((jarray) arrays[3*i+2], 0);
+    if (segment->facetBytes == 0) {
+      failed = true;
+      goto end;
+    }
   }
 
-  dvFacetBytes = (unsigned char *) env->GetPrimitiveArrayCritical(jdvFacetBytes, &isCopy);
-  if (dvFacetBytes == 0) {
+  result = countFacetsParallel(segments, numSegments, facetCounts->dense, facetCounts->numOrds, maxThreads, minHitsPerThread);
+  if (result == -2) {
     failed = true;
-    goto end;
   }
 
-  countFacets(bits, maxDoc, facetCounts, dvDocToAddress, dvFacetBytes);
-
  end:
-
-  if (bits != 0) {
-    env->ReleasePrimitiveArrayCritical(jbits, bits, JNI_ABORT);
+  if (segments != 0) {
+    for(int i=0;i<numSegments;i++) {
+      FacetSegment *segment = segments + i;
+      if (segment->bits != 0) {
+        env->ReleasePrimitiveArrayCritical((jarray) arrays[3*i], segment->bits, JNI_ABORT);
+      }
+      if (segment->docToAddress != 0) {
+        env->ReleasePrimitiveArrayCritical((jarray) arrays[3*i+1], segment->docToAddress, JNI_ABORT);
+      }
+      if (segment->facetBytes != 0) {
+        env->ReleasePrimitiveArrayCritical((jarray) arrays[3*i+2], segment->facetBytes, JNI_ABORT);
+      }
+    }
   }
-  if (facetCounts != 0) {
-    env->ReleasePrimitiveArrayCritical(jfacetCounts, facetCounts, 0);
+  if (segments != 0) {
+    free(segments);
   }
-  if (dvDocToAddress != 0) {
-    env->ReleasePrimitiveArrayCritical(jdvDocToAddress, dvDocToAddress, 0);
+  if (arrays != 0) {
+    free(arrays);
   }
-  if (dvFacetBytes != 0) {
-    env->ReleasePrimitiveArrayCritical(jdvFacetBytes, dvFacetBytes, 0);
+  if (ints != 0) {
+    free(ints);
   }
-  
+
   if (failed) {
     jclass c = env->FindClass("java/lang/OutOfMemoryError");
     env->ThrowNew(c, "failed to allocate temporary memory");
     return -1;
   }
 
-  return 0;
+  return result;
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_org_apache_lucene_search_NativeSearch_newFacetCounts
+  (JNIEnv *env,
+   jclass cl,
+
+   // Taxonomy size:
+   jint numOrds,
+
+   // One of FACET_AGGREGATION_*:
+   jint aggregation)
+{
+  FacetCounts *counts = newFacetCounts(numOrds, aggregation);
+  if (counts == 0) {
+    jclass c = env->FindClass("java/lang/OutOfMemoryError");
+    env->ThrowNew(c, "failed to allocate temporary memory");
+  }
+  return (jlong) counts;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_org_apache_lucene_search_NativeSearch_freeFacetCounts
+  (JNIEnv *env,
+   jclass cl,
+   jlong handle)
+{
+  freeFacetCounts((FacetCounts *) handle);
+}
+
+// Returns the touched (ord, count) pairs, by ord, or null
+// if the counts went dense; sums' counts are float bits:
+extern "C" JNIEXPORT jintArray JNICALL
+Java_org_apache_lucene_search_NativeSearch_getSparseFacetCounts
+  (JNIEnv *env,
+   jclass cl,
+   jlong handle)
+{
+  FacetCounts *counts = (FacetCounts *) handle;
+  if (counts->dense != 0) {
+    return 0;
+  }
+  jintArray result = env->NewIntArray(2*counts->sparse.size);
+  if (result == 0) {
+    return 0;
+  }
+  unsigned int *pairs = (unsigned int *) env->GetPrimitiveArrayCritical(result, 0);
+  if (pairs == 0) {
+    jclass c = env->FindClass("java/lang/OutOfMemoryError");
+    env->ThrowNew(c, "failed to allocate temporary memory");
+    return 0;
+  }
+  getSparseFacetCounts(counts, pairs);
+  env->ReleasePrimitiveArrayCritical(result, pairs, 0);
+  return result;
+}
+
+// Copies dense counts into the int[] indexed by taxonomy
+// ordinal:
+extern "C" JNIEXPORT void JNICALL
+Java_org_apache_lucene_search_NativeSearch_getDenseFacetCounts
+  (JNIEnv *env,
+   jclass cl,
+   jlong handle,
+   jintArray jfacetCounts)
+{
+  FacetCounts *counts = (FacetCounts *) handle;
+  env->SetIntArrayRegion(jfacetCounts, 0, counts->numOrds, (jint *) counts->dense);
+}
+
+// Copies dense sums into the float[] indexed by taxonomy
+// ordinal:
+extern "C" JNIEXPORT void JNICALL
+Java_org_apache_lucene_search_NativeSearch_getDenseFacetValues
+  (JNIEnv *env,
+   jclass cl,
+   jlong handle,
+   jfloatArray jfacetValues)
+{
+  FacetCounts *counts = (FacetCounts *) handle;
+  env->SetFloatArrayRegion(jfacetValues, 0, counts->numOrds, (jfloat *) counts->dense);
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_org_apache_lucene_search_NativeSearch_newTaxonomyArrays
+  (JNIEnv *env,
+   jclass cl,
+
+   // From ParallelTaxonomyArrays:
+   jintArray jparents,
+   jintArray jchildren,
+   jintArray jsiblings)
+{
+  int size = env->GetArrayLength(jparents);
+  TaxonomyArrays *taxonomy = newTaxonomyArrays(size);
+  if (taxonomy == 0) {
+    jclass c = env->FindClass("java/lang/OutOfMemoryError");
+    env->ThrowNew(c, "failed to allocate temporary memory");
+    return 0;
+  }
+  env->GetIntArrayRegion(jparents, 0, size, taxonomy->parents);
+  env->GetIntArrayRegion(jchildren, 0, size, taxonomy->children);
+  env->GetIntArrayRegion(jsiblings, 0, size, taxonomy->siblings);
+  return (jlong) taxonomy;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_org_apache_lucene_search_NativeSearch_freeTaxonomyArrays
+  (JNIEnv *env,
+   jclass cl,
+   jlong handle)
+{
+  freeTaxonomyArrays((TaxonomyArrays *) handle);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_org_apache_lucene_search_NativeSearch_rollupFacetCounts
+  (JNIEnv *env,
+   jclass cl,
+
+   // Handle from newFacetCounts:
+   jlong countsHandle,
+
+   // Handle from newTaxonomyArrays:
+   jlong taxonomyHandle,
+
+   jint rootOrd)
+{
+  if (!rollupFacetCounts((FacetCounts *) countsHandle, (TaxonomyArrays *) taxonomyHandle, rootOrd)) {
+    jclass c = env->FindClass("java/lang/OutOfMemoryError");
+    env->ThrowNew(c, "failed to allocate temporary memory");
+  }
+}
+
+// Returns rootOrd, its count and how many of its children
+// have a positive count, then the top (ord, count)
+// children, by descending count:
+extern "C" JNIEXPORT jintArray JNICALL
+Java_org_apache_lucene_search_NativeSearch_getTopFacetCounts
+  (JNIEnv *env,
+   jclass cl,
+
+   // Handle from newFacetCounts:
+   jlong countsHandle,
+
+   // Handle from newTaxonomyArrays:
+   jlong taxonomyHandle,
+
+   jint rootOrd,
+
+   jint topN)
+{
+  FacetCounts *counts = (FacetCounts *) countsHandle;
+  TaxonomyArrays *taxonomy = (TaxonomyArrays *) taxonomyHandle;
+  if ((unsigned int) topN > taxonomy->size) {
+    topN = taxonomy->size;
+  }
+  if (counts->dense == 0 && (unsigned int) topN > counts->sparse.size) {
+    topN = counts->sparse.size;
+  }
+  unsigned int *pairs = (unsigned int *) malloc((3 + 2*topN) * sizeof(int));
+  if (pairs == 0) {
+    jclass c = env->FindClass("java/lang/OutOfMemoryError");
+    env->ThrowNew(c, "failed to allocate temporary memory");
+    return 0;
+  }
+  pairs[0] = rootOrd;
+  pairs[1] = getFacetCount(counts, rootOrd);
+  int numValid;
+  int length = 3 + 2*getTopFacetCounts(counts, taxonomy, rootOrd, topN, pairs+3, &numValid);
+  pairs[2] = numValid;
+  jintArray result = env->NewIntArray(length);
+  if (result != 0) {
+    env->SetIntArrayRegion(result, 0, length, (jint *) pairs);
+  }
+  free(pairs);
+  return result;
 }
@@ -0,0 +1,361 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Sorting hits by up to MAX_SORT_KEYS numeric fields, score
+// and docID, collected into a PQ of (sort values, docID)
+// instead of (score, docID).  Field values are decoded
+// straight from the segment's mapped .dvd file
+// (Lucene42DocValuesFormat), like facets.cpp decodes its
+// packed addresses, instead of from the Java heap.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+// Big-endian, like DataOutput.writeLong:
+static long
+readLong(unsigned char *p) {
+  unsigned long v = 0;
+  for(int i=0;i<8;i++) {
+    v = (v << 8) | p[i];
+  }
+  return (long) v;
+}
+
+// Same as BlockPackedReaderIterator.readVLong: unlike
+// DataInput.readVLong, the 9th byte holds 8 bits:
+static unsigned long
+readBlockVLong(unsigned char **p) {
+  unsigned char *q = *p;
+  unsigned long v = 0;
+  int shift = 0;
+  for(int i=0;i<8;i++) {
+    unsigned char b = *q++;
+    v |= (unsigned long) (b & 0x7F) << shift;
+    if ((b & 0x80) == 0) {
+      *p = q;
+      return v;
+    }
+    shift += 7;
+  }
+  v |= (unsigned long) *q++ << 56;
+  *p = q;
+  return v;
+}
+
+static inline unsigned long
+valueMask(int bitsPerValue) {
+  return bitsPerValue == 64 ? ~0UL : (1UL << bitsPerValue) - 1;
+}
+
+// PackedInts.Format.PACKED: a big-endian bit stream, padded
+// to a byte; we only read the bytes holding the value so we
+// never run past the end of the mapped file:
+static unsigned long
+decodePacked(unsigned char *packed, long index, int bitsPerValue) {
+  long bitPos = index * bitsPerValue;
+  unsigned char *p = packed + (bitPos >> 3);
+  int bitOffset = bitPos & 7;
+  int numBytes = (bitOffset + bitsPerValue + 7) >> 3;
+
+  unsigned long v = 0;
+  for(int i=0;i<numBytes && i<8;i++) {
+    v = (v << 8) | p[i];
+  }
+  if (numBytes <= 8) {
+    return (v >> ((numBytes << 3) - bitOffset - bitsPerValue)) & valueMask(bitsPerValue);
+  }
+
+  // Value spans 9 bytes:
+  int endBits = bitOffset + bitsPerValue - 64;
+  return ((v << endBits) | (p[8] >> (8 - endBits))) & valueMask(bitsPerValue);
+}
+
+// PackedInts.Format.PACKED_SINGLE_BLOCK: 64/bitsPerValue
+// values per big-endian long, first value in the low bits:
+static unsigned long
+decodePackedSingleBlock(unsigned char *packed, long index, int bitsPerValue) {
+  int valuesPerBlock = 64 / bitsPerValue;
+  unsigned long block = (unsigned long) readLong(packed + ((index / valuesPerBlock) << 3));
+  return (block >> ((index % valuesPerBlock) * bitsPerValue)) & valueMask(bitsPerValue);
+}
+
+// address is where the field's NumericEntry.offset points
+// in the mapped .dvd file, or 0 if no doc in the segment
+// has a value; returns false if we ran out of memory:
+bool
+initNumericDocValues(NumericDocValues *dv, unsigned char *address, int format, int maxDoc) {
+  memset(dv, 0, sizeof(NumericDocValues));
+  if (address == 0) {
+    dv->format = DV_NO_VALUES;
+    return true;
+  }
+  dv->format = format;
+
+  unsigned char *p = address;
+  if (format == DV_UNCOMPRESSED) {
+    dv->packed = p;
+  } else if (format == DV_TABLE_COMPRESSED) {
+    int size = readVInt(&p);
+    dv->table = (long *) malloc(size * sizeof(long));
+    if (dv->table == 0) {
+      return false;
+    }
+    for(int i=0;i<size;i++) {
+      dv->table[i] = readLong(p);
+      p += 8;
+    }
+    // PackedInts.Format.getId():
+    dv->singleBlock = readVInt(&p) == 1;
+    dv->bitsPerValue = readVInt(&p);
+    dv->packed = p;
+  } else {
+    // DV_DELTA_COMPRESSED: a BlockPackedReader; we only
+    // find where each block starts, and decode values as
+    // they are collected:
+    int blockSize = readVInt(&p);
+    dv->blockShift = __builtin_ctz(blockSize);
+    dv->numBlocks = (maxDoc + blockSize - 1) >> dv->blockShift;
+    dv->blockMins = (long *) malloc(dv->numBlocks * sizeof(long));
+    dv->blockBitsPerValue = (unsigned char *) malloc(dv->numBlocks);
+    dv->blockPacked = (unsigned char **) malloc(dv->numBlocks * sizeof(unsigned char *));
+    if (dv->blockMins == 0 || dv->blockBitsPerValue == 0 || dv->blockPacked == 0) {
+      return false;
+    }
+    for(int i=0;i<dv->numBlocks;i++) {
+      // Token is (bitsPerValue << 1) | (min == 0 ? 1 : 0):
+      int token = *p++;
+      int bitsPerValue = token >> 1;
+      long min = 0;
+      if ((token & 1) == 0) {
+        // Zig-zag encoded, minus 1:
+        unsigned long n = 1 + readBlockVLong(&p);
+        min = (long) ((n >> 1) ^ -(n & 1));
+      }
+      dv->blockMins[i] = min;
+      dv->blockBitsPerValue[i] = bitsPerValue;
+      dv->blockPacked[i] = p;
+      if (bitsPerValue != 0) {
+        long count = maxDoc - ((long) i << dv->blockShift);
+        if (count > blockSize) {
+          count = blockSize;
+        }
+        p += (count * bitsPerValue + 7) >> 3;
+      }
+    }
+  }
+
+  return true;
+}
+
+void
+freeNumericDocValues(NumericDocValues *dv) {
+  if (dv->table != 0) {
+    free(dv->table);
+  }
+  if (dv->blockMins != 0) {
+    free(dv->blockMins);
+  }
+  if (dv->blockBitsPerValue != 0) {
+    free(dv->blockBitsPerValue);
+  }
+  if (dv->blockPacked != 0) {
+    free(dv->blockPacked);
+  }
+}
+
+long
+getNumericDocValue(NumericDocValues *dv, int docID) {
+  switch(dv->format) {
+  case DV_UNCOMPRESSED:
+    return (signed char) dv->packed[docID];
+  case DV_TABLE_COMPRESSED:
+    if (dv->singleBlock) {
+      return dv->table[decodePackedSingleBlock(dv->packed, docID, dv->bitsPerValue)];
+    } else {
+      return dv->table[decodePacked(dv->packed, docID, dv->bitsPerValue)];
+    }
+  case DV_DELTA_COMPRESSED:
+    {
+      int block = docID >> dv->blockShift;
+      int bitsPerValue = dv->blockBitsPerValue[block];
+      if (bitsPerValue == 0) {
+        return dv->blockMins[block];
+      }
+      return dv->blockMins[block] + (long) decodePacked(dv->blockPacked[block], docID & ((1 << dv->blockShift) - 1), bitsPerValue);
+    }
+  default:
+    // Same as FieldCache: docs without a value sort as 0:
+    return 0;
+  }
+}
+
+bool
+sortNeedsScores(NumericSort *sort) {
+  for(int i=0;i<sort->numKeys;i++) {
+    if (sort->keyTypes[i] == SORT_KEY_SCORE) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Same as NumericUtils.floatToSortableInt:
+static inline long
+floatToSortableInt(float score) {
+  int bits;
+  memcpy(&bits, &score, sizeof(int));
+  if (bits < 0) {
+    bits ^= 0x7fffffff;
+  }
+  return bits;
+}
+
+// True if hit 1 is less competitive than hit 2; ties go to
+// the lower docID, like TopFieldCollector.  NUM_KEYS is a
+// template parameter so the compiler unrolls the comparator
+// chain for each sort:
+template<int NUM_KEYS>
+static inline bool
+sortLessThan(NumericSort *sort, long *values1, int docID1, long *values2, int docID2) {
+  for(int i=0;i<NUM_KEYS;i++) {
+    if (values1[i] != values2[i]) {
+      return sort->descending[i] ? values1[i] < values2[i] : values1[i] > values2[i];
+    }
+  }
+  return docID1 > docID2;
+}
+
+template<int NUM_KEYS>
+static inline void
+copyValues(long *dest, long *src) {
+  for(int i=0;i<NUM_KEYS;i++) {
+    dest[i] = src[i];
+  }
+}
+
+template<int NUM_KEYS>
+static void
+downHeapSort(int heapSize, int *topDocIDs, NumericSort *sort) {
+  long *topValues = sort->topValues;
+  int i = 1;
+  // save top node
+  int savDocID = topDocIDs[i];
+  long savValues[NUM_KEYS];
+  copyValues<NUM_KEYS>(savValues, topValues + i*NUM_KEYS);
+  int j = i << 1;            // find smaller child
+  int k = j + 1;
+  if (k <= heapSize && sortLessThan<NUM_KEYS>(sort, topValues + k*NUM_KEYS, topDocIDs[k], topValues + j*NUM_KEYS, topDocIDs[j])) {
+    j = k;
+  }
+  while (j <= heapSize && sortLessThan<NUM_KEYS>(sort, topValues + j*NUM_KEYS, topDocIDs[j], savValues, savDocID)) {
+    // shift up child
+    topDocIDs[i] = topDocIDs[j];
+    copyValues<NUM_KEYS>(topValues + i*NUM_KEYS, topValues + j*NUM_KEYS);
+    i = j;
+    j = i << 1;
+    k = j + 1;
+    if (k <= heapSize && sortLessThan<NUM_KEYS>(sort, topValues + k*NUM_KEYS, topDocIDs[k], topValues + j*NUM_KEYS, topDocIDs[j])) {
+      j = k;
+    }
+  }
+  // install saved node
+  topDocIDs[i] = savDocID;
+  copyValues<NUM_KEYS>(topValues + i*NUM_KEYS, savValues);
+}
+
+template<int NUM_KEYS>
+static bool
+sortCollectKeys(NumericSort *sort, int topN, int docBase, int docUpto, unsigned int *filled, int numFilled,
+                unsigned char *skips, float *scores, int *topDocIDs) {
+  long *topValues = sort->topValues;
+  int docChunkBase = docBase + docUpto;
+  long values[NUM_KEYS];
+  for(int i=0;i<numFilled;i++) {
+    int slot = filled[i];
+    if (skips != 0 && skips[slot]) {
+      continue;
+    }
+    int docID = docChunkBase + slot;
+    for(int j=0;j<NUM_KEYS;j++) {
+      switch(sort->keyTypes[j]) {
+      case SORT_KEY_LONG:
+        values[j] = getNumericDocValue(&sort->values[j], docUpto + slot);
+        break;
+      case SORT_KEY_INT:
+        values[j] = (int) getNumericDocValue(&sort->values[j], docUpto + slot);
+        break;
+      case SORT_KEY_SCORE:
+        values[j] = floatToSortableInt(scores[slot]);
+        break;
+      default:
+        values[j] = docID;
+        break;
+      }
+    }
+
+    if (!sortLessThan<NUM_KEYS>(sort, topValues + NUM_KEYS, topDocIDs[1], values, docID)) {
+      // Not competitive, and in a sorted segment neither is
+      // any later doc:
+      if (sort->earlyTerminate) {
+        return true;
+      }
+      continue;
+    }
+
+    if (sort->hasAfter && !sortLessThan<NUM_KEYS>(sort, values, docID, sort->afterValues, sort->afterDocID)) {
+      // Already collected on a previous page
+      continue;
+    }
+
+    topDocIDs[1] = docID;
+    copyValues<NUM_KEYS>(topValues + NUM_KEYS, values);
+    downHeapSort<NUM_KEYS>(topN, topDocIDs, sort);
+
+    if (sort->earlyTerminate && ++sort->segmentHitCount >= topN) {
+      // Every later doc sorts after these topN hits:
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Collects one chunk's hits (slots relative to docUpto);
+// skips, if non-null, marks MUST_NOT matches; scores, if
+// non-null, holds each hit's final score.  Returns true if
+// the caller can stop collecting this segment (only when
+// sort->earlyTerminate):
+bool
+sortCollect(NumericSort *sort, int topN, int docBase, int docUpto, unsigned int *filled, int numFilled,
+            unsigned char *skips, float *scores, int *topDocIDs) {
+  if (sort->earlyTerminate) {
+    // Stopping at the first non-competitive hit is only
+    // safe in docID order, but kernels with several SHOULD
+    // clauses fill slots clause by clause:
+    sortSlots(filled, numFilled);
+  }
+  switch(sort->numKeys) {
+  case 1:
+    return sortCollectKeys<1>(sort, topN, docBase, docUpto, filled, numFilled, skips, scores, topDocIDs);
+  case 2:
+    return sortCollectKeys<2>(sort, topN, docBase, docUpto, filled, numFilled, skips, scores, topDocIDs);
+  default:
+    return sortCollectKeys<3>(sort, topN, docBase, docUpto, filled, numFilled, skips, scores, topDocIDs);
+  }
+}
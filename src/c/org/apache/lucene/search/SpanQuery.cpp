@@ -0,0 +1,552 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+
+typedef struct {
+  // SPAN_TERM, SPAN_OR, SPAN_NEAR_ORDERED or SPAN_NEAR_UNORDERED
+  int type;
+
+  // Leaf index for SPAN_TERM, slop for SPAN_NEAR_*:
+  int arg;
+
+  int numChildren;
+  int *children;
+
+  // Spans of this node in the current doc, in the same
+  // order Lucene's Spans would enumerate them:
+  int *starts;
+  int *ends;
+  int count;
+  int capacity;
+
+  // Cursor into starts/ends, used by the parent:
+  int upto;
+} SpanNode;
+
+static bool
+addSpan(SpanNode *node, int start, int end) {
+  if (node->count == node->capacity) {
+    int newCapacity = node->capacity == 0 ? 16 : 2*node->capacity;
+    int *starts = (int *) realloc(node->starts, newCapacity * sizeof(int));
+    if (starts == 0) {
+      return false;
+    }
+    node->starts = starts;
+    int *ends = (int *) realloc(node->ends, newCapacity * sizeof(int));
+    if (ends == 0) {
+      return false;
+    }
+    node->ends = ends;
+    node->capacity = newCapacity;
+  }
+  node->starts[node->count] = start;
+  node->ends[node->count] = end;
+  node->count++;
+  return true;
+}
+
+// Same as NearSpansOrdered.docSpansOrdered:
+static bool
+spansOrdered(int start1, int end1, int start2, int end2) {
+  if (start1 == start2) {
+    return end1 < end2;
+  } else {
+    return start1 < start2;
+  }
+}
+
+// Nodes arrive in pre-order; returns the index of the next
+// node after this node's subtree:
+static int
+initNode(SpanNode *nodes, int node, int *nodeTypes, int *nodeArgs, int *nodeChildCounts, int *childStore, int *childUpto) {
+  SpanNode *n = nodes + node;
+  n->type = nodeTypes[node];
+  n->arg = nodeArgs[node];
+  n->numChildren = nodeChildCounts[node];
+  n->children = childStore + *childUpto;
+  *childUpto += n->numChildren;
+  int next = node+1;
+  for(int i=0;i<n->numChildren;i++) {
+    n->children[i] = next;
+    next = initNode(nodes, next, nodeTypes, nodeArgs, nodeChildCounts, childStore, childUpto);
+  }
+  return next;
+}
+
+// True if the doc has the terms needed for this node to
+// possibly match:
+static bool
+mayMatch(SpanNode *nodes, int node, unsigned int mask) {
+  SpanNode *n = nodes + node;
+  switch(n->type) {
+  case SPAN_TERM:
+    return (mask & (1U << n->arg)) != 0;
+  case SPAN_OR:
+    for(int i=0;i<n->numChildren;i++) {
+      if (mayMatch(nodes, n->children[i], mask)) {
+        return true;
+      }
+    }
+    return false;
+  default:
+    if (n->numChildren == 0) {
+      return false;
+    }
+    for(int i=0;i<n->numChildren;i++) {
+      if (!mayMatch(nodes, n->children[i], mask)) {
+        return false;
+      }
+    }
+    return true;
+  }
+}
+
+static bool
+termSpans(SpanNode *node, PostingsState *sub, int slot) {
+  skipPositions(sub, sub->tfSums[slot]);
+  unsigned int freq = sub->tfs[slot];
+  unsigned int *posDeltas = sub->posDeltas;
+  int pos = posDeltas[sub->posBlockLastRead];
+  if (!addSpan(node, pos, pos+1)) {
+    return false;
+  }
+  for(unsigned int i=1;i<freq;i++) {
+    if (sub->posBlockLastRead == sub->posBlockEnd) {
+      nextPosBlock(sub);
+      sub->posBlockLastRead = -1;
+    }
+    pos += posDeltas[++sub->posBlockLastRead];
+    if (!addSpan(node, pos, pos+1)) {
+      return false;
+    }
+  }
+  // We are now on the doc's last position:
+  sub->posUpto = sub->tfSums[slot] + freq - 1;
+  return true;
+}
+
+// Like SpanOrQuery's spans: repeatedly takes the smallest
+// head across the sub-spans:
+static bool
+orSpans(SpanNode *nodes, SpanNode *node) {
+  for(int i=0;i<node->numChildren;i++) {
+    nodes[node->children[i]].upto = 0;
+  }
+  while (true) {
+    SpanNode *min = 0;
+    for(int i=0;i<node->numChildren;i++) {
+      SpanNode *sub = nodes + node->children[i];
+      if (sub->upto < sub->count &&
+          (min == 0 || spansOrdered(sub->starts[sub->upto], sub->ends[sub->upto], min->starts[min->upto], min->ends[min->upto]))) {
+        min = sub;
+      }
+    }
+    if (min == 0) {
+      return true;
+    }
+    if (!addSpan(node, min->starts[min->upto], min->ends[min->upto])) {
+      return false;
+    }
+    min->upto++;
+  }
+}
+
+// Port of NearSpansOrdered (stretchToOrder then
+// shrinkToAfterShortestMatch), within one doc:
+static bool
+nearOrderedSpans(SpanNode *nodes, SpanNode *node) {
+  int numChildren = node->numChildren;
+  int slop = node->arg;
+  for(int i=0;i<numChildren;i++) {
+    nodes[node->children[i]].upto = 0;
+  }
+  SpanNode *last = nodes + node->children[numChildren-1];
+
+  while (true) {
+    for(int i=1;i<numChildren;i++) {
+      SpanNode *prev = nodes + node->children[i-1];
+      SpanNode *sub = nodes + node->children[i];
+      while (!spansOrdered(prev->starts[prev->upto], prev->ends[prev->upto], sub->starts[sub->upto], sub->ends[sub->upto])) {
+        if (++sub->upto == sub->count) {
+          // No more matches in this doc
+          return true;
+        }
+      }
+    }
+
+    int matchStart = last->starts[last->upto];
+    int matchEnd = last->ends[last->upto];
+    int matchSlop = 0;
+    int lastStart = matchStart;
+    int lastEnd = matchEnd;
+    bool inSameDoc = true;
+    for(int i=numChildren-2;i>=0;i--) {
+      SpanNode *prev = nodes + node->children[i];
+      int prevStart = prev->starts[prev->upto];
+      int prevEnd = prev->ends[prev->upto];
+      // Advance prev until after (lastStart, lastEnd):
+      while (true) {
+        if (++prev->upto == prev->count) {
+          inSameDoc = false;
+          break;
+        }
+        int ppStart = prev->starts[prev->upto];
+        int ppEnd = prev->ends[prev->upto];
+        if (!spansOrdered(ppStart, ppEnd, lastStart, lastEnd)) {
+          break;
+        }
+        prevStart = ppStart;
+        prevEnd = ppEnd;
+      }
+      if (matchStart > prevEnd) {
+        // Only non overlapping spans add to slop:
+        matchSlop += matchStart - prevEnd;
+      }
+      matchStart = prevStart;
+      lastStart = prevStart;
+      lastEnd = prevEnd;
+    }
+
+    if (matchSlop <= slop && !addSpan(node, matchStart, matchEnd)) {
+      return false;
+    }
+    if (!inSameDoc) {
+      return true;
+    }
+  }
+}
+
+// Port of NearSpansUnordered, within one doc: always
+// advances the smallest sub-span, and matches when the
+// window from the smallest start to the "max" end has at
+// most slop positions not covered by the sub-spans:
+static bool
+nearUnorderedSpans(SpanNode *nodes, SpanNode *node) {
+  int numChildren = node->numChildren;
+  int slop = node->arg;
+  int totalLength = 0;
+  SpanNode *max = 0;
+  for(int i=0;i<numChildren;i++) {
+    SpanNode *sub = nodes + node->children[i];
+    sub->upto = 0;
+    totalLength += sub->ends[0] - sub->starts[0];
+    if (max == 0 || sub->ends[0] > max->ends[max->upto]) {
+      max = sub;
+    }
+  }
+
+  while (true) {
+    SpanNode *min = nodes + node->children[0];
+    for(int i=1;i<numChildren;i++) {
+      SpanNode *sub = nodes + node->children[i];
+      if (spansOrdered(sub->starts[sub->upto], sub->ends[sub->upto], min->starts[min->upto], min->ends[min->upto])) {
+        min = sub;
+      }
+    }
+
+    int matchStart = min->starts[min->upto];
+    int matchEnd = max->ends[max->upto];
+    if (matchEnd - matchStart - totalLength <= slop && !addSpan(node, matchStart, matchEnd)) {
+      return false;
+    }
+
+    totalLength -= min->ends[min->upto] - min->starts[min->upto];
+    if (++min->upto == min->count) {
+      return true;
+    }
+    totalLength += min->ends[min->upto] - min->starts[min->upto];
+    // NOTE: like SpansCell, max only moves when another
+    // sub-span ends later:
+    if (min->ends[min->upto] > max->ends[max->upto]) {
+      max = min;
+    }
+  }
+}
+
+static bool
+computeSpans(SpanNode *nodes, int node, PostingsState *subs, int slot, unsigned int mask) {
+  SpanNode *n = nodes + node;
+  n->count = 0;
+  if (!mayMatch(nodes, node, mask)) {
+    return true;
+  }
+  if (n->type == SPAN_TERM) {
+    return termSpans(n, subs + n->arg, slot);
+  }
+
+  for(int i=0;i<n->numChildren;i++) {
+    if (!computeSpans(nodes, n->children[i], subs, slot, mask)) {
+      return false;
+    }
+  }
+
+  if (n->type == SPAN_OR) {
+    return orSpans(nodes, n);
+  }
+
+  for(int i=0;i<n->numChildren;i++) {
+    if (nodes[n->children[i]].count == 0) {
+      return true;
+    }
+  }
+
+  if (n->numChildren == 1) {
+    // SpanNearQuery just uses the one clause's spans:
+    SpanNode *sub = nodes + n->children[0];
+    for(int i=0;i<sub->count;i++) {
+      if (!addSpan(n, sub->starts[i], sub->ends[i])) {
+        return false;
+      }
+    }
+    return true;
+  } else if (n->type == SPAN_NEAR_ORDERED) {
+    return nearOrderedSpans(nodes, n);
+  } else {
+    return nearUnorderedSpans(nodes, n);
+  }
+}
+
+static int
+leafChunk(PostingsState *sub,
+          unsigned int leafBit,
+          int endDoc,
+          unsigned int *filled,
+          int numFilled,
+          int *docIDs,
+          unsigned int *masks,
+          unsigned char *liveDocsBytes) {
+  int nextDocID = sub->nextDocID;
+  unsigned int *docDeltas = sub->docDeltas;
+  unsigned int *freqs = sub->freqs;
+
+  int blockLastRead = sub->docFreqBlockLastRead;
+  int blockEnd = sub->docFreqBlockEnd;
+  long tfSum = sub->tfSum;
+  unsigned long *tfSums = sub->tfSums;
+  unsigned int *tfs = sub->tfs;
+
+  while (nextDocID < endDoc) {
+    unsigned int freq = freqs[blockLastRead];
+    if (liveDocsBytes == 0 || isSet(liveDocsBytes, nextDocID)) {
+      int slot = nextDocID & MASK;
+      if (docIDs[slot] != nextDocID) {
+        docIDs[slot] = nextDocID;
+        masks[slot] = 0;
+        filled[numFilled++] = slot;
+      }
+      masks[slot] |= leafBit;
+      tfSums[slot] = tfSum;
+      tfs[slot] = freq;
+    }
+
+    tfSum += freq;
+
+    // Inlined nextDoc:
+    if (blockLastRead == blockEnd) {
+      if (sub->docsLeft == 0) {
+        nextDocID = NO_MORE_DOCS;
+        break;
+      } else {
+        nextDocFreqBlock(sub);
+        blockLastRead = -1;
+        blockEnd = sub->docFreqBlockEnd;
+      }
+    }
+    nextDocID += docDeltas[++blockLastRead];
+  }
+
+  sub->tfSum = tfSum;
+  sub->nextDocID = nextDocID;
+  sub->docFreqBlockLastRead = blockLastRead;
+
+  return numFilled;
+}
+
+int spanQuery(PostingsState* subs,
+              int numLeaves,
+              int *nodeTypes,
+              int *nodeArgs,
+              int *nodeChildCounts,
+              int numNodes,
+              unsigned char *liveDocsBytes,
+              float spanWeight,
+              int maxDoc,
+              int topN,
+              int docBase,
+              float *topScores,
+              int *topDocIDs,
+              float *normTable,
+              unsigned char *norms) {
+
+  bool failed = false;
+  SpanNode *nodes = 0;
+  int *childStore = 0;
+  int *docIDs = 0;
+  unsigned int *masks = 0;
+  unsigned int *filled = 0;
+  int hitCount = 0;
+
+  nodes = (SpanNode *) calloc(numNodes, sizeof(SpanNode));
+  if (nodes == 0) {
+    failed = true;
+    goto end;
+  }
+  // Each node is the child of at most one parent:
+  childStore = (int *) malloc(numNodes * sizeof(int));
+  if (childStore == 0) {
+    failed = true;
+    goto end;
+  }
+  {
+    int childUpto = 0;
+    initNode(nodes, 0, nodeTypes, nodeArgs, nodeChildCounts, childStore, &childUpto);
+  }
+
+  docIDs = (int *) malloc(CHUNK * sizeof(int));
+  if (docIDs == 0) {
+    failed = true;
+    goto end;
+  }
+  for(int i=0;i<CHUNK;i++) {
+    docIDs[i] = -1;
+  }
+  masks = (unsigned int *) malloc(CHUNK * sizeof(int));
+  if (masks == 0) {
+    failed = true;
+    goto end;
+  }
+  filled = (unsigned int *) malloc(CHUNK * sizeof(int));
+  if (filled == 0) {
+    failed = true;
+    goto end;
+  }
+
+  for(int i=0;i<numLeaves;i++) {
+    subs[i].tfSum = 0;
+    subs[i].tfSums = (unsigned long *) malloc(CHUNK * sizeof(long));
+    if (subs[i].tfSums == 0) {
+      failed = true;
+      goto end;
+    }
+    subs[i].tfs = (unsigned int *) malloc(CHUNK * sizeof(int));
+    if (subs[i].tfs == 0) {
+      failed = true;
+      goto end;
+    }
+  }
+
+  for(int docUpto=0;docUpto<maxDoc;docUpto+=CHUNK) {
+    int endDoc = docUpto + CHUNK;
+    int numFilled = 0;
+    for(int i=0;i<numLeaves;i++) {
+      numFilled = leafChunk(subs+i, 1U << i, endDoc, filled, numFilled, docIDs, masks, liveDocsBytes);
+    }
+
+    if (numLeaves > 1) {
+      // termSpans can only move each leaf's positions
+      // forward:
+      sortSlots(filled, numFilled);
+    }
+
+    for(int fill=0;fill<numFilled;fill++) {
+      int slot = filled[fill];
+      if (!computeSpans(nodes, 0, subs, slot, masks[slot])) {
+        failed = true;
+        goto end;
+      }
+      SpanNode *root = nodes;
+      if (root->count == 0) {
+        continue;
+      }
+
+      hitCount++;
+
+      int docID = docBase + docIDs[slot];
+
+      // collect
+      if (topScores == 0) {
+        if (docID < topDocIDs[1]) {
+          // Hit is competitive
+          topDocIDs[1] = docID;
+          downHeapNoScores(topN, topDocIDs);
+        }
+      } else {
+        // Same as SpanScorer: each span adds sloppyFreq of
+        // its length:
+        float freq = 0.0f;
+        for(int i=0;i<root->count;i++) {
+          freq += 1.0f / ((root->ends[i] - root->starts[i]) + 1);
+        }
+        float score = ((float) sqrt(freq)) * spanWeight;
+        score *= normTable[norms[docIDs[slot]]];
+
+        if (score > topScores[1] || (score == topScores[1] && docID < topDocIDs[1])) {
+          // Hit is competitive
+          topDocIDs[1] = docID;
+          topScores[1] = score;
+
+          downHeap(topN, topDocIDs, topScores);
+        }
+      }
+    }
+  }
+
+ end:
+  if (nodes != 0) {
+    for(int i=0;i<numNodes;i++) {
+      if (nodes[i].starts != 0) {
+        free(nodes[i].starts);
+      }
+      if (nodes[i].ends != 0) {
+        free(nodes[i].ends);
+      }
+    }
+    free(nodes);
+  }
+  if (childStore != 0) {
+    free(childStore);
+  }
+  if (docIDs != 0) {
+    free(docIDs);
+  }
+  if (masks != 0) {
+    free(masks);
+  }
+  if (filled != 0) {
+    free(filled);
+  }
+  for(int i=0;i<numLeaves;i++) {
+    if (subs[i].tfSums != 0) {
+      free(subs[i].tfSums);
+    }
+    if (subs[i].tfs != 0) {
+      free(subs[i].tfs);
+    }
+  }
+
+  if (failed) {
+    return -1;
+  } else {
+    return hitCount;
+  }
+}
@@ -0,0 +1,160 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Bounded cache of term metadata for one segment and
+// field, shared by all searching threads.
+//
+// Entries live in sets of TERM_CACHE_WAYS slots; a term can
+// only be in the set its hash selects, and each set evicts
+// with its own CLOCK hand.  Readers never lock: each entry
+// is a seqlock (version is odd while a writer updates it),
+// so a reader that races with a writer just sees a miss.
+// Writers take a try-lock, and simply don't cache the term
+// if another thread holds it.
+//
+// NOTE: relies on x86's ordering of plain loads and stores,
+// like the rest of this code; only compiler barriers are
+// needed on the read side.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+#define compilerBarrier() __asm__ __volatile__("" ::: "memory")
+
+static unsigned int
+hashTerm(unsigned char *term, int termLength) {
+  // FNV-1a:
+  unsigned int hash = 2166136261U;
+  for(int i=0;i<termLength;i++) {
+    hash ^= term[i];
+    hash *= 16777619U;
+  }
+  // 0 marks an empty entry:
+  return hash == 0 ? 1 : hash;
+}
+
+TermStateCache *
+newTermStateCache(int maxEntries) {
+  unsigned int numSets = 1;
+  while (numSets * TERM_CACHE_WAYS < (unsigned int) maxEntries) {
+    numSets *= 2;
+  }
+  TermStateCache *cache = (TermStateCache *) malloc(sizeof(TermStateCache));
+  if (cache == 0) {
+    return 0;
+  }
+  cache->numSets = numSets;
+  cache->writeLock = 0;
+  cache->hands = (unsigned char *) calloc(numSets, sizeof(char));
+  cache->entries = (TermStateCacheEntry *) calloc(numSets * TERM_CACHE_WAYS, sizeof(TermStateCacheEntry));
+  if (cache->hands == 0 || cache->entries == 0) {
+    freeTermStateCache(cache);
+    return 0;
+  }
+  return cache;
+}
+
+void
+freeTermStateCache(TermStateCache *cache) {
+  if (cache->hands != 0) {
+    free(cache->hands);
+  }
+  if (cache->entries != 0) {
+    free(cache->entries);
+  }
+  free(cache);
+}
+
+bool
+getTermStateCache(TermStateCache *cache, unsigned char *term, int termLength, TermMetaData *meta) {
+  if (termLength > TERM_CACHE_MAX_TERM_LENGTH) {
+    return false;
+  }
+  unsigned int hash = hashTerm(term, termLength);
+  TermStateCacheEntry *entry = cache->entries + (hash & (cache->numSets-1)) * TERM_CACHE_WAYS;
+  for(int way=0;way<TERM_CACHE_WAYS;way++,entry++) {
+    unsigned int version = entry->version;
+    if ((version & 1) != 0) {
+      // Being written
+      continue;
+    }
+    compilerBarrier();
+    if (entry->hash != hash || entry->termLength != termLength || memcmp(entry->term, term, termLength) != 0) {
+      continue;
+    }
+    TermMetaData copy = entry->meta;
+    compilerBarrier();
+    if (entry->version != version) {
+      // A writer replaced the entry while we read it
+      continue;
+    }
+    entry->referenced = 1;
+    *meta = copy;
+    return true;
+  }
+  return false;
+}
+
+void
+putTermStateCache(TermStateCache *cache, unsigned char *term, int termLength, TermMetaData *meta) {
+  if (termLength > TERM_CACHE_MAX_TERM_LENGTH) {
+    return;
+  }
+  if (!__sync_bool_compare_and_swap(&cache->writeLock, 0, 1)) {
+    // Another thread is inserting; don't wait for it
+    return;
+  }
+
+  unsigned int hash = hashTerm(term, termLength);
+  unsigned int set = hash & (cache->numSets-1);
+  TermStateCacheEntry *entries = cache->entries + set * TERM_CACHE_WAYS;
+
+  TermStateCacheEntry *entry = 0;
+  for(int way=0;way<TERM_CACHE_WAYS;way++) {
+    if (entries[way].hash == 0 ||
+        (entries[way].hash == hash && entries[way].termLength == termLength && memcmp(entries[way].term, term, termLength) == 0)) {
+      // Empty, or another thread already cached this term:
+      entry = entries + way;
+      break;
+    }
+  }
+
+  if (entry == 0) {
+    // CLOCK: give each referenced entry a second chance
+    int hand = cache->hands[set];
+    while (entries[hand].referenced) {
+      entries[hand].referenced = 0;
+      hand = (hand+1) % TERM_CACHE_WAYS;
+    }
+    entry = entries + hand;
+    cache->hands[set] = (hand+1) % TERM_CACHE_WAYS;
+  }
+
+  entry->version++;
+  __sync_synchronize();
+  entry->hash = hash;
+  entry->termLength = termLength;
+  memcpy(entry->term, term, termLength);
+  entry->meta = *meta;
+  entry->referenced = 0;
+  __sync_synchronize();
+  entry->version++;
+
+  __sync_lock_release(&cache->writeLock);
+}
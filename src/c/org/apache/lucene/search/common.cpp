@@ -16,7 +16,13 @@
  */
 
 #include <byteswap.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "common.h"
 
 static unsigned char readByte(unsigned char **p) {
@@ -24,7 +30,7 @@ static unsigned char readByte(unsigned char **p) {
   return *(*p)++;
 }
 
-static unsigned int readVInt(unsigned char **p) {
+unsigned int readVInt(unsigned char **p) {
   char b = (char) readByte(p);
   if (b >= 0) return b;
   unsigned int i = b & 0x7F;
@@ -42,6 +48,16 @@ static unsigned int readVInt(unsigned char **p) {
   return i | ((b & 0x0F) << 28);
 }
 
+unsigned long readVLong(unsigned char **p) {
+  unsigned char b = readByte(p);
+  unsigned long l = b & 0x7F;
+  for(int shift=7;(b & 0x80) != 0;shift+=7) {
+    b = readByte(p);
+    l |= ((unsigned long) (b & 0x7F)) << shift;
+  }
+  return l;
+}
+
 static void decodeSingleBlock1(unsigned long *blocks, unsigned int *values) {
   int valuesOffset = 0;
   long mask = 1;
@@ -2534,6 +2550,143 @@ bool isSet(unsigned char *bits, unsigned int docID) {
   return x;
 }
 
+// True if no doc in [docUpto, docUpto+CHUNK) is set, so a
+// kernel can skip the whole chunk:
+bool isChunkEmpty(unsigned char *bits, int docUpto, int maxDoc) {
+  int endDoc = docUpto + CHUNK;
+  if (endDoc > maxDoc) {
+    endDoc = maxDoc;
+  }
+  unsigned char *p = bits + (docUpto >> 3);
+  unsigned char *end = bits + ((endDoc + 7) >> 3);
+  while (p + 8 <= end) {
+    unsigned long word;
+    memcpy(&word, p, 8);
+    if (word != 0) {
+      return false;
+    }
+    p += 8;
+  }
+  while (p < end) {
+    if (*p++ != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Drops the slots in filled (docs of the chunk starting at
+// docUpto) whose bit is clear in bits, checking each against
+// the chunk's 16 words once, instead of checking every
+// clause's postings; returns the new numFilled:
+int andChunkBits(unsigned char *bits, int docUpto, int maxDoc, unsigned int *filled, int numFilled) {
+  unsigned long words[CHUNK/64];
+  // Last chunk may be partial:
+  int numBytes = ((maxDoc >> 3) + 1) - (docUpto >> 3);
+  if (numBytes > CHUNK/8) {
+    numBytes = CHUNK/8;
+  }
+  memset(words, 0, sizeof(words));
+  memcpy(words, bits + (docUpto >> 3), numBytes);
+
+  // A chunk with every doc set keeps all slots:
+#ifdef __SSE2__
+  const __m128i ones = _mm_set1_epi32(-1);
+  __m128i all = ones;
+  for(int i=0;i<CHUNK/64;i+=2) {
+    all = _mm_and_si128(all, _mm_loadu_si128((__m128i *) (words + i)));
+  }
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(all, ones)) == 0xFFFF) {
+    return numFilled;
+  }
+#else
+  unsigned long all = ~0UL;
+  for(int i=0;i<CHUNK/64;i++) {
+    all &= words[i];
+  }
+  if (all == ~0UL) {
+    return numFilled;
+  }
+#endif
+
+  int upto = 0;
+  for(int i=0;i<numFilled;i++) {
+    unsigned int slot = filled[i];
+    // Branch free: always write, only advance if it's set:
+    filled[upto] = slot;
+    upto += (words[slot >> 6] >> (slot & 63)) & 1;
+  }
+  return upto;
+}
+
+// ANDs the CHUNK/64 words of src into dest; returns false
+// if no bit of dest is left set:
+bool andChunkWords(unsigned long *dest, unsigned long *src) {
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  __m128i any = zero;
+  for(int i=0;i<CHUNK/64;i+=2) {
+    __m128i x = _mm_and_si128(_mm_loadu_si128((__m128i *) (dest + i)), _mm_loadu_si128((__m128i *) (src + i)));
+    _mm_storeu_si128((__m128i *) (dest + i), x);
+    any = _mm_or_si128(any, x);
+  }
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)) != 0xFFFF;
+#else
+  unsigned long any = 0;
+  for(int i=0;i<CHUNK/64;i++) {
+    dest[i] &= src[i];
+    any |= dest[i];
+  }
+  return any != 0;
+#endif
+}
+
+// Sorts filled (distinct slots of one chunk) into docID
+// order; kernels that OR several clauses append each
+// clause's new slots after the earlier clauses':
+void sortSlots(unsigned int *filled, int numFilled) {
+  unsigned long words[CHUNK/64];
+  memset(words, 0, sizeof(words));
+  for(int i=0;i<numFilled;i++) {
+    unsigned int slot = filled[i];
+    words[slot >> 6] |= 1UL << (slot & 63);
+  }
+  int upto = 0;
+  for(int i=0;i<CHUNK/64;i++) {
+    unsigned long word = words[i];
+    while (word != 0) {
+      filled[upto++] = (i << 6) + __builtin_ctzl(word);
+      word &= word - 1;
+    }
+  }
+}
+
+void skipChunk(PostingsState *sub, int endDoc) {
+  int nextDocID = sub->nextDocID;
+  unsigned int *docDeltas = sub->docDeltas;
+
+  int blockLastRead = sub->docFreqBlockLastRead;
+  int blockEnd = sub->docFreqBlockEnd;
+
+  while (nextDocID < endDoc) {
+    // Inlined nextDoc:
+    if (blockLastRead == blockEnd) {
+      if (sub->docsLeft == 0) {
+        nextDocID = NO_MORE_DOCS;
+        break;
+      } else {
+        nextDocFreqBlock(sub);
+        blockLastRead = -1;
+        blockEnd = sub->docFreqBlockEnd;
+      }
+    }
+    nextDocID += docDeltas[++blockLastRead];
+  }
+
+  sub->nextDocID = nextDocID;
+  sub->docFreqBlockLastRead = blockLastRead;
+}
+
 void setLongBit(unsigned long *bits, unsigned int index) {
   int wordNum = index >> 6;      // div 64
   int bit = index & 0x3f;     // mod 64
@@ -2541,3 +2694,182 @@ void setLongBit(unsigned long *bits, unsigned int index) {
   bits[wordNum] |= bitmask;
 }
 
+
+// One runJobs call's jobs; workers and the calling thread
+// each take the next unclaimed job until all are claimed:
+typedef struct JobBatch {
+  unsigned char *jobs;
+  int jobSize;
+  int numJobs;
+  void *(*fn)(void *);
+  // Guarded by pool.lock:
+  int nextJob;
+  int numDone;
+  pthread_cond_t done;
+  struct JobBatch *next;
+} JobBatch;
+
+// Worker threads owned by the library, started on first use
+// and stopped by setWorkerThreads, so searches don't pay a
+// pthread_create/join per call:
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  // Batches with unclaimed jobs, oldest first:
+  JobBatch *head;
+  JobBatch *tail;
+  pthread_t *threads;
+  int numThreads;
+  // How many workers to start on first use:
+  int targetThreads;
+  bool stopping;
+} pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, 0, 0, false};
+
+// Serializes setWorkerThreads:
+static pthread_mutex_t poolConfigLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Claims the oldest batch's next job; pool.lock must be
+// held.  Returns 0 if no job is unclaimed:
+static JobBatch *
+claimJob(int *job) {
+  JobBatch *batch = pool.head;
+  if (batch == 0) {
+    return 0;
+  }
+  *job = batch->nextJob++;
+  if (batch->nextJob == batch->numJobs) {
+    pool.head = batch->next;
+    if (pool.head == 0) {
+      pool.tail = 0;
+    }
+  }
+  return batch;
+}
+
+// Runs the claimed job and, if it was the batch's last,
+// wakes the thread waiting in runJobs; pool.lock must be
+// held, and is released while the job runs:
+static void
+runClaimedJob(JobBatch *batch, int job) {
+  pthread_mutex_unlock(&pool.lock);
+  batch->fn(batch->jobs + job * batch->jobSize);
+  pthread_mutex_lock(&pool.lock);
+  if (++batch->numDone == batch->numJobs) {
+    pthread_cond_signal(&batch->done);
+  }
+}
+
+static void *
+workerThread(void *arg) {
+  pthread_mutex_lock(&pool.lock);
+  while (true) {
+    int job;
+    JobBatch *batch = claimJob(&job);
+    if (batch != 0) {
+      runClaimedJob(batch, job);
+    } else if (pool.stopping) {
+      break;
+    } else {
+      pthread_cond_wait(&pool.work, &pool.lock);
+    }
+  }
+  pthread_mutex_unlock(&pool.lock);
+  return 0;
+}
+
+// Starts the workers if they aren't running; pool.lock must
+// be held.  Workers that fail to start are simply missing,
+// since the calling thread also runs jobs:
+static void
+startWorkers() {
+  if (pool.threads != 0 || pool.stopping || pool.targetThreads == 0) {
+    return;
+  }
+  pool.threads = (pthread_t *) malloc(pool.targetThreads * sizeof(pthread_t));
+  if (pool.threads == 0) {
+    return;
+  }
+  pool.numThreads = 0;
+  for(int t=0;t<pool.targetThreads;t++) {
+    if (pthread_create(pool.threads + pool.numThreads, 0, workerThread, 0) == 0) {
+      pool.numThreads++;
+    }
+  }
+}
+
+void
+setWorkerThreads(int numThreads) {
+  pthread_mutex_lock(&poolConfigLock);
+
+  // Stop the current workers; they first finish any queued
+  // jobs:
+  pthread_mutex_lock(&pool.lock);
+  pool.stopping = true;
+  pthread_t *threads = pool.threads;
+  int numOldThreads = pool.numThreads;
+  pthread_cond_broadcast(&pool.work);
+  pthread_mutex_unlock(&pool.lock);
+
+  for(int t=0;t<numOldThreads;t++) {
+    pthread_join(threads[t], 0);
+  }
+
+  pthread_mutex_lock(&pool.lock);
+  if (threads != 0) {
+    free(threads);
+  }
+  pool.threads = 0;
+  pool.numThreads = 0;
+  pool.targetThreads = numThreads > 1 ? numThreads-1 : 0;
+  pool.stopping = false;
+  pthread_mutex_unlock(&pool.lock);
+
+  pthread_mutex_unlock(&poolConfigLock);
+}
+
+void
+runJobs(void *jobs, int jobSize, int numJobs, void *(*fn)(void *)) {
+  unsigned char *jobBytes = (unsigned char *) jobs;
+  if (numJobs == 1) {
+    fn(jobBytes);
+    return;
+  }
+
+  JobBatch batch;
+  batch.jobs = jobBytes;
+  batch.jobSize = jobSize;
+  batch.numJobs = numJobs;
+  batch.fn = fn;
+  batch.nextJob = 0;
+  batch.numDone = 0;
+  batch.next = 0;
+  if (pthread_cond_init(&batch.done, 0) != 0) {
+    for(int t=0;t<numJobs;t++) {
+      fn(jobBytes + t * jobSize);
+    }
+    return;
+  }
+
+  pthread_mutex_lock(&pool.lock);
+  startWorkers();
+  if (pool.tail == 0) {
+    pool.head = &batch;
+  } else {
+    pool.tail->next = &batch;
+  }
+  pool.tail = &batch;
+  pthread_cond_broadcast(&pool.work);
+
+  // Help with our own jobs (and any queued before them), so
+  // we finish even if no worker is free:
+  while (batch.nextJob < numJobs) {
+    int job;
+    JobBatch *claimed = claimJob(&job);
+    runClaimedJob(claimed, job);
+  }
+  while (batch.numDone < numJobs) {
+    pthread_cond_wait(&batch.done, &pool.lock);
+  }
+  pthread_mutex_unlock(&pool.lock);
+  pthread_cond_destroy(&batch.done);
+}
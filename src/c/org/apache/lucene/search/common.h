@@ -66,7 +66,379 @@ typedef struct {
   int id;
 } PostingsState;
 
+// One field of a segment's BlockTree terms dict (.tim),
+// with Lucene41PostingsFormat term metadata:
+typedef struct {
+  // Where (mapped in RAM) the .tim file starts:
+  unsigned char *tim;
+
+  // FieldReader.rootBlockFP
+  long rootBlockFP;
+
+  bool hasFreqs;
+  bool hasPositions;
+  bool hasPayloadsOrOffsets;
+
+  // Last seeked term and the last block it visited, so a
+  // following larger term with the same block prefix can
+  // skip the descent from the root; the caller must keep
+  // lastTerm's bytes alive between seeks:
+  unsigned char *lastTerm;
+  int lastTermLength;
+  long lastBlockFP;
+  int lastPrefixLength;
+} TermsDict;
+
+// Same as Lucene41PostingsReader's IntBlockTermState:
+typedef struct {
+  int docFreq;
+  long totalTermFreq;
+  long docStartFP;
+  long posStartFP;
+  int singletonDocID;
+} TermMetaData;
+
+// exported from BlockTreeTermsReader.cpp:
+void initTermsDict(TermsDict *dict, unsigned char *tim, long rootBlockFP, bool hasFreqs, bool hasPositions, bool hasPayloadsOrOffsets);
+bool seekTermsDict(TermsDict *dict, unsigned char *term, int termLength, TermMetaData *meta);
+
+// Growable list of (docFreq, docStartFP) pairs, one per
+// term; for docFreq=1 terms the docID replaces docStartFP:
+typedef struct {
+  long *values;
+  int count;
+  int capacity;
+} TermStatsList;
+
+// Visits all terms accepted by the DFA (transitions has 256
+// entries per state, -1 for the dead state), in order:
+bool intersectTermsDict(TermsDict *dict, int *transitions, unsigned char *accept, int initialState, TermStatsList *out);
+
+// Visits all terms of a NumericRangeQuery: minBound and
+// maxBound are inclusive, already in sortable form (e.g.
+// NumericUtils.doubleToSortableLong), and valSize is 32 or
+// 64; returns false if malloc failed:
+bool numericRangeTermsDict(TermsDict *dict, int valSize, int precisionStep, long minBound, long maxBound, TermStatsList *out);
+
+typedef struct {
+  unsigned char *bytes;
+  int length;
+  int capacity;
+} ByteList;
+
+// LevenshteinAutomata.MAXIMUM_SUPPORTED_DISTANCE + 1:
+#define MAX_FUZZY_DFAS 3
+
+// fuzzyTermsDict adds (editDistance, termLength, docFreq,
+// totalTermFreq, docStartFP or singleton docID) per term:
+#define FUZZY_TERM_STATS 5
+
+// Visits all terms accepted by the last DFA, which must
+// accept a superset of the earlier ones (e.g. Levenshtein
+// DFAs for 0, 1, 2 edits, sharing one transitions table);
+// each term's edit distance is the first DFA accepting it.
+// Term bytes are appended to termBytes:
+bool fuzzyTermsDict(TermsDict *dict, int numDFAs, int *transitions, unsigned char *accept, int *initialStates,
+                    TermStatsList *out, ByteList *termBytes);
+
+#define TERM_CACHE_WAYS 8
+
+// Longer terms are never cached:
+#define TERM_CACHE_MAX_TERM_LENGTH 48
+
+typedef struct {
+  // Odd while a writer is updating the entry:
+  volatile unsigned int version;
+
+  // 0 if the entry is empty:
+  unsigned int hash;
+
+  // CLOCK bit, set on each hit:
+  volatile unsigned char referenced;
+
+  unsigned char termLength;
+  unsigned char term[TERM_CACHE_MAX_TERM_LENGTH];
+
+  // docFreq is 0 if the term does not exist:
+  TermMetaData meta;
+} TermStateCacheEntry;
+
+typedef struct {
+  // Always a power of 2:
+  unsigned int numSets;
+
+  // Only held while inserting:
+  volatile int writeLock;
+
+  // CLOCK hand, per set:
+  unsigned char *hands;
+
+  TermStateCacheEntry *entries;
+} TermStateCache;
+
+// exported from TermStateCache.cpp:
+TermStateCache *newTermStateCache(int maxEntries);
+void freeTermStateCache(TermStateCache *cache);
+bool getTermStateCache(TermStateCache *cache, unsigned char *term, int termLength, TermMetaData *meta);
+void putTermStateCache(TermStateCache *cache, unsigned char *term, int termLength, TermMetaData *meta);
+
+// Docs per filter container (docID >> 16 selects the
+// container):
+#define FILTER_CONTAINER_BITS 16
+
+#define FILTER_ARRAY_CONTAINER 0
+#define FILTER_BITMAP_CONTAINER 1
+#define FILTER_RUN_CONTAINER 2
+
+typedef struct {
+  unsigned char type;
+
+  // Array: number of values; run: number of runs; bitmap:
+  // unused:
+  unsigned int count;
+
+  // Array: sorted low 16 bits of each doc; run: (start,
+  // length-1) pairs, sorted by start:
+  unsigned short *values;
+
+  // Bitmap: 1024 words:
+  unsigned long *words;
+} FilterContainer;
+
+// Roaring-style compressed docs accepted by a cached filter
+// for one segment (not ANDed with liveDocs):
+typedef struct {
+  // The cache holds one reference, and each search using
+  // the bitmap another:
+  volatile int refCount;
+
+  int maxDoc;
+  int numContainers;
+  FilterContainer *containers;
+  long ramBytesUsed;
+} FilterBitmap;
+
+// exported from FilterBitmap.cpp:
+FilterBitmap *newFilterBitmap(unsigned long *words, int numWords, int maxDoc);
+void retainFilterBitmap(FilterBitmap *filter);
+void releaseFilterBitmap(FilterBitmap *filter);
+bool fillFilterChunk(FilterBitmap *filter, unsigned char *liveDocsBytes, unsigned char *acceptBits, int docUpto);
+void fillFilterBits(FilterBitmap *filter, unsigned char *liveDocsBytes, unsigned char *acceptBits);
+
+// Same as Lucene42DocValuesConsumer's numeric formats:
+#define DV_DELTA_COMPRESSED 0
+#define DV_TABLE_COMPRESSED 1
+#define DV_UNCOMPRESSED 2
+
+// No doc in the segment has a value:
+#define DV_NO_VALUES -1
+
+// One segment's Lucene42 numeric DocValues, pointing into
+// the mapped .dvd file:
+typedef struct {
+  int format;
+
+  // UNCOMPRESSED: one signed byte per doc; TABLE_COMPRESSED:
+  // packed ords into table:
+  unsigned char *packed;
+  int bitsPerValue;
+  // PackedInts.Format.PACKED_SINGLE_BLOCK, else PACKED:
+  bool singleBlock;
+  long *table;
+
+  // DELTA_COMPRESSED, per block of 1<<blockShift docs:
+  int blockShift;
+  int numBlocks;
+  long *blockMins;
+  unsigned char *blockBitsPerValue;
+  unsigned char **blockPacked;
+} NumericDocValues;
+
+// At most this many SortFields:
+#define MAX_SORT_KEYS 3
+
+// Same as NativeSearch.SORT_KEY_*:
+#define SORT_KEY_LONG 0
+#define SORT_KEY_INT 1
+#define SORT_KEY_SCORE 2
+#define SORT_KEY_DOC 3
+
+// Sorts hits by up to MAX_SORT_KEYS numeric DocValues
+// fields, score and docID:
+typedef struct {
+  int numKeys;
+  int keyTypes[MAX_SORT_KEYS];
+
+  // True if higher values sort first (SCORE, unless
+  // reversed):
+  bool descending[MAX_SORT_KEYS];
+
+  // Only for SORT_KEY_LONG and SORT_KEY_INT keys:
+  NumericDocValues values[MAX_SORT_KEYS];
+
+  // numKeys sort values for each hit in the PQ, parallel to
+  // topDocIDs; scores are stored as
+  // NumericUtils.floatToSortableInt:
+  long *topValues;
+
+  // searchAfter: only hits that sort after this one are
+  // collected:
+  bool hasAfter;
+  long afterValues[MAX_SORT_KEYS];
+  int afterDocID;
+
+  // The caller declared the segment's docID order matches
+  // the sort, so once topN of its hits were collected (or
+  // one was not competitive) no later doc can compete:
+  bool earlyTerminate;
+  int segmentHitCount;
+} NumericSort;
+
+// exported from NumericSort.cpp:
+bool initNumericDocValues(NumericDocValues *dv, unsigned char *address, int format, int maxDoc);
+void freeNumericDocValues(NumericDocValues *dv);
+long getNumericDocValue(NumericDocValues *dv, int docID);
+bool sortNeedsScores(NumericSort *sort);
+bool sortCollect(NumericSort *sort, int topN, int docBase, int docUpto, unsigned int *filled, int numFilled,
+                 unsigned char *skips, float *scores, int *topDocIDs);
+
+// Collapses hits by a SortedDocValues field, keeping each
+// group's best hit:
+typedef struct {
+  // Ordinal of each doc, stored as numeric DocValues:
+  NumericDocValues ords;
+
+  // Ordinal of each group in the PQ (-1 for sentinels),
+  // parallel to topDocIDs and topScores:
+  int *topOrds;
+
+  // PQ index of each ordinal's group, or 0 if it's not in
+  // the PQ:
+  int *ordToIndex;
+
+  // Hit count of each ordinal:
+  int *ordCounts;
+} GroupCollector;
+
+// exported from Grouping.cpp:
+void groupCollect(GroupCollector *groups, int topN, int docBase, int docUpto, unsigned int *filled, int numFilled,
+                  unsigned char *skips, float *scores, int *topDocIDs, float *topScores);
+
+// Implementations of Facet42BinaryDocValues' in-memory
+// docToAddress PackedInts.Reader:
+#define FACET_ADDRESS_PACKED64 0
+#define FACET_ADDRESS_SINGLE_BLOCK 1
+#define FACET_ADDRESS_DIRECT8 2
+#define FACET_ADDRESS_DIRECT16 3
+#define FACET_ADDRESS_DIRECT32 4
+#define FACET_ADDRESS_THREE_BLOCKS8 5
+
+// Open addressing ord -> count hash; keys are ord+1 so 0
+// marks an empty slot:
+typedef struct {
+  unsigned int *keys;
+  unsigned int *values;
+  unsigned int mask;
+  unsigned int size;
+} SparseCounts;
+
+// How FacetCounts aggregates each hit's ords; same as
+// FACET_AGGREGATION_* in NativeSearch.java:
+#define FACET_AGGREGATION_COUNT 0
+// Sums the hit's score:
+#define FACET_AGGREGATION_SUM_SCORE 1
+// Sums the float association of each of the hit's ords,
+// from the association Facet42BinaryDocValues:
+#define FACET_AGGREGATION_SUM_FLOAT_ASSOCIATION 2
+
+// One query's counts for a facet request, by taxonomy
+// ordinal: hashed while few ords are touched, so small
+// result sets never allocate or scan a taxonomy-sized
+// array, then moved to a dense array:
+typedef struct {
+  unsigned int numOrds;
+  SparseCounts sparse;
+  // Switch to dense once the hash has this many ords:
+  unsigned int maxSparse;
+  // 0 while sparse:
+  unsigned int *dense;
+  // Set if the hash or dense array couldn't be allocated:
+  bool failed;
+  // One of FACET_AGGREGATION_*; sums are floats, kept as
+  // their bits in the same hash or dense array:
+  int aggregation;
+} FacetCounts;
+
+// Copy of a taxonomy's ParallelTaxonomyArrays, indexed by
+// ord; -1 marks no parent, child or sibling:
+typedef struct {
+  unsigned int size;
+  int *parents;
+  // Youngest child:
+  int *children;
+  // Next older sibling:
+  int *siblings;
+} TaxonomyArrays;
+
+// Facet counting fused into drill sideways collection:
+// each hit's taxonomy ords are counted as it's collected,
+// instead of setting bits that are counted afterwards:
+typedef struct {
+  // Segment's Facet42BinaryDocValues; facetBytes is 0 if
+  // no doc in the segment has facets:
+  void *docToAddress;
+  unsigned char *facetBytes;
+  unsigned int (*getAddress)(void *blocks, unsigned int index);
+  unsigned int numFacetBytes;
+
+  // Same aggregation as all counts:
+  int aggregation;
+
+  // Drill-down counts (0 if there's no drill-down facet
+  // request), then each dim's drill sideways counts:
+  FacetCounts **counts;
+} FacetCounter;
+
+// exported from facets.cpp:
+// Sets getAddress and numFacetBytes, given docToAddress
+// and facetBytes; returns false if the docToAddress format
+// or bitsPerValue isn't supported:
+bool initFacetCounter(FacetCounter *facets, int addressFormat, int addressBitsPerValue, unsigned int maxDoc);
+
+// Counts docID's ords in each non-null counts[i], or sums
+// its score or float associations:
+void countDocFacets(FacetCounter *facets, unsigned int docID, FacetCounts **counts, int numCounts, float score);
+
+// Returns 0 if memory couldn't be allocated:
+FacetCounts *newFacetCounts(unsigned int numOrds, int aggregation);
+void freeFacetCounts(FacetCounts *counts);
+
+// Fills pairs with each touched (ord, count) of sparse
+// counts, by ord, and returns how many there are:
+int getSparseFacetCounts(FacetCounts *counts, unsigned int *pairs);
+
+// Returns false if memory couldn't be allocated:
+bool makeDenseFacetCounts(FacetCounts *counts);
+unsigned int getFacetCount(FacetCounts *counts, unsigned int ord);
+
+// Returns 0 if memory couldn't be allocated:
+TaxonomyArrays *newTaxonomyArrays(unsigned int size);
+void freeTaxonomyArrays(TaxonomyArrays *taxonomy);
+
+// Adds each descendant's count to its ancestors, up to and
+// including rootOrd; returns false if memory couldn't be
+// allocated:
+bool rollupFacetCounts(FacetCounts *counts, TaxonomyArrays *taxonomy, int rootOrd);
+
+// Fills pairs with the topN positive (ord, count) children
+// of rootOrd, by descending count then ord, and returns how
+// many there are; numValid is set to how many children of
+// rootOrd have a positive count:
+int getTopFacetCounts(FacetCounts *counts, TaxonomyArrays *taxonomy, int rootOrd, int topN, unsigned int *pairs, int *numValid);
+
 // exported from common.cpp:
+unsigned int readVInt(unsigned char **p);
+unsigned long readVLong(unsigned char **p);
 void nextDocFreqBlock(PostingsState* sub);
 void nextPosBlock(PostingsState* sub);
 void skipPositions(PostingsState *sub, long posCount);
@@ -74,8 +446,22 @@ void skipPositions(PostingsState *sub, long posCount);
 void downHeapNoScores(int heapSize, int *topDocIDs);
 void downHeap(int heapSize, int *topDocIDs, float *topScores);
 
+// Runs fn on each of the numJobs jobs (jobSize bytes
+// apart) on the library's worker threads, and returns once
+// all are done; the calling thread runs jobs too, so all
+// jobs finish even with no free worker:
+void runJobs(void *jobs, int jobSize, int numJobs, void *(*fn)(void *));
+
+// Stops the worker threads, after they finish any queued
+// jobs, and sets how many threads (counting the one calling
+// runJobs) may run jobs; the workers are started again on
+// first use:
+void setWorkerThreads(int numThreads);
+
 int booleanQueryOnlyShould(PostingsState* subs,
                            unsigned char *liveDocsBytes,
+                           FilterBitmap *filter,
+                           unsigned char *acceptBits,
                            double **termScoreCache,
                            float *termWeights,
                            int maxDoc,
@@ -88,6 +474,8 @@ int booleanQueryOnlyShould(PostingsState* subs,
                            unsigned int *coords,
                            float *topScores,
                            int *topDocIDs,
+                           NumericSort *sort,
+                           GroupCollector *groups,
                            float *coordFactors,
                            float *normTable,
                            unsigned char *norms,
@@ -98,10 +486,13 @@ int booleanQueryOnlyShould(PostingsState* subs,
                            unsigned int *dsTotalHits,
                            unsigned int *dsTermsPerDim,
                            unsigned long *dsHitBits,
-                           unsigned long **dsNearMissBits);
+                           unsigned long **dsNearMissBits,
+                           FacetCounter *dsFacets);
 
 int booleanQueryShouldMustNot(PostingsState* subs,
                               unsigned char *liveDocsBytes,
+                              FilterBitmap *filter,
+                              unsigned char *acceptBits,
                               double **termScoreCache,
                               float *termWeights,
                               int maxDoc,
@@ -115,6 +506,8 @@ int booleanQueryShouldMustNot(PostingsState* subs,
                               unsigned int *coords,
                               float *topScores,
                               int *topDocIDs,
+                              NumericSort *sort,
+                              GroupCollector *groups,
                               float *coordFactors,
                               float *normTable,
                               unsigned char *norms,
@@ -126,11 +519,14 @@ int booleanQueryShouldMustNot(PostingsState* subs,
                               unsigned int *dsTotalHits,
                               unsigned int *dsTermsPerDim,
                               unsigned long *dsHitBits,
-                              unsigned long **dsNearMissBits);
+                              unsigned long **dsNearMissBits,
+                              FacetCounter *dsFacets);
 
 
 int booleanQueryShouldMust(PostingsState* subs,
                            unsigned char *liveDocsBytes,
+                           FilterBitmap *filter,
+                           unsigned char *acceptBits,
                            double **termScoreCache,
                            float *termWeights,
                            int maxDoc,
@@ -144,6 +540,8 @@ int booleanQueryShouldMust(PostingsState* subs,
                            unsigned int *coords,
                            float *topScores,
                            int *topDocIDs,
+                           NumericSort *sort,
+                           GroupCollector *groups,
                            float *coordFactors,
                            float *normTable,
                            unsigned char *norms,
@@ -154,10 +552,13 @@ int booleanQueryShouldMust(PostingsState* subs,
                            unsigned int *dsTotalHits,
                            unsigned int *dsTermsPerDim,
                            unsigned long *dsHitBits,
-                           unsigned long **dsNearMissBits);
+                           unsigned long **dsNearMissBits,
+                           FacetCounter *dsFacets);
 
 int booleanQueryShouldMustMustNot(PostingsState* subs,
                                   unsigned char *liveDocsBytes,
+                                  FilterBitmap *filter,
+                                  unsigned char *acceptBits,
                                   double **termScoreCache,
                                   float *termWeights,
                                   int maxDoc,
@@ -172,6 +573,8 @@ int booleanQueryShouldMustMustNot(PostingsState* subs,
                                   unsigned int *coords,
                                   float *topScores,
                                   int *topDocIDs,
+                                  NumericSort *sort,
+                                  GroupCollector *groups,
                                   float *coordFactors,
                                   float *normTable,
                                   unsigned char *norms,
@@ -182,10 +585,13 @@ int booleanQueryShouldMustMustNot(PostingsState* subs,
                                   unsigned int *dsTotalHits,
                                   unsigned int *dsTermsPerDim,
                                   unsigned long *dsHitBits,
-                                  unsigned long **dsNearMissBits);
+                                  unsigned long **dsNearMissBits,
+                                  FacetCounter *dsFacets);
 
 int phraseQuery(PostingsState* subs,
                 unsigned char *liveDocsBytes,
+                FilterBitmap *filter,
+                unsigned char *acceptBits,
                 double *termScoreCache,
                 float termWeight,
                 int maxDoc,
@@ -199,7 +605,31 @@ int phraseQuery(PostingsState* subs,
                 int *topDocIDs,
                 float *normTable,
                 unsigned char *norms,
-                int *posOffsets);
+                int *posOffsets,
+                int *matchDocIDs,
+                unsigned int *matchFreqs);
+
+// Node types for spanQuery's pre-order span tree:
+#define SPAN_TERM 0
+#define SPAN_OR 1
+#define SPAN_NEAR_ORDERED 2
+#define SPAN_NEAR_UNORDERED 3
+
+int spanQuery(PostingsState* subs,
+              int numLeaves,
+              int *nodeTypes,
+              int *nodeArgs,
+              int *nodeChildCounts,
+              int numNodes,
+              unsigned char *liveDocsBytes,
+              float spanWeight,
+              int maxDoc,
+              int topN,
+              int docBase,
+              float *topScores,
+              int *topDocIDs,
+              float *normTable,
+              unsigned char *norms);
 
 unsigned int drillSidewaysCollect(unsigned int topN,
                                   unsigned int docBase,
@@ -221,15 +651,50 @@ unsigned int drillSidewaysCollect(unsigned int topN,
                                   unsigned int *termsPerDim,
                                   unsigned int *totalHits,
                                   unsigned long *hitBits,
-                                  unsigned long **nearMissBits);
+                                  unsigned long **nearMissBits,
+                                  FacetCounter *facets);
 
 bool isSet(unsigned char *bits, unsigned int docID);
+bool isChunkEmpty(unsigned char *bits, int docUpto, int maxDoc);
+int andChunkBits(unsigned char *bits, int docUpto, int maxDoc, unsigned int *filled, int numFilled);
+bool andChunkWords(unsigned long *dest, unsigned long *src);
+void sortSlots(unsigned int *filled, int numFilled);
+
+// Advances sub to its first doc >= endDoc, without
+// scoring or collecting the docs it passes:
+void skipChunk(PostingsState *sub, int endDoc);
+
+// Same as skipChunk, for all drill sideways subs:
+void drillSidewaysSkipChunk(PostingsState *subs, int numDims, unsigned int *termsPerDim, unsigned int endDoc);
 void setLongBit(unsigned long *bits, unsigned int docID);
 
 // FixedBitSet.nextSetBit:
 int nextSetBit(unsigned long *bits, int index);
 
-void countFacets(unsigned long *bits, unsigned int maxDoc, unsigned int *facetCounts, unsigned long *docToAddress, unsigned char *facetBytes);
+// Returns -1 if the docToAddress format or bitsPerValue
+// isn't supported:
+int countFacets(unsigned long *bits, unsigned int maxDoc, unsigned int *facetCounts, void *docToAddress,
+                int addressFormat, int addressBitsPerValue, unsigned char *facetBytes);
+
+// One segment's hits and Facet42BinaryDocValues, for
+// countFacetsParallel; facetBytes is 0 if no doc in the
+// segment has facets:
+typedef struct {
+  unsigned long *bits;
+  unsigned int maxDoc;
+  void *docToAddress;
+  int addressFormat;
+  int addressBitsPerValue;
+  unsigned char *facetBytes;
+} FacetSegment;
+
+// Counts all segments' hits into facetCounts (numOrds
+// long) on up to maxThreads threads, each counting at least
+// minHitsPerThread hits; returns -1 if a docToAddress
+// format or bitsPerValue isn't supported, or -2 if
+// temporary memory couldn't be allocated:
+int countFacetsParallel(FacetSegment *segments, int numSegments, unsigned int *facetCounts, unsigned int numOrds,
+                        int maxThreads, int minHitsPerThread);
 
 //#define DEBUG
 
@@ -15,8 +15,12 @@
  * limitations under the License.
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "common.h"
 
 int
@@ -41,10 +45,12 @@ nextSetBit(unsigned long *bits, unsigned int numWords, int index) {
   return NO_MORE_DOCS;
 }
 
-void
-accum(unsigned int upto, unsigned int endUpto, unsigned int *facetCounts, unsigned char *facetBytes) {
+// Decodes the delta-vInt ords (7 bits per byte, high bits
+// first, high bit set on all but the last byte) in [upto,
+// endUpto), continuing from prev, and counts each one:
+static void
+accumScalar(unsigned int upto, unsigned int endUpto, unsigned int prev, unsigned int *facetCounts, unsigned char *facetBytes) {
   unsigned int ord = 0;
-  unsigned int prev = 0;
   //printf("    accum address=%d len=%d\n", upto, endUpto-upto); fflush(stdout);
   while (upto < endUpto) {
     unsigned char b = facetBytes[upto++];
@@ -60,42 +66,3357 @@ accum(unsigned int upto, unsigned int endUpto, unsigned int *facetCounts, unsign
   }
 }
 
+// Same as accumScalar, from the start of a doc's ords, but
+// decodes 16 bytes at a time (Masked VByte): one movemask
+// finds where every value in the 16 bytes ends.  When all
+// are 1-byte deltas (common, since ords are dense), the
+// prefix sum is done in SIMD registers too.  numBytes is
+// how many bytes facetBytes has, so we never load past
+// it; the remainder falls back to accumScalar:
+static void
+accum(unsigned int upto, unsigned int endUpto, unsigned int *facetCounts, unsigned char *facetBytes, unsigned int numBytes) {
+  unsigned int prev = 0;
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  while (upto < endUpto && upto + 16 <= numBytes) {
+    __m128i bytes = _mm_loadu_si128((__m128i *) (facetBytes + upto));
+    unsigned int count = endUpto - upto;
+    if (count > 16) {
+      count = 16;
+    }
+    unsigned int valid = (1U << count) - 1;
+    // Bit i is set if byte i ends a value:
+    unsigned int ends = ~_mm_movemask_epi8(bytes) & valid;
+    if (ends == valid) {
+      // count 1-byte deltas: widen to ints and prefix sum
+      // 4 at a time, carrying the last sum forward:
+      unsigned int ords[16];
+      __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+      __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+      __m128i deltas[4] = {_mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+                           _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero)};
+      __m128i carry = _mm_set1_epi32(prev);
+      for(int i=0;i<4;i++) {
+        __m128i x = deltas[i];
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi32(x, carry);
+        _mm_storeu_si128((__m128i *) (ords + 4*i), x);
+        carry = _mm_shuffle_epi32(x, 0xFF);
+      }
+      for(unsigned int i=0;i<count;i++) {
+        facetCounts[ords[i]]++;
+      }
+      prev = ords[count-1];
+      upto += count;
+    } else {
+      // Each value's length is known up front, so we
+      // gather its bytes without testing each high bit; a
+      // value cut off by the 16 bytes is redone next time:
+      unsigned char *p = facetBytes + upto;
+      unsigned int start = 0;
+      while (ends != 0) {
+        unsigned int end = __builtin_ctz(ends);
+        ends &= ends - 1;
+        unsigned int delta = p[end];
+        unsigned int shift = 7;
+        for(unsigned int i=end;i>start;i--) {
+          delta |= (p[i-1] & 0x7F) << shift;
+          shift += 7;
+        }
+        prev += delta;
+        facetCounts[prev]++;
+        start = end + 1;
+      }
+      upto += start;
+    }
+  }
+#endif
+  accumScalar(upto, endUpto, prev, facetCounts, facetBytes);
+}
+
+static bool
+initSparseCounts(SparseCounts *sparse, unsigned int capacity) {
+  sparse->keys = (unsigned int *) calloc(capacity, sizeof(int));
+  sparse->values = (unsigned int *) malloc(capacity * sizeof(int));
+  sparse->mask = capacity - 1;
+  sparse->size = 0;
+  return sparse->keys != 0 && sparse->values != 0;
+}
+
+static void
+freeSparseCounts(SparseCounts *sparse) {
+  if (sparse->keys != 0) {
+    free(sparse->keys);
+  }
+  if (sparse->values != 0) {
+    free(sparse->values);
+  }
+}
+
+static inline unsigned int
+sparseSlot(unsigned int key, unsigned int mask) {
+  unsigned int h = key * 0x9E3779B1;
+  return (h ^ (h >> 16)) & mask;
+}
+
+// Doubles the hash once it's half full:
+static bool
+growSparseCounts(SparseCounts *sparse) {
+  SparseCounts old = *sparse;
+  if (!initSparseCounts(sparse, (old.mask+1) << 1)) {
+    freeSparseCounts(sparse);
+    *sparse = old;
+    return false;
+  }
+  for(unsigned int i=0;i<=old.mask;i++) {
+    unsigned int key = old.keys[i];
+    if (key != 0) {
+      unsigned int slot = sparseSlot(key, sparse->mask);
+      while (sparse->keys[slot] != 0) {
+        slot = (slot + 1) & sparse->mask;
+      }
+      sparse->keys[slot] = key;
+      sparse->values[slot] = old.values[i];
+    }
+  }
+  sparse->size = old.size;
+  freeSparseCounts(&old);
+  return true;
+}
+
+// Returns the ord's value, adding it as 0 if it's new, or
+// 0 if the hash couldn't grow:
+static inline unsigned int *
+sparseValue(SparseCounts *sparse, unsigned int ord) {
+  if (sparse->size << 1 > sparse->mask && !growSparseCounts(sparse)) {
+    return 0;
+  }
+  unsigned int key = ord + 1;
+  unsigned int slot = sparseSlot(key, sparse->mask);
+  while (true) {
+    if (sparse->keys[slot] == key) {
+      return sparse->values + slot;
+    } else if (sparse->keys[slot] == 0) {
+      sparse->keys[slot] = key;
+      sparse->values[slot] = 0;
+      sparse->size++;
+      return sparse->values + slot;
+    }
+    slot = (slot + 1) & sparse->mask;
+  }
+}
+
+// Returns false if the hash couldn't grow:
+static inline bool
+incSparseCount(SparseCounts *sparse, unsigned int ord) {
+  unsigned int *value = sparseValue(sparse, ord);
+  if (value == 0) {
+    return false;
+  }
+  (*value)++;
+  return true;
+}
+
+static unsigned int
+getSparseCount(SparseCounts *sparse, unsigned int ord) {
+  unsigned int key = ord + 1;
+  unsigned int slot = sparseSlot(key, sparse->mask);
+  while (sparse->keys[slot] != 0) {
+    if (sparse->keys[slot] == key) {
+      return sparse->values[slot];
+    }
+    slot = (slot + 1) & sparse->mask;
+  }
+  return 0;
+}
+
+// Hashed counts switch to dense once more than numOrds /
+// SPARSE_FACET_RATIO ords are touched; at a load factor of
+// 1/2 the hash then takes about as many bytes as there are
+// ords, vs 4 per ord for dense:
+#define SPARSE_FACET_RATIO 16
+
+FacetCounts *
+newFacetCounts(unsigned int numOrds, int aggregation) {
+  FacetCounts *counts = (FacetCounts *) calloc(1, sizeof(FacetCounts));
+  if (counts == 0) {
+    return 0;
+  }
+  counts->numOrds = numOrds;
+  counts->aggregation = aggregation;
+  counts->maxSparse = numOrds / SPARSE_FACET_RATIO;
+  if (!initSparseCounts(&counts->sparse, 1024)) {
+    freeFacetCounts(counts);
+    return 0;
+  }
+  return counts;
+}
+
+void
+freeFacetCounts(FacetCounts *counts) {
+  freeSparseCounts(&counts->sparse);
+  if (counts->dense != 0) {
+    free(counts->dense);
+  }
+  free(counts);
+}
+
+// Moves the hashed counts into a new dense array:
+bool
+makeDenseFacetCounts(FacetCounts *counts) {
+  if (counts->dense != 0) {
+    return true;
+  }
+  // Large callocs are mmap'd, so pages we never count into
+  // are never touched:
+  counts->dense = (unsigned int *) calloc(counts->numOrds, sizeof(int));
+  if (counts->dense == 0) {
+    return false;
+  }
+  SparseCounts *sparse = &counts->sparse;
+  for(unsigned int i=0;i<=sparse->mask;i++) {
+    if (sparse->keys[i] != 0) {
+      counts->dense[sparse->keys[i]-1] = sparse->values[i];
+    }
+  }
+  freeSparseCounts(sparse);
+  memset(sparse, 0, sizeof(SparseCounts));
+  return true;
+}
+
+// Returns the ord's count (or float sum's bits), or 0 if
+// memory couldn't be allocated:
+static inline unsigned int *
+facetValue(FacetCounts *counts, unsigned int ord) {
+  if (counts->dense != 0) {
+    return counts->dense + ord;
+  } else if (counts->failed) {
+    // Already out of memory; the caller throws
+    return 0;
+  } else if (counts->sparse.size >= counts->maxSparse) {
+    if (makeDenseFacetCounts(counts)) {
+      return counts->dense + ord;
+    }
+  } else {
+    unsigned int *value = sparseValue(&counts->sparse, ord);
+    if (value != 0) {
+      return value;
+    }
+  }
+  counts->failed = true;
+  return 0;
+}
+
+static inline void
+addFacetCount(FacetCounts *counts, unsigned int ord, unsigned int delta) {
+  unsigned int *value = facetValue(counts, ord);
+  if (value != 0) {
+    *value += delta;
+  }
+}
+
+static inline void
+incFacetCount(FacetCounts *counts, unsigned int ord) {
+  addFacetCount(counts, ord, 1);
+}
+
+static inline void
+addFacetFloat(FacetCounts *counts, unsigned int ord, float delta) {
+  float *value = (float *) facetValue(counts, ord);
+  if (value != 0) {
+    *value += delta;
+  }
+}
+
 unsigned int
-decode26(unsigned long *packed, unsigned int index) {
-  // The abstract index in a bit stream
-  long majorBitPos = (long) index * 26;
-  // The index in the backing long-array
-  int elementPos = (int) (majorBitPos >> 6);
-  // The number of value-bits in the second long
+getFacetCount(FacetCounts *counts, unsigned int ord) {
+  if (counts->dense != 0) {
+    return counts->dense[ord];
+  } else {
+    return getSparseCount(&counts->sparse, ord);
+  }
+}
+
+static int
+compareOrds(const void *a, const void *b) {
+  unsigned int ordA = *(unsigned int *) a;
+  unsigned int ordB = *(unsigned int *) b;
+  return ordA < ordB ? -1 : (ordA > ordB ? 1 : 0);
+}
+
+int
+getSparseFacetCounts(FacetCounts *counts, unsigned int *pairs) {
+  SparseCounts *sparse = &counts->sparse;
+  int upto = 0;
+  for(unsigned int i=0;i<=sparse->mask;i++) {
+    if (sparse->keys[i] != 0) {
+      pairs[upto++] = sparse->keys[i]-1;
+      pairs[upto++] = sparse->values[i];
+    }
+  }
+  qsort(pairs, upto/2, 2*sizeof(int), compareOrds);
+  return upto/2;
+}
+
+TaxonomyArrays *
+newTaxonomyArrays(unsigned int size) {
+  TaxonomyArrays *taxonomy = (TaxonomyArrays *) calloc(1, sizeof(TaxonomyArrays));
+  if (taxonomy == 0) {
+    return 0;
+  }
+  taxonomy->size = size;
+  taxonomy->parents = (int *) malloc(size * sizeof(int));
+  taxonomy->children = (int *) malloc(size * sizeof(int));
+  taxonomy->siblings = (int *) malloc(size * sizeof(int));
+  if (taxonomy->parents == 0 || taxonomy->children == 0 || taxonomy->siblings == 0) {
+    freeTaxonomyArrays(taxonomy);
+    return 0;
+  }
+  return taxonomy;
+}
+
+void
+freeTaxonomyArrays(TaxonomyArrays *taxonomy) {
+  if (taxonomy->parents != 0) {
+    free(taxonomy->parents);
+  }
+  if (taxonomy->children != 0) {
+    free(taxonomy->children);
+  }
+  if (taxonomy->siblings != 0) {
+    free(taxonomy->siblings);
+  }
+  free(taxonomy);
+}
+
+// Same as FastCountingFacetsAggregator.rollupCounts: each
+// ord (and its siblings) gets its descendants' counts:
+static unsigned int
+rollupDense(int ord, TaxonomyArrays *taxonomy, unsigned int *counts) {
+  unsigned int count = 0;
+  while (ord != -1) {
+    unsigned int childCount = counts[ord] + rollupDense(taxonomy->children[ord], taxonomy, counts);
+    counts[ord] = childCount;
+    count += childCount;
+    ord = taxonomy->siblings[ord];
+  }
+  return count;
+}
+
+// Same as SumScoreFacetsAggregator.rollupScores:
+static float
+rollupDenseFloats(int ord, TaxonomyArrays *taxonomy, float *values) {
+  float value = 0;
+  while (ord != -1) {
+    float childValue = values[ord] + rollupDenseFloats(taxonomy->children[ord], taxonomy, values);
+    values[ord] = childValue;
+    value += childValue;
+    ord = taxonomy->siblings[ord];
+  }
+  return value;
+}
+
+// Returns true if ord is a strict descendant of rootOrd:
+static bool
+isDescendant(TaxonomyArrays *taxonomy, int ord, int rootOrd) {
+  int parent = taxonomy->parents[ord];
+  while (parent != -1) {
+    if (parent == rootOrd) {
+      return true;
+    }
+    parent = taxonomy->parents[parent];
+  }
+  return false;
+}
+
+bool
+rollupFacetCounts(FacetCounts *counts, TaxonomyArrays *taxonomy, int rootOrd) {
+  if (counts->aggregation != FACET_AGGREGATION_COUNT) {
+    // Float sums depend on the order they're added in, so
+    // always add in the same order as Java:
+    if (!makeDenseFacetCounts(counts)) {
+      return false;
+    }
+    float *values = (float *) counts->dense;
+    values[rootOrd] += rollupDenseFloats(taxonomy->children[rootOrd], taxonomy, values);
+    return true;
+  }
+  if (counts->dense != 0) {
+    counts->dense[rootOrd] += rollupDense(taxonomy->children[rootOrd], taxonomy, counts->dense);
+    return true;
+  }
+
+  // Sparse: add each touched descendant's count to all its
+  // ancestors up to rootOrd; this is the same sum as the
+  // dense walk, but only visits counted ords:
+  unsigned int *pairs = (unsigned int *) malloc(2 * counts->sparse.size * sizeof(int));
+  if (pairs == 0) {
+    return false;
+  }
+  int numPairs = getSparseFacetCounts(counts, pairs);
+  for(int i=0;i<numPairs;i++) {
+    int ord = pairs[2*i];
+    if (!isDescendant(taxonomy, ord, rootOrd)) {
+      continue;
+    }
+    int parent = ord;
+    do {
+      parent = taxonomy->parents[parent];
+      addFacetCount(counts, parent, pairs[2*i+1]);
+    } while (parent != rootOrd);
+  }
+  free(pairs);
+  return !counts->failed;
+}
+
+// Same order as DepthOneFacetResultsHandler's queue: by
+// count, then by ord.  Only values > 0 are collected, and
+// positive floats' bits compare the same as the floats:
+static inline bool
+lessThanFacet(unsigned int *a, unsigned int *b) {
+  return a[1] < b[1] || (a[1] == b[1] && a[0] < b[0]);
+}
+
+static void
+downHeapFacets(unsigned int *heap, int heapSize) {
+  int i = 0;
+  // save node
+  unsigned int sav[2] = {heap[0], heap[1]};
+  int j = 1;
+  int k = 2;
+  if (k < heapSize && lessThanFacet(heap+2*k, heap+2*j)) {
+    j = k;
+  }
+  while (j < heapSize && lessThanFacet(heap+2*j, sav)) {
+    heap[2*i] = heap[2*j];
+    heap[2*i+1] = heap[2*j+1];
+    i = j;
+    j = (i << 1) + 1;
+    k = j + 1;
+    if (k < heapSize && lessThanFacet(heap+2*k, heap+2*j)) {
+      j = k;
+    }
+  }
+  heap[2*i] = sav[0];
+  heap[2*i+1] = sav[1];
+}
+
+static void
+upHeapFacets(unsigned int *heap, int index) {
+  int i = index;
+  unsigned int sav[2] = {heap[2*i], heap[2*i+1]};
+  int j = (i - 1) >> 1;
+  while (i > 0 && lessThanFacet(sav, heap+2*j)) {
+    heap[2*i] = heap[2*j];
+    heap[2*i+1] = heap[2*j+1];
+    i = j;
+    j = (i - 1) >> 1;
+  }
+  heap[2*i] = sav[0];
+  heap[2*i+1] = sav[1];
+}
+
+static inline void
+collectFacet(unsigned int *heap, int *heapSize, int topN, unsigned int ord, unsigned int count) {
+  unsigned int entry[2] = {ord, count};
+  if (*heapSize < topN) {
+    heap[2*(*heapSize)] = ord;
+    heap[2*(*heapSize)+1] = count;
+    upHeapFacets(heap, *heapSize);
+    (*heapSize)++;
+  } else if (lessThanFacet(heap, entry)) {
+    heap[0] = ord;
+    heap[1] = count;
+    downHeapFacets(heap, topN);
+  }
+}
+
+static int
+compareFacets(const void *a, const void *b) {
+  unsigned int *facetA = (unsigned int *) a;
+  unsigned int *facetB = (unsigned int *) b;
+  if (lessThanFacet(facetA, facetB)) {
+    return 1;
+  } else if (lessThanFacet(facetB, facetA)) {
+    return -1;
+  } else {
+    return 0;
+  }
+}
+
+int
+getTopFacetCounts(FacetCounts *counts, TaxonomyArrays *taxonomy, int rootOrd, int topN, unsigned int *pairs, int *numValid) {
+  int heapSize = 0;
+  *numValid = 0;
+  if (counts->dense != 0) {
+    unsigned int *dense = counts->dense;
+    int ord = taxonomy->children[rootOrd];
+    while (ord != -1) {
+      if ((int) dense[ord] > 0) {
+        (*numValid)++;
+        if (topN != 0) {
+          collectFacet(pairs, &heapSize, topN, ord, dense[ord]);
+        }
+      }
+      ord = taxonomy->siblings[ord];
+    }
+  } else {
+    // Only the touched ords can be non-zero:
+    SparseCounts *sparse = &counts->sparse;
+    for(unsigned int i=0;i<=sparse->mask;i++) {
+      if (sparse->keys[i] != 0) {
+        int ord = sparse->keys[i]-1;
+        if (taxonomy->parents[ord] == rootOrd && (int) sparse->values[i] > 0) {
+          (*numValid)++;
+          if (topN != 0) {
+            collectFacet(pairs, &heapSize, topN, ord, sparse->values[i]);
+          }
+        }
+      }
+    }
+  }
+  qsort(pairs, heapSize, 2*sizeof(int), compareFacets);
+  return heapSize;
+}
+
+// Same as PackedInts.Reader.get, for the docToAddress
+// array's implementation:
+typedef unsigned int (*addressGetter)(void *blocks, unsigned int index);
+
+// Decodes BLOCK_SIZE Packed64 values:
+typedef void (*addressDecoder)(unsigned long *blocks, unsigned int *values);
+
+// BEGIN AUTOGEN CODE (gen_BulkPacked.py facets)
+
+static unsigned int getPacked64_1(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 1;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  return (packed[elementPos] >> (64 - 1 - (majorBitPos & 63))) & 0x1L;
+}
+
+static void decodePacked64_1(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 2; ++i) {
+    unsigned long block = blocks[blocksOffset++];
+    for (int shift = 63; shift >= 0; shift -= 1) {
+      values[valuesOffset++] = (int) ((block >> shift) & 1);
+    }
+  }
+}
+
+static unsigned int getPacked64_2(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 2;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  return (packed[elementPos] >> (64 - 2 - (majorBitPos & 63))) & 0x3L;
+}
+
+static void decodePacked64_2(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 4; ++i) {
+    unsigned long block = blocks[blocksOffset++];
+    for (int shift = 62; shift >= 0; shift -= 2) {
+      values[valuesOffset++] = (int) ((block >> shift) & 3);
+    }
+  }
+}
+
+static unsigned int getPacked64_3(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 3;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 3 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0x7L;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0x7L;
+}
+
+static void decodePacked64_3(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 2; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 61);
+    values[valuesOffset++] = (int) ((block0 >> 58) & 7L);
+    values[valuesOffset++] = (int) ((block0 >> 55) & 7L);
+    values[valuesOffset++] = (int) ((block0 >> 52) & 7L);
+    values[valuesOffset++] = (int) ((block0 >> 49) & 7L);
+    values[valuesOffset++] = (int) ((block0 >> 46) & 7L);
+    values[valuesOffset++] = (int) ((block0 >> 43) & 7L);
+    values[valuesOffset++] = (int) ((block0 >> 40) & 7L);
+    values[valuesOffset++] = (int) ((block0 >> 37) & 7L);
+    values[valuesOffset++] = (int) ((block0 >> 34) & 7L);
+    values[valuesOffset++] = (int) ((block0 >> 31) & 7L);
+    values[valuesOffset++] = (int) ((block0 >> 28) & 7L);
+    values[valuesOffset++] = (int) ((block0 >> 25) & 7L);
+    values[valuesOffset++] = (int) ((block0 >> 22) & 7L);
+    values[valuesOffset++] = (int) ((block0 >> 19) & 7L);
+    values[valuesOffset++] = (int) ((block0 >> 16) & 7L);
+    values[valuesOffset++] = (int) ((block0 >> 13) & 7L);
+    values[valuesOffset++] = (int) ((block0 >> 10) & 7L);
+    values[valuesOffset++] = (int) ((block0 >> 7) & 7L);
+    values[valuesOffset++] = (int) ((block0 >> 4) & 7L);
+    values[valuesOffset++] = (int) ((block0 >> 1) & 7L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 1L) << 2) | (block1 >> 62));
+    values[valuesOffset++] = (int) ((block1 >> 59) & 7L);
+    values[valuesOffset++] = (int) ((block1 >> 56) & 7L);
+    values[valuesOffset++] = (int) ((block1 >> 53) & 7L);
+    values[valuesOffset++] = (int) ((block1 >> 50) & 7L);
+    values[valuesOffset++] = (int) ((block1 >> 47) & 7L);
+    values[valuesOffset++] = (int) ((block1 >> 44) & 7L);
+    values[valuesOffset++] = (int) ((block1 >> 41) & 7L);
+    values[valuesOffset++] = (int) ((block1 >> 38) & 7L);
+    values[valuesOffset++] = (int) ((block1 >> 35) & 7L);
+    values[valuesOffset++] = (int) ((block1 >> 32) & 7L);
+    values[valuesOffset++] = (int) ((block1 >> 29) & 7L);
+    values[valuesOffset++] = (int) ((block1 >> 26) & 7L);
+    values[valuesOffset++] = (int) ((block1 >> 23) & 7L);
+    values[valuesOffset++] = (int) ((block1 >> 20) & 7L);
+    values[valuesOffset++] = (int) ((block1 >> 17) & 7L);
+    values[valuesOffset++] = (int) ((block1 >> 14) & 7L);
+    values[valuesOffset++] = (int) ((block1 >> 11) & 7L);
+    values[valuesOffset++] = (int) ((block1 >> 8) & 7L);
+    values[valuesOffset++] = (int) ((block1 >> 5) & 7L);
+    values[valuesOffset++] = (int) ((block1 >> 2) & 7L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 3L) << 1) | (block2 >> 63));
+    values[valuesOffset++] = (int) ((block2 >> 60) & 7L);
+    values[valuesOffset++] = (int) ((block2 >> 57) & 7L);
+    values[valuesOffset++] = (int) ((block2 >> 54) & 7L);
+    values[valuesOffset++] = (int) ((block2 >> 51) & 7L);
+    values[valuesOffset++] = (int) ((block2 >> 48) & 7L);
+    values[valuesOffset++] = (int) ((block2 >> 45) & 7L);
+    values[valuesOffset++] = (int) ((block2 >> 42) & 7L);
+    values[valuesOffset++] = (int) ((block2 >> 39) & 7L);
+    values[valuesOffset++] = (int) ((block2 >> 36) & 7L);
+    values[valuesOffset++] = (int) ((block2 >> 33) & 7L);
+    values[valuesOffset++] = (int) ((block2 >> 30) & 7L);
+    values[valuesOffset++] = (int) ((block2 >> 27) & 7L);
+    values[valuesOffset++] = (int) ((block2 >> 24) & 7L);
+    values[valuesOffset++] = (int) ((block2 >> 21) & 7L);
+    values[valuesOffset++] = (int) ((block2 >> 18) & 7L);
+    values[valuesOffset++] = (int) ((block2 >> 15) & 7L);
+    values[valuesOffset++] = (int) ((block2 >> 12) & 7L);
+    values[valuesOffset++] = (int) ((block2 >> 9) & 7L);
+    values[valuesOffset++] = (int) ((block2 >> 6) & 7L);
+    values[valuesOffset++] = (int) ((block2 >> 3) & 7L);
+    values[valuesOffset++] = (int) (block2 & 7L);
+  }
+}
+
+static unsigned int getPacked64_4(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 4;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  return (packed[elementPos] >> (64 - 4 - (majorBitPos & 63))) & 0xfL;
+}
+
+static void decodePacked64_4(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 8; ++i) {
+    unsigned long block = blocks[blocksOffset++];
+    for (int shift = 60; shift >= 0; shift -= 4) {
+      values[valuesOffset++] = (int) ((block >> shift) & 15);
+    }
+  }
+}
+
+static unsigned int getPacked64_5(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 5;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 5 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0x1fL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0x1fL;
+}
+
+static void decodePacked64_5(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 2; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 59);
+    values[valuesOffset++] = (int) ((block0 >> 54) & 31L);
+    values[valuesOffset++] = (int) ((block0 >> 49) & 31L);
+    values[valuesOffset++] = (int) ((block0 >> 44) & 31L);
+    values[valuesOffset++] = (int) ((block0 >> 39) & 31L);
+    values[valuesOffset++] = (int) ((block0 >> 34) & 31L);
+    values[valuesOffset++] = (int) ((block0 >> 29) & 31L);
+    values[valuesOffset++] = (int) ((block0 >> 24) & 31L);
+    values[valuesOffset++] = (int) ((block0 >> 19) & 31L);
+    values[valuesOffset++] = (int) ((block0 >> 14) & 31L);
+    values[valuesOffset++] = (int) ((block0 >> 9) & 31L);
+    values[valuesOffset++] = (int) ((block0 >> 4) & 31L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 15L) << 1) | (block1 >> 63));
+    values[valuesOffset++] = (int) ((block1 >> 58) & 31L);
+    values[valuesOffset++] = (int) ((block1 >> 53) & 31L);
+    values[valuesOffset++] = (int) ((block1 >> 48) & 31L);
+    values[valuesOffset++] = (int) ((block1 >> 43) & 31L);
+    values[valuesOffset++] = (int) ((block1 >> 38) & 31L);
+    values[valuesOffset++] = (int) ((block1 >> 33) & 31L);
+    values[valuesOffset++] = (int) ((block1 >> 28) & 31L);
+    values[valuesOffset++] = (int) ((block1 >> 23) & 31L);
+    values[valuesOffset++] = (int) ((block1 >> 18) & 31L);
+    values[valuesOffset++] = (int) ((block1 >> 13) & 31L);
+    values[valuesOffset++] = (int) ((block1 >> 8) & 31L);
+    values[valuesOffset++] = (int) ((block1 >> 3) & 31L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 7L) << 2) | (block2 >> 62));
+    values[valuesOffset++] = (int) ((block2 >> 57) & 31L);
+    values[valuesOffset++] = (int) ((block2 >> 52) & 31L);
+    values[valuesOffset++] = (int) ((block2 >> 47) & 31L);
+    values[valuesOffset++] = (int) ((block2 >> 42) & 31L);
+    values[valuesOffset++] = (int) ((block2 >> 37) & 31L);
+    values[valuesOffset++] = (int) ((block2 >> 32) & 31L);
+    values[valuesOffset++] = (int) ((block2 >> 27) & 31L);
+    values[valuesOffset++] = (int) ((block2 >> 22) & 31L);
+    values[valuesOffset++] = (int) ((block2 >> 17) & 31L);
+    values[valuesOffset++] = (int) ((block2 >> 12) & 31L);
+    values[valuesOffset++] = (int) ((block2 >> 7) & 31L);
+    values[valuesOffset++] = (int) ((block2 >> 2) & 31L);
+    unsigned long block3 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block2 & 3L) << 3) | (block3 >> 61));
+    values[valuesOffset++] = (int) ((block3 >> 56) & 31L);
+    values[valuesOffset++] = (int) ((block3 >> 51) & 31L);
+    values[valuesOffset++] = (int) ((block3 >> 46) & 31L);
+    values[valuesOffset++] = (int) ((block3 >> 41) & 31L);
+    values[valuesOffset++] = (int) ((block3 >> 36) & 31L);
+    values[valuesOffset++] = (int) ((block3 >> 31) & 31L);
+    values[valuesOffset++] = (int) ((block3 >> 26) & 31L);
+    values[valuesOffset++] = (int) ((block3 >> 21) & 31L);
+    values[valuesOffset++] = (int) ((block3 >> 16) & 31L);
+    values[valuesOffset++] = (int) ((block3 >> 11) & 31L);
+    values[valuesOffset++] = (int) ((block3 >> 6) & 31L);
+    values[valuesOffset++] = (int) ((block3 >> 1) & 31L);
+    unsigned long block4 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block3 & 1L) << 4) | (block4 >> 60));
+    values[valuesOffset++] = (int) ((block4 >> 55) & 31L);
+    values[valuesOffset++] = (int) ((block4 >> 50) & 31L);
+    values[valuesOffset++] = (int) ((block4 >> 45) & 31L);
+    values[valuesOffset++] = (int) ((block4 >> 40) & 31L);
+    values[valuesOffset++] = (int) ((block4 >> 35) & 31L);
+    values[valuesOffset++] = (int) ((block4 >> 30) & 31L);
+    values[valuesOffset++] = (int) ((block4 >> 25) & 31L);
+    values[valuesOffset++] = (int) ((block4 >> 20) & 31L);
+    values[valuesOffset++] = (int) ((block4 >> 15) & 31L);
+    values[valuesOffset++] = (int) ((block4 >> 10) & 31L);
+    values[valuesOffset++] = (int) ((block4 >> 5) & 31L);
+    values[valuesOffset++] = (int) (block4 & 31L);
+  }
+}
+
+static unsigned int getPacked64_6(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 6;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 6 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0x3fL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0x3fL;
+}
+
+static void decodePacked64_6(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 4; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 58);
+    values[valuesOffset++] = (int) ((block0 >> 52) & 63L);
+    values[valuesOffset++] = (int) ((block0 >> 46) & 63L);
+    values[valuesOffset++] = (int) ((block0 >> 40) & 63L);
+    values[valuesOffset++] = (int) ((block0 >> 34) & 63L);
+    values[valuesOffset++] = (int) ((block0 >> 28) & 63L);
+    values[valuesOffset++] = (int) ((block0 >> 22) & 63L);
+    values[valuesOffset++] = (int) ((block0 >> 16) & 63L);
+    values[valuesOffset++] = (int) ((block0 >> 10) & 63L);
+    values[valuesOffset++] = (int) ((block0 >> 4) & 63L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 15L) << 2) | (block1 >> 62));
+    values[valuesOffset++] = (int) ((block1 >> 56) & 63L);
+    values[valuesOffset++] = (int) ((block1 >> 50) & 63L);
+    values[valuesOffset++] = (int) ((block1 >> 44) & 63L);
+    values[valuesOffset++] = (int) ((block1 >> 38) & 63L);
+    values[valuesOffset++] = (int) ((block1 >> 32) & 63L);
+    values[valuesOffset++] = (int) ((block1 >> 26) & 63L);
+    values[valuesOffset++] = (int) ((block1 >> 20) & 63L);
+    values[valuesOffset++] = (int) ((block1 >> 14) & 63L);
+    values[valuesOffset++] = (int) ((block1 >> 8) & 63L);
+    values[valuesOffset++] = (int) ((block1 >> 2) & 63L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 3L) << 4) | (block2 >> 60));
+    values[valuesOffset++] = (int) ((block2 >> 54) & 63L);
+    values[valuesOffset++] = (int) ((block2 >> 48) & 63L);
+    values[valuesOffset++] = (int) ((block2 >> 42) & 63L);
+    values[valuesOffset++] = (int) ((block2 >> 36) & 63L);
+    values[valuesOffset++] = (int) ((block2 >> 30) & 63L);
+    values[valuesOffset++] = (int) ((block2 >> 24) & 63L);
+    values[valuesOffset++] = (int) ((block2 >> 18) & 63L);
+    values[valuesOffset++] = (int) ((block2 >> 12) & 63L);
+    values[valuesOffset++] = (int) ((block2 >> 6) & 63L);
+    values[valuesOffset++] = (int) (block2 & 63L);
+  }
+}
+
+static unsigned int getPacked64_7(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 7;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 7 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0x7fL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0x7fL;
+}
+
+static void decodePacked64_7(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 2; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 57);
+    values[valuesOffset++] = (int) ((block0 >> 50) & 127L);
+    values[valuesOffset++] = (int) ((block0 >> 43) & 127L);
+    values[valuesOffset++] = (int) ((block0 >> 36) & 127L);
+    values[valuesOffset++] = (int) ((block0 >> 29) & 127L);
+    values[valuesOffset++] = (int) ((block0 >> 22) & 127L);
+    values[valuesOffset++] = (int) ((block0 >> 15) & 127L);
+    values[valuesOffset++] = (int) ((block0 >> 8) & 127L);
+    values[valuesOffset++] = (int) ((block0 >> 1) & 127L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 1L) << 6) | (block1 >> 58));
+    values[valuesOffset++] = (int) ((block1 >> 51) & 127L);
+    values[valuesOffset++] = (int) ((block1 >> 44) & 127L);
+    values[valuesOffset++] = (int) ((block1 >> 37) & 127L);
+    values[valuesOffset++] = (int) ((block1 >> 30) & 127L);
+    values[valuesOffset++] = (int) ((block1 >> 23) & 127L);
+    values[valuesOffset++] = (int) ((block1 >> 16) & 127L);
+    values[valuesOffset++] = (int) ((block1 >> 9) & 127L);
+    values[valuesOffset++] = (int) ((block1 >> 2) & 127L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 3L) << 5) | (block2 >> 59));
+    values[valuesOffset++] = (int) ((block2 >> 52) & 127L);
+    values[valuesOffset++] = (int) ((block2 >> 45) & 127L);
+    values[valuesOffset++] = (int) ((block2 >> 38) & 127L);
+    values[valuesOffset++] = (int) ((block2 >> 31) & 127L);
+    values[valuesOffset++] = (int) ((block2 >> 24) & 127L);
+    values[valuesOffset++] = (int) ((block2 >> 17) & 127L);
+    values[valuesOffset++] = (int) ((block2 >> 10) & 127L);
+    values[valuesOffset++] = (int) ((block2 >> 3) & 127L);
+    unsigned long block3 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block2 & 7L) << 4) | (block3 >> 60));
+    values[valuesOffset++] = (int) ((block3 >> 53) & 127L);
+    values[valuesOffset++] = (int) ((block3 >> 46) & 127L);
+    values[valuesOffset++] = (int) ((block3 >> 39) & 127L);
+    values[valuesOffset++] = (int) ((block3 >> 32) & 127L);
+    values[valuesOffset++] = (int) ((block3 >> 25) & 127L);
+    values[valuesOffset++] = (int) ((block3 >> 18) & 127L);
+    values[valuesOffset++] = (int) ((block3 >> 11) & 127L);
+    values[valuesOffset++] = (int) ((block3 >> 4) & 127L);
+    unsigned long block4 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block3 & 15L) << 3) | (block4 >> 61));
+    values[valuesOffset++] = (int) ((block4 >> 54) & 127L);
+    values[valuesOffset++] = (int) ((block4 >> 47) & 127L);
+    values[valuesOffset++] = (int) ((block4 >> 40) & 127L);
+    values[valuesOffset++] = (int) ((block4 >> 33) & 127L);
+    values[valuesOffset++] = (int) ((block4 >> 26) & 127L);
+    values[valuesOffset++] = (int) ((block4 >> 19) & 127L);
+    values[valuesOffset++] = (int) ((block4 >> 12) & 127L);
+    values[valuesOffset++] = (int) ((block4 >> 5) & 127L);
+    unsigned long block5 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block4 & 31L) << 2) | (block5 >> 62));
+    values[valuesOffset++] = (int) ((block5 >> 55) & 127L);
+    values[valuesOffset++] = (int) ((block5 >> 48) & 127L);
+    values[valuesOffset++] = (int) ((block5 >> 41) & 127L);
+    values[valuesOffset++] = (int) ((block5 >> 34) & 127L);
+    values[valuesOffset++] = (int) ((block5 >> 27) & 127L);
+    values[valuesOffset++] = (int) ((block5 >> 20) & 127L);
+    values[valuesOffset++] = (int) ((block5 >> 13) & 127L);
+    values[valuesOffset++] = (int) ((block5 >> 6) & 127L);
+    unsigned long block6 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block5 & 63L) << 1) | (block6 >> 63));
+    values[valuesOffset++] = (int) ((block6 >> 56) & 127L);
+    values[valuesOffset++] = (int) ((block6 >> 49) & 127L);
+    values[valuesOffset++] = (int) ((block6 >> 42) & 127L);
+    values[valuesOffset++] = (int) ((block6 >> 35) & 127L);
+    values[valuesOffset++] = (int) ((block6 >> 28) & 127L);
+    values[valuesOffset++] = (int) ((block6 >> 21) & 127L);
+    values[valuesOffset++] = (int) ((block6 >> 14) & 127L);
+    values[valuesOffset++] = (int) ((block6 >> 7) & 127L);
+    values[valuesOffset++] = (int) (block6 & 127L);
+  }
+}
+
+static unsigned int getPacked64_8(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 8;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  return (packed[elementPos] >> (64 - 8 - (majorBitPos & 63))) & 0xffL;
+}
+
+static void decodePacked64_8(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 16; ++i) {
+    unsigned long block = blocks[blocksOffset++];
+    for (int shift = 56; shift >= 0; shift -= 8) {
+      values[valuesOffset++] = (int) ((block >> shift) & 255);
+    }
+  }
+}
+
+static unsigned int getPacked64_9(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 9;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 9 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0x1ffL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0x1ffL;
+}
+
+static void decodePacked64_9(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 2; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 55);
+    values[valuesOffset++] = (int) ((block0 >> 46) & 511L);
+    values[valuesOffset++] = (int) ((block0 >> 37) & 511L);
+    values[valuesOffset++] = (int) ((block0 >> 28) & 511L);
+    values[valuesOffset++] = (int) ((block0 >> 19) & 511L);
+    values[valuesOffset++] = (int) ((block0 >> 10) & 511L);
+    values[valuesOffset++] = (int) ((block0 >> 1) & 511L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 1L) << 8) | (block1 >> 56));
+    values[valuesOffset++] = (int) ((block1 >> 47) & 511L);
+    values[valuesOffset++] = (int) ((block1 >> 38) & 511L);
+    values[valuesOffset++] = (int) ((block1 >> 29) & 511L);
+    values[valuesOffset++] = (int) ((block1 >> 20) & 511L);
+    values[valuesOffset++] = (int) ((block1 >> 11) & 511L);
+    values[valuesOffset++] = (int) ((block1 >> 2) & 511L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 3L) << 7) | (block2 >> 57));
+    values[valuesOffset++] = (int) ((block2 >> 48) & 511L);
+    values[valuesOffset++] = (int) ((block2 >> 39) & 511L);
+    values[valuesOffset++] = (int) ((block2 >> 30) & 511L);
+    values[valuesOffset++] = (int) ((block2 >> 21) & 511L);
+    values[valuesOffset++] = (int) ((block2 >> 12) & 511L);
+    values[valuesOffset++] = (int) ((block2 >> 3) & 511L);
+    unsigned long block3 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block2 & 7L) << 6) | (block3 >> 58));
+    values[valuesOffset++] = (int) ((block3 >> 49) & 511L);
+    values[valuesOffset++] = (int) ((block3 >> 40) & 511L);
+    values[valuesOffset++] = (int) ((block3 >> 31) & 511L);
+    values[valuesOffset++] = (int) ((block3 >> 22) & 511L);
+    values[valuesOffset++] = (int) ((block3 >> 13) & 511L);
+    values[valuesOffset++] = (int) ((block3 >> 4) & 511L);
+    unsigned long block4 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block3 & 15L) << 5) | (block4 >> 59));
+    values[valuesOffset++] = (int) ((block4 >> 50) & 511L);
+    values[valuesOffset++] = (int) ((block4 >> 41) & 511L);
+    values[valuesOffset++] = (int) ((block4 >> 32) & 511L);
+    values[valuesOffset++] = (int) ((block4 >> 23) & 511L);
+    values[valuesOffset++] = (int) ((block4 >> 14) & 511L);
+    values[valuesOffset++] = (int) ((block4 >> 5) & 511L);
+    unsigned long block5 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block4 & 31L) << 4) | (block5 >> 60));
+    values[valuesOffset++] = (int) ((block5 >> 51) & 511L);
+    values[valuesOffset++] = (int) ((block5 >> 42) & 511L);
+    values[valuesOffset++] = (int) ((block5 >> 33) & 511L);
+    values[valuesOffset++] = (int) ((block5 >> 24) & 511L);
+    values[valuesOffset++] = (int) ((block5 >> 15) & 511L);
+    values[valuesOffset++] = (int) ((block5 >> 6) & 511L);
+    unsigned long block6 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block5 & 63L) << 3) | (block6 >> 61));
+    values[valuesOffset++] = (int) ((block6 >> 52) & 511L);
+    values[valuesOffset++] = (int) ((block6 >> 43) & 511L);
+    values[valuesOffset++] = (int) ((block6 >> 34) & 511L);
+    values[valuesOffset++] = (int) ((block6 >> 25) & 511L);
+    values[valuesOffset++] = (int) ((block6 >> 16) & 511L);
+    values[valuesOffset++] = (int) ((block6 >> 7) & 511L);
+    unsigned long block7 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block6 & 127L) << 2) | (block7 >> 62));
+    values[valuesOffset++] = (int) ((block7 >> 53) & 511L);
+    values[valuesOffset++] = (int) ((block7 >> 44) & 511L);
+    values[valuesOffset++] = (int) ((block7 >> 35) & 511L);
+    values[valuesOffset++] = (int) ((block7 >> 26) & 511L);
+    values[valuesOffset++] = (int) ((block7 >> 17) & 511L);
+    values[valuesOffset++] = (int) ((block7 >> 8) & 511L);
+    unsigned long block8 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block7 & 255L) << 1) | (block8 >> 63));
+    values[valuesOffset++] = (int) ((block8 >> 54) & 511L);
+    values[valuesOffset++] = (int) ((block8 >> 45) & 511L);
+    values[valuesOffset++] = (int) ((block8 >> 36) & 511L);
+    values[valuesOffset++] = (int) ((block8 >> 27) & 511L);
+    values[valuesOffset++] = (int) ((block8 >> 18) & 511L);
+    values[valuesOffset++] = (int) ((block8 >> 9) & 511L);
+    values[valuesOffset++] = (int) (block8 & 511L);
+  }
+}
+
+static unsigned int getPacked64_10(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 10;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 10 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0x3ffL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0x3ffL;
+}
+
+static void decodePacked64_10(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 4; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 54);
+    values[valuesOffset++] = (int) ((block0 >> 44) & 1023L);
+    values[valuesOffset++] = (int) ((block0 >> 34) & 1023L);
+    values[valuesOffset++] = (int) ((block0 >> 24) & 1023L);
+    values[valuesOffset++] = (int) ((block0 >> 14) & 1023L);
+    values[valuesOffset++] = (int) ((block0 >> 4) & 1023L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 15L) << 6) | (block1 >> 58));
+    values[valuesOffset++] = (int) ((block1 >> 48) & 1023L);
+    values[valuesOffset++] = (int) ((block1 >> 38) & 1023L);
+    values[valuesOffset++] = (int) ((block1 >> 28) & 1023L);
+    values[valuesOffset++] = (int) ((block1 >> 18) & 1023L);
+    values[valuesOffset++] = (int) ((block1 >> 8) & 1023L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 255L) << 2) | (block2 >> 62));
+    values[valuesOffset++] = (int) ((block2 >> 52) & 1023L);
+    values[valuesOffset++] = (int) ((block2 >> 42) & 1023L);
+    values[valuesOffset++] = (int) ((block2 >> 32) & 1023L);
+    values[valuesOffset++] = (int) ((block2 >> 22) & 1023L);
+    values[valuesOffset++] = (int) ((block2 >> 12) & 1023L);
+    values[valuesOffset++] = (int) ((block2 >> 2) & 1023L);
+    unsigned long block3 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block2 & 3L) << 8) | (block3 >> 56));
+    values[valuesOffset++] = (int) ((block3 >> 46) & 1023L);
+    values[valuesOffset++] = (int) ((block3 >> 36) & 1023L);
+    values[valuesOffset++] = (int) ((block3 >> 26) & 1023L);
+    values[valuesOffset++] = (int) ((block3 >> 16) & 1023L);
+    values[valuesOffset++] = (int) ((block3 >> 6) & 1023L);
+    unsigned long block4 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block3 & 63L) << 4) | (block4 >> 60));
+    values[valuesOffset++] = (int) ((block4 >> 50) & 1023L);
+    values[valuesOffset++] = (int) ((block4 >> 40) & 1023L);
+    values[valuesOffset++] = (int) ((block4 >> 30) & 1023L);
+    values[valuesOffset++] = (int) ((block4 >> 20) & 1023L);
+    values[valuesOffset++] = (int) ((block4 >> 10) & 1023L);
+    values[valuesOffset++] = (int) (block4 & 1023L);
+  }
+}
+
+static unsigned int getPacked64_11(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 11;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 11 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0x7ffL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0x7ffL;
+}
+
+static void decodePacked64_11(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 2; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 53);
+    values[valuesOffset++] = (int) ((block0 >> 42) & 2047L);
+    values[valuesOffset++] = (int) ((block0 >> 31) & 2047L);
+    values[valuesOffset++] = (int) ((block0 >> 20) & 2047L);
+    values[valuesOffset++] = (int) ((block0 >> 9) & 2047L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 511L) << 2) | (block1 >> 62));
+    values[valuesOffset++] = (int) ((block1 >> 51) & 2047L);
+    values[valuesOffset++] = (int) ((block1 >> 40) & 2047L);
+    values[valuesOffset++] = (int) ((block1 >> 29) & 2047L);
+    values[valuesOffset++] = (int) ((block1 >> 18) & 2047L);
+    values[valuesOffset++] = (int) ((block1 >> 7) & 2047L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 127L) << 4) | (block2 >> 60));
+    values[valuesOffset++] = (int) ((block2 >> 49) & 2047L);
+    values[valuesOffset++] = (int) ((block2 >> 38) & 2047L);
+    values[valuesOffset++] = (int) ((block2 >> 27) & 2047L);
+    values[valuesOffset++] = (int) ((block2 >> 16) & 2047L);
+    values[valuesOffset++] = (int) ((block2 >> 5) & 2047L);
+    unsigned long block3 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block2 & 31L) << 6) | (block3 >> 58));
+    values[valuesOffset++] = (int) ((block3 >> 47) & 2047L);
+    values[valuesOffset++] = (int) ((block3 >> 36) & 2047L);
+    values[valuesOffset++] = (int) ((block3 >> 25) & 2047L);
+    values[valuesOffset++] = (int) ((block3 >> 14) & 2047L);
+    values[valuesOffset++] = (int) ((block3 >> 3) & 2047L);
+    unsigned long block4 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block3 & 7L) << 8) | (block4 >> 56));
+    values[valuesOffset++] = (int) ((block4 >> 45) & 2047L);
+    values[valuesOffset++] = (int) ((block4 >> 34) & 2047L);
+    values[valuesOffset++] = (int) ((block4 >> 23) & 2047L);
+    values[valuesOffset++] = (int) ((block4 >> 12) & 2047L);
+    values[valuesOffset++] = (int) ((block4 >> 1) & 2047L);
+    unsigned long block5 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block4 & 1L) << 10) | (block5 >> 54));
+    values[valuesOffset++] = (int) ((block5 >> 43) & 2047L);
+    values[valuesOffset++] = (int) ((block5 >> 32) & 2047L);
+    values[valuesOffset++] = (int) ((block5 >> 21) & 2047L);
+    values[valuesOffset++] = (int) ((block5 >> 10) & 2047L);
+    unsigned long block6 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block5 & 1023L) << 1) | (block6 >> 63));
+    values[valuesOffset++] = (int) ((block6 >> 52) & 2047L);
+    values[valuesOffset++] = (int) ((block6 >> 41) & 2047L);
+    values[valuesOffset++] = (int) ((block6 >> 30) & 2047L);
+    values[valuesOffset++] = (int) ((block6 >> 19) & 2047L);
+    values[valuesOffset++] = (int) ((block6 >> 8) & 2047L);
+    unsigned long block7 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block6 & 255L) << 3) | (block7 >> 61));
+    values[valuesOffset++] = (int) ((block7 >> 50) & 2047L);
+    values[valuesOffset++] = (int) ((block7 >> 39) & 2047L);
+    values[valuesOffset++] = (int) ((block7 >> 28) & 2047L);
+    values[valuesOffset++] = (int) ((block7 >> 17) & 2047L);
+    values[valuesOffset++] = (int) ((block7 >> 6) & 2047L);
+    unsigned long block8 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block7 & 63L) << 5) | (block8 >> 59));
+    values[valuesOffset++] = (int) ((block8 >> 48) & 2047L);
+    values[valuesOffset++] = (int) ((block8 >> 37) & 2047L);
+    values[valuesOffset++] = (int) ((block8 >> 26) & 2047L);
+    values[valuesOffset++] = (int) ((block8 >> 15) & 2047L);
+    values[valuesOffset++] = (int) ((block8 >> 4) & 2047L);
+    unsigned long block9 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block8 & 15L) << 7) | (block9 >> 57));
+    values[valuesOffset++] = (int) ((block9 >> 46) & 2047L);
+    values[valuesOffset++] = (int) ((block9 >> 35) & 2047L);
+    values[valuesOffset++] = (int) ((block9 >> 24) & 2047L);
+    values[valuesOffset++] = (int) ((block9 >> 13) & 2047L);
+    values[valuesOffset++] = (int) ((block9 >> 2) & 2047L);
+    unsigned long block10 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block9 & 3L) << 9) | (block10 >> 55));
+    values[valuesOffset++] = (int) ((block10 >> 44) & 2047L);
+    values[valuesOffset++] = (int) ((block10 >> 33) & 2047L);
+    values[valuesOffset++] = (int) ((block10 >> 22) & 2047L);
+    values[valuesOffset++] = (int) ((block10 >> 11) & 2047L);
+    values[valuesOffset++] = (int) (block10 & 2047L);
+  }
+}
+
+static unsigned int getPacked64_12(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 12;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 12 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0xfffL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0xfffL;
+}
+
+static void decodePacked64_12(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 8; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 52);
+    values[valuesOffset++] = (int) ((block0 >> 40) & 4095L);
+    values[valuesOffset++] = (int) ((block0 >> 28) & 4095L);
+    values[valuesOffset++] = (int) ((block0 >> 16) & 4095L);
+    values[valuesOffset++] = (int) ((block0 >> 4) & 4095L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 15L) << 8) | (block1 >> 56));
+    values[valuesOffset++] = (int) ((block1 >> 44) & 4095L);
+    values[valuesOffset++] = (int) ((block1 >> 32) & 4095L);
+    values[valuesOffset++] = (int) ((block1 >> 20) & 4095L);
+    values[valuesOffset++] = (int) ((block1 >> 8) & 4095L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 255L) << 4) | (block2 >> 60));
+    values[valuesOffset++] = (int) ((block2 >> 48) & 4095L);
+    values[valuesOffset++] = (int) ((block2 >> 36) & 4095L);
+    values[valuesOffset++] = (int) ((block2 >> 24) & 4095L);
+    values[valuesOffset++] = (int) ((block2 >> 12) & 4095L);
+    values[valuesOffset++] = (int) (block2 & 4095L);
+  }
+}
+
+static unsigned int getPacked64_13(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 13;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 13 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0x1fffL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0x1fffL;
+}
+
+static void decodePacked64_13(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 2; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 51);
+    values[valuesOffset++] = (int) ((block0 >> 38) & 8191L);
+    values[valuesOffset++] = (int) ((block0 >> 25) & 8191L);
+    values[valuesOffset++] = (int) ((block0 >> 12) & 8191L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 4095L) << 1) | (block1 >> 63));
+    values[valuesOffset++] = (int) ((block1 >> 50) & 8191L);
+    values[valuesOffset++] = (int) ((block1 >> 37) & 8191L);
+    values[valuesOffset++] = (int) ((block1 >> 24) & 8191L);
+    values[valuesOffset++] = (int) ((block1 >> 11) & 8191L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 2047L) << 2) | (block2 >> 62));
+    values[valuesOffset++] = (int) ((block2 >> 49) & 8191L);
+    values[valuesOffset++] = (int) ((block2 >> 36) & 8191L);
+    values[valuesOffset++] = (int) ((block2 >> 23) & 8191L);
+    values[valuesOffset++] = (int) ((block2 >> 10) & 8191L);
+    unsigned long block3 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block2 & 1023L) << 3) | (block3 >> 61));
+    values[valuesOffset++] = (int) ((block3 >> 48) & 8191L);
+    values[valuesOffset++] = (int) ((block3 >> 35) & 8191L);
+    values[valuesOffset++] = (int) ((block3 >> 22) & 8191L);
+    values[valuesOffset++] = (int) ((block3 >> 9) & 8191L);
+    unsigned long block4 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block3 & 511L) << 4) | (block4 >> 60));
+    values[valuesOffset++] = (int) ((block4 >> 47) & 8191L);
+    values[valuesOffset++] = (int) ((block4 >> 34) & 8191L);
+    values[valuesOffset++] = (int) ((block4 >> 21) & 8191L);
+    values[valuesOffset++] = (int) ((block4 >> 8) & 8191L);
+    unsigned long block5 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block4 & 255L) << 5) | (block5 >> 59));
+    values[valuesOffset++] = (int) ((block5 >> 46) & 8191L);
+    values[valuesOffset++] = (int) ((block5 >> 33) & 8191L);
+    values[valuesOffset++] = (int) ((block5 >> 20) & 8191L);
+    values[valuesOffset++] = (int) ((block5 >> 7) & 8191L);
+    unsigned long block6 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block5 & 127L) << 6) | (block6 >> 58));
+    values[valuesOffset++] = (int) ((block6 >> 45) & 8191L);
+    values[valuesOffset++] = (int) ((block6 >> 32) & 8191L);
+    values[valuesOffset++] = (int) ((block6 >> 19) & 8191L);
+    values[valuesOffset++] = (int) ((block6 >> 6) & 8191L);
+    unsigned long block7 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block6 & 63L) << 7) | (block7 >> 57));
+    values[valuesOffset++] = (int) ((block7 >> 44) & 8191L);
+    values[valuesOffset++] = (int) ((block7 >> 31) & 8191L);
+    values[valuesOffset++] = (int) ((block7 >> 18) & 8191L);
+    values[valuesOffset++] = (int) ((block7 >> 5) & 8191L);
+    unsigned long block8 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block7 & 31L) << 8) | (block8 >> 56));
+    values[valuesOffset++] = (int) ((block8 >> 43) & 8191L);
+    values[valuesOffset++] = (int) ((block8 >> 30) & 8191L);
+    values[valuesOffset++] = (int) ((block8 >> 17) & 8191L);
+    values[valuesOffset++] = (int) ((block8 >> 4) & 8191L);
+    unsigned long block9 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block8 & 15L) << 9) | (block9 >> 55));
+    values[valuesOffset++] = (int) ((block9 >> 42) & 8191L);
+    values[valuesOffset++] = (int) ((block9 >> 29) & 8191L);
+    values[valuesOffset++] = (int) ((block9 >> 16) & 8191L);
+    values[valuesOffset++] = (int) ((block9 >> 3) & 8191L);
+    unsigned long block10 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block9 & 7L) << 10) | (block10 >> 54));
+    values[valuesOffset++] = (int) ((block10 >> 41) & 8191L);
+    values[valuesOffset++] = (int) ((block10 >> 28) & 8191L);
+    values[valuesOffset++] = (int) ((block10 >> 15) & 8191L);
+    values[valuesOffset++] = (int) ((block10 >> 2) & 8191L);
+    unsigned long block11 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block10 & 3L) << 11) | (block11 >> 53));
+    values[valuesOffset++] = (int) ((block11 >> 40) & 8191L);
+    values[valuesOffset++] = (int) ((block11 >> 27) & 8191L);
+    values[valuesOffset++] = (int) ((block11 >> 14) & 8191L);
+    values[valuesOffset++] = (int) ((block11 >> 1) & 8191L);
+    unsigned long block12 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block11 & 1L) << 12) | (block12 >> 52));
+    values[valuesOffset++] = (int) ((block12 >> 39) & 8191L);
+    values[valuesOffset++] = (int) ((block12 >> 26) & 8191L);
+    values[valuesOffset++] = (int) ((block12 >> 13) & 8191L);
+    values[valuesOffset++] = (int) (block12 & 8191L);
+  }
+}
+
+static unsigned int getPacked64_14(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 14;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 14 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0x3fffL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0x3fffL;
+}
+
+static void decodePacked64_14(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 4; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 50);
+    values[valuesOffset++] = (int) ((block0 >> 36) & 16383L);
+    values[valuesOffset++] = (int) ((block0 >> 22) & 16383L);
+    values[valuesOffset++] = (int) ((block0 >> 8) & 16383L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 255L) << 6) | (block1 >> 58));
+    values[valuesOffset++] = (int) ((block1 >> 44) & 16383L);
+    values[valuesOffset++] = (int) ((block1 >> 30) & 16383L);
+    values[valuesOffset++] = (int) ((block1 >> 16) & 16383L);
+    values[valuesOffset++] = (int) ((block1 >> 2) & 16383L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 3L) << 12) | (block2 >> 52));
+    values[valuesOffset++] = (int) ((block2 >> 38) & 16383L);
+    values[valuesOffset++] = (int) ((block2 >> 24) & 16383L);
+    values[valuesOffset++] = (int) ((block2 >> 10) & 16383L);
+    unsigned long block3 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block2 & 1023L) << 4) | (block3 >> 60));
+    values[valuesOffset++] = (int) ((block3 >> 46) & 16383L);
+    values[valuesOffset++] = (int) ((block3 >> 32) & 16383L);
+    values[valuesOffset++] = (int) ((block3 >> 18) & 16383L);
+    values[valuesOffset++] = (int) ((block3 >> 4) & 16383L);
+    unsigned long block4 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block3 & 15L) << 10) | (block4 >> 54));
+    values[valuesOffset++] = (int) ((block4 >> 40) & 16383L);
+    values[valuesOffset++] = (int) ((block4 >> 26) & 16383L);
+    values[valuesOffset++] = (int) ((block4 >> 12) & 16383L);
+    unsigned long block5 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block4 & 4095L) << 2) | (block5 >> 62));
+    values[valuesOffset++] = (int) ((block5 >> 48) & 16383L);
+    values[valuesOffset++] = (int) ((block5 >> 34) & 16383L);
+    values[valuesOffset++] = (int) ((block5 >> 20) & 16383L);
+    values[valuesOffset++] = (int) ((block5 >> 6) & 16383L);
+    unsigned long block6 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block5 & 63L) << 8) | (block6 >> 56));
+    values[valuesOffset++] = (int) ((block6 >> 42) & 16383L);
+    values[valuesOffset++] = (int) ((block6 >> 28) & 16383L);
+    values[valuesOffset++] = (int) ((block6 >> 14) & 16383L);
+    values[valuesOffset++] = (int) (block6 & 16383L);
+  }
+}
+
+static unsigned int getPacked64_15(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 15;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 15 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0x7fffL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0x7fffL;
+}
+
+static void decodePacked64_15(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 2; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 49);
+    values[valuesOffset++] = (int) ((block0 >> 34) & 32767L);
+    values[valuesOffset++] = (int) ((block0 >> 19) & 32767L);
+    values[valuesOffset++] = (int) ((block0 >> 4) & 32767L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 15L) << 11) | (block1 >> 53));
+    values[valuesOffset++] = (int) ((block1 >> 38) & 32767L);
+    values[valuesOffset++] = (int) ((block1 >> 23) & 32767L);
+    values[valuesOffset++] = (int) ((block1 >> 8) & 32767L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 255L) << 7) | (block2 >> 57));
+    values[valuesOffset++] = (int) ((block2 >> 42) & 32767L);
+    values[valuesOffset++] = (int) ((block2 >> 27) & 32767L);
+    values[valuesOffset++] = (int) ((block2 >> 12) & 32767L);
+    unsigned long block3 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block2 & 4095L) << 3) | (block3 >> 61));
+    values[valuesOffset++] = (int) ((block3 >> 46) & 32767L);
+    values[valuesOffset++] = (int) ((block3 >> 31) & 32767L);
+    values[valuesOffset++] = (int) ((block3 >> 16) & 32767L);
+    values[valuesOffset++] = (int) ((block3 >> 1) & 32767L);
+    unsigned long block4 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block3 & 1L) << 14) | (block4 >> 50));
+    values[valuesOffset++] = (int) ((block4 >> 35) & 32767L);
+    values[valuesOffset++] = (int) ((block4 >> 20) & 32767L);
+    values[valuesOffset++] = (int) ((block4 >> 5) & 32767L);
+    unsigned long block5 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block4 & 31L) << 10) | (block5 >> 54));
+    values[valuesOffset++] = (int) ((block5 >> 39) & 32767L);
+    values[valuesOffset++] = (int) ((block5 >> 24) & 32767L);
+    values[valuesOffset++] = (int) ((block5 >> 9) & 32767L);
+    unsigned long block6 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block5 & 511L) << 6) | (block6 >> 58));
+    values[valuesOffset++] = (int) ((block6 >> 43) & 32767L);
+    values[valuesOffset++] = (int) ((block6 >> 28) & 32767L);
+    values[valuesOffset++] = (int) ((block6 >> 13) & 32767L);
+    unsigned long block7 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block6 & 8191L) << 2) | (block7 >> 62));
+    values[valuesOffset++] = (int) ((block7 >> 47) & 32767L);
+    values[valuesOffset++] = (int) ((block7 >> 32) & 32767L);
+    values[valuesOffset++] = (int) ((block7 >> 17) & 32767L);
+    values[valuesOffset++] = (int) ((block7 >> 2) & 32767L);
+    unsigned long block8 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block7 & 3L) << 13) | (block8 >> 51));
+    values[valuesOffset++] = (int) ((block8 >> 36) & 32767L);
+    values[valuesOffset++] = (int) ((block8 >> 21) & 32767L);
+    values[valuesOffset++] = (int) ((block8 >> 6) & 32767L);
+    unsigned long block9 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block8 & 63L) << 9) | (block9 >> 55));
+    values[valuesOffset++] = (int) ((block9 >> 40) & 32767L);
+    values[valuesOffset++] = (int) ((block9 >> 25) & 32767L);
+    values[valuesOffset++] = (int) ((block9 >> 10) & 32767L);
+    unsigned long block10 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block9 & 1023L) << 5) | (block10 >> 59));
+    values[valuesOffset++] = (int) ((block10 >> 44) & 32767L);
+    values[valuesOffset++] = (int) ((block10 >> 29) & 32767L);
+    values[valuesOffset++] = (int) ((block10 >> 14) & 32767L);
+    unsigned long block11 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block10 & 16383L) << 1) | (block11 >> 63));
+    values[valuesOffset++] = (int) ((block11 >> 48) & 32767L);
+    values[valuesOffset++] = (int) ((block11 >> 33) & 32767L);
+    values[valuesOffset++] = (int) ((block11 >> 18) & 32767L);
+    values[valuesOffset++] = (int) ((block11 >> 3) & 32767L);
+    unsigned long block12 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block11 & 7L) << 12) | (block12 >> 52));
+    values[valuesOffset++] = (int) ((block12 >> 37) & 32767L);
+    values[valuesOffset++] = (int) ((block12 >> 22) & 32767L);
+    values[valuesOffset++] = (int) ((block12 >> 7) & 32767L);
+    unsigned long block13 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block12 & 127L) << 8) | (block13 >> 56));
+    values[valuesOffset++] = (int) ((block13 >> 41) & 32767L);
+    values[valuesOffset++] = (int) ((block13 >> 26) & 32767L);
+    values[valuesOffset++] = (int) ((block13 >> 11) & 32767L);
+    unsigned long block14 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block13 & 2047L) << 4) | (block14 >> 60));
+    values[valuesOffset++] = (int) ((block14 >> 45) & 32767L);
+    values[valuesOffset++] = (int) ((block14 >> 30) & 32767L);
+    values[valuesOffset++] = (int) ((block14 >> 15) & 32767L);
+    values[valuesOffset++] = (int) (block14 & 32767L);
+  }
+}
+
+static unsigned int getPacked64_16(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 16;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  return (packed[elementPos] >> (64 - 16 - (majorBitPos & 63))) & 0xffffL;
+}
+
+static void decodePacked64_16(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 32; ++i) {
+    unsigned long block = blocks[blocksOffset++];
+    for (int shift = 48; shift >= 0; shift -= 16) {
+      values[valuesOffset++] = (int) ((block >> shift) & 65535);
+    }
+  }
+}
+
+static unsigned int getPacked64_17(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 17;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 17 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0x1ffffL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0x1ffffL;
+}
+
+static void decodePacked64_17(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 2; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 47);
+    values[valuesOffset++] = (int) ((block0 >> 30) & 131071L);
+    values[valuesOffset++] = (int) ((block0 >> 13) & 131071L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 8191L) << 4) | (block1 >> 60));
+    values[valuesOffset++] = (int) ((block1 >> 43) & 131071L);
+    values[valuesOffset++] = (int) ((block1 >> 26) & 131071L);
+    values[valuesOffset++] = (int) ((block1 >> 9) & 131071L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 511L) << 8) | (block2 >> 56));
+    values[valuesOffset++] = (int) ((block2 >> 39) & 131071L);
+    values[valuesOffset++] = (int) ((block2 >> 22) & 131071L);
+    values[valuesOffset++] = (int) ((block2 >> 5) & 131071L);
+    unsigned long block3 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block2 & 31L) << 12) | (block3 >> 52));
+    values[valuesOffset++] = (int) ((block3 >> 35) & 131071L);
+    values[valuesOffset++] = (int) ((block3 >> 18) & 131071L);
+    values[valuesOffset++] = (int) ((block3 >> 1) & 131071L);
+    unsigned long block4 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block3 & 1L) << 16) | (block4 >> 48));
+    values[valuesOffset++] = (int) ((block4 >> 31) & 131071L);
+    values[valuesOffset++] = (int) ((block4 >> 14) & 131071L);
+    unsigned long block5 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block4 & 16383L) << 3) | (block5 >> 61));
+    values[valuesOffset++] = (int) ((block5 >> 44) & 131071L);
+    values[valuesOffset++] = (int) ((block5 >> 27) & 131071L);
+    values[valuesOffset++] = (int) ((block5 >> 10) & 131071L);
+    unsigned long block6 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block5 & 1023L) << 7) | (block6 >> 57));
+    values[valuesOffset++] = (int) ((block6 >> 40) & 131071L);
+    values[valuesOffset++] = (int) ((block6 >> 23) & 131071L);
+    values[valuesOffset++] = (int) ((block6 >> 6) & 131071L);
+    unsigned long block7 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block6 & 63L) << 11) | (block7 >> 53));
+    values[valuesOffset++] = (int) ((block7 >> 36) & 131071L);
+    values[valuesOffset++] = (int) ((block7 >> 19) & 131071L);
+    values[valuesOffset++] = (int) ((block7 >> 2) & 131071L);
+    unsigned long block8 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block7 & 3L) << 15) | (block8 >> 49));
+    values[valuesOffset++] = (int) ((block8 >> 32) & 131071L);
+    values[valuesOffset++] = (int) ((block8 >> 15) & 131071L);
+    unsigned long block9 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block8 & 32767L) << 2) | (block9 >> 62));
+    values[valuesOffset++] = (int) ((block9 >> 45) & 131071L);
+    values[valuesOffset++] = (int) ((block9 >> 28) & 131071L);
+    values[valuesOffset++] = (int) ((block9 >> 11) & 131071L);
+    unsigned long block10 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block9 & 2047L) << 6) | (block10 >> 58));
+    values[valuesOffset++] = (int) ((block10 >> 41) & 131071L);
+    values[valuesOffset++] = (int) ((block10 >> 24) & 131071L);
+    values[valuesOffset++] = (int) ((block10 >> 7) & 131071L);
+    unsigned long block11 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block10 & 127L) << 10) | (block11 >> 54));
+    values[valuesOffset++] = (int) ((block11 >> 37) & 131071L);
+    values[valuesOffset++] = (int) ((block11 >> 20) & 131071L);
+    values[valuesOffset++] = (int) ((block11 >> 3) & 131071L);
+    unsigned long block12 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block11 & 7L) << 14) | (block12 >> 50));
+    values[valuesOffset++] = (int) ((block12 >> 33) & 131071L);
+    values[valuesOffset++] = (int) ((block12 >> 16) & 131071L);
+    unsigned long block13 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block12 & 65535L) << 1) | (block13 >> 63));
+    values[valuesOffset++] = (int) ((block13 >> 46) & 131071L);
+    values[valuesOffset++] = (int) ((block13 >> 29) & 131071L);
+    values[valuesOffset++] = (int) ((block13 >> 12) & 131071L);
+    unsigned long block14 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block13 & 4095L) << 5) | (block14 >> 59));
+    values[valuesOffset++] = (int) ((block14 >> 42) & 131071L);
+    values[valuesOffset++] = (int) ((block14 >> 25) & 131071L);
+    values[valuesOffset++] = (int) ((block14 >> 8) & 131071L);
+    unsigned long block15 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block14 & 255L) << 9) | (block15 >> 55));
+    values[valuesOffset++] = (int) ((block15 >> 38) & 131071L);
+    values[valuesOffset++] = (int) ((block15 >> 21) & 131071L);
+    values[valuesOffset++] = (int) ((block15 >> 4) & 131071L);
+    unsigned long block16 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block15 & 15L) << 13) | (block16 >> 51));
+    values[valuesOffset++] = (int) ((block16 >> 34) & 131071L);
+    values[valuesOffset++] = (int) ((block16 >> 17) & 131071L);
+    values[valuesOffset++] = (int) (block16 & 131071L);
+  }
+}
+
+static unsigned int getPacked64_18(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 18;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 18 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0x3ffffL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0x3ffffL;
+}
+
+static void decodePacked64_18(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 4; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 46);
+    values[valuesOffset++] = (int) ((block0 >> 28) & 262143L);
+    values[valuesOffset++] = (int) ((block0 >> 10) & 262143L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 1023L) << 8) | (block1 >> 56));
+    values[valuesOffset++] = (int) ((block1 >> 38) & 262143L);
+    values[valuesOffset++] = (int) ((block1 >> 20) & 262143L);
+    values[valuesOffset++] = (int) ((block1 >> 2) & 262143L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 3L) << 16) | (block2 >> 48));
+    values[valuesOffset++] = (int) ((block2 >> 30) & 262143L);
+    values[valuesOffset++] = (int) ((block2 >> 12) & 262143L);
+    unsigned long block3 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block2 & 4095L) << 6) | (block3 >> 58));
+    values[valuesOffset++] = (int) ((block3 >> 40) & 262143L);
+    values[valuesOffset++] = (int) ((block3 >> 22) & 262143L);
+    values[valuesOffset++] = (int) ((block3 >> 4) & 262143L);
+    unsigned long block4 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block3 & 15L) << 14) | (block4 >> 50));
+    values[valuesOffset++] = (int) ((block4 >> 32) & 262143L);
+    values[valuesOffset++] = (int) ((block4 >> 14) & 262143L);
+    unsigned long block5 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block4 & 16383L) << 4) | (block5 >> 60));
+    values[valuesOffset++] = (int) ((block5 >> 42) & 262143L);
+    values[valuesOffset++] = (int) ((block5 >> 24) & 262143L);
+    values[valuesOffset++] = (int) ((block5 >> 6) & 262143L);
+    unsigned long block6 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block5 & 63L) << 12) | (block6 >> 52));
+    values[valuesOffset++] = (int) ((block6 >> 34) & 262143L);
+    values[valuesOffset++] = (int) ((block6 >> 16) & 262143L);
+    unsigned long block7 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block6 & 65535L) << 2) | (block7 >> 62));
+    values[valuesOffset++] = (int) ((block7 >> 44) & 262143L);
+    values[valuesOffset++] = (int) ((block7 >> 26) & 262143L);
+    values[valuesOffset++] = (int) ((block7 >> 8) & 262143L);
+    unsigned long block8 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block7 & 255L) << 10) | (block8 >> 54));
+    values[valuesOffset++] = (int) ((block8 >> 36) & 262143L);
+    values[valuesOffset++] = (int) ((block8 >> 18) & 262143L);
+    values[valuesOffset++] = (int) (block8 & 262143L);
+  }
+}
+
+static unsigned int getPacked64_19(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 19;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 19 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0x7ffffL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0x7ffffL;
+}
+
+static void decodePacked64_19(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 2; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 45);
+    values[valuesOffset++] = (int) ((block0 >> 26) & 524287L);
+    values[valuesOffset++] = (int) ((block0 >> 7) & 524287L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 127L) << 12) | (block1 >> 52));
+    values[valuesOffset++] = (int) ((block1 >> 33) & 524287L);
+    values[valuesOffset++] = (int) ((block1 >> 14) & 524287L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 16383L) << 5) | (block2 >> 59));
+    values[valuesOffset++] = (int) ((block2 >> 40) & 524287L);
+    values[valuesOffset++] = (int) ((block2 >> 21) & 524287L);
+    values[valuesOffset++] = (int) ((block2 >> 2) & 524287L);
+    unsigned long block3 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block2 & 3L) << 17) | (block3 >> 47));
+    values[valuesOffset++] = (int) ((block3 >> 28) & 524287L);
+    values[valuesOffset++] = (int) ((block3 >> 9) & 524287L);
+    unsigned long block4 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block3 & 511L) << 10) | (block4 >> 54));
+    values[valuesOffset++] = (int) ((block4 >> 35) & 524287L);
+    values[valuesOffset++] = (int) ((block4 >> 16) & 524287L);
+    unsigned long block5 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block4 & 65535L) << 3) | (block5 >> 61));
+    values[valuesOffset++] = (int) ((block5 >> 42) & 524287L);
+    values[valuesOffset++] = (int) ((block5 >> 23) & 524287L);
+    values[valuesOffset++] = (int) ((block5 >> 4) & 524287L);
+    unsigned long block6 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block5 & 15L) << 15) | (block6 >> 49));
+    values[valuesOffset++] = (int) ((block6 >> 30) & 524287L);
+    values[valuesOffset++] = (int) ((block6 >> 11) & 524287L);
+    unsigned long block7 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block6 & 2047L) << 8) | (block7 >> 56));
+    values[valuesOffset++] = (int) ((block7 >> 37) & 524287L);
+    values[valuesOffset++] = (int) ((block7 >> 18) & 524287L);
+    unsigned long block8 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block7 & 262143L) << 1) | (block8 >> 63));
+    values[valuesOffset++] = (int) ((block8 >> 44) & 524287L);
+    values[valuesOffset++] = (int) ((block8 >> 25) & 524287L);
+    values[valuesOffset++] = (int) ((block8 >> 6) & 524287L);
+    unsigned long block9 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block8 & 63L) << 13) | (block9 >> 51));
+    values[valuesOffset++] = (int) ((block9 >> 32) & 524287L);
+    values[valuesOffset++] = (int) ((block9 >> 13) & 524287L);
+    unsigned long block10 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block9 & 8191L) << 6) | (block10 >> 58));
+    values[valuesOffset++] = (int) ((block10 >> 39) & 524287L);
+    values[valuesOffset++] = (int) ((block10 >> 20) & 524287L);
+    values[valuesOffset++] = (int) ((block10 >> 1) & 524287L);
+    unsigned long block11 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block10 & 1L) << 18) | (block11 >> 46));
+    values[valuesOffset++] = (int) ((block11 >> 27) & 524287L);
+    values[valuesOffset++] = (int) ((block11 >> 8) & 524287L);
+    unsigned long block12 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block11 & 255L) << 11) | (block12 >> 53));
+    values[valuesOffset++] = (int) ((block12 >> 34) & 524287L);
+    values[valuesOffset++] = (int) ((block12 >> 15) & 524287L);
+    unsigned long block13 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block12 & 32767L) << 4) | (block13 >> 60));
+    values[valuesOffset++] = (int) ((block13 >> 41) & 524287L);
+    values[valuesOffset++] = (int) ((block13 >> 22) & 524287L);
+    values[valuesOffset++] = (int) ((block13 >> 3) & 524287L);
+    unsigned long block14 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block13 & 7L) << 16) | (block14 >> 48));
+    values[valuesOffset++] = (int) ((block14 >> 29) & 524287L);
+    values[valuesOffset++] = (int) ((block14 >> 10) & 524287L);
+    unsigned long block15 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block14 & 1023L) << 9) | (block15 >> 55));
+    values[valuesOffset++] = (int) ((block15 >> 36) & 524287L);
+    values[valuesOffset++] = (int) ((block15 >> 17) & 524287L);
+    unsigned long block16 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block15 & 131071L) << 2) | (block16 >> 62));
+    values[valuesOffset++] = (int) ((block16 >> 43) & 524287L);
+    values[valuesOffset++] = (int) ((block16 >> 24) & 524287L);
+    values[valuesOffset++] = (int) ((block16 >> 5) & 524287L);
+    unsigned long block17 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block16 & 31L) << 14) | (block17 >> 50));
+    values[valuesOffset++] = (int) ((block17 >> 31) & 524287L);
+    values[valuesOffset++] = (int) ((block17 >> 12) & 524287L);
+    unsigned long block18 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block17 & 4095L) << 7) | (block18 >> 57));
+    values[valuesOffset++] = (int) ((block18 >> 38) & 524287L);
+    values[valuesOffset++] = (int) ((block18 >> 19) & 524287L);
+    values[valuesOffset++] = (int) (block18 & 524287L);
+  }
+}
+
+static unsigned int getPacked64_20(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 20;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 20 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0xfffffL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0xfffffL;
+}
+
+static void decodePacked64_20(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 8; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 44);
+    values[valuesOffset++] = (int) ((block0 >> 24) & 1048575L);
+    values[valuesOffset++] = (int) ((block0 >> 4) & 1048575L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 15L) << 16) | (block1 >> 48));
+    values[valuesOffset++] = (int) ((block1 >> 28) & 1048575L);
+    values[valuesOffset++] = (int) ((block1 >> 8) & 1048575L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 255L) << 12) | (block2 >> 52));
+    values[valuesOffset++] = (int) ((block2 >> 32) & 1048575L);
+    values[valuesOffset++] = (int) ((block2 >> 12) & 1048575L);
+    unsigned long block3 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block2 & 4095L) << 8) | (block3 >> 56));
+    values[valuesOffset++] = (int) ((block3 >> 36) & 1048575L);
+    values[valuesOffset++] = (int) ((block3 >> 16) & 1048575L);
+    unsigned long block4 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block3 & 65535L) << 4) | (block4 >> 60));
+    values[valuesOffset++] = (int) ((block4 >> 40) & 1048575L);
+    values[valuesOffset++] = (int) ((block4 >> 20) & 1048575L);
+    values[valuesOffset++] = (int) (block4 & 1048575L);
+  }
+}
+
+static unsigned int getPacked64_21(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 21;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 21 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0x1fffffL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0x1fffffL;
+}
+
+static void decodePacked64_21(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 2; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 43);
+    values[valuesOffset++] = (int) ((block0 >> 22) & 2097151L);
+    values[valuesOffset++] = (int) ((block0 >> 1) & 2097151L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 1L) << 20) | (block1 >> 44));
+    values[valuesOffset++] = (int) ((block1 >> 23) & 2097151L);
+    values[valuesOffset++] = (int) ((block1 >> 2) & 2097151L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 3L) << 19) | (block2 >> 45));
+    values[valuesOffset++] = (int) ((block2 >> 24) & 2097151L);
+    values[valuesOffset++] = (int) ((block2 >> 3) & 2097151L);
+    unsigned long block3 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block2 & 7L) << 18) | (block3 >> 46));
+    values[valuesOffset++] = (int) ((block3 >> 25) & 2097151L);
+    values[valuesOffset++] = (int) ((block3 >> 4) & 2097151L);
+    unsigned long block4 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block3 & 15L) << 17) | (block4 >> 47));
+    values[valuesOffset++] = (int) ((block4 >> 26) & 2097151L);
+    values[valuesOffset++] = (int) ((block4 >> 5) & 2097151L);
+    unsigned long block5 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block4 & 31L) << 16) | (block5 >> 48));
+    values[valuesOffset++] = (int) ((block5 >> 27) & 2097151L);
+    values[valuesOffset++] = (int) ((block5 >> 6) & 2097151L);
+    unsigned long block6 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block5 & 63L) << 15) | (block6 >> 49));
+    values[valuesOffset++] = (int) ((block6 >> 28) & 2097151L);
+    values[valuesOffset++] = (int) ((block6 >> 7) & 2097151L);
+    unsigned long block7 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block6 & 127L) << 14) | (block7 >> 50));
+    values[valuesOffset++] = (int) ((block7 >> 29) & 2097151L);
+    values[valuesOffset++] = (int) ((block7 >> 8) & 2097151L);
+    unsigned long block8 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block7 & 255L) << 13) | (block8 >> 51));
+    values[valuesOffset++] = (int) ((block8 >> 30) & 2097151L);
+    values[valuesOffset++] = (int) ((block8 >> 9) & 2097151L);
+    unsigned long block9 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block8 & 511L) << 12) | (block9 >> 52));
+    values[valuesOffset++] = (int) ((block9 >> 31) & 2097151L);
+    values[valuesOffset++] = (int) ((block9 >> 10) & 2097151L);
+    unsigned long block10 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block9 & 1023L) << 11) | (block10 >> 53));
+    values[valuesOffset++] = (int) ((block10 >> 32) & 2097151L);
+    values[valuesOffset++] = (int) ((block10 >> 11) & 2097151L);
+    unsigned long block11 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block10 & 2047L) << 10) | (block11 >> 54));
+    values[valuesOffset++] = (int) ((block11 >> 33) & 2097151L);
+    values[valuesOffset++] = (int) ((block11 >> 12) & 2097151L);
+    unsigned long block12 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block11 & 4095L) << 9) | (block12 >> 55));
+    values[valuesOffset++] = (int) ((block12 >> 34) & 2097151L);
+    values[valuesOffset++] = (int) ((block12 >> 13) & 2097151L);
+    unsigned long block13 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block12 & 8191L) << 8) | (block13 >> 56));
+    values[valuesOffset++] = (int) ((block13 >> 35) & 2097151L);
+    values[valuesOffset++] = (int) ((block13 >> 14) & 2097151L);
+    unsigned long block14 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block13 & 16383L) << 7) | (block14 >> 57));
+    values[valuesOffset++] = (int) ((block14 >> 36) & 2097151L);
+    values[valuesOffset++] = (int) ((block14 >> 15) & 2097151L);
+    unsigned long block15 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block14 & 32767L) << 6) | (block15 >> 58));
+    values[valuesOffset++] = (int) ((block15 >> 37) & 2097151L);
+    values[valuesOffset++] = (int) ((block15 >> 16) & 2097151L);
+    unsigned long block16 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block15 & 65535L) << 5) | (block16 >> 59));
+    values[valuesOffset++] = (int) ((block16 >> 38) & 2097151L);
+    values[valuesOffset++] = (int) ((block16 >> 17) & 2097151L);
+    unsigned long block17 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block16 & 131071L) << 4) | (block17 >> 60));
+    values[valuesOffset++] = (int) ((block17 >> 39) & 2097151L);
+    values[valuesOffset++] = (int) ((block17 >> 18) & 2097151L);
+    unsigned long block18 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block17 & 262143L) << 3) | (block18 >> 61));
+    values[valuesOffset++] = (int) ((block18 >> 40) & 2097151L);
+    values[valuesOffset++] = (int) ((block18 >> 19) & 2097151L);
+    unsigned long block19 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block18 & 524287L) << 2) | (block19 >> 62));
+    values[valuesOffset++] = (int) ((block19 >> 41) & 2097151L);
+    values[valuesOffset++] = (int) ((block19 >> 20) & 2097151L);
+    unsigned long block20 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block19 & 1048575L) << 1) | (block20 >> 63));
+    values[valuesOffset++] = (int) ((block20 >> 42) & 2097151L);
+    values[valuesOffset++] = (int) ((block20 >> 21) & 2097151L);
+    values[valuesOffset++] = (int) (block20 & 2097151L);
+  }
+}
+
+static unsigned int getPacked64_22(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 22;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 22 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0x3fffffL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0x3fffffL;
+}
+
+static void decodePacked64_22(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 4; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 42);
+    values[valuesOffset++] = (int) ((block0 >> 20) & 4194303L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 1048575L) << 2) | (block1 >> 62));
+    values[valuesOffset++] = (int) ((block1 >> 40) & 4194303L);
+    values[valuesOffset++] = (int) ((block1 >> 18) & 4194303L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 262143L) << 4) | (block2 >> 60));
+    values[valuesOffset++] = (int) ((block2 >> 38) & 4194303L);
+    values[valuesOffset++] = (int) ((block2 >> 16) & 4194303L);
+    unsigned long block3 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block2 & 65535L) << 6) | (block3 >> 58));
+    values[valuesOffset++] = (int) ((block3 >> 36) & 4194303L);
+    values[valuesOffset++] = (int) ((block3 >> 14) & 4194303L);
+    unsigned long block4 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block3 & 16383L) << 8) | (block4 >> 56));
+    values[valuesOffset++] = (int) ((block4 >> 34) & 4194303L);
+    values[valuesOffset++] = (int) ((block4 >> 12) & 4194303L);
+    unsigned long block5 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block4 & 4095L) << 10) | (block5 >> 54));
+    values[valuesOffset++] = (int) ((block5 >> 32) & 4194303L);
+    values[valuesOffset++] = (int) ((block5 >> 10) & 4194303L);
+    unsigned long block6 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block5 & 1023L) << 12) | (block6 >> 52));
+    values[valuesOffset++] = (int) ((block6 >> 30) & 4194303L);
+    values[valuesOffset++] = (int) ((block6 >> 8) & 4194303L);
+    unsigned long block7 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block6 & 255L) << 14) | (block7 >> 50));
+    values[valuesOffset++] = (int) ((block7 >> 28) & 4194303L);
+    values[valuesOffset++] = (int) ((block7 >> 6) & 4194303L);
+    unsigned long block8 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block7 & 63L) << 16) | (block8 >> 48));
+    values[valuesOffset++] = (int) ((block8 >> 26) & 4194303L);
+    values[valuesOffset++] = (int) ((block8 >> 4) & 4194303L);
+    unsigned long block9 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block8 & 15L) << 18) | (block9 >> 46));
+    values[valuesOffset++] = (int) ((block9 >> 24) & 4194303L);
+    values[valuesOffset++] = (int) ((block9 >> 2) & 4194303L);
+    unsigned long block10 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block9 & 3L) << 20) | (block10 >> 44));
+    values[valuesOffset++] = (int) ((block10 >> 22) & 4194303L);
+    values[valuesOffset++] = (int) (block10 & 4194303L);
+  }
+}
+
+static unsigned int getPacked64_23(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 23;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 23 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0x7fffffL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0x7fffffL;
+}
+
+static void decodePacked64_23(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 2; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 41);
+    values[valuesOffset++] = (int) ((block0 >> 18) & 8388607L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 262143L) << 5) | (block1 >> 59));
+    values[valuesOffset++] = (int) ((block1 >> 36) & 8388607L);
+    values[valuesOffset++] = (int) ((block1 >> 13) & 8388607L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 8191L) << 10) | (block2 >> 54));
+    values[valuesOffset++] = (int) ((block2 >> 31) & 8388607L);
+    values[valuesOffset++] = (int) ((block2 >> 8) & 8388607L);
+    unsigned long block3 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block2 & 255L) << 15) | (block3 >> 49));
+    values[valuesOffset++] = (int) ((block3 >> 26) & 8388607L);
+    values[valuesOffset++] = (int) ((block3 >> 3) & 8388607L);
+    unsigned long block4 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block3 & 7L) << 20) | (block4 >> 44));
+    values[valuesOffset++] = (int) ((block4 >> 21) & 8388607L);
+    unsigned long block5 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block4 & 2097151L) << 2) | (block5 >> 62));
+    values[valuesOffset++] = (int) ((block5 >> 39) & 8388607L);
+    values[valuesOffset++] = (int) ((block5 >> 16) & 8388607L);
+    unsigned long block6 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block5 & 65535L) << 7) | (block6 >> 57));
+    values[valuesOffset++] = (int) ((block6 >> 34) & 8388607L);
+    values[valuesOffset++] = (int) ((block6 >> 11) & 8388607L);
+    unsigned long block7 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block6 & 2047L) << 12) | (block7 >> 52));
+    values[valuesOffset++] = (int) ((block7 >> 29) & 8388607L);
+    values[valuesOffset++] = (int) ((block7 >> 6) & 8388607L);
+    unsigned long block8 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block7 & 63L) << 17) | (block8 >> 47));
+    values[valuesOffset++] = (int) ((block8 >> 24) & 8388607L);
+    values[valuesOffset++] = (int) ((block8 >> 1) & 8388607L);
+    unsigned long block9 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block8 & 1L) << 22) | (block9 >> 42));
+    values[valuesOffset++] = (int) ((block9 >> 19) & 8388607L);
+    unsigned long block10 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block9 & 524287L) << 4) | (block10 >> 60));
+    values[valuesOffset++] = (int) ((block10 >> 37) & 8388607L);
+    values[valuesOffset++] = (int) ((block10 >> 14) & 8388607L);
+    unsigned long block11 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block10 & 16383L) << 9) | (block11 >> 55));
+    values[valuesOffset++] = (int) ((block11 >> 32) & 8388607L);
+    values[valuesOffset++] = (int) ((block11 >> 9) & 8388607L);
+    unsigned long block12 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block11 & 511L) << 14) | (block12 >> 50));
+    values[valuesOffset++] = (int) ((block12 >> 27) & 8388607L);
+    values[valuesOffset++] = (int) ((block12 >> 4) & 8388607L);
+    unsigned long block13 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block12 & 15L) << 19) | (block13 >> 45));
+    values[valuesOffset++] = (int) ((block13 >> 22) & 8388607L);
+    unsigned long block14 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block13 & 4194303L) << 1) | (block14 >> 63));
+    values[valuesOffset++] = (int) ((block14 >> 40) & 8388607L);
+    values[valuesOffset++] = (int) ((block14 >> 17) & 8388607L);
+    unsigned long block15 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block14 & 131071L) << 6) | (block15 >> 58));
+    values[valuesOffset++] = (int) ((block15 >> 35) & 8388607L);
+    values[valuesOffset++] = (int) ((block15 >> 12) & 8388607L);
+    unsigned long block16 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block15 & 4095L) << 11) | (block16 >> 53));
+    values[valuesOffset++] = (int) ((block16 >> 30) & 8388607L);
+    values[valuesOffset++] = (int) ((block16 >> 7) & 8388607L);
+    unsigned long block17 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block16 & 127L) << 16) | (block17 >> 48));
+    values[valuesOffset++] = (int) ((block17 >> 25) & 8388607L);
+    values[valuesOffset++] = (int) ((block17 >> 2) & 8388607L);
+    unsigned long block18 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block17 & 3L) << 21) | (block18 >> 43));
+    values[valuesOffset++] = (int) ((block18 >> 20) & 8388607L);
+    unsigned long block19 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block18 & 1048575L) << 3) | (block19 >> 61));
+    values[valuesOffset++] = (int) ((block19 >> 38) & 8388607L);
+    values[valuesOffset++] = (int) ((block19 >> 15) & 8388607L);
+    unsigned long block20 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block19 & 32767L) << 8) | (block20 >> 56));
+    values[valuesOffset++] = (int) ((block20 >> 33) & 8388607L);
+    values[valuesOffset++] = (int) ((block20 >> 10) & 8388607L);
+    unsigned long block21 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block20 & 1023L) << 13) | (block21 >> 51));
+    values[valuesOffset++] = (int) ((block21 >> 28) & 8388607L);
+    values[valuesOffset++] = (int) ((block21 >> 5) & 8388607L);
+    unsigned long block22 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block21 & 31L) << 18) | (block22 >> 46));
+    values[valuesOffset++] = (int) ((block22 >> 23) & 8388607L);
+    values[valuesOffset++] = (int) (block22 & 8388607L);
+  }
+}
+
+static unsigned int getPacked64_24(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 24;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 24 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0xffffffL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0xffffffL;
+}
+
+static void decodePacked64_24(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 16; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 40);
+    values[valuesOffset++] = (int) ((block0 >> 16) & 16777215L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 65535L) << 8) | (block1 >> 56));
+    values[valuesOffset++] = (int) ((block1 >> 32) & 16777215L);
+    values[valuesOffset++] = (int) ((block1 >> 8) & 16777215L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 255L) << 16) | (block2 >> 48));
+    values[valuesOffset++] = (int) ((block2 >> 24) & 16777215L);
+    values[valuesOffset++] = (int) (block2 & 16777215L);
+  }
+}
+
+static unsigned int getPacked64_25(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 25;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 25 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0x1ffffffL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0x1ffffffL;
+}
+
+static void decodePacked64_25(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 2; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 39);
+    values[valuesOffset++] = (int) ((block0 >> 14) & 33554431L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 16383L) << 11) | (block1 >> 53));
+    values[valuesOffset++] = (int) ((block1 >> 28) & 33554431L);
+    values[valuesOffset++] = (int) ((block1 >> 3) & 33554431L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 7L) << 22) | (block2 >> 42));
+    values[valuesOffset++] = (int) ((block2 >> 17) & 33554431L);
+    unsigned long block3 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block2 & 131071L) << 8) | (block3 >> 56));
+    values[valuesOffset++] = (int) ((block3 >> 31) & 33554431L);
+    values[valuesOffset++] = (int) ((block3 >> 6) & 33554431L);
+    unsigned long block4 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block3 & 63L) << 19) | (block4 >> 45));
+    values[valuesOffset++] = (int) ((block4 >> 20) & 33554431L);
+    unsigned long block5 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block4 & 1048575L) << 5) | (block5 >> 59));
+    values[valuesOffset++] = (int) ((block5 >> 34) & 33554431L);
+    values[valuesOffset++] = (int) ((block5 >> 9) & 33554431L);
+    unsigned long block6 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block5 & 511L) << 16) | (block6 >> 48));
+    values[valuesOffset++] = (int) ((block6 >> 23) & 33554431L);
+    unsigned long block7 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block6 & 8388607L) << 2) | (block7 >> 62));
+    values[valuesOffset++] = (int) ((block7 >> 37) & 33554431L);
+    values[valuesOffset++] = (int) ((block7 >> 12) & 33554431L);
+    unsigned long block8 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block7 & 4095L) << 13) | (block8 >> 51));
+    values[valuesOffset++] = (int) ((block8 >> 26) & 33554431L);
+    values[valuesOffset++] = (int) ((block8 >> 1) & 33554431L);
+    unsigned long block9 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block8 & 1L) << 24) | (block9 >> 40));
+    values[valuesOffset++] = (int) ((block9 >> 15) & 33554431L);
+    unsigned long block10 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block9 & 32767L) << 10) | (block10 >> 54));
+    values[valuesOffset++] = (int) ((block10 >> 29) & 33554431L);
+    values[valuesOffset++] = (int) ((block10 >> 4) & 33554431L);
+    unsigned long block11 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block10 & 15L) << 21) | (block11 >> 43));
+    values[valuesOffset++] = (int) ((block11 >> 18) & 33554431L);
+    unsigned long block12 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block11 & 262143L) << 7) | (block12 >> 57));
+    values[valuesOffset++] = (int) ((block12 >> 32) & 33554431L);
+    values[valuesOffset++] = (int) ((block12 >> 7) & 33554431L);
+    unsigned long block13 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block12 & 127L) << 18) | (block13 >> 46));
+    values[valuesOffset++] = (int) ((block13 >> 21) & 33554431L);
+    unsigned long block14 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block13 & 2097151L) << 4) | (block14 >> 60));
+    values[valuesOffset++] = (int) ((block14 >> 35) & 33554431L);
+    values[valuesOffset++] = (int) ((block14 >> 10) & 33554431L);
+    unsigned long block15 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block14 & 1023L) << 15) | (block15 >> 49));
+    values[valuesOffset++] = (int) ((block15 >> 24) & 33554431L);
+    unsigned long block16 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block15 & 16777215L) << 1) | (block16 >> 63));
+    values[valuesOffset++] = (int) ((block16 >> 38) & 33554431L);
+    values[valuesOffset++] = (int) ((block16 >> 13) & 33554431L);
+    unsigned long block17 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block16 & 8191L) << 12) | (block17 >> 52));
+    values[valuesOffset++] = (int) ((block17 >> 27) & 33554431L);
+    values[valuesOffset++] = (int) ((block17 >> 2) & 33554431L);
+    unsigned long block18 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block17 & 3L) << 23) | (block18 >> 41));
+    values[valuesOffset++] = (int) ((block18 >> 16) & 33554431L);
+    unsigned long block19 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block18 & 65535L) << 9) | (block19 >> 55));
+    values[valuesOffset++] = (int) ((block19 >> 30) & 33554431L);
+    values[valuesOffset++] = (int) ((block19 >> 5) & 33554431L);
+    unsigned long block20 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block19 & 31L) << 20) | (block20 >> 44));
+    values[valuesOffset++] = (int) ((block20 >> 19) & 33554431L);
+    unsigned long block21 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block20 & 524287L) << 6) | (block21 >> 58));
+    values[valuesOffset++] = (int) ((block21 >> 33) & 33554431L);
+    values[valuesOffset++] = (int) ((block21 >> 8) & 33554431L);
+    unsigned long block22 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block21 & 255L) << 17) | (block22 >> 47));
+    values[valuesOffset++] = (int) ((block22 >> 22) & 33554431L);
+    unsigned long block23 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block22 & 4194303L) << 3) | (block23 >> 61));
+    values[valuesOffset++] = (int) ((block23 >> 36) & 33554431L);
+    values[valuesOffset++] = (int) ((block23 >> 11) & 33554431L);
+    unsigned long block24 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block23 & 2047L) << 14) | (block24 >> 50));
+    values[valuesOffset++] = (int) ((block24 >> 25) & 33554431L);
+    values[valuesOffset++] = (int) (block24 & 33554431L);
+  }
+}
+
+static unsigned int getPacked64_26(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 26;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
   long endBits = (majorBitPos & 63) + 26 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0x3ffffffL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0x3ffffffL;
+}
 
-  //printf("decode26: index=%d elementPos=%d\n", index, elementPos);fflush(stdout);
+static void decodePacked64_26(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 4; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 38);
+    values[valuesOffset++] = (int) ((block0 >> 12) & 67108863L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 4095L) << 14) | (block1 >> 50));
+    values[valuesOffset++] = (int) ((block1 >> 24) & 67108863L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 16777215L) << 2) | (block2 >> 62));
+    values[valuesOffset++] = (int) ((block2 >> 36) & 67108863L);
+    values[valuesOffset++] = (int) ((block2 >> 10) & 67108863L);
+    unsigned long block3 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block2 & 1023L) << 16) | (block3 >> 48));
+    values[valuesOffset++] = (int) ((block3 >> 22) & 67108863L);
+    unsigned long block4 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block3 & 4194303L) << 4) | (block4 >> 60));
+    values[valuesOffset++] = (int) ((block4 >> 34) & 67108863L);
+    values[valuesOffset++] = (int) ((block4 >> 8) & 67108863L);
+    unsigned long block5 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block4 & 255L) << 18) | (block5 >> 46));
+    values[valuesOffset++] = (int) ((block5 >> 20) & 67108863L);
+    unsigned long block6 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block5 & 1048575L) << 6) | (block6 >> 58));
+    values[valuesOffset++] = (int) ((block6 >> 32) & 67108863L);
+    values[valuesOffset++] = (int) ((block6 >> 6) & 67108863L);
+    unsigned long block7 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block6 & 63L) << 20) | (block7 >> 44));
+    values[valuesOffset++] = (int) ((block7 >> 18) & 67108863L);
+    unsigned long block8 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block7 & 262143L) << 8) | (block8 >> 56));
+    values[valuesOffset++] = (int) ((block8 >> 30) & 67108863L);
+    values[valuesOffset++] = (int) ((block8 >> 4) & 67108863L);
+    unsigned long block9 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block8 & 15L) << 22) | (block9 >> 42));
+    values[valuesOffset++] = (int) ((block9 >> 16) & 67108863L);
+    unsigned long block10 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block9 & 65535L) << 10) | (block10 >> 54));
+    values[valuesOffset++] = (int) ((block10 >> 28) & 67108863L);
+    values[valuesOffset++] = (int) ((block10 >> 2) & 67108863L);
+    unsigned long block11 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block10 & 3L) << 24) | (block11 >> 40));
+    values[valuesOffset++] = (int) ((block11 >> 14) & 67108863L);
+    unsigned long block12 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block11 & 16383L) << 12) | (block12 >> 52));
+    values[valuesOffset++] = (int) ((block12 >> 26) & 67108863L);
+    values[valuesOffset++] = (int) (block12 & 67108863L);
+  }
+}
 
-  if (endBits <= 0) { // Single block
-    //printf("  single block endBits=%d: %d\n", endBits, (packed[elementPos] >> -endBits) & 67108863);fflush(stdout);
-    return (packed[elementPos] >> -endBits) & 67108863;
+static unsigned int getPacked64_27(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 27;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 27 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0x7ffffffL;
   }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0x7ffffffL;
+}
 
-  // Two blocks
-  int result = ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 67108863;
-  //printf("  two blocks: %d\n", result);fflush(stdout);
-  return result;
+static void decodePacked64_27(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 2; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 37);
+    values[valuesOffset++] = (int) ((block0 >> 10) & 134217727L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 1023L) << 17) | (block1 >> 47));
+    values[valuesOffset++] = (int) ((block1 >> 20) & 134217727L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 1048575L) << 7) | (block2 >> 57));
+    values[valuesOffset++] = (int) ((block2 >> 30) & 134217727L);
+    values[valuesOffset++] = (int) ((block2 >> 3) & 134217727L);
+    unsigned long block3 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block2 & 7L) << 24) | (block3 >> 40));
+    values[valuesOffset++] = (int) ((block3 >> 13) & 134217727L);
+    unsigned long block4 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block3 & 8191L) << 14) | (block4 >> 50));
+    values[valuesOffset++] = (int) ((block4 >> 23) & 134217727L);
+    unsigned long block5 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block4 & 8388607L) << 4) | (block5 >> 60));
+    values[valuesOffset++] = (int) ((block5 >> 33) & 134217727L);
+    values[valuesOffset++] = (int) ((block5 >> 6) & 134217727L);
+    unsigned long block6 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block5 & 63L) << 21) | (block6 >> 43));
+    values[valuesOffset++] = (int) ((block6 >> 16) & 134217727L);
+    unsigned long block7 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block6 & 65535L) << 11) | (block7 >> 53));
+    values[valuesOffset++] = (int) ((block7 >> 26) & 134217727L);
+    unsigned long block8 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block7 & 67108863L) << 1) | (block8 >> 63));
+    values[valuesOffset++] = (int) ((block8 >> 36) & 134217727L);
+    values[valuesOffset++] = (int) ((block8 >> 9) & 134217727L);
+    unsigned long block9 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block8 & 511L) << 18) | (block9 >> 46));
+    values[valuesOffset++] = (int) ((block9 >> 19) & 134217727L);
+    unsigned long block10 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block9 & 524287L) << 8) | (block10 >> 56));
+    values[valuesOffset++] = (int) ((block10 >> 29) & 134217727L);
+    values[valuesOffset++] = (int) ((block10 >> 2) & 134217727L);
+    unsigned long block11 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block10 & 3L) << 25) | (block11 >> 39));
+    values[valuesOffset++] = (int) ((block11 >> 12) & 134217727L);
+    unsigned long block12 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block11 & 4095L) << 15) | (block12 >> 49));
+    values[valuesOffset++] = (int) ((block12 >> 22) & 134217727L);
+    unsigned long block13 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block12 & 4194303L) << 5) | (block13 >> 59));
+    values[valuesOffset++] = (int) ((block13 >> 32) & 134217727L);
+    values[valuesOffset++] = (int) ((block13 >> 5) & 134217727L);
+    unsigned long block14 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block13 & 31L) << 22) | (block14 >> 42));
+    values[valuesOffset++] = (int) ((block14 >> 15) & 134217727L);
+    unsigned long block15 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block14 & 32767L) << 12) | (block15 >> 52));
+    values[valuesOffset++] = (int) ((block15 >> 25) & 134217727L);
+    unsigned long block16 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block15 & 33554431L) << 2) | (block16 >> 62));
+    values[valuesOffset++] = (int) ((block16 >> 35) & 134217727L);
+    values[valuesOffset++] = (int) ((block16 >> 8) & 134217727L);
+    unsigned long block17 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block16 & 255L) << 19) | (block17 >> 45));
+    values[valuesOffset++] = (int) ((block17 >> 18) & 134217727L);
+    unsigned long block18 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block17 & 262143L) << 9) | (block18 >> 55));
+    values[valuesOffset++] = (int) ((block18 >> 28) & 134217727L);
+    values[valuesOffset++] = (int) ((block18 >> 1) & 134217727L);
+    unsigned long block19 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block18 & 1L) << 26) | (block19 >> 38));
+    values[valuesOffset++] = (int) ((block19 >> 11) & 134217727L);
+    unsigned long block20 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block19 & 2047L) << 16) | (block20 >> 48));
+    values[valuesOffset++] = (int) ((block20 >> 21) & 134217727L);
+    unsigned long block21 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block20 & 2097151L) << 6) | (block21 >> 58));
+    values[valuesOffset++] = (int) ((block21 >> 31) & 134217727L);
+    values[valuesOffset++] = (int) ((block21 >> 4) & 134217727L);
+    unsigned long block22 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block21 & 15L) << 23) | (block22 >> 41));
+    values[valuesOffset++] = (int) ((block22 >> 14) & 134217727L);
+    unsigned long block23 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block22 & 16383L) << 13) | (block23 >> 51));
+    values[valuesOffset++] = (int) ((block23 >> 24) & 134217727L);
+    unsigned long block24 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block23 & 16777215L) << 3) | (block24 >> 61));
+    values[valuesOffset++] = (int) ((block24 >> 34) & 134217727L);
+    values[valuesOffset++] = (int) ((block24 >> 7) & 134217727L);
+    unsigned long block25 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block24 & 127L) << 20) | (block25 >> 44));
+    values[valuesOffset++] = (int) ((block25 >> 17) & 134217727L);
+    unsigned long block26 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block25 & 131071L) << 10) | (block26 >> 54));
+    values[valuesOffset++] = (int) ((block26 >> 27) & 134217727L);
+    values[valuesOffset++] = (int) (block26 & 134217727L);
+  }
+}
+
+static unsigned int getPacked64_28(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 28;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 28 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0xfffffffL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0xfffffffL;
+}
+
+static void decodePacked64_28(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 8; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 36);
+    values[valuesOffset++] = (int) ((block0 >> 8) & 268435455L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 255L) << 20) | (block1 >> 44));
+    values[valuesOffset++] = (int) ((block1 >> 16) & 268435455L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 65535L) << 12) | (block2 >> 52));
+    values[valuesOffset++] = (int) ((block2 >> 24) & 268435455L);
+    unsigned long block3 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block2 & 16777215L) << 4) | (block3 >> 60));
+    values[valuesOffset++] = (int) ((block3 >> 32) & 268435455L);
+    values[valuesOffset++] = (int) ((block3 >> 4) & 268435455L);
+    unsigned long block4 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block3 & 15L) << 24) | (block4 >> 40));
+    values[valuesOffset++] = (int) ((block4 >> 12) & 268435455L);
+    unsigned long block5 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block4 & 4095L) << 16) | (block5 >> 48));
+    values[valuesOffset++] = (int) ((block5 >> 20) & 268435455L);
+    unsigned long block6 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block5 & 1048575L) << 8) | (block6 >> 56));
+    values[valuesOffset++] = (int) ((block6 >> 28) & 268435455L);
+    values[valuesOffset++] = (int) (block6 & 268435455L);
+  }
+}
+
+static unsigned int getPacked64_29(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 29;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 29 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0x1fffffffL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0x1fffffffL;
+}
+
+static void decodePacked64_29(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 2; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 35);
+    values[valuesOffset++] = (int) ((block0 >> 6) & 536870911L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 63L) << 23) | (block1 >> 41));
+    values[valuesOffset++] = (int) ((block1 >> 12) & 536870911L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 4095L) << 17) | (block2 >> 47));
+    values[valuesOffset++] = (int) ((block2 >> 18) & 536870911L);
+    unsigned long block3 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block2 & 262143L) << 11) | (block3 >> 53));
+    values[valuesOffset++] = (int) ((block3 >> 24) & 536870911L);
+    unsigned long block4 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block3 & 16777215L) << 5) | (block4 >> 59));
+    values[valuesOffset++] = (int) ((block4 >> 30) & 536870911L);
+    values[valuesOffset++] = (int) ((block4 >> 1) & 536870911L);
+    unsigned long block5 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block4 & 1L) << 28) | (block5 >> 36));
+    values[valuesOffset++] = (int) ((block5 >> 7) & 536870911L);
+    unsigned long block6 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block5 & 127L) << 22) | (block6 >> 42));
+    values[valuesOffset++] = (int) ((block6 >> 13) & 536870911L);
+    unsigned long block7 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block6 & 8191L) << 16) | (block7 >> 48));
+    values[valuesOffset++] = (int) ((block7 >> 19) & 536870911L);
+    unsigned long block8 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block7 & 524287L) << 10) | (block8 >> 54));
+    values[valuesOffset++] = (int) ((block8 >> 25) & 536870911L);
+    unsigned long block9 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block8 & 33554431L) << 4) | (block9 >> 60));
+    values[valuesOffset++] = (int) ((block9 >> 31) & 536870911L);
+    values[valuesOffset++] = (int) ((block9 >> 2) & 536870911L);
+    unsigned long block10 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block9 & 3L) << 27) | (block10 >> 37));
+    values[valuesOffset++] = (int) ((block10 >> 8) & 536870911L);
+    unsigned long block11 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block10 & 255L) << 21) | (block11 >> 43));
+    values[valuesOffset++] = (int) ((block11 >> 14) & 536870911L);
+    unsigned long block12 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block11 & 16383L) << 15) | (block12 >> 49));
+    values[valuesOffset++] = (int) ((block12 >> 20) & 536870911L);
+    unsigned long block13 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block12 & 1048575L) << 9) | (block13 >> 55));
+    values[valuesOffset++] = (int) ((block13 >> 26) & 536870911L);
+    unsigned long block14 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block13 & 67108863L) << 3) | (block14 >> 61));
+    values[valuesOffset++] = (int) ((block14 >> 32) & 536870911L);
+    values[valuesOffset++] = (int) ((block14 >> 3) & 536870911L);
+    unsigned long block15 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block14 & 7L) << 26) | (block15 >> 38));
+    values[valuesOffset++] = (int) ((block15 >> 9) & 536870911L);
+    unsigned long block16 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block15 & 511L) << 20) | (block16 >> 44));
+    values[valuesOffset++] = (int) ((block16 >> 15) & 536870911L);
+    unsigned long block17 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block16 & 32767L) << 14) | (block17 >> 50));
+    values[valuesOffset++] = (int) ((block17 >> 21) & 536870911L);
+    unsigned long block18 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block17 & 2097151L) << 8) | (block18 >> 56));
+    values[valuesOffset++] = (int) ((block18 >> 27) & 536870911L);
+    unsigned long block19 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block18 & 134217727L) << 2) | (block19 >> 62));
+    values[valuesOffset++] = (int) ((block19 >> 33) & 536870911L);
+    values[valuesOffset++] = (int) ((block19 >> 4) & 536870911L);
+    unsigned long block20 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block19 & 15L) << 25) | (block20 >> 39));
+    values[valuesOffset++] = (int) ((block20 >> 10) & 536870911L);
+    unsigned long block21 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block20 & 1023L) << 19) | (block21 >> 45));
+    values[valuesOffset++] = (int) ((block21 >> 16) & 536870911L);
+    unsigned long block22 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block21 & 65535L) << 13) | (block22 >> 51));
+    values[valuesOffset++] = (int) ((block22 >> 22) & 536870911L);
+    unsigned long block23 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block22 & 4194303L) << 7) | (block23 >> 57));
+    values[valuesOffset++] = (int) ((block23 >> 28) & 536870911L);
+    unsigned long block24 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block23 & 268435455L) << 1) | (block24 >> 63));
+    values[valuesOffset++] = (int) ((block24 >> 34) & 536870911L);
+    values[valuesOffset++] = (int) ((block24 >> 5) & 536870911L);
+    unsigned long block25 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block24 & 31L) << 24) | (block25 >> 40));
+    values[valuesOffset++] = (int) ((block25 >> 11) & 536870911L);
+    unsigned long block26 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block25 & 2047L) << 18) | (block26 >> 46));
+    values[valuesOffset++] = (int) ((block26 >> 17) & 536870911L);
+    unsigned long block27 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block26 & 131071L) << 12) | (block27 >> 52));
+    values[valuesOffset++] = (int) ((block27 >> 23) & 536870911L);
+    unsigned long block28 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block27 & 8388607L) << 6) | (block28 >> 58));
+    values[valuesOffset++] = (int) ((block28 >> 29) & 536870911L);
+    values[valuesOffset++] = (int) (block28 & 536870911L);
+  }
+}
+
+static unsigned int getPacked64_30(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 30;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 30 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0x3fffffffL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0x3fffffffL;
+}
+
+static void decodePacked64_30(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 4; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 34);
+    values[valuesOffset++] = (int) ((block0 >> 4) & 1073741823L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 15L) << 26) | (block1 >> 38));
+    values[valuesOffset++] = (int) ((block1 >> 8) & 1073741823L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 255L) << 22) | (block2 >> 42));
+    values[valuesOffset++] = (int) ((block2 >> 12) & 1073741823L);
+    unsigned long block3 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block2 & 4095L) << 18) | (block3 >> 46));
+    values[valuesOffset++] = (int) ((block3 >> 16) & 1073741823L);
+    unsigned long block4 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block3 & 65535L) << 14) | (block4 >> 50));
+    values[valuesOffset++] = (int) ((block4 >> 20) & 1073741823L);
+    unsigned long block5 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block4 & 1048575L) << 10) | (block5 >> 54));
+    values[valuesOffset++] = (int) ((block5 >> 24) & 1073741823L);
+    unsigned long block6 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block5 & 16777215L) << 6) | (block6 >> 58));
+    values[valuesOffset++] = (int) ((block6 >> 28) & 1073741823L);
+    unsigned long block7 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block6 & 268435455L) << 2) | (block7 >> 62));
+    values[valuesOffset++] = (int) ((block7 >> 32) & 1073741823L);
+    values[valuesOffset++] = (int) ((block7 >> 2) & 1073741823L);
+    unsigned long block8 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block7 & 3L) << 28) | (block8 >> 36));
+    values[valuesOffset++] = (int) ((block8 >> 6) & 1073741823L);
+    unsigned long block9 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block8 & 63L) << 24) | (block9 >> 40));
+    values[valuesOffset++] = (int) ((block9 >> 10) & 1073741823L);
+    unsigned long block10 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block9 & 1023L) << 20) | (block10 >> 44));
+    values[valuesOffset++] = (int) ((block10 >> 14) & 1073741823L);
+    unsigned long block11 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block10 & 16383L) << 16) | (block11 >> 48));
+    values[valuesOffset++] = (int) ((block11 >> 18) & 1073741823L);
+    unsigned long block12 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block11 & 262143L) << 12) | (block12 >> 52));
+    values[valuesOffset++] = (int) ((block12 >> 22) & 1073741823L);
+    unsigned long block13 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block12 & 4194303L) << 8) | (block13 >> 56));
+    values[valuesOffset++] = (int) ((block13 >> 26) & 1073741823L);
+    unsigned long block14 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block13 & 67108863L) << 4) | (block14 >> 60));
+    values[valuesOffset++] = (int) ((block14 >> 30) & 1073741823L);
+    values[valuesOffset++] = (int) (block14 & 1073741823L);
+  }
+}
+
+static unsigned int getPacked64_31(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 31;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  long endBits = (majorBitPos & 63) + 31 - 64;
+  if (endBits <= 0) {
+    return (packed[elementPos] >> -endBits) & 0x7fffffffL;
+  }
+  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & 0x7fffffffL;
+}
+
+static void decodePacked64_31(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 2; ++i) {
+    unsigned long block0 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (block0 >> 33);
+    values[valuesOffset++] = (int) ((block0 >> 2) & 2147483647L);
+    unsigned long block1 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block0 & 3L) << 29) | (block1 >> 35));
+    values[valuesOffset++] = (int) ((block1 >> 4) & 2147483647L);
+    unsigned long block2 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block1 & 15L) << 27) | (block2 >> 37));
+    values[valuesOffset++] = (int) ((block2 >> 6) & 2147483647L);
+    unsigned long block3 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block2 & 63L) << 25) | (block3 >> 39));
+    values[valuesOffset++] = (int) ((block3 >> 8) & 2147483647L);
+    unsigned long block4 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block3 & 255L) << 23) | (block4 >> 41));
+    values[valuesOffset++] = (int) ((block4 >> 10) & 2147483647L);
+    unsigned long block5 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block4 & 1023L) << 21) | (block5 >> 43));
+    values[valuesOffset++] = (int) ((block5 >> 12) & 2147483647L);
+    unsigned long block6 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block5 & 4095L) << 19) | (block6 >> 45));
+    values[valuesOffset++] = (int) ((block6 >> 14) & 2147483647L);
+    unsigned long block7 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block6 & 16383L) << 17) | (block7 >> 47));
+    values[valuesOffset++] = (int) ((block7 >> 16) & 2147483647L);
+    unsigned long block8 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block7 & 65535L) << 15) | (block8 >> 49));
+    values[valuesOffset++] = (int) ((block8 >> 18) & 2147483647L);
+    unsigned long block9 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block8 & 262143L) << 13) | (block9 >> 51));
+    values[valuesOffset++] = (int) ((block9 >> 20) & 2147483647L);
+    unsigned long block10 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block9 & 1048575L) << 11) | (block10 >> 53));
+    values[valuesOffset++] = (int) ((block10 >> 22) & 2147483647L);
+    unsigned long block11 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block10 & 4194303L) << 9) | (block11 >> 55));
+    values[valuesOffset++] = (int) ((block11 >> 24) & 2147483647L);
+    unsigned long block12 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block11 & 16777215L) << 7) | (block12 >> 57));
+    values[valuesOffset++] = (int) ((block12 >> 26) & 2147483647L);
+    unsigned long block13 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block12 & 67108863L) << 5) | (block13 >> 59));
+    values[valuesOffset++] = (int) ((block13 >> 28) & 2147483647L);
+    unsigned long block14 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block13 & 268435455L) << 3) | (block14 >> 61));
+    values[valuesOffset++] = (int) ((block14 >> 30) & 2147483647L);
+    unsigned long block15 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block14 & 1073741823L) << 1) | (block15 >> 63));
+    values[valuesOffset++] = (int) ((block15 >> 32) & 2147483647L);
+    values[valuesOffset++] = (int) ((block15 >> 1) & 2147483647L);
+    unsigned long block16 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block15 & 1L) << 30) | (block16 >> 34));
+    values[valuesOffset++] = (int) ((block16 >> 3) & 2147483647L);
+    unsigned long block17 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block16 & 7L) << 28) | (block17 >> 36));
+    values[valuesOffset++] = (int) ((block17 >> 5) & 2147483647L);
+    unsigned long block18 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block17 & 31L) << 26) | (block18 >> 38));
+    values[valuesOffset++] = (int) ((block18 >> 7) & 2147483647L);
+    unsigned long block19 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block18 & 127L) << 24) | (block19 >> 40));
+    values[valuesOffset++] = (int) ((block19 >> 9) & 2147483647L);
+    unsigned long block20 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block19 & 511L) << 22) | (block20 >> 42));
+    values[valuesOffset++] = (int) ((block20 >> 11) & 2147483647L);
+    unsigned long block21 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block20 & 2047L) << 20) | (block21 >> 44));
+    values[valuesOffset++] = (int) ((block21 >> 13) & 2147483647L);
+    unsigned long block22 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block21 & 8191L) << 18) | (block22 >> 46));
+    values[valuesOffset++] = (int) ((block22 >> 15) & 2147483647L);
+    unsigned long block23 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block22 & 32767L) << 16) | (block23 >> 48));
+    values[valuesOffset++] = (int) ((block23 >> 17) & 2147483647L);
+    unsigned long block24 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block23 & 131071L) << 14) | (block24 >> 50));
+    values[valuesOffset++] = (int) ((block24 >> 19) & 2147483647L);
+    unsigned long block25 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block24 & 524287L) << 12) | (block25 >> 52));
+    values[valuesOffset++] = (int) ((block25 >> 21) & 2147483647L);
+    unsigned long block26 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block25 & 2097151L) << 10) | (block26 >> 54));
+    values[valuesOffset++] = (int) ((block26 >> 23) & 2147483647L);
+    unsigned long block27 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block26 & 8388607L) << 8) | (block27 >> 56));
+    values[valuesOffset++] = (int) ((block27 >> 25) & 2147483647L);
+    unsigned long block28 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block27 & 33554431L) << 6) | (block28 >> 58));
+    values[valuesOffset++] = (int) ((block28 >> 27) & 2147483647L);
+    unsigned long block29 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block28 & 134217727L) << 4) | (block29 >> 60));
+    values[valuesOffset++] = (int) ((block29 >> 29) & 2147483647L);
+    unsigned long block30 = blocks[blocksOffset++];
+    values[valuesOffset++] = (int) (((block29 & 536870911L) << 2) | (block30 >> 62));
+    values[valuesOffset++] = (int) ((block30 >> 31) & 2147483647L);
+    values[valuesOffset++] = (int) (block30 & 2147483647L);
+  }
+}
+
+static unsigned int getPacked64_32(void *blocks, unsigned int index) {
+  unsigned long *packed = (unsigned long *) blocks;
+  unsigned long majorBitPos = (unsigned long) index * 32;
+  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);
+  return (packed[elementPos] >> (64 - 32 - (majorBitPos & 63))) & 0xffffffffL;
+}
+
+static void decodePacked64_32(unsigned long *blocks, unsigned int *values) {
+  int blocksOffset = 0;
+  int valuesOffset = 0;
+  for (int i = 0; i < 64; ++i) {
+    unsigned long block = blocks[blocksOffset++];
+    for (int shift = 32; shift >= 0; shift -= 32) {
+      values[valuesOffset++] = (int) ((block >> shift) & 4294967295);
+    }
+  }
+}
+
+static unsigned int getSingleBlock1(void *blocks, unsigned int index) {
+  unsigned long block = ((unsigned long *) blocks)[index / 64];
+  return (block >> ((index % 64) * 1)) & 0x1L;
+}
+
+static unsigned int getSingleBlock2(void *blocks, unsigned int index) {
+  unsigned long block = ((unsigned long *) blocks)[index / 32];
+  return (block >> ((index % 32) * 2)) & 0x3L;
+}
+
+static unsigned int getSingleBlock3(void *blocks, unsigned int index) {
+  unsigned long block = ((unsigned long *) blocks)[index / 21];
+  return (block >> ((index % 21) * 3)) & 0x7L;
+}
+
+static unsigned int getSingleBlock4(void *blocks, unsigned int index) {
+  unsigned long block = ((unsigned long *) blocks)[index / 16];
+  return (block >> ((index % 16) * 4)) & 0xfL;
+}
+
+static unsigned int getSingleBlock5(void *blocks, unsigned int index) {
+  unsigned long block = ((unsigned long *) blocks)[index / 12];
+  return (block >> ((index % 12) * 5)) & 0x1fL;
+}
+
+static unsigned int getSingleBlock6(void *blocks, unsigned int index) {
+  unsigned long block = ((unsigned long *) blocks)[index / 10];
+  return (block >> ((index % 10) * 6)) & 0x3fL;
+}
+
+static unsigned int getSingleBlock7(void *blocks, unsigned int index) {
+  unsigned long block = ((unsigned long *) blocks)[index / 9];
+  return (block >> ((index % 9) * 7)) & 0x7fL;
+}
+
+static unsigned int getSingleBlock8(void *blocks, unsigned int index) {
+  unsigned long block = ((unsigned long *) blocks)[index / 8];
+  return (block >> ((index % 8) * 8)) & 0xffL;
+}
+
+static unsigned int getSingleBlock9(void *blocks, unsigned int index) {
+  unsigned long block = ((unsigned long *) blocks)[index / 7];
+  return (block >> ((index % 7) * 9)) & 0x1ffL;
+}
+
+static unsigned int getSingleBlock10(void *blocks, unsigned int index) {
+  unsigned long block = ((unsigned long *) blocks)[index / 6];
+  return (block >> ((index % 6) * 10)) & 0x3ffL;
+}
+
+static unsigned int getSingleBlock12(void *blocks, unsigned int index) {
+  unsigned long block = ((unsigned long *) blocks)[index / 5];
+  return (block >> ((index % 5) * 12)) & 0xfffL;
+}
+
+static unsigned int getSingleBlock16(void *blocks, unsigned int index) {
+  unsigned long block = ((unsigned long *) blocks)[index / 4];
+  return (block >> ((index % 4) * 16)) & 0xffffL;
+}
+
+static unsigned int getSingleBlock21(void *blocks, unsigned int index) {
+  unsigned long block = ((unsigned long *) blocks)[index / 3];
+  return (block >> ((index % 3) * 21)) & 0x1fffffL;
+}
+
+static unsigned int getSingleBlock32(void *blocks, unsigned int index) {
+  unsigned long block = ((unsigned long *) blocks)[index / 2];
+  return (block >> ((index % 2) * 32)) & 0xffffffffL;
+}
+
+static addressGetter packed64Getters[] = {
+  0,
+  getPacked64_1,
+  getPacked64_2,
+  getPacked64_3,
+  getPacked64_4,
+  getPacked64_5,
+  getPacked64_6,
+  getPacked64_7,
+  getPacked64_8,
+  getPacked64_9,
+  getPacked64_10,
+  getPacked64_11,
+  getPacked64_12,
+  getPacked64_13,
+  getPacked64_14,
+  getPacked64_15,
+  getPacked64_16,
+  getPacked64_17,
+  getPacked64_18,
+  getPacked64_19,
+  getPacked64_20,
+  getPacked64_21,
+  getPacked64_22,
+  getPacked64_23,
+  getPacked64_24,
+  getPacked64_25,
+  getPacked64_26,
+  getPacked64_27,
+  getPacked64_28,
+  getPacked64_29,
+  getPacked64_30,
+  getPacked64_31,
+  getPacked64_32,
+};
+
+static addressDecoder packed64Decoders[] = {
+  0,
+  decodePacked64_1,
+  decodePacked64_2,
+  decodePacked64_3,
+  decodePacked64_4,
+  decodePacked64_5,
+  decodePacked64_6,
+  decodePacked64_7,
+  decodePacked64_8,
+  decodePacked64_9,
+  decodePacked64_10,
+  decodePacked64_11,
+  decodePacked64_12,
+  decodePacked64_13,
+  decodePacked64_14,
+  decodePacked64_15,
+  decodePacked64_16,
+  decodePacked64_17,
+  decodePacked64_18,
+  decodePacked64_19,
+  decodePacked64_20,
+  decodePacked64_21,
+  decodePacked64_22,
+  decodePacked64_23,
+  decodePacked64_24,
+  decodePacked64_25,
+  decodePacked64_26,
+  decodePacked64_27,
+  decodePacked64_28,
+  decodePacked64_29,
+  decodePacked64_30,
+  decodePacked64_31,
+  decodePacked64_32,
+};
+
+// 0 if Packed64SingleBlock does not support the bpv:
+static addressGetter singleBlockGetters[] = {
+  0,
+  getSingleBlock1,
+  getSingleBlock2,
+  getSingleBlock3,
+  getSingleBlock4,
+  getSingleBlock5,
+  getSingleBlock6,
+  getSingleBlock7,
+  getSingleBlock8,
+  getSingleBlock9,
+  getSingleBlock10,
+  0,
+  getSingleBlock12,
+  0,
+  0,
+  0,
+  getSingleBlock16,
+  0,
+  0,
+  0,
+  0,
+  getSingleBlock21,
+  0,
+  0,
+  0,
+  0,
+  0,
+  0,
+  0,
+  0,
+  0,
+  0,
+  getSingleBlock32,
+};
+// END AUTOGEN CODE (gen_BulkPacked.py facets)
+
+static unsigned int
+getDirect8(void *blocks, unsigned int index) {
+  return ((unsigned char *) blocks)[index];
+}
+
+static unsigned int
+getDirect16(void *blocks, unsigned int index) {
+  return ((unsigned short *) blocks)[index];
+}
+
+static unsigned int
+getDirect32(void *blocks, unsigned int index) {
+  return ((unsigned int *) blocks)[index];
+}
+
+static unsigned int
+getThreeBlocks8(void *blocks, unsigned int index) {
+  unsigned char *p = ((unsigned char *) blocks) + 3*index;
+  return (p[0] << 16) | (p[1] << 8) | p[2];
+}
+
+// If a BLOCK_SIZE window of docs has at least this many
+// hits, its addresses are decoded in one shot instead of
+// one hit at a time:
+#define DENSE_ADDRESS_HITS 16
+
+// Counts the facet ords of each hit in one window of
+// BLOCK_SIZE docs starting at docBase; addresses has the
+// window's BLOCK_SIZE+1 addresses if it's non-null, else
+// each hit's are looked up with getAddress:
+static void
+countWindow(unsigned long *bits, unsigned int numWords, unsigned int docBase, unsigned int *facetCounts,
+            void *docToAddress, addressGetter getAddress, unsigned int *addresses, unsigned char *facetBytes,
+            unsigned int numFacetBytes) {
+  for(unsigned int i=0;i<BLOCK_SIZE/64;i++) {
+    unsigned int wordIndex = (docBase >> 6) + i;
+    if (wordIndex >= numWords) {
+      break;
+    }
+    unsigned long word = bits[wordIndex];
+    while (word != 0) {
+      unsigned int offset = (i << 6) + ffsl(word) - 1;
+      word &= word - 1;
+      if (addresses != 0) {
+        accum(addresses[offset], addresses[offset+1], facetCounts, facetBytes, numFacetBytes);
+      } else {
+        unsigned int doc = docBase + offset;
+        accum(getAddress(docToAddress, doc), getAddress(docToAddress, doc+1), facetCounts, facetBytes, numFacetBytes);
+      }
+    }
+  }
+}
+
+// Picks the docToAddress decoders for the format;
+// decodeAddresses is left 0 if there is no bulk decoder:
+static bool
+getAddressDecoders(int addressFormat, int addressBitsPerValue, addressGetter *getAddress, addressDecoder *decodeAddresses) {
+  *getAddress = 0;
+  *decodeAddresses = 0;
+  switch(addressFormat) {
+  case FACET_ADDRESS_PACKED64:
+    if (addressBitsPerValue >= 1 && addressBitsPerValue <= 32) {
+      *getAddress = packed64Getters[addressBitsPerValue];
+      *decodeAddresses = packed64Decoders[addressBitsPerValue];
+    }
+    break;
+  case FACET_ADDRESS_SINGLE_BLOCK:
+    if (addressBitsPerValue >= 1 && addressBitsPerValue <= 32) {
+      *getAddress = singleBlockGetters[addressBitsPerValue];
+    }
+    break;
+  case FACET_ADDRESS_DIRECT8:
+    *getAddress = getDirect8;
+    break;
+  case FACET_ADDRESS_DIRECT16:
+    *getAddress = getDirect16;
+    break;
+  case FACET_ADDRESS_DIRECT32:
+    *getAddress = getDirect32;
+    break;
+  case FACET_ADDRESS_THREE_BLOCKS8:
+    *getAddress = getThreeBlocks8;
+    break;
+  }
+  return *getAddress != 0;
+}
+
+bool
+initFacetCounter(FacetCounter *facets, int addressFormat, int addressBitsPerValue, unsigned int maxDoc) {
+  addressDecoder decodeAddresses;
+  if (!getAddressDecoders(addressFormat, addressBitsPerValue, &facets->getAddress, &decodeAddresses)) {
+    return false;
+  }
+  if (facets->facetBytes != 0) {
+    facets->numFacetBytes = facets->getAddress(facets->docToAddress, maxDoc);
+  } else {
+    facets->numFacetBytes = 0;
+  }
+  return true;
+}
+
+// Same as SumFloatAssociationFacetsAggregator: each
+// doc's bytes are (ord, float bits) big-endian int pairs:
+static void
+sumDocFloatAssociations(unsigned char *facetBytes, unsigned int upto, unsigned int endUpto, FacetCounts **counts, int numCounts) {
+  while (upto < endUpto) {
+    unsigned char *p = facetBytes + upto;
+    unsigned int ord = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    unsigned int bits = (p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+    float value;
+    memcpy(&value, &bits, sizeof(float));
+    for(int i=0;i<numCounts;i++) {
+      if (counts[i] != 0) {
+        addFacetFloat(counts[i], ord, value);
+      }
+    }
+    upto += 8;
+  }
 }
 
 void
-countFacets(unsigned long *bits, unsigned int maxDoc, unsigned int *facetCounts, unsigned long *dvDocToAddress, unsigned char *dvFacetBytes) {
+countDocFacets(FacetCounter *facets, unsigned int docID, FacetCounts **counts, int numCounts, float score) {
+  if (facets->facetBytes == 0) {
+    // No doc in this segment has facets
+    return;
+  }
+  unsigned int upto = facets->getAddress(facets->docToAddress, docID);
+  unsigned int endUpto = facets->getAddress(facets->docToAddress, docID+1);
+  if (facets->aggregation == FACET_AGGREGATION_SUM_FLOAT_ASSOCIATION) {
+    sumDocFloatAssociations(facets->facetBytes, upto, endUpto, counts, numCounts);
+    return;
+  }
+  if (facets->aggregation == FACET_AGGREGATION_COUNT && numCounts == 1 && (counts[0] == 0 || counts[0]->dense != 0)) {
+    if (counts[0] != 0) {
+      accum(upto, endUpto, counts[0]->dense, facets->facetBytes, facets->numFacetBytes);
+    }
+    return;
+  }
+
+  // Decode once, count (or sum the score) into every
+  // non-null counts:
+  unsigned char *facetBytes = facets->facetBytes;
+  bool sumScores = facets->aggregation == FACET_AGGREGATION_SUM_SCORE;
+  unsigned int ord = 0;
+  unsigned int prev = 0;
+  while (upto < endUpto) {
+    unsigned char b = facetBytes[upto++];
+    if ((b & 0x80) == 0) {
+      prev = ord = ((ord << 7) | b) + prev;
+      for(int i=0;i<numCounts;i++) {
+        if (counts[i] == 0) {
+          // No drill down requests
+        } else if (sumScores) {
+          addFacetFloat(counts[i], ord, score);
+        } else {
+          incFacetCount(counts[i], ord);
+        }
+      }
+      ord = 0;
+    } else {
+      ord = (ord << 7) | (b & 0x7F);
+    }
+  }
+}
+
+// Counts the facet ords of each hit in docs docStart
+// (a multiple of BLOCK_SIZE) to docEnd:
+static void
+countRange(unsigned long *bits, unsigned int maxDoc, unsigned int docStart, unsigned int docEnd, unsigned int *facetCounts,
+           void *docToAddress, addressGetter getAddress, addressDecoder decodeAddresses, int addressBitsPerValue,
+           unsigned char *facetBytes, unsigned int numFacetBytes) {
   unsigned int numWords = (maxDoc + 63)/64;
-  int doc = nextSetBit(bits, numWords, doc);
-  //printf("\ncountFacets maxDoc=%d\n", maxDoc);
-  while (doc < maxDoc) {
-    //printf("  cycle doc=%d\n", doc);fflush(stdout);
-    accum(decode26(dvDocToAddress, doc),
-          decode26(dvDocToAddress, doc+1),
-          facetCounts,
-          dvFacetBytes);
-    if (doc == maxDoc-1) {
+  unsigned int addresses[BLOCK_SIZE+1];
+  for(unsigned int docBase=docStart;docBase<docEnd;docBase+=BLOCK_SIZE) {
+    unsigned int wordIndex = docBase >> 6;
+    int hitCount = __builtin_popcountl(bits[wordIndex]);
+    if (wordIndex+1 < numWords) {
+      hitCount += __builtin_popcountl(bits[wordIndex+1]);
+    }
+    if (hitCount == 0) {
+      continue;
+    }
+    // There are maxDoc+1 addresses, so only whole windows
+    // before the last doc can be bulk decoded:
+    if (decodeAddresses != 0 && hitCount >= DENSE_ADDRESS_HITS && docBase + BLOCK_SIZE <= maxDoc) {
+      decodeAddresses(((unsigned long *) docToAddress) + (docBase >> 6) * addressBitsPerValue, addresses);
+      addresses[BLOCK_SIZE] = getAddress(docToAddress, docBase + BLOCK_SIZE);
+      countWindow(bits, numWords, docBase, facetCounts, docToAddress, getAddress, addresses, facetBytes, numFacetBytes);
+    } else {
+      countWindow(bits, numWords, docBase, facetCounts, docToAddress, getAddress, 0, facetBytes, numFacetBytes);
+    }
+  }
+}
+
+int
+countFacets(unsigned long *bits, unsigned int maxDoc, unsigned int *facetCounts, void *docToAddress,
+            int addressFormat, int addressBitsPerValue, unsigned char *facetBytes) {
+  // Pick the decoders once for the whole segment:
+  addressGetter getAddress;
+  addressDecoder decodeAddresses;
+  if (!getAddressDecoders(addressFormat, addressBitsPerValue, &getAddress, &decodeAddresses)) {
+    return -1;
+  }
+
+  countRange(bits, maxDoc, 0, maxDoc, facetCounts, docToAddress, getAddress, decodeAddresses, addressBitsPerValue,
+             facetBytes, getAddress(docToAddress, maxDoc));
+  return 0;
+}
+
+// Segments are split into chunks of this many docs, which
+// are divvied up among the threads by hit count:
+#define FACET_CHUNK_DOCS (64*BLOCK_SIZE)
+
+// A thread whose chunks have fewer than numOrds /
+// SPARSE_FACET_RATIO facet bytes counts into a hash instead
+// of its own dense copy of the counts, which would cost
+// more to zero and to merge than counting.
+typedef struct {
+  FacetSegment *segment;
+  addressGetter getAddress;
+  addressDecoder decodeAddresses;
+  unsigned int numFacetBytes;
+  unsigned int docStart;
+  unsigned int docEnd;
+  unsigned int hitCount;
+} FacetChunk;
+
+typedef struct {
+  FacetChunk *chunks;
+  int chunkStart;
+  int chunkEnd;
+  // Dense counts, or 0 if this thread uses sparse:
+  unsigned int *counts;
+  SparseCounts sparse;
+  bool failed;
+
+  // Merging the dense counts, by ord ranges:
+  unsigned int **allCounts;
+  int numCounts;
+  unsigned int ordStart;
+  unsigned int ordEnd;
+} FacetJob;
+
+static bool
+countRangeSparse(FacetChunk *chunk, SparseCounts *sparse) {
+  FacetSegment *segment = chunk->segment;
+  unsigned long *bits = segment->bits;
+  unsigned char *facetBytes = segment->facetBytes;
+  unsigned int wordEnd = (chunk->docEnd + 63) >> 6;
+  for(unsigned int wordIndex=chunk->docStart>>6;wordIndex<wordEnd;wordIndex++) {
+    unsigned long word = bits[wordIndex];
+    while (word != 0) {
+      unsigned int doc = (wordIndex << 6) + ffsl(word) - 1;
+      word &= word - 1;
+      unsigned int upto = chunk->getAddress(segment->docToAddress, doc);
+      unsigned int endUpto = chunk->getAddress(segment->docToAddress, doc+1);
+      unsigned int ord = 0;
+      unsigned int prev = 0;
+      while (upto < endUpto) {
+        unsigned char b = facetBytes[upto++];
+        if ((b & 0x80) == 0) {
+          prev = ord = ((ord << 7) | b) + prev;
+          if (!incSparseCount(sparse, ord)) {
+            return false;
+          }
+          ord = 0;
+        } else {
+          ord = (ord << 7) | (b & 0x7F);
+        }
+      }
+    }
+  }
+  return true;
+}
+
+static void *
+countFacetsThread(void *arg) {
+  FacetJob *job = (FacetJob *) arg;
+  for(int i=job->chunkStart;i<job->chunkEnd;i++) {
+    FacetChunk *chunk = job->chunks + i;
+    FacetSegment *segment = chunk->segment;
+    if (job->counts != 0) {
+      countRange(segment->bits, segment->maxDoc, chunk->docStart, chunk->docEnd, job->counts, segment->docToAddress,
+                 chunk->getAddress, chunk->decodeAddresses, segment->addressBitsPerValue, segment->facetBytes,
+                 chunk->numFacetBytes);
+    } else if (!countRangeSparse(chunk, &job->sparse)) {
+      job->failed = true;
       break;
     }
-    doc = nextSetBit(bits, numWords, doc+1);
   }
+  return 0;
+}
+
+// Adds the other threads' dense counts into the first:
+static void *
+mergeCountsThread(void *arg) {
+  FacetJob *job = (FacetJob *) arg;
+  unsigned int *dest = job->allCounts[0];
+  for(int t=1;t<job->numCounts;t++) {
+    unsigned int *src = job->allCounts[t];
+    unsigned int i = job->ordStart;
+#ifdef __SSE2__
+    for(;i+4<=job->ordEnd;i+=4) {
+      __m128i sum = _mm_add_epi32(_mm_loadu_si128((__m128i *) (dest + i)), _mm_loadu_si128((__m128i *) (src + i)));
+      _mm_storeu_si128((__m128i *) (dest + i), sum);
+    }
+#endif
+    for(;i<job->ordEnd;i++) {
+      dest[i] += src[i];
+    }
+  }
+  return 0;
+}
+
+int
+countFacetsParallel(FacetSegment *segments, int numSegments, unsigned int *facetCounts, unsigned int numOrds, int maxThreads,
+                    int minHitsPerThread) {
+  FacetChunk *chunks = 0;
+  FacetJob *jobs = 0;
+  unsigned int **allCounts = 0;
+  int numChunks = 0;
+  int numThreads = 1;
+  int numDense = 0;
+  long totalHits = 0;
+  int result = 0;
+
+  int maxChunks = 0;
+  for(int i=0;i<numSegments;i++) {
+    maxChunks += (segments[i].maxDoc + FACET_CHUNK_DOCS - 1) / FACET_CHUNK_DOCS;
+  }
+  chunks = (FacetChunk *) malloc(maxChunks * sizeof(FacetChunk));
+  if (chunks == 0) {
+    result = -2;
+    goto end;
+  }
+
+  // Chunk the segments, skipping those with no facets and
+  // chunks with no hits:
+  for(int i=0;i<numSegments;i++) {
+    FacetSegment *segment = segments + i;
+    if (segment->facetBytes == 0) {
+      continue;
+    }
+    addressGetter getAddress;
+    addressDecoder decodeAddresses;
+    if (!getAddressDecoders(segment->addressFormat, segment->addressBitsPerValue, &getAddress, &decodeAddresses)) {
+      result = -1;
+      goto end;
+    }
+    unsigned int numFacetBytes = getAddress(segment->docToAddress, segment->maxDoc);
+    unsigned int numWords = (segment->maxDoc + 63)/64;
+    for(unsigned int docStart=0;docStart<segment->maxDoc;docStart+=FACET_CHUNK_DOCS) {
+      unsigned int docEnd = docStart + FACET_CHUNK_DOCS;
+      if (docEnd > segment->maxDoc) {
+        docEnd = segment->maxDoc;
+      }
+      unsigned int wordEnd = (docEnd + 63) >> 6;
+      unsigned int hitCount = 0;
+      for(unsigned int j=docStart>>6;j<wordEnd && j<numWords;j++) {
+        hitCount += __builtin_popcountl(segment->bits[j]);
+      }
+      if (hitCount != 0) {
+        FacetChunk *chunk = chunks + numChunks++;
+        chunk->segment = segment;
+        chunk->getAddress = getAddress;
+        chunk->decodeAddresses = decodeAddresses;
+        chunk->numFacetBytes = numFacetBytes;
+        chunk->docStart = docStart;
+        chunk->docEnd = docEnd;
+        chunk->hitCount = hitCount;
+        totalHits += hitCount;
+      }
+    }
+  }
+
+  if (maxThreads > 1) {
+    long n = totalHits / minHitsPerThread;
+    if (n > numChunks) {
+      n = numChunks;
+    }
+    numThreads = n < maxThreads ? (int) n : maxThreads;
+    if (numThreads < 1) {
+      numThreads = 1;
+    }
+  }
+
+  if (numThreads == 1) {
+    FacetJob job;
+    memset(&job, 0, sizeof(FacetJob));
+    job.chunks = chunks;
+    job.chunkEnd = numChunks;
+    job.counts = facetCounts;
+    countFacetsThread(&job);
+    goto end;
+  }
+
+  jobs = (FacetJob *) calloc(numThreads, sizeof(FacetJob));
+  allCounts = (unsigned int **) calloc(numThreads, sizeof(int *));
+  if (jobs == 0 || allCounts == 0) {
+    result = -2;
+    goto end;
+  }
+
+  {
+    // Split chunks by hit count; the first thread counts
+    // straight into facetCounts:
+    long hitsUpto = 0;
+    int chunkUpto = 0;
+    allCounts[numDense++] = facetCounts;
+    for(int t=0;t<numThreads;t++) {
+      FacetJob *job = jobs + t;
+      job->chunks = chunks;
+      job->chunkStart = chunkUpto;
+      long target = totalHits * (t+1) / numThreads;
+      unsigned long numBytes = 0;
+      while (chunkUpto < numChunks && (t == numThreads-1 || hitsUpto < target)) {
+        FacetChunk *chunk = chunks + chunkUpto++;
+        hitsUpto += chunk->hitCount;
+        // Estimate the chunk's ords by its hits' share of
+        // its facet bytes:
+        unsigned int bytesStart = chunk->getAddress(chunk->segment->docToAddress, chunk->docStart);
+        unsigned int bytesEnd = chunk->getAddress(chunk->segment->docToAddress, chunk->docEnd);
+        numBytes += (unsigned long) (bytesEnd - bytesStart) * chunk->hitCount / (chunk->docEnd - chunk->docStart);
+      }
+      job->chunkEnd = chunkUpto;
+      if (t == 0) {
+        job->counts = facetCounts;
+      } else if (numBytes * SPARSE_FACET_RATIO < numOrds) {
+        // Load factor stays at most 1/2:
+        unsigned int capacity = 1024;
+        while (capacity < 2 * numBytes) {
+          capacity <<= 1;
+        }
+        if (!initSparseCounts(&job->sparse, capacity)) {
+          result = -2;
+          goto end;
+        }
+      } else {
+        job->counts = (unsigned int *) calloc(numOrds, sizeof(int));
+        if (job->counts == 0) {
+          result = -2;
+          goto end;
+        }
+        allCounts[numDense++] = job->counts;
+      }
+    }
+  }
+
+  runJobs(jobs, sizeof(FacetJob), numThreads, countFacetsThread);
+  for(int t=0;t<numThreads;t++) {
+    if (jobs[t].failed) {
+      result = -2;
+      goto end;
+    }
+  }
+
+  if (numDense > 1) {
+    // Merge the dense counts by ord ranges:
+    for(int t=0;t<numThreads;t++) {
+      FacetJob *job = jobs + t;
+      job->allCounts = allCounts;
+      job->numCounts = numDense;
+      job->ordStart = (unsigned int) ((unsigned long) numOrds * t / numThreads);
+      job->ordEnd = (unsigned int) ((unsigned long) numOrds * (t+1) / numThreads);
+    }
+    runJobs(jobs, sizeof(FacetJob), numThreads, mergeCountsThread);
+  }
+
+  // Sparse counts are small by construction, so they're
+  // merged on this thread:
+  for(int t=1;t<numThreads;t++) {
+    SparseCounts *sparse = &jobs[t].sparse;
+    if (sparse->keys != 0) {
+      for(unsigned int i=0;i<=sparse->mask;i++) {
+        if (sparse->keys[i] != 0) {
+          facetCounts[sparse->keys[i]-1] += sparse->values[i];
+        }
+      }
+    }
+  }
+
+ end:
+  if (jobs != 0) {
+    for(int t=1;t<numThreads;t++) {
+      if (jobs[t].counts != 0) {
+        free(jobs[t].counts);
+      }
+      freeSparseCounts(&jobs[t].sparse);
+    }
+    free(jobs);
+  }
+  if (allCounts != 0) {
+    free(allCounts);
+  }
+  if (chunks != 0) {
+    free(chunks);
+  }
+  return result;
 }
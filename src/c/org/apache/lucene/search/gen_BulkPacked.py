@@ -17,11 +17,13 @@
 
 import StringIO
 
-"""Code generation for bulk operations (for postings decode)"""
+"""Code generation for bulk operations (for postings decode, and
+facet docToAddress decode)"""
 
 MAX_SPECIALIZED_BITS_PER_VALUE = 24;
 PACKED_64_SINGLE_BLOCK_BPV = [1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 12, 16, 21, 32]
 OUTPUT_FILE = "src/c/org/apache/lucene/search/common.cpp"
+FACETS_OUTPUT_FILE = "src/c/org/apache/lucene/search/facets.cpp"
 
 def is_power_of_two(n):
   return n & (n - 1) == 0
@@ -66,13 +68,15 @@ def block_value_count(bpv, bits=64):
   assert values * bpv == bits * blocks, "%d values, %d blocks, %d bits per value" %(values, blocks, bpv)
   return blocks, values, iters
 
-def p64_decode(bpv, f):
+def p64_decode(bpv, f, name='decode%d', swap=True):
+  """Postings blocks are read from the mapped file, so they are
+  byte-swapped; Packed64 blocks (facets) are already longs."""
   mask = (1 << bpv) - 1
   
   blocks, values, iters = block_value_count(bpv)
   cast_start, cast_end = casts('int')
 
-  f.write("static void decode%d(unsigned long *blocks, unsigned int *values) {\n" % bpv)
+  f.write(("static void " + name + "(unsigned long *blocks, unsigned int *values) {\n") % bpv)
   f.write("  int blocksOffset = 0;\n")
   f.write("  int valuesOffset = 0;\n")
   #f.write('  printf("decode %s\\n");\n' % bpv);
@@ -80,7 +84,8 @@ def p64_decode(bpv, f):
 
   if is_power_of_two(bpv):
     f.write("    unsigned long block = blocks[blocksOffset++];\n")
-    f.write("    block = __bswap_64(block);\n")
+    if swap:
+      f.write("    block = __bswap_64(block);\n")
     f.write("    for (int shift = %d; shift >= 0; shift -= %d) {\n" %(64 - bpv, bpv))
     f.write("      values[valuesOffset++] = %s(block >> shift) & %d%s;\n" %(cast_start, mask, cast_end))
     f.write("    }\n") 
@@ -91,7 +96,8 @@ def p64_decode(bpv, f):
       if bit_offset == 0:
         # start of block
         f.write("    unsigned long block%d = blocks[blocksOffset++];\n" %block_offset);
-        f.write("    block%d = __bswap_64(block%d);\n" % (block_offset, block_offset))
+        if swap:
+          f.write("    block%d = __bswap_64(block%d);\n" % (block_offset, block_offset))
         f.write("    values[valuesOffset++] = %sblock%d >> %d%s;\n" %(cast_start, block_offset, 64 - bpv, cast_end))
       elif bit_offset + bpv == 64:
         # end of block
@@ -105,11 +111,95 @@ def p64_decode(bpv, f):
         shift1 = bit_offset + bpv - 64
         shift2 = 64 - shift1
         f.write("    unsigned long block%d = blocks[blocksOffset++];\n" %(block_offset + 1));
-        f.write("    block%d = __bswap_64(block%d);\n" % (block_offset+1, block_offset+1))
+        if swap:
+          f.write("    block%d = __bswap_64(block%d);\n" % (block_offset+1, block_offset+1))
         f.write("    values[valuesOffset++] = %s((block%d & %dL) << %d) | (block%d >> %d)%s;\n" %(cast_start, block_offset, mask1, shift1, block_offset + 1, shift2, cast_end))
   f.write("  }\n")
   f.write("}\n")
 
+def p64_get(bpv, f):
+  """Random access to one Packed64 value, like Packed64.get."""
+  mask = (1 << bpv) - 1
+  f.write("static unsigned int getPacked64_%d(void *blocks, unsigned int index) {\n" % bpv)
+  f.write("  unsigned long *packed = (unsigned long *) blocks;\n")
+  f.write("  unsigned long majorBitPos = (unsigned long) index * %d;\n" % bpv)
+  f.write("  unsigned int elementPos = (unsigned int) (majorBitPos >> 6);\n")
+  if 64 % bpv == 0:
+    # Values never span two blocks
+    f.write("  return (packed[elementPos] >> (64 - %d - (majorBitPos & 63))) & %sL;\n" % (bpv, hexNoLSuffix(mask)))
+  else:
+    f.write("  long endBits = (majorBitPos & 63) + %d - 64;\n" % bpv)
+    f.write("  if (endBits <= 0) {\n")
+    f.write("    return (packed[elementPos] >> -endBits) & %sL;\n" % hexNoLSuffix(mask))
+    f.write("  }\n")
+    f.write("  return ((packed[elementPos] << endBits) | (packed[elementPos+1] >> (64 - endBits))) & %sL;\n" % hexNoLSuffix(mask))
+  f.write("}\n")
+
+def p64sb_get(bpv, f):
+  """Random access to one Packed64SingleBlock value, like
+  Packed64SingleBlockN.get."""
+  mask = (1 << bpv) - 1
+  values_per_block = 64 / bpv
+  f.write("static unsigned int getSingleBlock%d(void *blocks, unsigned int index) {\n" % bpv)
+  f.write("  unsigned long block = ((unsigned long *) blocks)[index / %d];\n" % values_per_block)
+  f.write("  return (block >> ((index %% %d) * %d)) & %sL;\n" % (values_per_block, bpv, hexNoLSuffix(mask)))
+  f.write("}\n")
+
+def replace_autogen(file_name, begin, end, s):
+  s2 = open(file_name, 'rb').read()
+  i = s2.find(begin)
+  if i == -1:
+    raise RuntimeError('cannot find BEGIN AUTOGEN comment in %s' % file_name)
+  j = s2.find(end)
+  if j == -1:
+    raise RuntimeError('cannot find END AUTOGEN comment in %s' % file_name)
+
+  s2 = s2[:i] + s + s2[j+len(end):]
+
+  open(file_name, 'wb').write(s2)
+
+def write_facets():
+  """Facet42BinaryDocValues' docToAddress decoders, selected per
+  segment by countFacets in facets.cpp.  Addresses index a byte[],
+  so at most 32 bits per value."""
+  f = StringIO.StringIO()
+  begin = '// BEGIN AUTOGEN CODE (gen_BulkPacked.py facets)\n'
+  end = '// END AUTOGEN CODE (gen_BulkPacked.py facets)\n'
+  f.write(begin)
+
+  for bpv in xrange(1, 33):
+    f.write('\n')
+    p64_get(bpv, f)
+    f.write('\n')
+    # Decodes BLOCK_SIZE values, starting at a multiple of
+    # BLOCK_SIZE:
+    p64_decode(bpv, f, 'decodePacked64_%d', False)
+
+  for bpv in PACKED_64_SINGLE_BLOCK_BPV:
+    f.write('\n')
+    p64sb_get(bpv, f)
+
+  f.write('\nstatic addressGetter packed64Getters[] = {\n  0,\n')
+  for bpv in xrange(1, 33):
+    f.write('  getPacked64_%d,\n' % bpv)
+  f.write('};\n')
+
+  f.write('\nstatic addressDecoder packed64Decoders[] = {\n  0,\n')
+  for bpv in xrange(1, 33):
+    f.write('  decodePacked64_%d,\n' % bpv)
+  f.write('};\n')
+
+  f.write('\n// 0 if Packed64SingleBlock does not support the bpv:\n')
+  f.write('static addressGetter singleBlockGetters[] = {\n  0,\n')
+  for bpv in xrange(1, 33):
+    if bpv in PACKED_64_SINGLE_BLOCK_BPV:
+      f.write('  getSingleBlock%d,\n' % bpv)
+    else:
+      f.write('  0,\n')
+  f.write('};\n')
+
+  f.write(end)
+  replace_autogen(FACETS_OUTPUT_FILE, begin, end, f.getvalue())
 
 if __name__ == '__main__':
   f = StringIO.StringIO()
@@ -165,17 +255,10 @@ static void readPackedBlock(unsigned char **p, unsigned int *dest) {
 
   f.write('// END AUTOGEN CODE (gen_Packed.py)\n')
 
-  s = f.getvalue()
-
-  s2 = open(OUTPUT_FILE, 'rb').read()
-  i = s2.find('// BEGIN AUTOGEN CODE (gen_Packed.py)\n')
-  if i == -1:
-    raise RuntimeError('cannot find BEGIN AUTOGEN comment')
-  j = s2.find('// END AUTOGEN CODE (gen_Packed.py)\n')
-  if j == -1:
-    raise RuntimeError('cannot find END AUTOGEN comment')
-
-  s2 = s2[:i] + s + s2[j+36:]
+  replace_autogen(OUTPUT_FILE,
+                  '// BEGIN AUTOGEN CODE (gen_Packed.py)\n',
+                  '// END AUTOGEN CODE (gen_Packed.py)\n',
+                  f.getvalue())
 
-  open(OUTPUT_FILE, 'wb').write(s2)
+  write_facets()
   
@@ -0,0 +1,601 @@
+package org.apache.lucene.search;
+
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+import java.io.IOException;
+import java.util.ArrayList;
+import java.util.Collection;
+import java.util.HashMap;
+import java.util.HashSet;
+import java.util.List;
+import java.util.Map;
+import java.util.Set;
+
+import org.apache.lucene.codecs.CodecUtil;
+import org.apache.lucene.index.AtomicReaderContext;
+import org.apache.lucene.index.DocsAndPositionsEnum;
+import org.apache.lucene.index.FieldInfo;
+import org.apache.lucene.index.IndexReader;
+import org.apache.lucene.index.SegmentInfoPerCommit;
+import org.apache.lucene.index.SegmentInfos;
+import org.apache.lucene.index.SegmentReader;
+import org.apache.lucene.index.Terms;
+import org.apache.lucene.index.TermsEnum;
+import org.apache.lucene.store.Directory;
+import org.apache.lucene.store.IOContext;
+import org.apache.lucene.store.IndexInput;
+import org.apache.lucene.store.IndexOutput;
+import org.apache.lucene.store.NativeMMapDirectory;
+import org.apache.lucene.util.ArrayUtil;
+import org.apache.lucene.util.BytesRef;
+import org.apache.lucene.util.IOUtils;
+import org.apache.lucene.util.packed.PackedInts;
+
+/** Offline-built "sidecar" holding postings for bigrams of
+ *  common words, so that {@link NativeSearch} can run an
+ *  exact PhraseQuery like "to be or not to be" against a
+ *  few short bigram postings instead of decoding positions
+ *  for the huge unigram postings.  This is the CommonGrams
+ *  trick, applied at search time without reindexing.
+ *
+ *  <p>The sidecar is written per segment and per field into
+ *  the segment's {@link NativeMMapDirectory}, with docs,
+ *  freqs and positions in the same block format as
+ *  Lucene41PostingsFormat, so the C++ code reads it with
+ *  nextDocFreqBlock/nextPosBlock.  Segments without a
+ *  sidecar (e.g., new segments after a reopen) just use the
+ *  unigram postings; call {@link #build} again to cover
+ *  them.
+ *
+ *  <p>IndexFileDeleter does not know about the sidecar
+ *  files, so {@link #build} also deletes any sidecar whose
+ *  segment is no longer in the index (e.g., it was merged
+ *  away).  Each sidecar records its segment's name and the
+ *  index's commit generation when it was built, so a
+ *  leftover sidecar is never used for a different segment
+ *  that reuses the name after the index is recreated. */
+
+public class CommonGrams {
+
+  // NOTE: must not start with _ else IndexFileDeleter will
+  // think these are unreferenced codec files:
+  private static final String FILE_PREFIX = "cg";
+
+  static final String TERMS_EXTENSION = "cgt";
+  static final String DOC_EXTENSION = "cgd";
+  static final String POS_EXTENSION = "cgp";
+
+  private static final String CODEC = "CommonGrams";
+  private static final int VERSION_START = 0;
+  // Terms file records segment name + commit generation
+  // instead of maxDoc:
+  private static final int VERSION_SEGMENT_ID = 1;
+  private static final int VERSION_CURRENT = VERSION_SEGMENT_ID;
+
+  // Must match Lucene41PostingsFormat.BLOCK_SIZE:
+  private static final int BLOCK_SIZE = 128;
+
+  // Lucene41 ForUtil's marker for a block whose values are
+  // all the same:
+  private static final int ALL_VALUES_EQUAL = 0;
+
+  private CommonGrams() {
+  }
+
+  static String fileName(String segmentName, String field, String extension) {
+    return FILE_PREFIX + segmentName + "_" + field + "." + extension;
+  }
+
+  /** Builds the sidecar for every segment in the reader,
+   *  holding postings for all bigrams (word1 followed by
+   *  word2) of the provided common words in the field.
+   *  The field must index positions.  Don't call this while
+   *  searches are running against the same segments, since
+   *  any previously mapped sidecar is unmapped.  Sidecars
+   *  (for any field) of segments that are neither in the
+   *  reader nor in the latest commit are deleted. */
+  public static void build(IndexReader reader, String field, Collection<String> commonWords) throws IOException {
+    BytesRef[] words = new BytesRef[commonWords.size()];
+    int upto = 0;
+    for(String word : commonWords) {
+      words[upto++] = new BytesRef(word);
+    }
+
+    // Directory -> names of its segments in the reader:
+    Map<Directory,Set<String>> segNames = new HashMap<Directory,Set<String>>();
+    for(AtomicReaderContext ctx : reader.leaves()) {
+      if (!(ctx.reader() instanceof SegmentReader)) {
+        throw new IllegalArgumentException("leaves must be SegmentReaders; got: " + ctx.reader());
+      }
+      SegmentReader segReader = (SegmentReader) ctx.reader();
+      buildSegment(segReader, field, words);
+      invalidate(segReader.getCoreCacheKey(), field);
+      Set<String> names = segNames.get(segReader.directory());
+      if (names == null) {
+        names = new HashSet<String>();
+        segNames.put(segReader.directory(), names);
+      }
+      names.add(segReader.getSegmentName());
+    }
+
+    for(Map.Entry<Directory,Set<String>> ent : segNames.entrySet()) {
+      deleteStaleFiles(ent.getKey(), ent.getValue());
+    }
+  }
+
+  /** Deletes sidecar files whose segment is neither in
+   *  keepSegNames nor in the latest commit.  A file that
+   *  can't be deleted yet (e.g., it is still open on
+   *  Windows) is left for the next build. */
+  private static void deleteStaleFiles(Directory dir, Set<String> keepSegNames) throws IOException {
+    Set<String> liveSegNames = new HashSet<String>(keepSegNames);
+    if (SegmentInfos.getLastCommitGeneration(dir) != -1) {
+      SegmentInfos infos = new SegmentInfos();
+      infos.read(dir);
+      for(SegmentInfoPerCommit info : infos) {
+        liveSegNames.add(info.info.name);
+      }
+    }
+
+    for(String fileName : dir.listAll()) {
+      String segName = segmentName(fileName);
+      if (segName != null && !liveSegNames.contains(segName)) {
+        try {
+          dir.deleteFile(fileName);
+        } catch (IOException ioe) {
+          // Try again next time
+        }
+      }
+    }
+  }
+
+  /** Returns the segment name of a sidecar file, or null if
+   *  this is not a sidecar file. */
+  static String segmentName(String fileName) {
+    if (!fileName.startsWith(FILE_PREFIX + "_")) {
+      return null;
+    }
+    if (!fileName.endsWith("." + TERMS_EXTENSION) && !fileName.endsWith("." + DOC_EXTENSION) && !fileName.endsWith("." + POS_EXTENSION)) {
+      return null;
+    }
+    int end = fileName.indexOf('_', FILE_PREFIX.length()+1);
+    if (end == -1) {
+      return null;
+    }
+    return fileName.substring(FILE_PREFIX.length(), end);
+  }
+
+  private static void buildSegment(SegmentReader reader, String field, BytesRef[] words) throws IOException {
+    FieldInfo fieldInfo = reader.getFieldInfos().fieldInfo(field);
+    if (fieldInfo == null) {
+      return;
+    }
+    if (fieldInfo.getIndexOptions().compareTo(FieldInfo.IndexOptions.DOCS_AND_FREQS_AND_POSITIONS) < 0) {
+      throw new IllegalArgumentException("field \"" + field + "\" does not index positions");
+    }
+
+    Terms terms = reader.terms(field);
+    if (terms == null) {
+      return;
+    }
+
+    Directory dir = reader.directory();
+    String segName = reader.getSegmentName();
+
+    IndexOutput termsOut = null;
+    IndexOutput docOut = null;
+    IndexOutput posOut = null;
+    boolean success = false;
+    try {
+      termsOut = dir.createOutput(fileName(segName, field, TERMS_EXTENSION), IOContext.DEFAULT);
+      docOut = dir.createOutput(fileName(segName, field, DOC_EXTENSION), IOContext.DEFAULT);
+      posOut = dir.createOutput(fileName(segName, field, POS_EXTENSION), IOContext.DEFAULT);
+      CodecUtil.writeHeader(termsOut, CODEC, VERSION_CURRENT);
+      CodecUtil.writeHeader(docOut, CODEC, VERSION_CURRENT);
+      CodecUtil.writeHeader(posOut, CODEC, VERSION_CURRENT);
+
+      boolean indexHasOffsets = fieldInfo.getIndexOptions().compareTo(FieldInfo.IndexOptions.DOCS_AND_FREQS_AND_POSITIONS_AND_OFFSETS) >= 0;
+      BlockWriter writer = new BlockWriter(docOut, posOut, fieldInfo.hasPayloads(), indexHasOffsets);
+
+      List<BytesRef> bigramWords = new ArrayList<BytesRef>();
+      List<long[]> bigramStats = new ArrayList<long[]>();
+
+      TermsEnum termsEnum1 = terms.iterator(null);
+      TermsEnum termsEnum2 = terms.iterator(null);
+      DocsAndPositionsEnum posEnum1 = null;
+      DocsAndPositionsEnum posEnum2 = null;
+      int[] positions = new int[16];
+
+      for(BytesRef word1 : words) {
+        if (!termsEnum1.seekExact(word1, false)) {
+          continue;
+        }
+        for(BytesRef word2 : words) {
+          if (!termsEnum2.seekExact(word2, false)) {
+            continue;
+          }
+          // NOTE: no liveDocs: the sidecar mirrors the raw
+          // postings and deletes are applied at search time:
+          posEnum1 = termsEnum1.docsAndPositions(null, posEnum1, 0);
+          posEnum2 = termsEnum2.docsAndPositions(null, posEnum2, 0);
+
+          writer.startTerm();
+
+          int docID1 = posEnum1.nextDoc();
+          int docID2 = posEnum2.nextDoc();
+          while (docID1 != DocsAndPositionsEnum.NO_MORE_DOCS && docID2 != DocsAndPositionsEnum.NO_MORE_DOCS) {
+            if (docID1 < docID2) {
+              docID1 = posEnum1.advance(docID2);
+            } else if (docID2 < docID1) {
+              docID2 = posEnum2.advance(docID1);
+            } else {
+              // Both words are in this doc; find each
+              // position where word2 immediately follows
+              // word1:
+              int left1 = posEnum1.freq()-1;
+              int left2 = posEnum2.freq()-1;
+              int pos1 = posEnum1.nextPosition();
+              int pos2 = posEnum2.nextPosition();
+              int freq = 0;
+              while (true) {
+                if (pos1+1 < pos2) {
+                  if (left1 == 0) {
+                    break;
+                  }
+                  pos1 = posEnum1.nextPosition();
+                  left1--;
+                } else if (pos1+1 > pos2) {
+                  if (left2 == 0) {
+                    break;
+                  }
+                  pos2 = posEnum2.nextPosition();
+                  left2--;
+                } else {
+                  positions = ArrayUtil.grow(positions, freq+1);
+                  positions[freq++] = pos1;
+                  if (left1 == 0 || left2 == 0) {
+                    break;
+                  }
+                  pos1 = posEnum1.nextPosition();
+                  left1--;
+                  pos2 = posEnum2.nextPosition();
+                  left2--;
+                }
+              }
+              if (freq > 0) {
+                writer.addDoc(docID1, positions, freq);
+              }
+              docID1 = posEnum1.nextDoc();
+              docID2 = posEnum2.nextDoc();
+            }
+          }
+
+          if (writer.docFreq > 0) {
+            bigramWords.add(BytesRef.deepCopyOf(word1));
+            bigramWords.add(BytesRef.deepCopyOf(word2));
+            bigramStats.add(writer.finishTerm());
+          }
+        }
+      }
+
+      termsOut.writeString(segName);
+      termsOut.writeLong(SegmentInfos.getLastCommitGeneration(dir));
+      termsOut.writeVInt(bigramStats.size());
+      for(int i=0;i<bigramStats.size();i++) {
+        BytesRef word1 = bigramWords.get(2*i);
+        BytesRef word2 = bigramWords.get(2*i+1);
+        termsOut.writeVInt(word1.length);
+        termsOut.writeBytes(word1.bytes, word1.offset, word1.length);
+        termsOut.writeVInt(word2.length);
+        termsOut.writeBytes(word2.bytes, word2.offset, word2.length);
+        long[] stats = bigramStats.get(i);
+        termsOut.writeVInt((int) stats[0]);
+        termsOut.writeVLong(stats[1]);
+        termsOut.writeVLong(stats[2]);
+        termsOut.writeVLong(stats[3]);
+      }
+      success = true;
+    } finally {
+      if (success) {
+        IOUtils.close(termsOut, docOut, posOut);
+      } else {
+        IOUtils.closeWhileHandlingException(termsOut, docOut, posOut);
+      }
+    }
+  }
+
+  /** Writes docs/freqs and positions for one bigram, in
+   *  the same block layout as Lucene41PostingsWriter (but
+   *  never pulsed, and without skip data since the C++
+   *  code always decodes sequentially). */
+  private static class BlockWriter {
+    final IndexOutput docOut;
+    final IndexOutput posOut;
+    final boolean indexHasPayloads;
+    final boolean indexHasOffsets;
+
+    final int[] docDeltaBuffer = new int[BLOCK_SIZE];
+    final int[] freqBuffer = new int[BLOCK_SIZE];
+    final int[] posDeltaBuffer = new int[BLOCK_SIZE];
+
+    int docBufferUpto;
+    int posBufferUpto;
+    int lastDocID;
+    int docFreq;
+    long totalTermFreq;
+    long docStartFP;
+    long posStartFP;
+
+    public BlockWriter(IndexOutput docOut, IndexOutput posOut, boolean indexHasPayloads, boolean indexHasOffsets) {
+      this.docOut = docOut;
+      this.posOut = posOut;
+      this.indexHasPayloads = indexHasPayloads;
+      this.indexHasOffsets = indexHasOffsets;
+    }
+
+    public void startTerm() {
+      docStartFP = docOut.getFilePointer();
+      posStartFP = posOut.getFilePointer();
+      docBufferUpto = 0;
+      posBufferUpto = 0;
+      lastDocID = 0;
+      docFreq = 0;
+      totalTermFreq = 0;
+    }
+
+    public void addDoc(int docID, int[] positions, int freq) throws IOException {
+      docDeltaBuffer[docBufferUpto] = docID - lastDocID;
+      freqBuffer[docBufferUpto] = freq;
+      docBufferUpto++;
+      docFreq++;
+      totalTermFreq += freq;
+      lastDocID = docID;
+
+      int lastPos = 0;
+      for(int i=0;i<freq;i++) {
+        posDeltaBuffer[posBufferUpto++] = positions[i] - lastPos;
+        lastPos = positions[i];
+        if (posBufferUpto == BLOCK_SIZE) {
+          writeBlock(posDeltaBuffer, posOut);
+          posBufferUpto = 0;
+        }
+      }
+
+      if (docBufferUpto == BLOCK_SIZE) {
+        writeBlock(docDeltaBuffer, docOut);
+        writeBlock(freqBuffer, docOut);
+        docBufferUpto = 0;
+      }
+    }
+
+    /** Returns docFreq, totalTermFreq, docStartFP,
+     *  posStartFP. */
+    public long[] finishTerm() throws IOException {
+      // vInt encode the remaining docs/freqs:
+      for(int i=0;i<docBufferUpto;i++) {
+        int docDelta = docDeltaBuffer[i];
+        int freq = freqBuffer[i];
+        if (freq == 1) {
+          docOut.writeVInt((docDelta<<1)|1);
+        } else {
+          docOut.writeVInt(docDelta<<1);
+          docOut.writeVInt(freq);
+        }
+      }
+
+      // vInt encode the remaining positions; we never have
+      // payloads or offsets, but must write the same codes
+      // as the field's unigram postings:
+      for(int i=0;i<posBufferUpto;i++) {
+        if (indexHasPayloads) {
+          // payload length stays 0:
+          posOut.writeVInt(posDeltaBuffer[i]<<1);
+        } else {
+          posOut.writeVInt(posDeltaBuffer[i]);
+        }
+        if (indexHasOffsets) {
+          // offset delta and length stay 0:
+          posOut.writeVInt(0);
+        }
+      }
+
+      return new long[] {docFreq, totalTermFreq, docStartFP, posStartFP};
+    }
+  }
+
+  // Same as Lucene41's ForUtil.writeBlock:
+  private static void writeBlock(int[] values, IndexOutput out) throws IOException {
+    boolean allEqual = true;
+    long or = 0;
+    for(int i=0;i<BLOCK_SIZE;i++) {
+      if (values[i] != values[0]) {
+        allEqual = false;
+      }
+      or |= values[i];
+    }
+    if (allEqual) {
+      out.writeByte((byte) ALL_VALUES_EQUAL);
+      out.writeVInt(values[0]);
+      return;
+    }
+
+    int bitsPerValue = PackedInts.bitsRequired(or);
+    PackedInts.FormatAndBits formatAndBits = PackedInts.fastestFormatAndBits(BLOCK_SIZE, bitsPerValue, PackedInts.COMPACT);
+    assert formatAndBits.bitsPerValue == bitsPerValue;
+    PackedInts.Encoder encoder = PackedInts.getEncoder(formatAndBits.format, PackedInts.VERSION_CURRENT, bitsPerValue);
+    int iterations = (BLOCK_SIZE + encoder.byteValueCount() - 1) / encoder.byteValueCount();
+    byte[] encoded = new byte[iterations * encoder.byteBlockCount()];
+    encoder.encode(values, 0, encoded, 0, iterations);
+    out.writeByte((byte) bitsPerValue);
+    // The C++ decoder assumes 16 bytes per bit:
+    out.writeBytes(encoded, bitsPerValue * (BLOCK_SIZE/8));
+  }
+
+  /** Holds one segment's mapped sidecar for one field. */
+  static class SegmentBigrams {
+    final IndexInput docIn;
+    final IndexInput posIn;
+    final long docAddress;
+    final long posAddress;
+
+    // word1 + 0 byte + word2 -> {docFreq, totalTermFreq,
+    // docStartFP, posStartFP}
+    final Map<BytesRef,long[]> bigrams;
+
+    SegmentBigrams(IndexInput docIn, IndexInput posIn, Map<BytesRef,long[]> bigrams) {
+      this.docIn = docIn;
+      this.posIn = posIn;
+      this.bigrams = bigrams;
+      docAddress = NativeSearch.getMMapAddress(docIn);
+      posAddress = NativeSearch.getMMapAddress(posIn);
+    }
+
+    /** Returns {docFreq, totalTermFreq, docStartFP,
+     *  posStartFP}, or null if this bigram is not in the
+     *  sidecar. */
+    public long[] get(BytesRef word1, BytesRef word2) {
+      return bigrams.get(bigramKey(word1, word2));
+    }
+
+    void close() throws IOException {
+      IOUtils.close(docIn, posIn);
+    }
+  }
+
+  static BytesRef bigramKey(BytesRef word1, BytesRef word2) {
+    BytesRef key = new BytesRef(word1.length + 1 + word2.length);
+    System.arraycopy(word1.bytes, word1.offset, key.bytes, 0, word1.length);
+    System.arraycopy(word2.bytes, word2.offset, key.bytes, word1.length+1, word2.length);
+    key.length = key.bytes.length;
+    return key;
+  }
+
+  // Segment core key -> field -> sidecar, or null if the
+  // segment has no sidecar for that field:
+  private static final Map<Object,Map<String,SegmentBigrams>> cache = new HashMap<Object,Map<String,SegmentBigrams>>();
+
+  /** Returns the sidecar for this segment and field, or
+   *  null if it was never built. */
+  static synchronized SegmentBigrams getSegmentBigrams(SegmentReader reader, String field) throws IOException {
+    Object coreKey = reader.getCoreCacheKey();
+    Map<String,SegmentBigrams> byField = cache.get(coreKey);
+    if (byField == null) {
+      byField = new HashMap<String,SegmentBigrams>();
+      cache.put(coreKey, byField);
+      reader.addCoreClosedListener(new SegmentReader.CoreClosedListener() {
+          @Override
+          public void onClose(SegmentReader owner) {
+            invalidate(owner.getCoreCacheKey(), null);
+          }
+        });
+    } else if (byField.containsKey(field)) {
+      return byField.get(field);
+    }
+
+    SegmentBigrams bigrams = open(reader, field);
+    byField.put(field, bigrams);
+    return bigrams;
+  }
+
+  private static SegmentBigrams open(SegmentReader reader, String field) throws IOException {
+    Directory dir = reader.directory();
+    String segName = reader.getSegmentName();
+    String termsFileName = fileName(segName, field, TERMS_EXTENSION);
+    if (!dir.fileExists(termsFileName)) {
+      return null;
+    }
+    if (!(NativeSearch.unwrap(dir) instanceof NativeMMapDirectory)) {
+      throw new IllegalArgumentException("directory must be a NativeMMapDirectory; got: " + dir);
+    }
+
+    Map<BytesRef,long[]> bigrams = new HashMap<BytesRef,long[]>();
+    IndexInput termsIn = dir.openInput(termsFileName, IOContext.READONCE);
+    try {
+      int version = CodecUtil.checkHeader(termsIn, CODEC, VERSION_START, VERSION_CURRENT);
+      if (version < VERSION_SEGMENT_ID) {
+        // Can't tell which segment it was built for:
+        return null;
+      }
+      if (!segName.equals(termsIn.readString()) || termsIn.readLong() > SegmentInfos.getLastCommitGeneration(dir)) {
+        // Stale sidecar from a previous index with the same
+        // segment name, whose generations have since
+        // restarted:
+        return null;
+      }
+      int count = termsIn.readVInt();
+      for(int i=0;i<count;i++) {
+        BytesRef word1 = new BytesRef(termsIn.readVInt());
+        word1.length = word1.bytes.length;
+        termsIn.readBytes(word1.bytes, 0, word1.length);
+        BytesRef word2 = new BytesRef(termsIn.readVInt());
+        word2.length = word2.bytes.length;
+        termsIn.readBytes(word2.bytes, 0, word2.length);
+        long[] stats = new long[4];
+        stats[0] = termsIn.readVInt();
+        stats[1] = termsIn.readVLong();
+        stats[2] = termsIn.readVLong();
+        stats[3] = termsIn.readVLong();
+        bigrams.put(bigramKey(word1, word2), stats);
+      }
+    } finally {
+      termsIn.close();
+    }
+
+    IndexInput docIn = null;
+    IndexInput posIn = null;
+    boolean success = false;
+    try {
+      docIn = NativeSearch.unwrap(dir.openInput(fileName(segName, field, DOC_EXTENSION), IOContext.DEFAULT));
+      CodecUtil.checkHeader(docIn, CODEC, VERSION_START, VERSION_CURRENT);
+      posIn = NativeSearch.unwrap(dir.openInput(fileName(segName, field, POS_EXTENSION), IOContext.DEFAULT));
+      CodecUtil.checkHeader(posIn, CODEC, VERSION_START, VERSION_CURRENT);
+      success = true;
+    } finally {
+      if (!success) {
+        IOUtils.closeWhileHandlingException(docIn, posIn);
+      }
+    }
+
+    return new SegmentBigrams(docIn, posIn, bigrams);
+  }
+
+  /** Drops (and closes) cached sidecars for this segment
+   *  core; if field is null, all fields are dropped. */
+  private static synchronized void invalidate(Object coreKey, String field) {
+    Map<String,SegmentBigrams> byField = cache.get(coreKey);
+    if (byField == null) {
+      return;
+    }
+    List<SegmentBigrams> toClose = new ArrayList<SegmentBigrams>();
+    if (field == null) {
+      cache.remove(coreKey);
+      toClose.addAll(byField.values());
+    } else {
+      toClose.add(byField.remove(field));
+    }
+    for(SegmentBigrams bigrams : toClose) {
+      if (bigrams != null) {
+        try {
+          bigrams.close();
+        } catch (IOException ioe) {
+          throw new RuntimeException(ioe);
+        }
+      }
+    }
+  }
+}
@@ -24,11 +24,18 @@ import java.nio.ByteBuffer;
 import java.nio.channels.FileChannel;
 import java.util.ArrayList;
 import java.util.Arrays;
+import java.util.Collections;
+import java.util.Comparator;
 import java.util.HashMap;
+import java.util.HashSet;
+import java.util.Iterator;
+import java.util.LinkedHashMap;
 import java.util.List;
 import java.util.Map;
+import java.util.Set;
+import java.util.WeakHashMap;
+import java.util.concurrent.ConcurrentHashMap;
 
-import org.apache.lucene.codecs.BlockTermState;
 import org.apache.lucene.codecs.Codec;
 import org.apache.lucene.codecs.LiveDocsFormat;
 import org.apache.lucene.codecs.NormsFormat;
@@ -37,43 +44,53 @@ import org.apache.lucene.codecs.lucene40.Lucene40LiveDocsFormat;
 import org.apache.lucene.codecs.lucene41.Lucene41PostingsFormat;
 import org.apache.lucene.codecs.lucene42.Lucene42NormsFormat;
 import org.apache.lucene.codecs.perfield.PerFieldPostingsFormat;
-import org.apache.lucene.facet.params.CategoryListParams.OrdinalPolicy;
+import org.apache.lucene.document.FieldType;
 import org.apache.lucene.facet.params.CategoryListParams;
 import org.apache.lucene.facet.params.FacetSearchParams;
 import org.apache.lucene.facet.search.DrillDownQuery;
 import org.apache.lucene.facet.search.DrillSideways.DrillSidewaysResult;
 import org.apache.lucene.facet.search.DrillSideways;
-import org.apache.lucene.facet.search.FacetArrays;
+import org.apache.lucene.facet.search.FacetRequest.FacetArraysSource;
 import org.apache.lucene.facet.search.FacetRequest;
 import org.apache.lucene.facet.search.FacetResult;
+import org.apache.lucene.facet.search.FacetResultNode;
 import org.apache.lucene.facet.search.FacetsAccumulator;
-import org.apache.lucene.facet.search.FacetsAggregator;
 import org.apache.lucene.facet.search.FacetsCollector.MatchingDocs;
 import org.apache.lucene.facet.search.FacetsCollector;
-import org.apache.lucene.facet.search.FastCountingFacetsAggregator;
 import org.apache.lucene.facet.search.StandardFacetsAccumulator;
-import org.apache.lucene.facet.search.TopKFacetResultsHandler;
-import org.apache.lucene.facet.taxonomy.ParallelTaxonomyArrays;
 import org.apache.lucene.facet.taxonomy.TaxonomyReader;
-import org.apache.lucene.index.AtomicReader;
 import org.apache.lucene.index.AtomicReaderContext;
 import org.apache.lucene.index.BinaryDocValues;
 import org.apache.lucene.index.DocsAndPositionsEnum;
-import org.apache.lucene.index.DocsEnum;
 import org.apache.lucene.index.FieldInfo;
+import org.apache.lucene.index.IndexReader;
 import org.apache.lucene.index.Fields;
-import org.apache.lucene.index.FilteredTermsEnum;
 import org.apache.lucene.index.NumericDocValues;
 import org.apache.lucene.index.SegmentReader;
+import org.apache.lucene.index.SortedDocValues;
 import org.apache.lucene.index.Term;
 import org.apache.lucene.index.Terms;
 import org.apache.lucene.index.TermsEnum;
+import org.apache.lucene.search.grouping.GroupDocs;
+import org.apache.lucene.search.grouping.GroupingSearch;
+import org.apache.lucene.search.grouping.TopGroups;
 import org.apache.lucene.search.similarities.DefaultSimilarity;
 import org.apache.lucene.search.similarities.Similarity;
+import org.apache.lucene.search.spans.SpanNearQuery;
+import org.apache.lucene.search.spans.SpanOrQuery;
+import org.apache.lucene.search.spans.SpanQuery;
+import org.apache.lucene.search.spans.SpanTermQuery;
 import org.apache.lucene.store.Directory;
 import org.apache.lucene.store.IndexInput;
 import org.apache.lucene.store.NativeMMapDirectory;
 import org.apache.lucene.util.*;
+import org.apache.lucene.util.automaton.Automaton;
+import org.apache.lucene.util.automaton.BasicAutomata;
+import org.apache.lucene.util.automaton.BasicOperations;
+import org.apache.lucene.util.automaton.ByteRunAutomaton;
+import org.apache.lucene.util.automaton.CompiledAutomaton;
+import org.apache.lucene.util.automaton.LevenshteinAutomata;
+import org.apache.lucene.util.packed.PackedInts;
 
 /** Uses JNI (C) code to execute a BooleanQuery.  Note that this
  *  class can currently only run in a very precise
@@ -100,6 +117,53 @@ public class NativeSearch {
       int[] topDocIDs,
       float[] topScores,
 
+      // Sort values of the hits in the PQ (one per SortField
+      // for each hit), or null to sort by score:
+      long[] topSortValues,
+
+      // SORT_KEY_* of each SortField:
+      int[] sortKeys,
+
+      // SortField.getReverse() of each SortField:
+      boolean[] sortReverse,
+
+      // Per SortField, address in memory where the field's
+      // numeric DocValues begin (in the mapped .dvd file), or 0
+      // if no doc in this segment has a value or the SortField
+      // is not by a field:
+      long[] sortDVAddresses,
+
+      // Per SortField, Lucene42DocValuesConsumer format of the
+      // field:
+      int[] sortDVFormats,
+
+      // searchAfter: sort values of the last hit of the
+      // previous page, or null:
+      long[] sortAfterValues,
+
+      // searchAfter: docID of the last hit of the previous
+      // page:
+      int sortAfterDocID,
+
+      // True if the segment's docIDs are already in sort order,
+      // so collection may stop once no later doc can compete:
+      boolean sortEarlyTerminate,
+
+      // Grouping: per-PQ-entry ord of the group whose best hit
+      // it holds (-1 if none), or null if not grouping:
+      int[] topGroupOrds,
+
+      // Grouping: per-ord hit count, valueCount long:
+      int[] groupOrdCounts,
+
+      // Grouping: address in memory where the group field's
+      // ords begin (in the mapped .dvd file):
+      long groupDVAddress,
+
+      // Grouping: Lucene42DocValuesConsumer format of the
+      // group field's ords:
+      int groupDVFormat,
+
       // Current segment's maxDoc
       int maxDoc,
 
@@ -108,6 +172,10 @@ public class NativeSearch {
 
       // Current segment's liveDocs, or null:
       byte[] liveDocsBytes,
+
+      // Handle from newFilterBitmap for the search's cached
+      // filter, or 0:
+      long filterBitmap,
       
       // weightValue from each TermWeight:
       float[] termWeights,
@@ -150,13 +218,57 @@ public class NativeSearch {
 
       long[][] dsNearMissBits,
 
+      // If non-null, hits and near misses are counted here
+      // instead of set in dsHitBits/dsNearMissBits: handles
+      // from newFacetCounts for the drill down counts (or 0),
+      // then each dim's drill sideways counts:
+      long[] dsFacetCounts,
+
+      // Backing array of the segment's docToAddress
+      // PackedInts.Reader:
+      Object dsFacetAddresses,
+
+      // One of FACET_ADDRESS_*:
+      int dsFacetAddressFormat,
+
+      int dsFacetAddressBitsPerValue,
+
+      // Null if no doc in the segment has facets:
+      byte[] dsFacetBytes,
+
       int[] dsSingletonDocIDs,
 
       int[] dsDocFreqs,
 
       long[] dsDocTermStartFPs,
 
-      long dsDocFileAddress
+      long dsDocFileAddress,
+
+      // Number of terms in each clause that is an exact
+      // PhraseQuery, else 0; null if there are no phrase
+      // clauses:
+      int[] phraseTermCounts,
+
+      // Per-term postings of all phrase clauses, in clause
+      // order:
+      int[] phraseSingletonDocIDs,
+
+      long[] phraseTotalTermFreqs,
+
+      int[] phraseDocFreqs,
+
+      long[] phraseDocTermStartFPs,
+
+      long[] phrasePosTermStartFPs,
+
+      int[] phrasePosOffsets,
+
+      // Address in memory where .pos file is mapped:
+      long posFileAddress,
+
+      boolean indexHasPayloads,
+
+      boolean indexHasOffsets
       );
   
   private static native int searchSegmentExactPhraseQuery(
@@ -173,6 +285,10 @@ public class NativeSearch {
 
       // Current segment's liveDocs, or null:
       byte[] liveDocsBytes,
+
+      // Handle from newFilterBitmap for the search's cached
+      // filter, or 0:
+      long filterBitmap,
       
       // weightValue from each TermWeight:
       float termWeight,
@@ -212,12 +328,122 @@ public class NativeSearch {
 
       boolean indexHasOffsets);
 
+  private static native int searchSegmentSpanQuery(
+      // PQ holding top hits so far, pre-filled with sentinel
+      // values: 
+      int[] topDocIDs,
+      float[] topScores,
+
+      // Current segment's maxDoc
+      int maxDoc,
+
+      // Current segment's docBase
+      int docBase,
+
+      // Current segment's liveDocs, or null:
+      byte[] liveDocsBytes,
+
+      // Handle from newFilterBitmap for the search's cached
+      // filter, or 0:
+      long filterBitmap,
+      
+      // weightValue from the SpanScorer's docScorer:
+      float spanWeight,
+
+      // Norms for the field (all SpanTermQuery must be against a single field):
+      byte[] norms,
+
+      // Cache, mapping byte norm -> float
+      float[] normTable,
+
+      // Span tree, in pre-order: SPAN_* type of each node
+      int[] nodeTypes,
+
+      // Leaf index for SPAN_TERM nodes, slop for SPAN_NEAR_*
+      // nodes:
+      int[] nodeArgs,
+
+      // How many child nodes follow each node:
+      int[] nodeChildCounts,
+
+      // If the leaf's term has only one docID in this segment (it was "pulsed") then its set here, else -1:
+      int[] singletonDocIDs,
+
+      long[] totalTermFreqs,
+
+      // docFreq of each leaf's term, or 0 if it does not
+      // occur in this segment:
+      int[] docFreqs,
+      
+      // Offset in the .doc file where this term's docs+freqs begin:
+      long[] docTermStartFPs,
+
+      // Offset in the .pos file where this term's positions begin:
+      long[] posTermStartFPs,
+
+      // Address in memory where .doc file is mapped:
+      long docFileAddress,
+
+      // Address in memory where .pos file is mapped:
+      long posFileAddress,
+
+      boolean indexHasPayloads,
+
+      boolean indexHasOffsets);
+
   private static native int searchSegmentTermQuery(
       // PQ holding top hits so far, pre-filled with sentinel
       // values: 
       int[] topDocIDs,
       float[] topScores,
 
+      // Sort values of the hits in the PQ (one per SortField
+      // for each hit), or null to sort by score:
+      long[] topSortValues,
+
+      // SORT_KEY_* of each SortField:
+      int[] sortKeys,
+
+      // SortField.getReverse() of each SortField:
+      boolean[] sortReverse,
+
+      // Per SortField, address in memory where the field's
+      // numeric DocValues begin (in the mapped .dvd file), or 0
+      // if no doc in this segment has a value or the SortField
+      // is not by a field:
+      long[] sortDVAddresses,
+
+      // Per SortField, Lucene42DocValuesConsumer format of the
+      // field:
+      int[] sortDVFormats,
+
+      // searchAfter: sort values of the last hit of the
+      // previous page, or null:
+      long[] sortAfterValues,
+
+      // searchAfter: docID of the last hit of the previous
+      // page:
+      int sortAfterDocID,
+
+      // True if the segment's docIDs are already in sort order,
+      // so collection may stop once no later doc can compete:
+      boolean sortEarlyTerminate,
+
+      // Grouping: per-PQ-entry ord of the group whose best hit
+      // it holds (-1 if none), or null if not grouping:
+      int[] topGroupOrds,
+
+      // Grouping: per-ord hit count, valueCount long:
+      int[] groupOrdCounts,
+
+      // Grouping: address in memory where the group field's
+      // ords begin (in the mapped .dvd file):
+      long groupDVAddress,
+
+      // Grouping: Lucene42DocValuesConsumer format of the
+      // group field's ords:
+      int groupDVFormat,
+
       // Current segment's maxDoc
       int maxDoc,
 
@@ -227,6 +453,10 @@ public class NativeSearch {
       // Current segment's liveDocs, or null:
       byte[] liveDocsBytes,
 
+      // Handle from newFilterBitmap for the search's cached
+      // filter, or 0:
+      long filterBitmap,
+
       boolean docsOnly,
       
       // weightValue for this TermQuery's TermWeight
@@ -263,6 +493,24 @@ public class NativeSearch {
 
       long[][] dsNearMissBits,
 
+      // If non-null, hits and near misses are counted here
+      // instead of set in dsHitBits/dsNearMissBits: handles
+      // from newFacetCounts for the drill down counts (or 0),
+      // then each dim's drill sideways counts:
+      long[] dsFacetCounts,
+
+      // Backing array of the segment's docToAddress
+      // PackedInts.Reader:
+      Object dsFacetAddresses,
+
+      // One of FACET_ADDRESS_*:
+      int dsFacetAddressFormat,
+
+      int dsFacetAddressBitsPerValue,
+
+      // Null if no doc in the segment has facets:
+      byte[] dsFacetBytes,
+
       int[] dsSingletonDocIDs,
 
       int[] dsDocFreqs,
@@ -271,28 +519,255 @@ public class NativeSearch {
 
       long dsDocFileAddress);
 
-  private static native void fillMultiTermFilter(
-      long[] bits,
+  private static native int lookupTerms(
+      // Address in memory where .tim file is mapped:
+      long timFileAddress,
+
+      // FieldReader.rootBlockFP for the field:
+      long rootBlockFP,
+
+      boolean hasFreqs,
+
+      boolean hasPositions,
+
+      boolean hasPayloadsOrOffsets,
+
+      // Handle from newTermStateCache for this segment and
+      // field, or 0 to not use a cache:
+      long termStateCache,
+
+      // All terms' bytes, concatenated:
+      byte[] termBytes,
 
+      // Start of each term in termBytes, plus the end of the
+      // last term:
+      int[] termOffsets,
+
+      // Outputs; docFreq is 0 if the term does not exist:
+      int[] docFreqs,
+      long[] totalTermFreqs,
+      long[] docTermStartFPs,
+      long[] posTermStartFPs,
+      int[] singletonDocIDs);
+
+  private static native int collectMultiTermDocs(
+      // Output: sorted, unique live docIDs; must have room
+      // for the sum of all docFreqs plus the singletons:
+      int[] docIDs,
+
+      // Current segment's liveDocs, or null:
       byte[] liveDocsBytes,
 
+      // Handle from newFilterBitmap for the search's cached
+      // filter, or 0:
+      long filterBitmap,
+
+      // Address in memory where .doc file is mapped:
       long address,
 
+      // docFreq, docStartFP pairs:
       long[] termStatsArray,
 
+      // Sorted docIDs of terms with docFreq=1:
+      int[] singletonDocIDs,
+
       boolean docsOnly);
 
-  private static native void countFacets(
+  private static native long[] intersectTerms(
+      // Address in memory where .tim file is mapped:
+      long timFileAddress,
+
+      // FieldReader.rootBlockFP for the field:
+      long rootBlockFP,
+
+      boolean hasFreqs,
+
+      boolean hasPositions,
+
+      boolean hasPayloadsOrOffsets,
+
+      // DFA over term bytes: 256 entries per state, -1 for
+      // the dead state:
+      int[] transitions,
+
+      boolean[] accept,
+
+      int initialState);
+
+  // Returns (editDistance, termLength, docFreq,
+  // totalTermFreq, docStartFP or singleton docID) per term:
+  private static native long[] fuzzyTerms(
+      // Address in memory where .tim file is mapped:
+      long timFileAddress,
+
+      // FieldReader.rootBlockFP for the field:
+      long rootBlockFP,
+
+      boolean hasFreqs,
+
+      boolean hasPositions,
+
+      boolean hasPayloadsOrOffsets,
 
+      // Levenshtein DFAs for 0..maxEdits edits, sharing one
+      // table: 256 entries per state, -1 for the dead state:
+      int[] transitions,
+
+      boolean[] accept,
+
+      // Initial state of each DFA:
+      int[] initialStates,
+
+      // Set to all matching terms' bytes, concatenated:
+      byte[][] termBytesOut);
+
+  private static native long[] numericRangeTerms(
+      // Address in memory where .tim file is mapped:
+      long timFileAddress,
+
+      // FieldReader.rootBlockFP for the field:
+      long rootBlockFP,
+
+      boolean hasFreqs,
+
+      boolean hasPositions,
+
+      boolean hasPayloadsOrOffsets,
+
+      // 32 for int/float, 64 for long/double:
+      int valSize,
+
+      int precisionStep,
+
+      // Inclusive bounds, already converted to sortable
+      // int/long like NumericRangeTermsEnum does:
+      long minBound,
+      long maxBound);
+
+  private static native long newTermStateCache(
+      // Max number of terms to cache:
+      int maxEntries);
+
+  private static native void freeTermStateCache(long termStateCache);
+
+  private static native long newFilterBitmap(
+      // FixedBitSet's bits for the docs the filter accepts in
+      // this segment:
       long[] bits,
 
-      int maxDoc,
+      // Current segment's maxDoc
+      int maxDoc);
+
+  private static native long getFilterBitmapRamBytesUsed(long filterBitmap);
+
+  private static native void retainFilterBitmap(long filterBitmap);
+
+  // Frees the bitmap once the last reference is released:
+  private static native void releaseFilterBitmap(long filterBitmap);
+
+  private static native void fillMultiTermFilter(
+      long[] bits,
+
+      byte[] liveDocsBytes,
+
+      long filterBitmap,
+
+      long address,
+
+      long[] termStatsArray,
+
+      boolean docsOnly,
+
+      // Max threads to decode terms with:
+      int maxThreads,
 
-      int[] facetCounts,
+      // Don't bother with a thread for fewer postings than
+      // this:
+      int minPostingsPerThread);
 
-      long[] dvDocToAddress,
+  // Stops the library's worker threads and sets how many
+  // threads, counting the caller's, may run parallel jobs;
+  // workers start again on first use:
+  private static native void setWorkerThreads(int threads);
 
-      byte[] dvBytes);
+  private static native int countFacets(
+
+      // Each segment's hits:
+      long[][] bits,
+
+      int[] maxDocs,
+
+      // Backing array of each segment's docToAddress
+      // PackedInts.Reader:
+      Object[] dvDocToAddresses,
+
+      // One of FACET_ADDRESS_* per segment:
+      int[] dvAddressFormats,
+
+      int[] dvAddressBitsPerValue,
+
+      // Null for segments with no facets:
+      byte[][] dvBytes,
+
+      // Handle from newFacetCounts; made dense first:
+      long facetCounts,
+
+      // Max threads to count with:
+      int maxThreads,
+
+      // Don't bother with a thread for fewer hits than this:
+      int minHitsPerThread);
+
+  // Returns a handle to native counts for a taxonomy of this
+  // size, kept sparse while few ords are counted:
+  private static native long newFacetCounts(int numOrds,
+
+                                            // One of FACET_AGGREGATION_*:
+                                            int aggregation);
+
+  // Returns the counted (ord, count) pairs, sorted by ord,
+  // or null if the counts became dense; sums are float bits:
+  private static native int[] getSparseFacetCounts(long handle);
+
+  // Copies dense counts into the int[] indexed by ord:
+  private static native void getDenseFacetCounts(long handle, int[] facetCounts);
+
+  // Copies dense sums into the float[] indexed by ord:
+  private static native void getDenseFacetValues(long handle, float[] facetValues);
+
+  private static native void freeFacetCounts(long handle);
+
+  // Returns a handle to a native copy of the taxonomy's
+  // ParallelTaxonomyArrays:
+  private static native long newTaxonomyArrays(int[] parents, int[] children, int[] siblings);
+
+  private static native void freeTaxonomyArrays(long handle);
+
+  // Same as FastCountingFacetsAggregator.rollupValues:
+  private static native void rollupFacetCounts(long counts, long taxonomyArrays, int rootOrd);
+
+  // Returns rootOrd, its count and how many of its children
+  // have a positive count, then up to topN of its
+  // children's (ord, count), by descending count, like
+  // IntFacetResultsHandler (FloatFacetResultsHandler for
+  // sums, as float bits):
+  private static native int[] getTopFacetCounts(long counts, long taxonomyArrays, int rootOrd, int topN);
+
+  // Same as FACET_AGGREGATION_* in common.h:
+  private static final int FACET_AGGREGATION_COUNT = 0;
+  private static final int FACET_AGGREGATION_SUM_SCORE = 1;
+  private static final int FACET_AGGREGATION_SUM_FLOAT_ASSOCIATION = 2;
+
+  // Same as CategoryFloatAssociation.ASSOCIATION_LIST_ID:
+  private static final String FLOAT_ASSOCIATION_LIST_ID = "$assoc_float#";
+
+  // Same as FACET_ADDRESS_* in common.h:
+  private static final int FACET_ADDRESS_PACKED64 = 0;
+  private static final int FACET_ADDRESS_SINGLE_BLOCK = 1;
+  private static final int FACET_ADDRESS_DIRECT8 = 2;
+  private static final int FACET_ADDRESS_DIRECT16 = 3;
+  private static final int FACET_ADDRESS_DIRECT32 = 4;
+  private static final int FACET_ADDRESS_THREE_BLOCKS8 = 5;
 
   /** Runs the equivalent of DrillSideways.search, using
    *  optimized C++ code when possible, but otherwise
@@ -324,100 +799,478 @@ public class NativeSearch {
     }
   }
 
-  private static void getFacetCounts(int[] counts, long[] bits, AtomicReader reader, FacetSearchParams fsp) throws IOException {
-    int maxDoc = reader.maxDoc();
-    // nocommit must verify only one clparams for all FR cat paths:
-    BinaryDocValues bdv = reader.getBinaryDocValues(fsp.indexingParams.getCategoryListParams(null).field);
-    // nocommit must verify this is a Facet42BDV
-    // instance
-    //System.out.println("bits[0]=" + bits[0]);
-    byte[] dvBytes = (byte[]) getFieldObject(bdv, "org.apache.lucene.facet.codecs.facet42.Facet42BinaryDocValues", "bytes");
-    Object o = getFieldObject(bdv, "org.apache.lucene.facet.codecs.facet42.Facet42BinaryDocValues", "addresses");
-    long[] dvAddresses = (long[]) getFieldObject(o, "org.apache.lucene.util.packed.Packed64", "blocks");
-    //System.out.println("BPV=" + getIntField(o, "org.apache.lucene.util.packed.PackedInts$ReaderImpl", "bitsPerValue"));
-    //System.out.println("native dd addresss.len=" + dvAddresses.length + " bytes.len=" + dvBytes.length);
-    countFacets(bits, maxDoc, counts, dvAddresses, dvBytes);
+  /** Returns the backing array of Facet42BinaryDocValues'
+   *  in-memory docToAddress, setting formatOut[0] to one of
+   *  FACET_ADDRESS_*, or null if its PackedInts.Reader
+   *  implementation isn't supported. */
+  private static Object getFacetAddresses(PackedInts.Reader addresses, int[] formatOut) {
+    // PackedInts.getReader picks the implementation from
+    // the format and bitsPerValue the writer chose:
+    String className = addresses.getClass().getName();
+    if (className.equals("org.apache.lucene.util.packed.Packed64")) {
+      formatOut[0] = FACET_ADDRESS_PACKED64;
+      return getFieldObject(addresses, className, "blocks");
+    } else if (className.startsWith("org.apache.lucene.util.packed.Packed64SingleBlock$")) {
+      formatOut[0] = FACET_ADDRESS_SINGLE_BLOCK;
+      return getFieldObject(addresses, "org.apache.lucene.util.packed.Packed64SingleBlock", "blocks");
+    } else if (className.equals("org.apache.lucene.util.packed.Direct8")) {
+      formatOut[0] = FACET_ADDRESS_DIRECT8;
+      return getFieldObject(addresses, className, "values");
+    } else if (className.equals("org.apache.lucene.util.packed.Direct16")) {
+      formatOut[0] = FACET_ADDRESS_DIRECT16;
+      return getFieldObject(addresses, className, "values");
+    } else if (className.equals("org.apache.lucene.util.packed.Direct32")) {
+      formatOut[0] = FACET_ADDRESS_DIRECT32;
+      return getFieldObject(addresses, className, "values");
+    } else if (className.equals("org.apache.lucene.util.packed.Packed8ThreeBlocks")) {
+      formatOut[0] = FACET_ADDRESS_THREE_BLOCKS8;
+      return getFieldObject(addresses, className, "blocks");
+    } else {
+      return null;
+    }
   }
 
-  private static DrillSidewaysResult _drillSidewaysSearch(DrillSideways ds, DrillDownQuery query, int topN, FacetSearchParams fsp) throws IOException {
-    IndexSearcher searcher = (IndexSearcher) getFieldObject(ds, "org.apache.lucene.facet.search.DrillSideways", "searcher");
-    TaxonomyReader taxoReader = (TaxonomyReader) getFieldObject(ds, "org.apache.lucene.facet.search.DrillSideways", "taxoReader");
-    Method m = getMethod("org.apache.lucene.facet.search.DrillSideways", "moveDrillDownOnlyClauses", DrillDownQuery.class, FacetSearchParams.class);
-    query = (DrillDownQuery) invoke(m, ds, query, fsp);
-    m = getMethod("org.apache.lucene.facet.search.DrillDownQuery", "getDims");
-    Map<String,Integer> drillDownDims = (Map<String,Integer>) invoke(m, query);
-
-    if (drillDownDims.isEmpty()) {
-      // nocommit do non-DS optimized faceting here, once
-      // that's added:
-      throw new IllegalArgumentException("no drill down dims");
+  /** Drill down and drill sideways counts that the search
+   *  kernels increment as they collect each hit or near
+   *  miss, instead of setting bits that are counted in a
+   *  second pass.  Each segment's Facet42BinaryDocValues is
+   *  indexed by its reader ord. */
+  private static class NativeFacetCounts {
+    // Drill down accumulator (null if there are no drill
+    // down requests), then each dim's drill sideways
+    // accumulator:
+    final FacetsAccumulator[] accumulators;
+    // One of FACET_AGGREGATION_*, the same for every
+    // accumulator:
+    final int aggregation;
+    // Native counts per accumulator, from newHandles until
+    // freeHandles (0 when there is no drill down
+    // accumulator):
+    final long[] handles;
+    final Object[] addresses;
+    final int[] addressFormats;
+    final int[] addressBitsPerValue;
+    // Null for segments with no facets:
+    final byte[][] bytes;
+
+    public NativeFacetCounts(FacetsAccumulator[] accumulators, int aggregation, int numSegments) {
+      this.accumulators = accumulators;
+      this.aggregation = aggregation;
+      handles = new long[accumulators.length];
+      addresses = new Object[numSegments];
+      addressFormats = new int[numSegments];
+      addressBitsPerValue = new int[numSegments];
+      bytes = new byte[numSegments][];
     }
 
-    BooleanClause[] clauses = ((BooleanQuery) getFieldObject(query, "org.apache.lucene.facet.search.DrillDownQuery", "query")).getClauses();
-
-    if (clauses.length == drillDownDims.size()) {
-      // TODO: we could optimize this pure-browse case by
-      // making a custom scorer instead:
-      throw new IllegalArgumentException("baseQuery must be non-null");
+    /** Allocates the native counts; they start sparse, so
+     *  queries matching few docs don't touch a count per
+     *  taxonomy ordinal.  Call freeHandles when done. */
+    public void newHandles() {
+      for(int i=0;i<accumulators.length;i++) {
+        if (accumulators[i] != null) {
+          handles[i] = newFacetCounts(accumulators[i].taxonomyReader.getSize(), aggregation);
+        }
+      }
     }
-    
-    Query baseQuery = clauses[0].getQuery();
-
-    // nocommit is this the right place?
-    baseQuery = searcher.rewrite(baseQuery);
 
-    String dsField = null;
-    int numDims = drillDownDims.size();
-    int[] termsPerDim = new int[numDims];
-    List<BytesRef> ddTerms = new ArrayList<BytesRef>();
-
-    // nocommit how to rule out aggregators that need
-    // float[] scores?
-    
-    for(int i=1;i<clauses.length;i++) {
-      Query q = clauses[i].getQuery();
-
-      // DrillDownQuery always wraps each subQuery in
-      // ConstantScoreQuery:
-      assert q instanceof ConstantScoreQuery;
-      q = ((ConstantScoreQuery) q).getQuery();
+    /** Returns accumulator i's results.  When every request
+     *  just wants the top children by descending count, they
+     *  are rolled up and selected natively, so the
+     *  accumulator's FacetArrays is never allocated;
+     *  otherwise the counts are copied into its FacetArrays
+     *  and it computes the results. */
+    public List<FacetResult> accumulate(int i) throws IOException {
+      FacetsAccumulator accumulator = accumulators[i];
+      FacetSearchParams fsp = accumulator.searchParams;
+      for(FacetRequest fr : fsp.facetRequests) {
+        if (fr.getDepth() != 1 || fr.getSortOrder() != FacetRequest.SortOrder.DESCENDING) {
+          copyCounts(i);
+          // Already counted; this only rolls up and computes
+          // the top children:
+          return accumulator.accumulate(Collections.<MatchingDocs>emptyList());
+        }
+      }
 
-      if (q instanceof TermQuery) {
-        // Single-select drill-down
-        Term ddTerm = ((TermQuery) q).getTerm();
-        if (dsField == null) {
-          dsField = ddTerm.field();
-        } else if (!dsField.equals(ddTerm.field())) {
-          throw new IllegalArgumentException("all drill-downs must be against a single field");
+      TaxonomyReader taxoReader = accumulator.taxonomyReader;
+      long taxonomyArrays = getTaxonomyArrays(taxoReader);
+      List<FacetResult> results = new ArrayList<FacetResult>();
+      for(FacetRequest fr : fsp.facetRequests) {
+        int rootOrd = taxoReader.getOrdinal(fr.categoryPath);
+        FacetResultNode root = new FacetResultNode();
+        root.ordinal = rootOrd;
+        root.label = fr.categoryPath;
+        if (rootOrd == TaxonomyReader.INVALID_ORDINAL) {
+          // Category does not exist
+          results.add(new FacetResult(fr, root, 0));
+          continue;
         }
-        ddTerms.add(ddTerm.bytes());
-        termsPerDim[i-1] = 1;
-      } else {
-        // Muti-select drill-down
-        BooleanQuery q2 = (BooleanQuery) q;
-        BooleanClause[] clauses2 = q2.getClauses();
-        termsPerDim[i-1] = clauses2.length;
-        //System.out.println("java: tpd[" + (i-1) + "]=" + termsPerDim[i-1]);
-        for(int j=0;j<clauses2.length;j++) {
-          if (clauses2[j].getQuery() instanceof TermQuery) {
-            Term ddTerm = ((TermQuery) clauses2[j].getQuery()).getTerm();
-            if (dsField == null) {
-              dsField = ddTerm.field();
-            } else if (!dsField.equals(ddTerm.field())) {
-              throw new IllegalArgumentException("all drill-downs must be against a single field");
-            }
-            ddTerms.add(ddTerm.bytes());
-          } else {
-            throw new IllegalArgumentException("all drill-downs must be against a single field");
+        // SumFloatAssociationFacetsAggregator doesn't roll up:
+        if (fr.categoryPath.length > 0 && aggregation != FACET_AGGREGATION_SUM_FLOAT_ASSOCIATION) {
+          CategoryListParams clp = fsp.indexingParams.getCategoryListParams(fr.categoryPath);
+          if (clp.getOrdinalPolicy(fr.categoryPath.components[0]) == CategoryListParams.OrdinalPolicy.NO_PARENTS) {
+            rollupFacetCounts(handles[i], taxonomyArrays, rootOrd);
           }
         }
+        int[] top = getTopFacetCounts(handles[i], taxonomyArrays, rootOrd, fr.numResults);
+        root.value = getValue(top[1]);
+        FacetResultNode[] subResults = new FacetResultNode[(top.length-3)/2];
+        for(int j=0;j<subResults.length;j++) {
+          FacetResultNode node = new FacetResultNode();
+          node.ordinal = top[3+2*j];
+          node.value = getValue(top[4+2*j]);
+          node.label = taxoReader.getPath(node.ordinal);
+          subResults[j] = node;
+        }
+        root.subResults = Arrays.asList(subResults);
+        results.add(new FacetResult(fr, root, top[2]));
       }
+      return results;
     }
 
-    // nocommit if fsp2 is null we don't need the dd bitset:
-    SearchResult rawResult = _search(searcher, baseQuery, topN, numDims, termsPerDim, dsField, ddTerms);
+    private double getValue(int count) {
+      if (aggregation == FACET_AGGREGATION_COUNT) {
+        return count;
+      } else {
+        return Float.intBitsToFloat(count);
+      }
+    }
 
-    List<FacetRequest> ddRequests = new ArrayList<FacetRequest>();
+    /** Copies the native counts (or sums) into accumulator
+     *  i's FacetArrays. */
+    private void copyCounts(int i) {
+      int[] pairs = getSparseFacetCounts(handles[i]);
+      if (aggregation == FACET_AGGREGATION_COUNT) {
+        int[] counts = accumulators[i].facetArrays.getIntArray();
+        if (pairs == null) {
+          getDenseFacetCounts(handles[i], counts);
+        } else {
+          for(int j=0;j<pairs.length;j+=2) {
+            counts[pairs[j]] = pairs[j+1];
+          }
+        }
+      } else {
+        float[] values = accumulators[i].facetArrays.getFloatArray();
+        if (pairs == null) {
+          getDenseFacetValues(handles[i], values);
+        } else {
+          for(int j=0;j<pairs.length;j+=2) {
+            values[pairs[j]] = Float.intBitsToFloat(pairs[j+1]);
+          }
+        }
+      }
+    }
+
+    public void freeHandles() {
+      for(int i=0;i<handles.length;i++) {
+        if (handles[i] != 0) {
+          freeFacetCounts(handles[i]);
+          handles[i] = 0;
+        }
+      }
+    }
+  }
+
+  /** Returns true if cl, a FacetsAccumulator subclass,
+   *  overrides this method. */
+  private static boolean overrides(Class<?> cl, String methodName, Class<?>... params) {
+    for(;cl != FacetsAccumulator.class;cl = cl.getSuperclass()) {
+      try {
+        cl.getDeclaredMethod(methodName, params);
+        return true;
+      } catch (NoSuchMethodException nsme) {
+        // Keep looking
+      }
+    }
+    return false;
+  }
+
+  /** Returns which FACET_AGGREGATION_* this accumulator's
+   *  aggregator does, if it only sums the hits' ords into
+   *  its FacetArrays before rolling up and computing the top
+   *  children, so the sums can be filled in natively;
+   *  otherwise returns -1.  Subclasses may only change the
+   *  aggregator. */
+  private static int getAggregation(FacetsAccumulator accumulator) {
+    if (overrides(accumulator.getClass(), "accumulate", List.class) ||
+        overrides(accumulator.getClass(), "createFacetResultsHandler", FacetRequest.class)) {
+      return -1;
+    }
+    String aggregator = accumulator.getAggregator().getClass().getName();
+    int aggregation;
+    FacetArraysSource source;
+    if (aggregator.equals("org.apache.lucene.facet.search.FastCountingFacetsAggregator") ||
+        aggregator.equals("org.apache.lucene.facet.search.CountingFacetsAggregator")) {
+      aggregation = FACET_AGGREGATION_COUNT;
+      source = FacetArraysSource.INT;
+    } else if (aggregator.equals("org.apache.lucene.facet.search.SumScoreFacetsAggregator")) {
+      aggregation = FACET_AGGREGATION_SUM_SCORE;
+      source = FacetArraysSource.FLOAT;
+    } else if (aggregator.equals("org.apache.lucene.facet.associations.SumFloatAssociationFacetsAggregator")) {
+      aggregation = FACET_AGGREGATION_SUM_FLOAT_ASSOCIATION;
+      source = FacetArraysSource.FLOAT;
+    } else {
+      return -1;
+    }
+    FacetSearchParams fsp = accumulator.searchParams;
+    for(FacetRequest fr : fsp.facetRequests) {
+      // So the results handler reads the values we fill:
+      if (fr.getFacetArraysSource() != source) {
+        return -1;
+      }
+      // Same check FastCountingFacetsAggregator makes; the
+      // float associations are fixed-width instead:
+      CategoryListParams clp = fsp.indexingParams.getCategoryListParams(fr.categoryPath);
+      if (aggregation != FACET_AGGREGATION_SUM_FLOAT_ASSOCIATION &&
+          !clp.createEncoder().createMatchingDecoder().getClass().getSimpleName().equals("DGapVInt8IntDecoder")) {
+        return -1;
+      }
+    }
+    return aggregation;
+  }
+
+  /** Returns the counts (or sums) to fill while collecting
+   *  drill sideways hits, or null if some accumulator does
+   *  more than count or sum, the accumulators aggregate
+   *  differently, the requests span more than one category
+   *  list, or some segment's facets aren't in an in-memory
+   *  Facet42BinaryDocValues we can decode. */
+  private static NativeFacetCounts getNativeFacetCounts(IndexReader reader, FacetSearchParams fsp, FacetsAccumulator drillDownAccumulator,
+                                                        FacetsAccumulator[] drillSidewaysAccumulators) throws IOException {
+    String field = null;
+    for(FacetRequest fr : fsp.facetRequests) {
+      String clpField = fsp.indexingParams.getCategoryListParams(fr.categoryPath).field;
+      if (field == null) {
+        field = clpField;
+      } else if (!field.equals(clpField)) {
+        return null;
+      }
+    }
+
+    FacetsAccumulator[] accumulators = new FacetsAccumulator[1+drillSidewaysAccumulators.length];
+    accumulators[0] = drillDownAccumulator;
+    System.arraycopy(drillSidewaysAccumulators, 0, accumulators, 1, drillSidewaysAccumulators.length);
+    int aggregation = -1;
+    for(FacetsAccumulator accumulator : accumulators) {
+      if (accumulator == null) {
+        // No drill down requests
+        continue;
+      }
+      int accAggregation = getAggregation(accumulator);
+      if (accAggregation == -1 || (aggregation != -1 && accAggregation != aggregation)) {
+        return null;
+      }
+      aggregation = accAggregation;
+    }
+    if (aggregation == FACET_AGGREGATION_SUM_FLOAT_ASSOCIATION) {
+      // Associations are indexed in their own field:
+      field += FLOAT_ASSOCIATION_LIST_ID;
+    }
+
+    List<AtomicReaderContext> leaves = reader.leaves();
+    NativeFacetCounts facetCounts = new NativeFacetCounts(accumulators, aggregation, leaves.size());
+    int[] format = new int[1];
+    for(AtomicReaderContext ctx : leaves) {
+      BinaryDocValues bdv = ctx.reader().getBinaryDocValues(field);
+      if (bdv == null) {
+        // No doc in this segment has facets
+        continue;
+      }
+      if (!bdv.getClass().getName().equals("org.apache.lucene.facet.codecs.facet42.Facet42BinaryDocValues")) {
+        return null;
+      }
+      PackedInts.Reader addresses = (PackedInts.Reader) getFieldObject(bdv, "org.apache.lucene.facet.codecs.facet42.Facet42BinaryDocValues", "addresses");
+      Object array = getFacetAddresses(addresses, format);
+      if (array == null) {
+        return null;
+      }
+      facetCounts.addresses[ctx.ord] = array;
+      facetCounts.addressFormats[ctx.ord] = format[0];
+      facetCounts.addressBitsPerValue[ctx.ord] = addresses.getBitsPerValue();
+      facetCounts.bytes[ctx.ord] = (byte[]) getFieldObject(bdv, "org.apache.lucene.facet.codecs.facet42.Facet42BinaryDocValues", "bytes");
+    }
+    return facetCounts;
+  }
+
+  // Each taxonomy's ParallelTaxonomyArrays -> its native
+  // copy; the copy is freed once the arrays are collected:
+  private static final Map<Object,TaxonomyArraysHandle> taxonomyArrays = new WeakHashMap<Object,TaxonomyArraysHandle>();
+
+  /** Owns one handle from newTaxonomyArrays. */
+  private static final class TaxonomyArraysHandle {
+    final long address;
+
+    public TaxonomyArraysHandle(long address) {
+      this.address = address;
+    }
+
+    @Override
+    protected void finalize() {
+      freeTaxonomyArrays(address);
+    }
+  }
+
+  /** Returns the native copy of this taxonomy's parent,
+   *  child and sibling arrays, copying them the first time
+   *  they are seen. */
+  private static synchronized long getTaxonomyArrays(TaxonomyReader taxoReader) throws IOException {
+    Object arrays = taxoReader.getParallelTaxonomyArrays();
+    TaxonomyArraysHandle handle = taxonomyArrays.get(arrays);
+    if (handle == null) {
+      handle = new TaxonomyArraysHandle(newTaxonomyArrays(taxoReader.getParallelTaxonomyArrays().parents(),
+                                                          taxoReader.getParallelTaxonomyArrays().children(),
+                                                          taxoReader.getParallelTaxonomyArrays().siblings()));
+      taxonomyArrays.put(arrays, handle);
+    }
+    return handle.address;
+  }
+
+  private static volatile int facetCountThreads = 1;
+
+  /** Sets how many native threads may count drill sideways
+   *  facets.  With one thread (the default) each hit's
+   *  facets are counted as the hit is collected; with more,
+   *  hits are first collected into per-segment bitsets, and
+   *  then all segments are counted at once.  Each thread
+   *  beyond the first needs a temporary count per taxonomy
+   *  ordinal, or a hash if its share of the hits is small.
+   *  Few hits always use one thread, and score or
+   *  association sums are always summed as hits are
+   *  collected.  The native threads are started on first
+   *  use and kept for later searches; changing this stops
+   *  them. */
+  public static void setFacetCountThreads(int threads) {
+    if (threads < 1) {
+      throw new IllegalArgumentException("threads must be >= 1; got: " + threads);
+    }
+    facetCountThreads = threads;
+    resizeWorkerPool();
+  }
+
+  /** The native worker threads are shared by facet counting
+   *  and MultiTermQuery filter decoding, so there are enough
+   *  for whichever may use more. */
+  private static synchronized void resizeWorkerPool() {
+    setWorkerThreads(Math.max(facetCountThreads, multiTermFilterThreads));
+  }
+
+  // Each facet count thread counts at least this many hits;
+  // tests lower it so small indices use the threads too:
+  static volatile int facetCountMinHitsPerThread = 16*1024;
+
+  /** Counts the drill down and drill sideways hits that the
+   *  search set in each segment's bitsets, in one native call
+   *  over all segments per count array. */
+  private static void countFacets(NativeFacetCounts facetCounts, List<DrillSidewaysState> dsStates, int maxThreads) {
+    int numSegments = dsStates.size();
+    long[][] bits = new long[numSegments][];
+    int[] maxDocs = new int[numSegments];
+    Object[] addresses = new Object[numSegments];
+    int[] addressFormats = new int[numSegments];
+    int[] addressBitsPerValue = new int[numSegments];
+    byte[][] bytes = new byte[numSegments][];
+    for(int i=0;i<numSegments;i++) {
+      AtomicReaderContext ctx = dsStates.get(i).ctx;
+      maxDocs[i] = ctx.reader().maxDoc();
+      addresses[i] = facetCounts.addresses[ctx.ord];
+      addressFormats[i] = facetCounts.addressFormats[ctx.ord];
+      addressBitsPerValue[i] = facetCounts.addressBitsPerValue[ctx.ord];
+      bytes[i] = facetCounts.bytes[ctx.ord];
+    }
+    for(int dim=-1;dim<facetCounts.accumulators.length-1;dim++) {
+      long counts = facetCounts.handles[1+dim];
+      if (counts == 0) {
+        // No drill down requests
+        continue;
+      }
+      for(int i=0;i<numSegments;i++) {
+        DrillSidewaysState dsState = dsStates.get(i);
+        bits[i] = dim == -1 ? dsState.ddBitsArray : dsState.dsBitsArrays[dim];
+      }
+      if (countFacets(bits, maxDocs, addresses, addressFormats, addressBitsPerValue, bytes, counts, maxThreads,
+                      facetCountMinHitsPerThread) != 0) {
+        throw new IllegalArgumentException("cannot handle facet docToAddress");
+      }
+    }
+  }
+
+  // Tests set this so a drill sideways search whose facets
+  // are not aggregated while collecting throws
+  // IllegalArgumentException:
+  static volatile boolean requireFusedFacets;
+
+  private static DrillSidewaysResult _drillSidewaysSearch(DrillSideways ds, DrillDownQuery query, int topN, FacetSearchParams fsp) throws IOException {
+    IndexSearcher searcher = (IndexSearcher) getFieldObject(ds, "org.apache.lucene.facet.search.DrillSideways", "searcher");
+    Method m = getMethod("org.apache.lucene.facet.search.DrillSideways", "moveDrillDownOnlyClauses", DrillDownQuery.class, FacetSearchParams.class);
+    query = (DrillDownQuery) invoke(m, ds, query, fsp);
+    m = getMethod("org.apache.lucene.facet.search.DrillDownQuery", "getDims");
+    Map<String,Integer> drillDownDims = (Map<String,Integer>) invoke(m, query);
+
+    if (drillDownDims.isEmpty()) {
+      // nocommit do non-DS optimized faceting here, once
+      // that's added:
+      throw new IllegalArgumentException("no drill down dims");
+    }
+
+    BooleanClause[] clauses = ((BooleanQuery) getFieldObject(query, "org.apache.lucene.facet.search.DrillDownQuery", "query")).getClauses();
+
+    if (clauses.length == drillDownDims.size()) {
+      // TODO: we could optimize this pure-browse case by
+      // making a custom scorer instead:
+      throw new IllegalArgumentException("baseQuery must be non-null");
+    }
+    
+    Query baseQuery = clauses[0].getQuery();
+
+    // nocommit is this the right place?
+    baseQuery = searcher.rewrite(baseQuery);
+
+    String dsField = null;
+    int numDims = drillDownDims.size();
+    int[] termsPerDim = new int[numDims];
+    List<BytesRef> ddTerms = new ArrayList<BytesRef>();
+
+    for(int i=1;i<clauses.length;i++) {
+      Query q = clauses[i].getQuery();
+
+      // DrillDownQuery always wraps each subQuery in
+      // ConstantScoreQuery:
+      assert q instanceof ConstantScoreQuery;
+      q = ((ConstantScoreQuery) q).getQuery();
+
+      if (q instanceof TermQuery) {
+        // Single-select drill-down
+        Term ddTerm = ((TermQuery) q).getTerm();
+        if (dsField == null) {
+          dsField = ddTerm.field();
+        } else if (!dsField.equals(ddTerm.field())) {
+          throw new IllegalArgumentException("all drill-downs must be against a single field");
+        }
+        ddTerms.add(ddTerm.bytes());
+        termsPerDim[i-1] = 1;
+      } else {
+        // Muti-select drill-down
+        BooleanQuery q2 = (BooleanQuery) q;
+        BooleanClause[] clauses2 = q2.getClauses();
+        termsPerDim[i-1] = clauses2.length;
+        //System.out.println("java: tpd[" + (i-1) + "]=" + termsPerDim[i-1]);
+        for(int j=0;j<clauses2.length;j++) {
+          if (clauses2[j].getQuery() instanceof TermQuery) {
+            Term ddTerm = ((TermQuery) clauses2[j].getQuery()).getTerm();
+            if (dsField == null) {
+              dsField = ddTerm.field();
+            } else if (!dsField.equals(ddTerm.field())) {
+              throw new IllegalArgumentException("all drill-downs must be against a single field");
+            }
+            ddTerms.add(ddTerm.bytes());
+          } else {
+            throw new IllegalArgumentException("all drill-downs must be against a single field");
+          }
+        }
+      }
+    }
+
+    List<FacetRequest> ddRequests = new ArrayList<FacetRequest>();
     for(FacetRequest fr : fsp.facetRequests) {
       assert fr.categoryPath.length > 0;
       if (!drillDownDims.containsKey(fr.categoryPath.components[0])) {
@@ -451,124 +1304,95 @@ public class NativeSearch {
       idx++;
     }
 
-    // C facets is only ~ 16% faster, and is not complete
-    // (need to gen all bitsPerValue for decode):
-    boolean useCFacets = false;
-
     m = getMethod("org.apache.lucene.facet.search.DrillSideways", "getDrillDownAccumulator", FacetSearchParams.class);
     FacetsAccumulator drillDownAccumulator = fsp2 == null ? null : (FacetsAccumulator) invoke(m, ds, fsp2);
     if (drillDownAccumulator != null && (drillDownAccumulator instanceof StandardFacetsAccumulator)) {
       throw new IllegalArgumentException("accumulator must not be StandardFacetsAccumulator");
     }
 
-    List<FacetResult>[] drillSidewaysResults = new List[numDims];
-    List<FacetResult> drillDownResults = null;
+    // When every accumulator just counts, or sums scores or
+    // float associations, the hits' ords are aggregated
+    // natively, into native counts: by the search kernels as
+    // they collect each hit, or, when counting with more than
+    // one facet count thread, from the per-segment bits the
+    // kernels set.  The top children are then also picked
+    // natively.  Otherwise the accumulators aggregate those
+    // bits:
+    NativeFacetCounts facetCounts = getNativeFacetCounts(searcher.getIndexReader(), fsp, drillDownAccumulator, drillSidewaysAccumulators);
+    int countThreads = facetCountThreads;
+    // Only counts can come from the bits, which lose each
+    // hit's score:
+    boolean fused = facetCounts != null && (countThreads == 1 || facetCounts.aggregation != FACET_AGGREGATION_COUNT);
+    if (requireFusedFacets && !fused) {
+      throw new IllegalArgumentException("facets are not aggregated while collecting hits");
+    }
 
-    long t0 = System.currentTimeMillis();
+    SearchResult rawResult;
     List<FacetResult> mergedResults = new ArrayList<FacetResult>();
-    int[] requestUpto = new int[drillDownDims.size()];
-    int ddUpto = 0;
-    for(int i=0;i<fsp.facetRequests.size();i++) {
-      FacetRequest fr = fsp.facetRequests.get(i);
-      assert fr.categoryPath.length > 0;
-      Integer dimIndex = drillDownDims.get(fr.categoryPath.components[0]);
-      if (dimIndex == null) {
-        // Pure drill down dim (the current query didn't
-        // drill down on this dim):
-        if (drillDownResults == null) {
-          // Lazy init, in case all requests were against
-          // drill-sideways dims:
-
-          if (useCFacets) {
-            // nocommit must verify all criteria that
-            // FastCountingFAcetsCollector verifies
-
-            FacetArrays arr = new FacetArrays(taxoReader.getSize());
-            int[] counts = arr.getIntArray();
-            for(DrillSidewaysState dsState : rawResult.dsRawResults) {
-              getFacetCounts(counts, dsState.ddBitsArray, dsState.ctx.reader(), fsp2);
-            }
+    long t0;
+    try {
+      if (facetCounts != null) {
+        facetCounts.newHandles();
+      }
+      rawResult = _search(searcher, baseQuery, null, topN, null, null, numDims, termsPerDim, dsField, ddTerms,
+                          fused ? facetCounts : null);
+      if (facetCounts != null && !fused) {
+        countFacets(facetCounts, rawResult.dsRawResults, countThreads);
+      }
 
-            ParallelTaxonomyArrays arrays = taxoReader.getParallelTaxonomyArrays();
-            final int[] children = arrays.children();
-            final int[] siblings = arrays.siblings();
-
-            FacetsAggregator agg = new FastCountingFacetsAggregator();
-
-            drillDownResults = new ArrayList<FacetResult>();
-            for(FacetRequest fr2 : fsp2.facetRequests) {
-              int rootOrd = taxoReader.getOrdinal(fr2.categoryPath);
-              CategoryListParams clp = fsp2.indexingParams.getCategoryListParams(fr2.categoryPath);
-              if (fr2.categoryPath.length > 0) { // someone might ask to aggregate the ROOT category
-                OrdinalPolicy ordinalPolicy = clp.getOrdinalPolicy(fr2.categoryPath.components[0]);
-                if (ordinalPolicy == OrdinalPolicy.NO_PARENTS) {
-                  // rollup values
-                  //System.out.println("dd rollup");
-                  agg.rollupValues(fr2, rootOrd, children, siblings, arr);
-                }
-              }
+      List<FacetResult>[] drillSidewaysResults = new List[numDims];
+      List<FacetResult> drillDownResults = null;
 
-              drillDownResults.add(new TopKFacetResultsHandler(taxoReader, fr2, arr).compute());
-            }
-          } else {
-            List<MatchingDocs> matchingDocs = new ArrayList<MatchingDocs>();
-            for(DrillSidewaysState dsState : rawResult.dsRawResults) {
-              matchingDocs.add(new MatchingDocs(dsState.ctx, dsState.ddBits, dsState.totalHits[0], null));
+      t0 = System.currentTimeMillis();
+      int[] requestUpto = new int[drillDownDims.size()];
+      int ddUpto = 0;
+      for(int i=0;i<fsp.facetRequests.size();i++) {
+        FacetRequest fr = fsp.facetRequests.get(i);
+        assert fr.categoryPath.length > 0;
+        Integer dimIndex = drillDownDims.get(fr.categoryPath.components[0]);
+        if (dimIndex == null) {
+          // Pure drill down dim (the current query didn't
+          // drill down on this dim):
+          if (drillDownResults == null) {
+            // Lazy init, in case all requests were against
+            // drill-sideways dims:
+
+            if (facetCounts != null) {
+              drillDownResults = facetCounts.accumulate(0);
+            } else {
+              List<MatchingDocs> matchingDocs = new ArrayList<MatchingDocs>();
+              for(DrillSidewaysState dsState : rawResult.dsRawResults) {
+                matchingDocs.add(new MatchingDocs(dsState.ctx, dsState.ddBits, dsState.totalHits[0], null));
+              }
+              drillDownResults = drillDownAccumulator.accumulate(matchingDocs);
             }
-            drillDownResults = drillDownAccumulator.accumulate(matchingDocs);
           }
-        }
-        mergedResults.add(drillDownResults.get(ddUpto++));
-      } else {
-        // Drill sideways dim:
-        int dim = dimIndex.intValue();
-        List<FacetResult> sidewaysResult = drillSidewaysResults[dim];
-        if (sidewaysResult == null) {
-          if (useCFacets) {
+          mergedResults.add(drillDownResults.get(ddUpto++));
+        } else {
+          // Drill sideways dim:
+          int dim = dimIndex.intValue();
+          List<FacetResult> sidewaysResult = drillSidewaysResults[dim];
+          if (sidewaysResult == null) {
             // Lazy init, in case no facet request is against
             // a given drill down dim:
-
-            // nocommit must verify all criteria that
-            // FastCountingFAcetsCollector verifies
-
-            FacetArrays arr = new FacetArrays(taxoReader.getSize());
-            int[] counts = arr.getIntArray();
-            for(DrillSidewaysState dsState : rawResult.dsRawResults) {
-              getFacetCounts(counts, dsState.dsBitsArrays[dim], dsState.ctx.reader(), fsp);
-            }
-
-            ParallelTaxonomyArrays arrays = taxoReader.getParallelTaxonomyArrays();
-            final int[] children = arrays.children();
-            final int[] siblings = arrays.siblings();
-
-            FacetsAggregator agg = new FastCountingFacetsAggregator();
-
-            drillSidewaysResults[dim] = sidewaysResult = new ArrayList<FacetResult>();
-            for(FacetRequest fr2 : drillSidewaysAccumulators[dim].searchParams.facetRequests) {
-              int rootOrd = taxoReader.getOrdinal(fr.categoryPath);
-              CategoryListParams clp = fsp2.indexingParams.getCategoryListParams(fr.categoryPath);
-              if (fr.categoryPath.length > 0) { // someone might ask to aggregate the ROOT category
-                OrdinalPolicy ordinalPolicy = clp.getOrdinalPolicy(fr.categoryPath.components[0]);
-                if (ordinalPolicy == OrdinalPolicy.NO_PARENTS) {
-                  // rollup values
-                  //System.out.println("ds rollup");
-                  agg.rollupValues(fr, rootOrd, children, siblings, arr);
-                }
+            if (facetCounts != null) {
+              sidewaysResult = facetCounts.accumulate(1+dim);
+            } else {
+              List<MatchingDocs> matchingDocs = new ArrayList<MatchingDocs>();
+              for(DrillSidewaysState dsState : rawResult.dsRawResults) {
+                matchingDocs.add(new MatchingDocs(dsState.ctx, dsState.dsBits[dim], dsState.totalHits[1+dim], null));
               }
-
-              sidewaysResult.add(new TopKFacetResultsHandler(taxoReader, fr2, arr).compute());
+              sidewaysResult = drillSidewaysAccumulators[dim].accumulate(matchingDocs);
             }
-          } else {
-            List<MatchingDocs> matchingDocs = new ArrayList<MatchingDocs>();
-            for(DrillSidewaysState dsState : rawResult.dsRawResults) {
-              matchingDocs.add(new MatchingDocs(dsState.ctx, dsState.dsBits[dim], dsState.totalHits[1+dim], null));
-            }
-            sidewaysResult = drillSidewaysAccumulators[dim].accumulate(matchingDocs);
             drillSidewaysResults[dim] = sidewaysResult;
           }
+          mergedResults.add(sidewaysResult.get(requestUpto[dim]));
+          requestUpto[dim]++;
         }
-        mergedResults.add(sidewaysResult.get(requestUpto[dim]));
-        requestUpto[dim]++;
+      }
+    } finally {
+      if (facetCounts != null) {
+        facetCounts.freeHandles();
       }
     }
     long t1 = System.currentTimeMillis();
@@ -597,7 +1421,15 @@ public class NativeSearch {
     public int[] totalHits;
     public AtomicReaderContext ctx;
 
-    public DrillSidewaysState(SegmentState state, int dsNumDims, int[] dsTermsPerDim, String dsField, List<BytesRef> dsTerms) throws IOException {
+    // Only set when facets are counted while collecting:
+    public long[] facetCounts;
+    public Object facetAddresses;
+    public int facetAddressFormat;
+    public int facetAddressBitsPerValue;
+    public byte[] facetBytes;
+
+    public DrillSidewaysState(SegmentState state, int dsNumDims, int[] dsTermsPerDim, String dsField, List<BytesRef> dsTerms,
+                              NativeFacetCounts dsFacets) throws IOException {
       if (dsNumDims == 0) {
         return;
       }
@@ -613,45 +1445,47 @@ public class NativeSearch {
       if (terms == null) {
         throw new IllegalArgumentException("facet field does not exist");
       }
-      TermsEnum termsEnum = terms.iterator(null);
+      NativeTermsDict dict = new NativeTermsDict(terms, state.reader.getFieldInfos().fieldInfo(dsField),
+                                                 getTermStateCache(state.reader, dsField));
+      int[] allDocFreqs = new int[dsTerms.size()];
+      long[] allTotalTermFreqs = new long[dsTerms.size()];
+      long[] allDocTermStartFPs = new long[dsTerms.size()];
+      long[] allPosTermStartFPs = new long[dsTerms.size()];
+      int[] allSingletonDocIDs = new int[dsTerms.size()];
+      dict.lookup(dsTerms, allDocFreqs, allTotalTermFreqs, allDocTermStartFPs, allPosTermStartFPs, allSingletonDocIDs);
+
       int termUpto = 0;
-      long address = 0;
       int lastNumValidTerms = 0;
       int numValidTerms = 0;
       for(int i=0;i<dsNumDims;i++) {
         //System.out.println("dim=" + i + " termsPerDim=" + dsTermsPerDim[i]);
         for(int j=0;j<dsTermsPerDim[i];j++) {
-          BytesRef term = dsTerms.get(termUpto++);
-          //System.out.println("  term=" + term);
-          if (termsEnum.seekExact(term, false)) {
-            DocsEnum docsEnum = termsEnum.docs(null, null, 0);
-            if (docsEnum != null) {
-              docFreqs[numValidTerms] = getIntField(docsEnum, "org.apache.lucene.codecs.lucene41.Lucene41PostingsReader$BlockDocsEnum", "docFreq");
-              totalTermFreqs[numValidTerms] = getLongField(docsEnum, "org.apache.lucene.codecs.lucene41.Lucene41PostingsReader$BlockDocsEnum", "totalTermFreq");
-              if (docFreqs[numValidTerms] > 1) {
-                singletonDocIDs[numValidTerms] = -1;
-                docTermStartFPs[numValidTerms] = getLongField(docsEnum, "org.apache.lucene.codecs.lucene41.Lucene41PostingsReader$BlockDocsEnum", "docTermStartFP");
-                if (address == 0) {
-                  IndexInput docIn = (IndexInput) getFieldObject(docsEnum, "org.apache.lucene.codecs.lucene41.Lucene41PostingsReader$BlockDocsEnum", "docIn");
-                  address = getMMapAddress(unwrap(docIn));
-                }
-              } else {
-                singletonDocIDs[numValidTerms] = getIntField(docsEnum, "org.apache.lucene.codecs.lucene41.Lucene41PostingsReader$BlockDocsEnum", "singletonDocID");
-              }
-              //System.out.println("dF[" + numValidTerms + "]=" + docFreqs[numValidTerms] + "; startFP=" + docTermStartFPs[i]);
-              numValidTerms++;
-            } else {
-              //System.out.println("no docs match " + term);
-            }
+          if (allDocFreqs[termUpto] != 0) {
+            docFreqs[numValidTerms] = allDocFreqs[termUpto];
+            totalTermFreqs[numValidTerms] = allTotalTermFreqs[termUpto];
+            docTermStartFPs[numValidTerms] = allDocTermStartFPs[termUpto];
+            singletonDocIDs[numValidTerms] = allSingletonDocIDs[termUpto];
+            //System.out.println("dF[" + numValidTerms + "]=" + docFreqs[numValidTerms] + "; startFP=" + docTermStartFPs[i]);
+            numValidTerms++;
           } else {
-            //System.out.println("no term match " + term);
+            //System.out.println("no term match " + dsTerms.get(termUpto));
           }
+          termUpto++;
         }
         termsPerDim[i] = numValidTerms - lastNumValidTerms;
         lastNumValidTerms = numValidTerms;
         //System.out.println("i=" + i + " cout=" + termsPerDim[i]);
       }
-      this.address = address;
+      this.address = dict.docAddress;
+      if (dsFacets != null) {
+        int ord = ctx.ord;
+        facetCounts = dsFacets.handles;
+        facetAddresses = dsFacets.addresses[ord];
+        facetAddressFormat = dsFacets.addressFormats[ord];
+        facetAddressBitsPerValue = dsFacets.addressBitsPerValue[ord];
+        facetBytes = dsFacets.bytes[ord];
+        return;
+      }
       ddBits = new FixedBitSet(state.maxDoc);
       ddBitsArray = (long[]) getFieldObject(ddBits, "org.apache.lucene.util.FixedBitSet", "bits");
       dsBits = new FixedBitSet[dsNumDims];
@@ -667,106 +1501,1215 @@ public class NativeSearch {
     final TopDocs hits;
     final List<DrillSidewaysState> dsRawResults;
 
+    // Only set when grouping:
+    final TopGroups<BytesRef> groups;
+
     public SearchResult(TopDocs hits) {
       this.hits = hits;
       this.dsRawResults = null;
+      this.groups = null;
     }
 
     public SearchResult(TopDocs hits, List<DrillSidewaysState> dsRawResults) {
       this.hits = hits;
       this.dsRawResults = dsRawResults;
+      this.groups = null;
+    }
+
+    public SearchResult(TopGroups<BytesRef> groups) {
+      this.hits = null;
+      this.dsRawResults = null;
+      this.groups = groups;
+    }
+  }
+
+  /** Runs the search, using optimized C++ code when
+   *  possible, but otherwise falling back on
+   *  IndexSearcher. */
+  public static TopDocs search(IndexSearcher searcher, Query query, int topN) throws IOException {
+    return search(searcher, query, null, topN);
+  }
+
+  /** Same as {@link #search(IndexSearcher,Query,int)}, only
+   *  returning hits the filter (may be null) accepts. */
+  public static TopDocs search(IndexSearcher searcher, Query query, Filter filter, int topN) throws IOException {
+    //System.out.println("NATIVE: query in: " + query);
+    Filter nativeFilter = getNativeFilter(searcher, filter);
+    try {
+      if (query.getClass() == FuzzyQuery.class) {
+        // Expand natively, instead of rewriting to a BooleanQuery:
+        try {
+          SearchResult result = _searchFuzzyQuery(searcher, (FuzzyQuery) query, nativeFilter, topN);
+          if (result != null) {
+            return result.hits;
+          }
+        } catch (IllegalArgumentException iae) {
+          return searcher.search(query, filter, topN);
+        }
+      }
+      query = searcher.rewrite(query);
+      //System.out.println("NATIVE: after rewrite: " + query);
+
+      try {
+        TopDocs hits = _search(searcher, query, nativeFilter, topN, null, null, 0, null, null, null, null).hits;
+        //System.out.println("NATIVE: " + hits.totalHits + " hits");
+        return hits;
+      } catch (IllegalArgumentException iae) {
+        //System.out.println("NATIVE: skip: " + iae);
+        return searcher.search(query, filter, topN);
+      }
+    } finally {
+      releaseNativeFilter(nativeFilter);
+    }
+  }
+
+  /** Runs the search.search, using only optimized C++ code
+   *  and otherwise throws IllegalArgumentException
+   *  explaining why the optimized search did not apply.
+   *  Call this to understand why a given search isn't optimized. */ 
+  public static TopDocs searchNative(IndexSearcher searcher, Query query, int topN) throws IOException {
+    return searchNative(searcher, query, null, topN);
+  }
+
+  /** Same as {@link #searchNative(IndexSearcher,Query,int)},
+   *  only returning hits the filter (may be null) accepts. */
+  public static TopDocs searchNative(IndexSearcher searcher, Query query, Filter filter, int topN) throws IOException {
+    //System.out.println("NATIVE: query in=" + query);
+    Filter nativeFilter = getNativeFilter(searcher, filter);
+    try {
+      if (query.getClass() == FuzzyQuery.class) {
+        SearchResult result = _searchFuzzyQuery(searcher, (FuzzyQuery) query, nativeFilter, topN);
+        if (result != null) {
+          return result.hits;
+        }
+      }
+      query = searcher.rewrite(query);
+      //System.out.println("NATIVE: after rewrite: " + query + "; " + query.getClass());
+      return _search(searcher, query, nativeFilter, topN, null, null, 0, null, null, null, null).hits;
+    } finally {
+      releaseNativeFilter(nativeFilter);
+    }
+  }
+
+  /** Same as {@link #search(IndexSearcher,Query,Filter,int)},
+   *  only sorting hits by sort, like {@link
+   *  IndexSearcher#search(Query,Filter,int,Sort)}.  Up to
+   *  three SortFields, each INT or LONG on Lucene42 numeric
+   *  DocValues, SCORE or DOC, are optimized. */
+  public static TopFieldDocs search(IndexSearcher searcher, Query query, Filter filter, int topN, Sort sort) throws IOException {
+    return searchAfter(searcher, null, query, filter, topN, sort);
+  }
+
+  /** Same as {@link
+   *  #search(IndexSearcher,Query,Filter,int,Sort)}, but
+   *  throws IllegalArgumentException explaining why the
+   *  optimized search did not apply. */
+  public static TopFieldDocs searchNative(IndexSearcher searcher, Query query, Filter filter, int topN, Sort sort) throws IOException {
+    return searchAfterNative(searcher, null, query, filter, topN, sort);
+  }
+
+  /** Same as {@link
+   *  #search(IndexSearcher,Query,Filter,int,Sort)}, only
+   *  returning hits that sort after after (the last hit of
+   *  the previous page, or null), like {@link
+   *  IndexSearcher#searchAfter(ScoreDoc,Query,Filter,int,Sort)}. */
+  public static TopFieldDocs searchAfter(IndexSearcher searcher, FieldDoc after, Query query, Filter filter, int topN, Sort sort) throws IOException {
+    return searchAfter(searcher, after, query, filter, topN, sort, false);
+  }
+
+  /** Same as {@link
+   *  #searchAfter(IndexSearcher,FieldDoc,Query,Filter,int,Sort)};
+   *  pass docsInSortOrder=true only if every segment's docIDs
+   *  are already in sort order (e.g. the index was sorted
+   *  offline), so each segment's collection can stop once
+   *  its remaining docs can no longer compete.  In that case
+   *  totalHits is only a lower bound. */
+  public static TopFieldDocs searchAfter(IndexSearcher searcher, FieldDoc after, Query query, Filter filter, int topN, Sort sort,
+                                         boolean docsInSortOrder) throws IOException {
+    Filter nativeFilter = getNativeFilter(searcher, filter);
+    try {
+      query = searcher.rewrite(query);
+      try {
+        return (TopFieldDocs) _search(searcher, query, nativeFilter, topN, new NativeSort(sort, after, docsInSortOrder), null, 0, null, null, null, null).hits;
+      } catch (IllegalArgumentException iae) {
+        return (TopFieldDocs) searcher.searchAfter(after, query, filter, topN, sort);
+      }
+    } finally {
+      releaseNativeFilter(nativeFilter);
+    }
+  }
+
+  /** Same as {@link
+   *  #searchAfter(IndexSearcher,FieldDoc,Query,Filter,int,Sort)},
+   *  but throws IllegalArgumentException explaining why the
+   *  optimized search did not apply. */
+  public static TopFieldDocs searchAfterNative(IndexSearcher searcher, FieldDoc after, Query query, Filter filter, int topN, Sort sort) throws IOException {
+    return searchAfterNative(searcher, after, query, filter, topN, sort, false);
+  }
+
+  /** Same as {@link
+   *  #searchAfter(IndexSearcher,FieldDoc,Query,Filter,int,Sort,boolean)},
+   *  but throws IllegalArgumentException explaining why the
+   *  optimized search did not apply. */
+  public static TopFieldDocs searchAfterNative(IndexSearcher searcher, FieldDoc after, Query query, Filter filter, int topN, Sort sort,
+                                               boolean docsInSortOrder) throws IOException {
+    Filter nativeFilter = getNativeFilter(searcher, filter);
+    try {
+      query = searcher.rewrite(query);
+      return (TopFieldDocs) _search(searcher, query, nativeFilter, topN, new NativeSort(sort, after, docsInSortOrder), null, 0, null, null, null, null).hits;
+    } finally {
+      releaseNativeFilter(nativeFilter);
+    }
+  }
+
+  /** Collapses hits by groupField, which must have
+   *  SortedDocValues (Lucene42DocValuesFormat), returning
+   *  the topNGroups groups with the best scoring hits, with
+   *  only each group's best hit, same as {@link
+   *  GroupingSearch} with groupDocsLimit=1 and the default
+   *  (relevance) group and within-group sorts. */
+  public static TopGroups<BytesRef> groupSearch(IndexSearcher searcher, Query query, Filter filter, String groupField, int topNGroups) throws IOException {
+    Filter nativeFilter = getNativeFilter(searcher, filter);
+    try {
+      query = searcher.rewrite(query);
+      try {
+        return _search(searcher, query, nativeFilter, topNGroups, null, new NativeGrouping(groupField), 0, null, null, null, null).groups;
+      } catch (IllegalArgumentException iae) {
+        GroupingSearch groupingSearch = new GroupingSearch(groupField);
+        groupingSearch.setGroupDocsLimit(1);
+        return groupingSearch.search(searcher, filter, query, 0, topNGroups);
+      }
+    } finally {
+      releaseNativeFilter(nativeFilter);
+    }
+  }
+
+  /** Same as {@link
+   *  #groupSearch(IndexSearcher,Query,Filter,String,int)},
+   *  but throws IllegalArgumentException explaining why the
+   *  optimized search did not apply. */
+  public static TopGroups<BytesRef> groupSearchNative(IndexSearcher searcher, Query query, Filter filter, String groupField, int topNGroups) throws IOException {
+    Filter nativeFilter = getNativeFilter(searcher, filter);
+    try {
+      query = searcher.rewrite(query);
+      return _search(searcher, query, nativeFilter, topNGroups, null, new NativeGrouping(groupField), 0, null, null, null, null).groups;
+    } finally {
+      releaseNativeFilter(nativeFilter);
+    }
+  }
+
+  private static class SegmentState {
+    SegmentReader reader;
+    byte[] normBytes;
+    byte[] liveDocsBytes;
+
+    // Handle from the native filter cache, or 0 if there's
+    // no filter or it was folded into liveDocsBytes:
+    long filterBitmap;
+
+    boolean skip;
+    boolean docsOnly;
+    Bits liveDocs;
+    AtomicReaderContext ctx;
+    int maxDoc;
+
+    /** filter (may be null) is ANDed into liveDocsBytes,
+     *  unless it's a CachedFilter. */
+    public SegmentState(AtomicReaderContext ctx, String field, Filter filter) throws IOException {
+      if (!(ctx.reader() instanceof SegmentReader)) {
+        throw new IllegalArgumentException("leaves must be SegmentReaders; got: " + ctx.reader());
+      }
+      this.ctx = ctx;
+      reader = (SegmentReader) ctx.reader();
+      maxDoc = reader.maxDoc();
+      Directory dir = unwrap(reader.directory());
+      if (!(dir instanceof NativeMMapDirectory)) {
+        throw new IllegalArgumentException("directory must be a NativeMMapDirectory; got: " + reader.directory());
+      }
+      Codec codec = reader.getSegmentInfo().info.getCodec();
+
+      FieldInfo fieldInfo = reader.getFieldInfos().fieldInfo(field);
+      if (fieldInfo == null) {
+        // Field never appeared in this segment so no docs
+        // will match:
+        skip = true;
+        return;
+      }
+      skip = false;
+      docsOnly = fieldInfo.getIndexOptions() == FieldInfo.IndexOptions.DOCS_ONLY;
+
+      LiveDocsFormat ldf = codec.liveDocsFormat();
+      if (!(ldf instanceof Lucene40LiveDocsFormat)) {
+        throw new IllegalArgumentException("LiveDocsFormat must be Lucene40LiveDocsFormat; got: " + ldf);
+      }
+
+      NormsFormat nf = codec.normsFormat();
+      if (!(nf instanceof Lucene42NormsFormat)) {
+        throw new IllegalArgumentException("NormsFormat for field=" + field + " must be Lucene42NormsFormat; got: " + nf);
+      }
+
+      NumericDocValues norms = reader.getNormValues(field);
+      if (norms == null) {
+        normBytes = null;
+      } else {
+        normBytes = getNormsBytes(norms);
+      }
+
+      liveDocs = reader.getLiveDocs();
+
+      if (liveDocs != null) {
+        liveDocsBytes = getLiveDocsBits(liveDocs);
+      }
+
+      if (filter instanceof CachedFilter) {
+        // The kernels AND the cached bitmap with
+        // liveDocsBytes themselves:
+        FilterCacheEntry entry = ((CachedFilter) filter).getEntry(ctx);
+        if (entry.cardinality == 0) {
+          skip = true;
+        } else {
+          filterBitmap = entry.bitmap;
+        }
+      } else if (filter != null) {
+        // The kernels only check one mask, so we fold the
+        // filter into liveDocsBytes:
+        liveDocsBytes = getAcceptDocsBits(ctx, filter, liveDocs, liveDocsBytes);
+        if (liveDocsBytes == null) {
+          skip = true;
+        }
+      }
+    }
+  }
+
+  // Same as Lucene42DocValuesConsumer's numeric formats:
+  private static final int DV_DELTA_COMPRESSED = 0;
+  private static final int DV_TABLE_COMPRESSED = 1;
+  private static final int DV_UNCOMPRESSED = 2;
+
+  // Same as SORT_KEY_* in common.h:
+  private static final int SORT_KEY_LONG = 0;
+  private static final int SORT_KEY_INT = 1;
+  private static final int SORT_KEY_SCORE = 2;
+  private static final int SORT_KEY_DOC = 3;
+
+  // Same as MAX_SORT_KEYS in common.h:
+  private static final int MAX_SORT_KEYS = 3;
+
+  /** Sorts hits by up to MAX_SORT_KEYS SortFields, each INT
+   *  or LONG (whose Lucene42 numeric DocValues the C++ code
+   *  decodes straight from each segment's mapped .dvd
+   *  file), SCORE or DOC, optionally only collecting hits
+   *  after the last hit of a previous page.  Each hit's sort
+   *  values are held as longs, with scores as
+   *  NumericUtils.floatToSortableInt. */
+  private static class NativeSort {
+    final Sort sort;
+    final int[] keys;
+    final boolean[] reverse;
+
+    // Null unless the key is INT or LONG:
+    final String[] fields;
+
+    // True if higher values sort first:
+    final boolean[] descending;
+
+    // searchAfter, or null:
+    final long[] afterValues;
+    final int afterDocID;
+
+    // Caller declared each segment's docIDs are in sort order:
+    final boolean docsInSortOrder;
+
+    // Set by setNextReader:
+    final long[] dvAddresses;
+    final int[] dvFormats;
+
+    public NativeSort(Sort sort, FieldDoc after, boolean docsInSortOrder) {
+      SortField[] sortFields = sort.getSort();
+      if (sortFields.length > MAX_SORT_KEYS) {
+        throw new IllegalArgumentException("can only sort by up to " + MAX_SORT_KEYS + " SortFields; got: " + sort);
+      }
+      int numKeys = sortFields.length;
+      keys = new int[numKeys];
+      reverse = new boolean[numKeys];
+      fields = new String[numKeys];
+      descending = new boolean[numKeys];
+      dvAddresses = new long[numKeys];
+      dvFormats = new int[numKeys];
+
+      for(int i=0;i<numKeys;i++) {
+        SortField sortField = sortFields[i];
+        switch(sortField.getType()) {
+        case INT:
+          keys[i] = SORT_KEY_INT;
+          break;
+        case LONG:
+          keys[i] = SORT_KEY_LONG;
+          break;
+        case SCORE:
+          keys[i] = SORT_KEY_SCORE;
+          break;
+        case DOC:
+          keys[i] = SORT_KEY_DOC;
+          break;
+        default:
+          throw new IllegalArgumentException("SortField type must be INT, LONG, SCORE or DOC; got: " + sortField.getType());
+        }
+        if (keys[i] == SORT_KEY_INT || keys[i] == SORT_KEY_LONG) {
+          if (sortField.getParser() != null) {
+            throw new IllegalArgumentException("cannot handle SortField with a FieldCache parser; got: " + sortField.getParser());
+          }
+          if (sortField.missingValue != null) {
+            throw new IllegalArgumentException("cannot handle SortField with a missingValue; got: " + sortField.missingValue);
+          }
+          fields[i] = sortField.getField();
+        }
+        reverse[i] = sortField.getReverse();
+        // Higher scores sort first unless reversed:
+        descending[i] = keys[i] == SORT_KEY_SCORE ? !reverse[i] : reverse[i];
+      }
+
+      if (after != null) {
+        if (after.fields == null || after.fields.length != numKeys) {
+          throw new IllegalArgumentException("after must be a FieldDoc from a search sorted by the same Sort");
+        }
+        afterValues = new long[numKeys];
+        for(int i=0;i<numKeys;i++) {
+          afterValues[i] = toSortValue(i, after.fields[i]);
+        }
+        afterDocID = after.doc;
+      } else {
+        afterValues = null;
+        afterDocID = 0;
+      }
+
+      this.sort = sort;
+      this.docsInSortOrder = docsInSortOrder;
+    }
+
+    public boolean needsScores() {
+      for(int key : keys) {
+        if (key == SORT_KEY_SCORE) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    /** Inverse of toFieldValue. */
+    long toSortValue(int key, Object value) {
+      switch(keys[key]) {
+      case SORT_KEY_LONG:
+        return ((Long) value).longValue();
+      case SORT_KEY_SCORE:
+        return NumericUtils.floatToSortableInt(((Float) value).floatValue());
+      default:
+        // INT and DOC:
+        return ((Integer) value).intValue();
+      }
+    }
+
+    /** Returns the FieldDoc.fields value, same as
+     *  FieldComparator.value. */
+    Object toFieldValue(int key, long value) {
+      switch(keys[key]) {
+      case SORT_KEY_LONG:
+        return Long.valueOf(value);
+      case SORT_KEY_SCORE:
+        return Float.valueOf(NumericUtils.sortableIntToFloat((int) value));
+      default:
+        // INT and DOC:
+        return Integer.valueOf((int) value);
+      }
+    }
+
+    /** Returns the PQ's sort values (keys.length per hit),
+     *  pre-filled with a sentinel that every hit beats (ties
+     *  go to the lower docID). */
+    public long[] newTopValues(int topN) {
+      long[] topValues = new long[(topN+1)*keys.length];
+      for(int i=0;i<topValues.length;i++) {
+        topValues[i] = descending[i % keys.length] ? Long.MIN_VALUE : Long.MAX_VALUE;
+      }
+      return topValues;
+    }
+
+    /** True if hit 1 is less competitive than hit 2; values
+     *  holds keys.length sort values per hit. */
+    boolean lessThan(int docID1, long[] values1, int offset1, int docID2, long[] values2, int offset2) {
+      for(int i=0;i<keys.length;i++) {
+        long value1 = values1[offset1+i];
+        long value2 = values2[offset2+i];
+        if (value1 != value2) {
+          return descending[i] ? value1 < value2 : value1 > value2;
+        }
+      }
+      return docID1 > docID2;
+    }
+
+    public void setNextReader(SegmentReader reader) throws IOException {
+      for(int i=0;i<keys.length;i++) {
+        if (fields[i] != null) {
+          setDocValues(reader, i);
+        }
+      }
+    }
+
+    private void setDocValues(SegmentReader reader, int key) throws IOException {
+      String field = fields[key];
+      FieldInfo fieldInfo = reader.getFieldInfos().fieldInfo(field);
+      NumericDocValues values = reader.getNumericDocValues(field);
+      if (values == null) {
+        if (fieldInfo != null && fieldInfo.isIndexed()) {
+          throw new IllegalArgumentException("sort field=" + field + " must have numeric DocValues, not be un-inverted by FieldCache");
+        }
+        // Same as FieldCache: every doc sorts as 0
+        dvAddresses[key] = 0;
+        dvFormats[key] = 0;
+        return;
+      }
+
+      int[] format = new int[1];
+      dvAddresses[key] = getNumericDocValuesAddress(values, fieldInfo, format);
+      dvFormats[key] = format[0];
+    }
+  }
+
+  /** Returns the address in memory where the field's
+   *  Lucene42 numeric DocValues (for SortedDocValues, its
+   *  ords) begin in the mapped .dvd file; formatOut[0] is
+   *  set to its Lucene42DocValuesConsumer format. */
+  private static long getNumericDocValuesAddress(Object values, FieldInfo fieldInfo, int[] formatOut) {
+    String field = fieldInfo.name;
+    String className = values.getClass().getName();
+    if (!className.startsWith("org.apache.lucene.codecs.lucene42.Lucene42DocValuesProducer$")) {
+      throw new IllegalArgumentException("DocValuesFormat for field=" + field + " must be Lucene42DocValuesFormat; got: " + className);
+    }
+    Object producer = getFieldObject(values, className, "this$0");
+    Map<?,?> numerics = (Map<?,?>) getFieldObject(producer, "org.apache.lucene.codecs.lucene42.Lucene42DocValuesProducer", "numerics");
+    Object entry = numerics.get(fieldInfo.number);
+    String entryClassName = "org.apache.lucene.codecs.lucene42.Lucene42DocValuesProducer$NumericEntry";
+    int format = ((Byte) getFieldObject(entry, entryClassName, "format")).byteValue();
+    if (format != DV_DELTA_COMPRESSED && format != DV_TABLE_COMPRESSED && format != DV_UNCOMPRESSED) {
+      throw new IllegalArgumentException("unknown numeric DocValues format=" + format + " for field=" + field);
+    }
+    if (format != DV_UNCOMPRESSED && getIntField(entry, entryClassName, "packedIntsVersion") != PackedInts.VERSION_BYTE_ALIGNED) {
+      throw new IllegalArgumentException("field=" + field + " must use byte-aligned packed ints");
+    }
+    IndexInput data = (IndexInput) getFieldObject(producer, "org.apache.lucene.codecs.lucene42.Lucene42DocValuesProducer", "data");
+    formatOut[0] = format;
+    return getMMapAddress(unwrap(data)) + getLongField(entry, entryClassName, "offset");
+  }
+
+  /** Collapses hits by a SortedDocValues field, keeping the
+   *  top groups by their best hit's score and only that hit
+   *  per group, like {@link GroupingSearch} with
+   *  groupDocsLimit=1 and relevance group and within-group
+   *  sorts.  Each segment collects its top groups by ord
+   *  (whose Lucene42 numeric DocValues the C++ code decodes
+   *  straight from the mapped .dvd file), reusing the
+   *  topDocIDs/topScores PQ; since ords are per-segment, the
+   *  segments' groups are then merged by term. */
+  private static class NativeGrouping {
+    final String field;
+
+    // Set by setNextReader:
+    int[] topGroupOrds;
+    int[] ordCounts;
+    long dvAddress;
+    int dvFormat;
+    SortedDocValues values;
+
+    // Best hit per group term, across segments:
+    final Map<BytesRef,ScoreDoc> groups = new HashMap<BytesRef,ScoreDoc>();
+
+    // Per segment, to total each top group's hits:
+    final List<SortedDocValues> segmentValues = new ArrayList<SortedDocValues>();
+    final List<int[]> segmentOrdCounts = new ArrayList<int[]>();
+
+    public NativeGrouping(String field) {
+      this.field = field;
+    }
+
+    /** Resets the PQ for the next segment. */
+    public void setNextReader(SegmentReader reader, int[] topDocIDs, float[] topScores) throws IOException {
+      FieldInfo fieldInfo = reader.getFieldInfos().fieldInfo(field);
+      values = reader.getSortedDocValues(field);
+      if (values == null) {
+        throw new IllegalArgumentException("group field=" + field + " must have SortedDocValues in every segment");
+      }
+      int[] format = new int[1];
+      dvAddress = getNumericDocValuesAddress(values, fieldInfo, format);
+      dvFormat = format[0];
+
+      if (topGroupOrds == null) {
+        topGroupOrds = new int[topDocIDs.length];
+      }
+      Arrays.fill(topDocIDs, Integer.MAX_VALUE);
+      Arrays.fill(topScores, Float.NEGATIVE_INFINITY);
+      Arrays.fill(topGroupOrds, -1);
+      ordCounts = new int[values.getValueCount()];
+    }
+
+    /** Merges the segment's top groups, by term. */
+    public void finishSegment(int[] topDocIDs, float[] topScores) {
+      for(int i=1;i<topDocIDs.length;i++) {
+        int ord = topGroupOrds[i];
+        if (ord == -1) {
+          continue;
+        }
+        BytesRef term = new BytesRef();
+        values.lookupOrd(ord, term);
+        term = BytesRef.deepCopyOf(term);
+        ScoreDoc prev = groups.get(term);
+        // Segments are visited in docID order, so on a tie
+        // the earlier segment's hit stays the best:
+        if (prev == null || topScores[i] > prev.score) {
+          groups.put(term, new ScoreDoc(topDocIDs[i], topScores[i]));
+        }
+      }
+      segmentValues.add(values);
+      segmentOrdCounts.add(ordCounts);
+    }
+
+    public TopGroups<BytesRef> getTopGroups(int topN, int totalHits) {
+      List<Map.Entry<BytesRef,ScoreDoc>> entries = new ArrayList<Map.Entry<BytesRef,ScoreDoc>>(groups.entrySet());
+      if (entries.isEmpty()) {
+        // Same as GroupingSearch when nothing matched:
+        @SuppressWarnings({"unchecked","rawtypes"})
+        GroupDocs<BytesRef>[] empty = new GroupDocs[0];
+        return new TopGroups<BytesRef>(new SortField[0], new SortField[0], 0, 0, empty, Float.NaN);
+      }
+      Collections.sort(entries,
+                       new Comparator<Map.Entry<BytesRef,ScoreDoc>>() {
+                         @Override
+                         public int compare(Map.Entry<BytesRef,ScoreDoc> a, Map.Entry<BytesRef,ScoreDoc> b) {
+                           ScoreDoc hitA = a.getValue();
+                           ScoreDoc hitB = b.getValue();
+                           if (hitA.score != hitB.score) {
+                             return hitA.score > hitB.score ? -1 : 1;
+                           }
+                           return hitA.doc - hitB.doc;
+                         }
+                       });
+
+      int numGroups = Math.min(topN, entries.size());
+      @SuppressWarnings({"unchecked","rawtypes"})
+      GroupDocs<BytesRef>[] groupDocs = new GroupDocs[numGroups];
+      int totalGroupedHits = 0;
+      float maxScore = Float.NEGATIVE_INFINITY;
+      for(int i=0;i<numGroups;i++) {
+        BytesRef term = entries.get(i).getKey();
+        ScoreDoc hit = entries.get(i).getValue();
+        int groupHits = 0;
+        for(int seg=0;seg<segmentValues.size();seg++) {
+          int ord = segmentValues.get(seg).lookupTerm(term);
+          if (ord >= 0) {
+            groupHits += segmentOrdCounts.get(seg)[ord];
+          }
+        }
+        totalGroupedHits += groupHits;
+        maxScore = Math.max(maxScore, hit.score);
+        groupDocs[i] = new GroupDocs<BytesRef>(Float.NaN, hit.score, groupHits, new ScoreDoc[] {hit}, term, new Object[] {hit.score});
+      }
+
+      return new TopGroups<BytesRef>(Sort.RELEVANCE.getSort(), Sort.RELEVANCE.getSort(), totalHits, totalGroupedHits, groupDocs, maxScore);
+    }
+  }
+
+  /** Returns the docs the filter accepts in this segment,
+   *  ANDed with liveDocsBytes if it's non-null, in the same
+   *  layout as getLiveDocsBits, or null if no doc is
+   *  accepted. */
+  private static byte[] getAcceptDocsBits(AtomicReaderContext ctx, Filter filter, Bits liveDocs, byte[] liveDocsBytes) throws IOException {
+    FixedBitSet bits = getFilterBits(ctx, filter, liveDocs);
+    if (bits == null) {
+      return null;
+    }
+    int maxDoc = ctx.reader().maxDoc();
+
+    long[] words = bits.getBits();
+    byte[] acceptBytes = new byte[(maxDoc >>> 3) + 1];
+    boolean any = false;
+    for(int i=0;i<acceptBytes.length && (i>>>3)<words.length;i++) {
+      byte b = (byte) (words[i>>>3] >>> ((i&7)<<3));
+      if (liveDocsBytes != null) {
+        b &= liveDocsBytes[i];
+      }
+      acceptBytes[i] = b;
+      any |= b != 0;
+    }
+    return any ? acceptBytes : null;
+  }
+
+  /** Returns the docs the filter accepts in this segment,
+   *  or null if it accepts none. */
+  private static FixedBitSet getFilterBits(AtomicReaderContext ctx, Filter filter, Bits acceptDocs) throws IOException {
+    DocIdSet docIdSet = filter.getDocIdSet(ctx, acceptDocs);
+    if (docIdSet == null) {
+      return null;
+    }
+    if (docIdSet instanceof FixedBitSet) {
+      return (FixedBitSet) docIdSet;
+    }
+    DocIdSetIterator it = docIdSet.iterator();
+    if (it == null) {
+      return null;
+    }
+    FixedBitSet bits = new FixedBitSet(ctx.reader().maxDoc());
+    bits.or(it);
+    return bits;
+  }
+
+  /** One segment's BlockTree terms dict and Lucene41
+   *  postings files for a field, so terms can be resolved
+   *  natively (lookupTerms) instead of seeking a TermsEnum
+   *  and pulling each term's metadata out via reflection. */
+  private static class NativeTermsDict {
+    final long timAddress;
+    final long rootBlockFP;
+    final long docAddress;
+    final long posAddress;
+    final boolean hasFreqs;
+    final boolean hasPositions;
+    final boolean hasPayloadsOrOffsets;
+    final long termStateCache;
+
+    /** termStateCache is from getTermStateCache, or 0 to
+     *  always seek the terms dict. */
+    public NativeTermsDict(Terms terms, FieldInfo fieldInfo, long termStateCache) {
+      if (!terms.getClass().getName().equals("org.apache.lucene.codecs.BlockTreeTermsReader$FieldReader")) {
+        throw new IllegalArgumentException("terms dict must be BlockTreeTermsReader; got " + terms.getClass().getName());
+      }
+      Object termsReader = getFieldObject(terms, "org.apache.lucene.codecs.BlockTreeTermsReader$FieldReader", "this$0");
+      Object postingsReader = getFieldObject(termsReader, "org.apache.lucene.codecs.BlockTreeTermsReader", "postingsReader");
+      if (!postingsReader.getClass().getName().equals("org.apache.lucene.codecs.lucene41.Lucene41PostingsReader")) {
+        throw new IllegalArgumentException("must use Lucene41PostingsFormat; got " + postingsReader.getClass().getName());
+      }
+
+      rootBlockFP = getLongField(terms, "org.apache.lucene.codecs.BlockTreeTermsReader$FieldReader", "rootBlockFP");
+      IndexInput timIn = (IndexInput) getFieldObject(termsReader, "org.apache.lucene.codecs.BlockTreeTermsReader", "in");
+      timAddress = getMMapAddress(unwrap(timIn));
+      IndexInput docIn = (IndexInput) getFieldObject(postingsReader, "org.apache.lucene.codecs.lucene41.Lucene41PostingsReader", "docIn");
+      docAddress = getMMapAddress(unwrap(docIn));
+      // Null if no field in the segment has positions:
+      IndexInput posIn = (IndexInput) getFieldObject(postingsReader, "org.apache.lucene.codecs.lucene41.Lucene41PostingsReader", "posIn");
+      posAddress = posIn == null ? 0 : getMMapAddress(unwrap(posIn));
+
+      FieldInfo.IndexOptions indexOptions = fieldInfo.getIndexOptions();
+      hasFreqs = indexOptions != FieldInfo.IndexOptions.DOCS_ONLY;
+      hasPositions = indexOptions.compareTo(FieldInfo.IndexOptions.DOCS_AND_FREQS_AND_POSITIONS) >= 0;
+      hasPayloadsOrOffsets = fieldInfo.hasPayloads() || indexOptions.compareTo(FieldInfo.IndexOptions.DOCS_AND_FREQS_AND_POSITIONS_AND_OFFSETS) >= 0;
+      this.termStateCache = termStateCache;
+    }
+
+    /** Resolves all terms in one native call; docFreqs[i]
+     *  is 0 if terms.get(i) does not exist.  Sorted terms
+     *  resolve fastest.  Returns how many terms exist. */
+    public int lookup(List<BytesRef> terms, int[] docFreqs, long[] totalTermFreqs,
+                      long[] docTermStartFPs, long[] posTermStartFPs, int[] singletonDocIDs) {
+      int[] termOffsets = new int[terms.size()+1];
+      int numBytes = 0;
+      for(int i=0;i<terms.size();i++) {
+        termOffsets[i] = numBytes;
+        numBytes += terms.get(i).length;
+      }
+      termOffsets[terms.size()] = numBytes;
+      byte[] termBytes = new byte[numBytes];
+      for(int i=0;i<terms.size();i++) {
+        BytesRef term = terms.get(i);
+        System.arraycopy(term.bytes, term.offset, termBytes, termOffsets[i], term.length);
+      }
+      return lookupTerms(timAddress, rootBlockFP, hasFreqs, hasPositions, hasPayloadsOrOffsets,
+                         termStateCache, termBytes, termOffsets, docFreqs, totalTermFreqs, docTermStartFPs, posTermStartFPs, singletonDocIDs);
+    }
+
+    /** Returns (docFreq, docStartFP) pairs for all terms the
+     *  DFA accepts, in term order; for docFreq=1 terms the
+     *  singleton docID replaces docStartFP. */
+    public long[] intersect(ByteDFA dfa) {
+      return intersectTerms(timAddress, rootBlockFP, hasFreqs, hasPositions, hasPayloadsOrOffsets,
+                            dfa.transitions, dfa.accept, dfa.initialState);
+    }
+
+    /** Returns (editDistance, termLength, docFreq,
+     *  totalTermFreq, docStartFP or singleton docID) for all
+     *  terms within the fuzzy query's edit distance, in term
+     *  order; termBytesOut[0] is set to their bytes. */
+    public long[] fuzzy(FuzzyDFAs dfas, byte[][] termBytesOut) {
+      return fuzzyTerms(timAddress, rootBlockFP, hasFreqs, hasPositions, hasPayloadsOrOffsets,
+                        dfas.transitions, dfas.accept, dfas.initialStates, termBytesOut);
+    }
+
+    /** Same as intersect, for the trie terms of a numeric
+     *  range. */
+    public long[] numericRange(NumericRange range) {
+      return numericRangeTerms(timAddress, rootBlockFP, hasFreqs, hasPositions, hasPayloadsOrOffsets,
+                               range.valSize, range.precisionStep, range.minBound, range.maxBound);
+    }
+  }
+
+  /** A DFA over term bytes as a flat table (256 entries per
+   *  state, -1 for the dead state), so it can be intersected
+   *  natively with the terms dict. */
+  static class ByteDFA {
+    final int[] transitions;
+    final boolean[] accept;
+    final int initialState;
+
+    ByteDFA(int[] transitions, boolean[] accept, int initialState) {
+      this.transitions = transitions;
+      this.accept = accept;
+      this.initialState = initialState;
+    }
+
+    /** Accepts exactly these bytes, or, if isPrefix, all
+     *  terms starting with them. */
+    static ByteDFA forBytes(BytesRef bytes, boolean isPrefix) {
+      int numStates = bytes.length+1;
+      int[] transitions = new int[256*numStates];
+      Arrays.fill(transitions, -1);
+      for(int i=0;i<bytes.length;i++) {
+        transitions[256*i + (bytes.bytes[bytes.offset+i] & 0xff)] = i+1;
+      }
+      if (isPrefix) {
+        Arrays.fill(transitions, 256*bytes.length, 256*numStates, bytes.length);
+      }
+      boolean[] accept = new boolean[numStates];
+      accept[bytes.length] = true;
+      return new ByteDFA(transitions, accept, 0);
+    }
+
+    static ByteDFA forRunAutomaton(ByteRunAutomaton a) {
+      int numStates = a.getSize();
+      int[] transitions = new int[256*numStates];
+      boolean[] accept = new boolean[numStates];
+      for(int state=0;state<numStates;state++) {
+        for(int b=0;b<256;b++) {
+          transitions[256*state+b] = a.step(state, b);
+        }
+        accept[state] = a.isAccept(state);
+      }
+      return new ByteDFA(transitions, accept, a.getInitialState());
+    }
+
+    static ByteDFA forCompiledAutomaton(CompiledAutomaton compiled) {
+      switch(compiled.type) {
+      case NONE:
+        int[] transitions = new int[256];
+        Arrays.fill(transitions, -1);
+        return new ByteDFA(transitions, new boolean[1], 0);
+      case ALL:
+        return forBytes(new BytesRef(), true);
+      case SINGLE:
+        return forBytes(compiled.term, false);
+      case PREFIX:
+        return forBytes(compiled.term, true);
+      default:
+        return forRunAutomaton(compiled.runAutomaton);
+      }
+    }
+  }
+
+  /** FuzzyQuery's Levenshtein DFAs for 0..maxEdits edits,
+   *  built like FuzzyTermsEnum builds them, renumbered into
+   *  one table so they can all run in a single native walk of
+   *  the terms dict. */
+  static class FuzzyDFAs {
+    final int[] transitions;
+    final boolean[] accept;
+    final int[] initialStates;
+
+    FuzzyDFAs(FuzzyQuery query, int[] codePoints) {
+      int prefixLength = Math.min(query.getPrefixLength(), codePoints.length);
+      LevenshteinAutomata builder = new LevenshteinAutomata(UnicodeUtil.newString(codePoints, prefixLength, codePoints.length - prefixLength),
+                                                            query.getTranspositions());
+      int maxEdits = query.getMaxEdits();
+      ByteDFA[] dfas = new ByteDFA[maxEdits+1];
+      int numStates = 0;
+      for(int ed=0;ed<=maxEdits;ed++) {
+        Automaton a = builder.toAutomaton(ed);
+        if (prefixLength > 0) {
+          Automaton prefix = BasicAutomata.makeString(UnicodeUtil.newString(codePoints, 0, prefixLength));
+          a = BasicOperations.concatenate(prefix, a);
+        }
+        dfas[ed] = ByteDFA.forRunAutomaton(new CompiledAutomaton(a, true, false).runAutomaton);
+        numStates += dfas[ed].accept.length;
+      }
+
+      transitions = new int[256*numStates];
+      accept = new boolean[numStates];
+      initialStates = new int[maxEdits+1];
+      int stateBase = 0;
+      for(int ed=0;ed<=maxEdits;ed++) {
+        ByteDFA dfa = dfas[ed];
+        for(int i=0;i<dfa.transitions.length;i++) {
+          int state = dfa.transitions[i];
+          transitions[256*stateBase+i] = state == -1 ? -1 : stateBase + state;
+        }
+        System.arraycopy(dfa.accept, 0, accept, stateBase, dfa.accept.length);
+        initialStates[ed] = stateBase + dfa.initialState;
+        stateBase += dfa.accept.length;
+      }
+    }
+  }
+
+  /** A NumericRangeQuery's inclusive bounds, as sortable
+   *  int/long, the same as NumericRangeTermsEnum computes
+   *  them; minBound > maxBound if nothing can match. */
+  static class NumericRange {
+    final int valSize;
+    final int precisionStep;
+    final long minBound;
+    final long maxBound;
+
+    NumericRange(int valSize, int precisionStep, long minBound, long maxBound) {
+      this.valSize = valSize;
+      this.precisionStep = precisionStep;
+      this.minBound = minBound;
+      this.maxBound = maxBound;
+    }
+
+    static NumericRange forQuery(NumericRangeQuery<?> query) {
+      FieldType.NumericType dataType = (FieldType.NumericType) getFieldObject(query, "org.apache.lucene.search.NumericRangeQuery", "dataType");
+      Number min = query.getMin();
+      Number max = query.getMax();
+      int precisionStep = query.getPrecisionStep();
+      switch(dataType) {
+      case LONG:
+      case DOUBLE: {
+        long minBound;
+        long maxBound;
+        if (dataType == FieldType.NumericType.LONG) {
+          minBound = min == null ? Long.MIN_VALUE : min.longValue();
+          maxBound = max == null ? Long.MAX_VALUE : max.longValue();
+        } else {
+          minBound = NumericUtils.doubleToSortableLong(min == null ? Double.NEGATIVE_INFINITY : min.doubleValue());
+          maxBound = NumericUtils.doubleToSortableLong(max == null ? Double.POSITIVE_INFINITY : max.doubleValue());
+        }
+        if (!query.includesMin() && min != null) {
+          if (minBound == Long.MAX_VALUE) {
+            return new NumericRange(64, precisionStep, 1, 0);
+          }
+          minBound++;
+        }
+        if (!query.includesMax() && max != null) {
+          if (maxBound == Long.MIN_VALUE) {
+            return new NumericRange(64, precisionStep, 1, 0);
+          }
+          maxBound--;
+        }
+        return new NumericRange(64, precisionStep, minBound, maxBound);
+      }
+      case INT:
+      case FLOAT: {
+        int minBound;
+        int maxBound;
+        if (dataType == FieldType.NumericType.INT) {
+          minBound = min == null ? Integer.MIN_VALUE : min.intValue();
+          maxBound = max == null ? Integer.MAX_VALUE : max.intValue();
+        } else {
+          minBound = NumericUtils.floatToSortableInt(min == null ? Float.NEGATIVE_INFINITY : min.floatValue());
+          maxBound = NumericUtils.floatToSortableInt(max == null ? Float.POSITIVE_INFINITY : max.floatValue());
+        }
+        if (!query.includesMin() && min != null) {
+          if (minBound == Integer.MAX_VALUE) {
+            return new NumericRange(32, precisionStep, 1, 0);
+          }
+          minBound++;
+        }
+        if (!query.includesMax() && max != null) {
+          if (maxBound == Integer.MIN_VALUE) {
+            return new NumericRange(32, precisionStep, 1, 0);
+          }
+          maxBound--;
+        }
+        return new NumericRange(32, precisionStep, minBound, maxBound);
+      }
+      default:
+        throw new IllegalArgumentException("unknown NumericType " + dataType);
+      }
+    }
+  }
+
+  /** Returns the DFA matching the query's terms, or null if
+   *  its terms must be enumerated with its TermsEnum. */
+  private static ByteDFA getByteDFA(MultiTermQuery query) {
+    // Exact class checks, since subclasses may override
+    // getTermsEnum:
+    if (query.getClass() == PrefixQuery.class) {
+      return ByteDFA.forBytes(((PrefixQuery) query).getPrefix().bytes(), true);
+    } else if (query.getClass() == WildcardQuery.class ||
+               query.getClass() == RegexpQuery.class ||
+               query.getClass() == AutomatonQuery.class) {
+      return ByteDFA.forCompiledAutomaton((CompiledAutomaton) getFieldObject(query, "org.apache.lucene.search.AutomatonQuery", "compiled"));
+    } else {
+      return null;
+    }
+  }
+
+  // Segment core key -> field -> native term state cache
+  // (from newTermStateCache); lookups don't lock:
+  private static final Map<Object,Map<String,Long>> termStateCaches = new ConcurrentHashMap<Object,Map<String,Long>>();
+
+  private static volatile int termStateCacheSize = 8192;
+
+  /** Sets how many terms are cached, per segment and field,
+   *  when queries resolve terms natively; 0 disables the
+   *  cache.  Only affects caches created after this call. */
+  public static void setTermStateCacheSize(int size) {
+    if (size < 0) {
+      throw new IllegalArgumentException("size must be >= 0; got: " + size);
+    }
+    termStateCacheSize = size;
+  }
+
+  /** Returns the native term state cache for this segment
+   *  and field, creating it if needed, or 0 if caching is
+   *  disabled. */
+  static long getTermStateCache(SegmentReader reader, String field) {
+    if (termStateCacheSize == 0) {
+      return 0;
+    }
+    Map<String,Long> byField = termStateCaches.get(reader.getCoreCacheKey());
+    if (byField != null) {
+      Long cache = byField.get(field);
+      if (cache != null) {
+        return cache;
+      }
+    }
+    return openTermStateCache(reader, field);
+  }
+
+  private static synchronized long openTermStateCache(SegmentReader reader, String field) {
+    Object coreKey = reader.getCoreCacheKey();
+    Map<String,Long> byField = termStateCaches.get(coreKey);
+    if (byField == null) {
+      byField = new ConcurrentHashMap<String,Long>();
+      termStateCaches.put(coreKey, byField);
+      reader.addCoreClosedListener(new SegmentReader.CoreClosedListener() {
+          @Override
+          public void onClose(SegmentReader owner) {
+            freeTermStateCaches(owner.getCoreCacheKey());
+          }
+        });
+    } else {
+      Long cache = byField.get(field);
+      if (cache != null) {
+        return cache;
+      }
+    }
+    long cache = newTermStateCache(termStateCacheSize);
+    byField.put(field, cache);
+    return cache;
+  }
+
+  private static synchronized void freeTermStateCaches(Object coreKey) {
+    Map<String,Long> byField = termStateCaches.remove(coreKey);
+    if (byField != null) {
+      for(long cache : byField.values()) {
+        freeTermStateCache(cache);
+      }
+    }
+  }
+
+  /** One segment's cached filter bitmap. */
+  private static final class FilterCacheEntry {
+    // Handle from newFilterBitmap:
+    final long bitmap;
+    final int cardinality;
+    final long ramBytesUsed;
+
+    public FilterCacheEntry(long bitmap, int cardinality) {
+      this.bitmap = bitmap;
+      this.cardinality = cardinality;
+      ramBytesUsed = getFilterBitmapRamBytesUsed(bitmap);
+    }
+  }
+
+  private static final class FilterCacheKey {
+    final Object coreKey;
+    final Filter filter;
+
+    public FilterCacheKey(Object coreKey, Filter filter) {
+      this.coreKey = coreKey;
+      this.filter = filter;
+    }
+
+    @Override
+    public boolean equals(Object other) {
+      if (!(other instanceof FilterCacheKey)) {
+        return false;
+      }
+      FilterCacheKey otherKey = (FilterCacheKey) other;
+      return coreKey == otherKey.coreKey && filter.equals(otherKey.filter);
+    }
+
+    @Override
+    public int hashCode() {
+      return System.identityHashCode(coreKey) * 31 + filter.hashCode();
+    }
+  }
+
+  /** Wraps the search's filter so each segment's docs come
+   *  from the native filter cache; the bitmaps it acquires
+   *  are released by releaseNativeFilter once the search is
+   *  done. */
+  private static final class CachedFilter extends Filter {
+    final Filter filter;
+
+    // By leaf ord; null until that segment asks:
+    private final FilterCacheEntry[] entries;
+
+    public CachedFilter(Filter filter, int numLeaves) {
+      this.filter = filter;
+      entries = new FilterCacheEntry[numLeaves];
+    }
+
+    @Override
+    public DocIdSet getDocIdSet(AtomicReaderContext ctx, Bits acceptDocs) throws IOException {
+      return filter.getDocIdSet(ctx, acceptDocs);
+    }
+
+    FilterCacheEntry getEntry(AtomicReaderContext ctx) throws IOException {
+      FilterCacheEntry entry = entries[ctx.ord];
+      if (entry == null) {
+        entry = acquireFilterBitmap(ctx, filter);
+        entries[ctx.ord] = entry;
+      }
+      return entry;
+    }
+
+    void release() {
+      for(FilterCacheEntry entry : entries) {
+        if (entry != null) {
+          releaseFilterBitmap(entry.bitmap);
+        }
+      }
     }
   }
 
-  /** Runs the search, using optimized C++ code when
-   *  possible, but otherwise falling back on
-   *  IndexSearcher. */
-  public static TopDocs search(IndexSearcher searcher, Query query, int topN) throws IOException {
-    //System.out.println("NATIVE: query in: " + query);
-    query = searcher.rewrite(query);
-    //System.out.println("NATIVE: after rewrite: " + query);
+  // Access ordered, so iteration visits least recently used
+  // bitmaps first; the cache holds one reference to each
+  // bitmap:
+  private static final LinkedHashMap<FilterCacheKey,FilterCacheEntry> filterCache = new LinkedHashMap<FilterCacheKey,FilterCacheEntry>(16, 0.75f, true);
 
-    try {
-      TopDocs hits = _search(searcher, query, topN, 0, null, null, null).hits;
-      //System.out.println("NATIVE: " + hits.totalHits + " hits");
-      return hits;
-    } catch (IllegalArgumentException iae) {
-      //System.out.println("NATIVE: skip: " + iae);
-      return searcher.search(query, null, topN);
+  // Segment cores we've registered a CoreClosedListener on:
+  private static final Set<Object> filterCacheCores = new HashSet<Object>();
+
+  private static long filterCacheRamBytesUsed;
+
+  private static volatile long filterCacheMaxBytes = 64*1024*1024;
+
+  /** Sets the max RAM, across all segments, used to cache
+   *  filters natively as compressed bitmaps; 0 disables the
+   *  cache, so filters are evaluated on every search. */
+  public static void setFilterCacheMaxBytes(long maxBytes) {
+    if (maxBytes < 0) {
+      throw new IllegalArgumentException("maxBytes must be >= 0; got: " + maxBytes);
+    }
+    synchronized (filterCache) {
+      filterCacheMaxBytes = maxBytes;
+      evictFilterCache();
     }
   }
 
-  /** Runs the search.search, using only optimized C++ code
-   *  and otherwise throws IllegalArgumentException
-   *  explaining why the optimized search did not apply.
-   *  Call this to understand why a given search isn't optimized. */ 
-  public static TopDocs searchNative(IndexSearcher searcher, Query query, int topN) throws IOException {
-    //System.out.println("NATIVE: query in=" + query);
-    query = searcher.rewrite(query);
-    //System.out.println("NATIVE: after rewrite: " + query + "; " + query.getClass());
-    return _search(searcher, query, topN, 0, null, null, null).hits;
+  /** Returns RAM used by cached filter bitmaps. */
+  static long getFilterCacheRamBytesUsed() {
+    synchronized (filterCache) {
+      return filterCacheRamBytesUsed;
+    }
   }
-  
-  private static class SegmentState {
-    SegmentReader reader;
-    byte[] normBytes;
-    byte[] liveDocsBytes;
-    boolean skip;
-    boolean docsOnly;
-    Bits liveDocs;
-    AtomicReaderContext ctx;
-    int maxDoc;
-
-    public SegmentState(AtomicReaderContext ctx, String field) throws IOException {
-      if (!(ctx.reader() instanceof SegmentReader)) {
-        throw new IllegalArgumentException("leaves must be SegmentReaders; got: " + ctx.reader());
-      }
-      this.ctx = ctx;
-      reader = (SegmentReader) ctx.reader();
-      maxDoc = reader.maxDoc();
-      Directory dir = unwrap(reader.directory());
-      if (!(dir instanceof NativeMMapDirectory)) {
-        throw new IllegalArgumentException("directory must be a NativeMMapDirectory; got: " + reader.directory());
-      }
-      Codec codec = reader.getSegmentInfo().info.getCodec();
 
-      FieldInfo fieldInfo = reader.getFieldInfos().fieldInfo(field);
-      if (fieldInfo == null) {
-        // Field never appeared in this segment so no docs
-        // will match:
-        skip = true;
-        return;
-      }
-      skip = false;
-      docsOnly = fieldInfo.getIndexOptions() == FieldInfo.IndexOptions.DOCS_ONLY;
+  private static Filter getNativeFilter(IndexSearcher searcher, Filter filter) {
+    if (filter == null || filterCacheMaxBytes == 0) {
+      return filter;
+    }
+    return new CachedFilter(filter, searcher.getIndexReader().leaves().size());
+  }
 
-      LiveDocsFormat ldf = codec.liveDocsFormat();
-      if (!(ldf instanceof Lucene40LiveDocsFormat)) {
-        throw new IllegalArgumentException("LiveDocsFormat must be Lucene40LiveDocsFormat; got: " + ldf);
-      }
+  private static void releaseNativeFilter(Filter filter) {
+    if (filter instanceof CachedFilter) {
+      ((CachedFilter) filter).release();
+    }
+  }
 
-      NormsFormat nf = codec.normsFormat();
-      if (!(nf instanceof Lucene42NormsFormat)) {
-        throw new IllegalArgumentException("NormsFormat for field=" + field + " must be Lucene42NormsFormat; got: " + nf);
+  /** Returns this segment's bitmap for the filter, with a
+   *  reference the caller must release, building and
+   *  caching it on a miss. */
+  private static FilterCacheEntry acquireFilterBitmap(AtomicReaderContext ctx, Filter filter) throws IOException {
+    SegmentReader reader = (SegmentReader) ctx.reader();
+    FilterCacheKey key = new FilterCacheKey(reader.getCoreCacheKey(), filter);
+    synchronized (filterCache) {
+      FilterCacheEntry entry = filterCache.get(key);
+      if (entry != null) {
+        retainFilterBitmap(entry.bitmap);
+        return entry;
       }
+    }
 
-      NumericDocValues norms = reader.getNormValues(field);
-      if (norms == null) {
-        normBytes = null;
-      } else {
-        normBytes = getNormsBytes(norms);
+    // Build without holding the lock; if another thread
+    // races us, only one of the bitmaps is cached.  Deleted
+    // docs are left in, since liveDocs change while the
+    // core stays the same:
+    FixedBitSet bits = getFilterBits(ctx, filter, null);
+    if (bits == null) {
+      bits = new FixedBitSet(reader.maxDoc());
+    }
+    FilterCacheEntry entry = new FilterCacheEntry(newFilterBitmap(bits.getBits(), reader.maxDoc()), (int) bits.cardinality());
+
+    synchronized (filterCache) {
+      if (entry.ramBytesUsed <= filterCacheMaxBytes && !filterCache.containsKey(key)) {
+        if (filterCacheCores.add(key.coreKey)) {
+          reader.addCoreClosedListener(new SegmentReader.CoreClosedListener() {
+              @Override
+              public void onClose(SegmentReader owner) {
+                freeFilterCache(owner.getCoreCacheKey());
+              }
+            });
+        }
+        retainFilterBitmap(entry.bitmap);
+        filterCache.put(key, entry);
+        filterCacheRamBytesUsed += entry.ramBytesUsed;
+        evictFilterCache();
       }
+    }
+    return entry;
+  }
 
-      liveDocs = reader.getLiveDocs();
+  // Drops least recently used bitmaps until we are within
+  // budget; searches still using them keep their own
+  // reference:
+  private static void evictFilterCache() {
+    assert Thread.holdsLock(filterCache);
+    Iterator<FilterCacheEntry> it = filterCache.values().iterator();
+    while (filterCacheRamBytesUsed > filterCacheMaxBytes && it.hasNext()) {
+      FilterCacheEntry entry = it.next();
+      it.remove();
+      filterCacheRamBytesUsed -= entry.ramBytesUsed;
+      releaseFilterBitmap(entry.bitmap);
+    }
+  }
 
-      if (liveDocs != null) {
-        liveDocsBytes = getLiveDocsBits(liveDocs);
+  private static void freeFilterCache(Object coreKey) {
+    synchronized (filterCache) {
+      filterCacheCores.remove(coreKey);
+      Iterator<Map.Entry<FilterCacheKey,FilterCacheEntry>> it = filterCache.entrySet().iterator();
+      while (it.hasNext()) {
+        Map.Entry<FilterCacheKey,FilterCacheEntry> mapEntry = it.next();
+        if (mapEntry.getKey().coreKey == coreKey) {
+          it.remove();
+          filterCacheRamBytesUsed -= mapEntry.getValue().ramBytesUsed;
+          releaseFilterBitmap(mapEntry.getValue().bitmap);
+        }
       }
     }
   }
 
-  private static SearchResult _search(IndexSearcher searcher, Query query, int topN, int dsNumDims, int[] dsTermsPerDim,
-                                      String dsField, List<BytesRef> dsTerms) throws IOException {
+  /** sort is null to sort by score. */
+  private static SearchResult _search(IndexSearcher searcher, Query query, Filter filter, int topN, NativeSort sort, NativeGrouping grouping,
+                                      int dsNumDims, int[] dsTermsPerDim, String dsField, List<BytesRef> dsTerms,
+                                      NativeFacetCounts dsFacets) throws IOException {
 
     if (topN == 0) {
       throw new IllegalArgumentException("topN must be > 0; got: 0");
@@ -787,47 +2730,362 @@ public class NativeSearch {
         //System.out.println("unwrap csq to " + query.getClass());
       } else {
         Filter f = csq.getFilter();
-        if (f instanceof MultiTermQueryWrapperFilter) {
+        if (f instanceof MultiTermQueryWrapperFilter && sort == null && grouping == null) {
           //System.out.println("NATIVE: mtq filter " + f);
-          return _searchMTQFilter(searcher, (MultiTermQueryWrapperFilter) f, topN, csq.getBoost());
+          return _searchMTQFilter(searcher, (MultiTermQueryWrapperFilter) f, filter, topN, csq.getBoost());
         }
       }
     }
 
     // System.out.println("NATIVE: search " + query);
 
+    if (sort != null && !(query instanceof TermQuery) && !(query instanceof BooleanQuery)) {
+      throw new IllegalArgumentException("sorting is only supported for TermQuery and BooleanQuery; got: " + query.getClass());
+    }
+
+    if (grouping != null && !(query instanceof TermQuery) && !(query instanceof BooleanQuery)) {
+      throw new IllegalArgumentException("grouping is only supported for TermQuery and BooleanQuery; got: " + query.getClass());
+    }
+
     if (query instanceof TermQuery) {
-      return _searchTermQuery(searcher, (TermQuery) query, topN, constantScore, dsNumDims, dsTermsPerDim, dsField, dsTerms);
+      return _searchTermQuery(searcher, (TermQuery) query, filter, topN, constantScore, sort, grouping, dsNumDims, dsTermsPerDim, dsField, dsTerms, dsFacets);
     } else if (query instanceof PhraseQuery) {
-      return _searchPhraseQuery(searcher, (PhraseQuery) query, topN, constantScore);
+      return _searchPhraseQuery(searcher, (PhraseQuery) query, filter, topN, constantScore);
     } else if (query instanceof BooleanQuery) {
-      return _searchBooleanQuery(searcher, (BooleanQuery) query, topN, constantScore, dsNumDims, dsTermsPerDim, dsField, dsTerms);
+      return _searchBooleanQuery(searcher, (BooleanQuery) query, filter, topN, constantScore, sort, grouping, dsNumDims, dsTermsPerDim, dsField, dsTerms, dsFacets);
+    } else if (query instanceof SpanQuery) {
+      return _searchSpanQuery(searcher, (SpanQuery) query, filter, topN, constantScore);
     } else {
-      throw new IllegalArgumentException("rewritten query must be TermQuery, BooleanQuery or PhraseQuery; got: " + query.getClass());
+      throw new IllegalArgumentException("rewritten query must be TermQuery, BooleanQuery, PhraseQuery or SpanQuery; got: " + query.getClass());
+    }
+  }
+
+  /** One term of a FuzzyQuery's expansion, across all
+   *  segments. */
+  private static class FuzzyTerm {
+    final BytesRef bytes;
+    final float boost;
+    int docFreq;
+
+    // Per segment; docFreqs[i] is 0 if the segment doesn't
+    // have the term:
+    final int[] docFreqs;
+    final long[] totalTermFreqs;
+    // docStartFP, or the singleton docID if docFreq is 1:
+    final long[] docTermStartFPs;
+
+    public FuzzyTerm(BytesRef bytes, float boost, int numSegments) {
+      this.bytes = bytes;
+      this.boost = boost;
+      docFreqs = new int[numSegments];
+      totalTermFreqs = new long[numSegments];
+      docTermStartFPs = new long[numSegments];
+    }
+  }
+
+  /** Runs a FuzzyQuery without rewriting it: each segment's
+   *  terms within its edit distance are found in one native
+   *  walk of the terms dict, the top terms are picked the
+   *  same way TopTermsScoringBooleanQueryRewrite picks them,
+   *  and those are scored as a coord-disabled OR.  Returns
+   *  null if the query should be rewritten instead. */
+  private static SearchResult _searchFuzzyQuery(IndexSearcher searcher, FuzzyQuery query, Filter filter, int topN) throws IOException {
+    if (query.getRewriteMethod().getClass() != MultiTermQuery.TopTermsScoringBooleanQueryRewrite.class) {
+      return null;
+    }
+
+    String text = query.getTerm().text();
+    int[] codePoints = new int[text.codePointCount(0, text.length())];
+    for(int i=0,upto=0;i<text.length();upto++) {
+      codePoints[upto] = text.codePointAt(i);
+      i += Character.charCount(codePoints[upto]);
+    }
+    if (query.getMaxEdits() == 0 || query.getPrefixLength() >= codePoints.length) {
+      // FuzzyTermsEnum only matches the term itself:
+      return null;
+    }
+
+    if (topN == 0) {
+      throw new IllegalArgumentException("topN must be > 0; got: 0");
+    }
+
+    if (topN > searcher.getIndexReader().maxDoc()) {
+      topN = searcher.getIndexReader().maxDoc();
+    }
+
+    List<AtomicReaderContext> leaves = searcher.getIndexReader().leaves();
+    Similarity sim = searcher.getSimilarity();
+
+    if (!(sim instanceof DefaultSimilarity)) {
+      throw new IllegalArgumentException("searcher.getSimilarity() must be DefaultSimilarity; got: " + sim);
+    }
+
+    String field = query.getField();
+    FuzzyDFAs dfas = new FuzzyDFAs(query, codePoints);
+    Map<BytesRef,FuzzyTerm> fuzzyTerms = new HashMap<BytesRef,FuzzyTerm>();
+    SegmentState[] states = new SegmentState[leaves.size()];
+    long[] docAddresses = new long[leaves.size()];
+
+    for(int readerIDX=0;readerIDX<leaves.size();readerIDX++) {
+      SegmentState state = new SegmentState(leaves.get(readerIDX), field, filter);
+      if (state.docsOnly) {
+        throw new IllegalArgumentException("cannot handle DOCS_ONLY field");
+      }
+      if (state.normBytes == null) {
+        throw new IllegalArgumentException("cannot handle omitNorms field");
+      }
+      if (state.skip) {
+        continue;
+      }
+      Terms terms = state.reader.terms(field);
+      if (terms == null) {
+        continue;
+      }
+      states[readerIDX] = state;
+      NativeTermsDict dict = new NativeTermsDict(terms, state.reader.getFieldInfos().fieldInfo(field), 0);
+      docAddresses[readerIDX] = dict.docAddress;
+
+      byte[][] termBytesOut = new byte[1][];
+      long[] termStats = dict.fuzzy(dfas, termBytesOut);
+      byte[] termBytes = termBytesOut[0];
+      int termOffset = 0;
+      for(int i=0;i<termStats.length;i+=5) {
+        int ed = (int) termStats[i];
+        int termLength = (int) termStats[i+1];
+        BytesRef bytes = new BytesRef(termBytes, termOffset, termLength);
+        termOffset += termLength;
+
+        FuzzyTerm fuzzyTerm = fuzzyTerms.get(bytes);
+        if (fuzzyTerm == null) {
+          // Same boost as FuzzyTermsEnum:
+          float boost;
+          if (ed == 0) {
+            boost = 1.0f;
+          } else {
+            float similarity = 1.0f - ((float) ed / (float) (Math.min(UnicodeUtil.codePointCount(bytes), codePoints.length)));
+            if (similarity <= 0.0f) {
+              continue;
+            }
+            boost = similarity;
+          }
+          fuzzyTerm = new FuzzyTerm(bytes, boost, leaves.size());
+          fuzzyTerms.put(bytes, fuzzyTerm);
+        }
+        int docFreq = (int) termStats[i+2];
+        fuzzyTerm.docFreq += docFreq;
+        fuzzyTerm.docFreqs[readerIDX] = docFreq;
+        fuzzyTerm.totalTermFreqs[readerIDX] = termStats[i+3];
+        fuzzyTerm.docTermStartFPs[readerIDX] = termStats[i+4];
+      }
+    }
+
+    // Highest boost first, then smallest term, like
+    // TopTermsRewrite's ScoreTerm:
+    List<FuzzyTerm> topTerms = new ArrayList<FuzzyTerm>(fuzzyTerms.values());
+    Collections.sort(topTerms, new Comparator<FuzzyTerm>() {
+        @Override
+        public int compare(FuzzyTerm a, FuzzyTerm b) {
+          if (a.boost != b.boost) {
+            return Float.compare(b.boost, a.boost);
+          }
+          return a.bytes.compareTo(b.bytes);
+        }
+      });
+    int maxSize = Math.min(((TopTermsRewrite<?>) query.getRewriteMethod()).getSize(), BooleanQuery.getMaxClauseCount());
+    if (topTerms.size() > maxSize) {
+      topTerms = topTerms.subList(0, maxSize);
+    }
+
+    if (topTerms.isEmpty()) {
+      return new SearchResult(new TopDocs(0, new ScoreDoc[0]));
+    }
+
+    // Same math as TermWeight under a BooleanWeight, done
+    // up front instead of building a TermQuery (and
+    // TermContext) per term:
+    DefaultSimilarity defaultSim = (DefaultSimilarity) sim;
+    long maxDoc = searcher.collectionStatistics(field).maxDoc();
+    float[] idfs = new float[topTerms.size()];
+    float[] queryWeights = new float[topTerms.size()];
+    float sumOfSquaredWeights = 0.0f;
+    for(int i=0;i<topTerms.size();i++) {
+      idfs[i] = defaultSim.idf(topTerms.get(i).docFreq, maxDoc);
+      queryWeights[i] = idfs[i] * topTerms.get(i).boost;
+      sumOfSquaredWeights += queryWeights[i] * queryWeights[i];
+    }
+    sumOfSquaredWeights *= query.getBoost() * query.getBoost();
+    float queryNorm = sim.queryNorm(sumOfSquaredWeights);
+    if (Float.isInfinite(queryNorm) || Float.isNaN(queryNorm)) {
+      queryNorm = 1.0f;
+    }
+    queryNorm *= query.getBoost();
+    final Map<FuzzyTerm,Float> termWeightsByTerm = new HashMap<FuzzyTerm,Float>();
+    for(int i=0;i<topTerms.size();i++) {
+      termWeightsByTerm.put(topTerms.get(i), queryWeights[i] * queryNorm * idfs[i]);
+    }
+
+    float[] coordFactors = new float[topTerms.size()+1];
+    Arrays.fill(coordFactors, 1.0f);
+
+    float[] topScores = new float[topN+1];
+    Arrays.fill(topScores, Float.MIN_VALUE);
+    int[] topDocIDs = new int[topN+1];
+    Arrays.fill(topDocIDs, Integer.MAX_VALUE);
+    int totalHits = 0;
+    float[] normTable = getNormTable();
+
+    for(int readerIDX=0;readerIDX<leaves.size();readerIDX++) {
+      SegmentState state = states[readerIDX];
+      if (state == null) {
+        continue;
+      }
+
+      final int segIDX = readerIDX;
+      List<FuzzyTerm> segTerms = new ArrayList<FuzzyTerm>();
+      for(FuzzyTerm fuzzyTerm : topTerms) {
+        if (fuzzyTerm.docFreqs[segIDX] != 0) {
+          segTerms.add(fuzzyTerm);
+        }
+      }
+      if (segTerms.isEmpty()) {
+        continue;
+      }
+
+      // SHOULD clauses go in order of docFreq descending:
+      Collections.sort(segTerms, new Comparator<FuzzyTerm>() {
+          @Override
+          public int compare(FuzzyTerm a, FuzzyTerm b) {
+            return b.docFreqs[segIDX] - a.docFreqs[segIDX];
+          }
+        });
+
+      float[] termWeights = new float[segTerms.size()];
+      int[] singletonDocIDs = new int[segTerms.size()];
+      long[] totalTermFreqs = new long[segTerms.size()];
+      int[] docFreqs = new int[segTerms.size()];
+      long[] docTermStartFPs = new long[segTerms.size()];
+      for(int i=0;i<segTerms.size();i++) {
+        FuzzyTerm fuzzyTerm = segTerms.get(i);
+        termWeights[i] = termWeightsByTerm.get(fuzzyTerm);
+        docFreqs[i] = fuzzyTerm.docFreqs[segIDX];
+        if (docFreqs[i] > 1) {
+          docTermStartFPs[i] = fuzzyTerm.docTermStartFPs[segIDX];
+          singletonDocIDs[i] = -1;
+        } else {
+          // Pulsed
+          singletonDocIDs[i] = (int) fuzzyTerm.docTermStartFPs[segIDX];
+          totalTermFreqs[i] = fuzzyTerm.totalTermFreqs[segIDX];
+        }
+      }
+
+      totalHits += searchSegmentBooleanQuery(topDocIDs,
+                                             topScores,
+                                             null,
+                                             null,
+                                             null,
+                                             null,
+                                             null,
+                                             null,
+                                             0,
+                                             false,
+                                             null,
+                                             null,
+                                             0,
+                                             0,
+                                             state.maxDoc,
+                                             state.ctx.docBase,
+                                             state.liveDocsBytes,
+                                             state.filterBitmap,
+                                             termWeights,
+                                             state.normBytes,
+                                             normTable,
+                                             coordFactors,
+                                             singletonDocIDs,
+                                             totalTermFreqs,
+                                             docFreqs,
+                                             docTermStartFPs,
+                                             docAddresses[segIDX],
+                                             0,
+                                             0,
+                                             0,
+                                             null,
+                                             null,
+                                             null,
+                                             null,
+                                             null,
+                                             null,
+                                             0,
+                                             0,
+                                             null,
+                                             null,
+                                             null,
+                                             null,
+                                             0,
+                                             null,
+                                             null,
+                                             null,
+                                             null,
+                                             null,
+                                             null,
+                                             null,
+                                             0,
+                                             false,
+                                             false);
+    }
+
+    return new SearchResult(buildTopDocs(topDocIDs, topScores, totalHits, topN, -1.0f));
+  }
+
+  // MultiTermQuery results whose summed docFreq is below
+  // maxDoc/SPARSE_MTQ_RATIO are collected as a sorted docID
+  // array (4 bytes per posting) instead of a bitset (1 bit
+  // per doc):
+  private static final int SPARSE_MTQ_RATIO = 32;
+
+  private static volatile int multiTermFilterThreads = 1;
+
+  /** Sets how many native threads may decode a
+   *  MultiTermQuery's terms into its filter bitset, per
+   *  segment; each thread beyond the first needs a temporary
+   *  bitset of maxDoc bits.  Small expansions always use one
+   *  thread.  Default is 1. */
+  public static void setMultiTermFilterThreads(int threads) {
+    if (threads < 1) {
+      throw new IllegalArgumentException("threads must be >= 1; got: " + threads);
     }
+    multiTermFilterThreads = threads;
+    resizeWorkerPool();
   }
 
-  private static SearchResult _searchMTQFilter(IndexSearcher searcher, MultiTermQueryWrapperFilter filter, int topN, float constantScore) throws IOException {
+  // Each MultiTermQuery filter thread decodes at least this
+  // many postings; tests lower it so small indices use the
+  // threads too:
+  static volatile int multiTermFilterMinPostingsPerThread = 64*1024;
+
+  private static SearchResult _searchMTQFilter(IndexSearcher searcher, MultiTermQueryWrapperFilter mtqFilter, Filter filter, int topN, float constantScore) throws IOException {
     //System.out.println("MTQ search");
     List<AtomicReaderContext> leaves = searcher.getIndexReader().leaves();
     Similarity sim = searcher.getSimilarity();
 
-    MultiTermQuery query = getMultiTermQueryWrapperFilterQuery(filter);
+    MultiTermQuery query = getMultiTermQueryWrapperFilterQuery(mtqFilter);
 
     if (!(sim instanceof DefaultSimilarity)) {
       throw new IllegalArgumentException("searcher.getSimilarity() must be DefaultSimilarity; got: " + sim);
     }
 
-    String field = filter.getField();
+    String field = mtqFilter.getField();
 
     int[] topDocIDs = new int[topN+1];
     Arrays.fill(topDocIDs, Integer.MAX_VALUE);
 
+    ByteDFA dfa = getByteDFA(query);
+    NumericRange numericRange = query.getClass() == NumericRangeQuery.class ? NumericRange.forQuery((NumericRangeQuery<?>) query) : null;
+
     List<ScoreDoc> scoreDocs = new ArrayList<ScoreDoc>();
     int totalHits = 0;
     for(int readerIDX=0;readerIDX<leaves.size();readerIDX++) {
       AtomicReaderContext ctx = leaves.get(readerIDX);
-      SegmentState state = new SegmentState(ctx, field);
+      SegmentState state = new SegmentState(ctx, field, filter);
       if (state.skip) {
         continue;
       }
@@ -842,65 +3100,104 @@ public class NativeSearch {
         continue;
       }
 
-      List<Long> termStats = new ArrayList<Long>();
+      // The term state cache is skipped since expanded terms
+      // are mostly one-off and would evict hot terms:
+      NativeTermsDict dict = new NativeTermsDict(terms, state.reader.getFieldInfos().fieldInfo(field), 0);
+      int numTerms;
+      int[] docFreqs;
+      long[] docTermStartFPs;
+      int[] singletonDocIDs;
+
+      if (dfa != null || numericRange != null) {
+        // Walk the terms dict natively, skipping whole blocks
+        // whose prefix the automaton (or the numeric range's
+        // trie sub-ranges) rejects:
+        long[] termStatsPairs = dfa != null ? dict.intersect(dfa) : dict.numericRange(numericRange);
+        numTerms = termStatsPairs.length/2;
+        docFreqs = new int[numTerms];
+        docTermStartFPs = new long[numTerms];
+        singletonDocIDs = new int[numTerms];
+        for(int i=0;i<numTerms;i++) {
+          docFreqs[i] = (int) termStatsPairs[2*i];
+          if (docFreqs[i] == 1) {
+            singletonDocIDs[i] = (int) termStatsPairs[2*i+1];
+          } else {
+            docTermStartFPs[i] = termStatsPairs[2*i+1];
+          }
+        }
+      } else {
+        TermsEnum termsEnum = query.getTermsEnum(terms);
+        if (termsEnum.next() == null) {
+          continue;
+        }
 
-      TermsEnum termsEnum = query.getTermsEnum(terms);
-      if (termsEnum.next() == null) {
+        List<BytesRef> matchedTerms = new ArrayList<BytesRef>();
+        do {
+          matchedTerms.add(BytesRef.deepCopyOf(termsEnum.term()));
+        } while (termsEnum.next() != null);
+
+        // Re-seek the (sorted) matched terms natively, instead
+        // of decoding each term's metadata via reflection:
+        numTerms = matchedTerms.size();
+        docFreqs = new int[numTerms];
+        docTermStartFPs = new long[numTerms];
+        singletonDocIDs = new int[numTerms];
+        dict.lookup(matchedTerms, docFreqs, new long[numTerms], docTermStartFPs, new long[numTerms], singletonDocIDs);
+      }
+
+      long sumDocFreq = 0;
+      int numSingletons = 0;
+      List<Long> termStats = new ArrayList<Long>();
+      for(int i=0;i<numTerms;i++) {
+        sumDocFreq += docFreqs[i];
+        if (docFreqs[i] == 1) {
+          // Pulsed
+          singletonDocIDs[numSingletons++] = singletonDocIDs[i];
+        } else if (docFreqs[i] > 1) {
+          termStats.add((long) docFreqs[i]);
+          termStats.add(docTermStartFPs[i]);
+        }
+      }
+      if (sumDocFreq == 0) {
         continue;
       }
+      long[] termStatsArray = new long[termStats.size()];
+      for(int i=0;i<termStatsArray.length;i++) { 
+        termStatsArray[i] = termStats.get(i);
+      }
 
-      DocsEnum docsEnum = termsEnum.docs(null, null);
+      if (sumDocFreq * SPARSE_MTQ_RATIO < state.maxDoc) {
+        // Few matches: merge the terms' postings into a sorted
+        // docID array instead of filling and scanning a bitset:
+        int[] sortedSingletonDocIDs = Arrays.copyOf(singletonDocIDs, numSingletons);
+        Arrays.sort(sortedSingletonDocIDs);
+        int[] docIDs = new int[(int) sumDocFreq];
+        int count = collectMultiTermDocs(docIDs, state.liveDocsBytes, state.filterBitmap, dict.docAddress, termStatsArray, sortedSingletonDocIDs, state.docsOnly);
+        for(int i=0;i<count && scoreDocs.size() < topN;i++) {
+          scoreDocs.add(new ScoreDoc(ctx.docBase + docIDs[i], constantScore));
+        }
+        totalHits += count;
+        continue;
+      }
 
       // fill into a FixedBitSet
       FixedBitSet bitSet = new FixedBitSet(state.maxDoc);
 
-      if (termsEnum instanceof FilteredTermsEnum) {
-        TermsEnum wrappedTermsEnum = getActualTEnum(termsEnum);
-        //System.out.println("wrapped TE=" + wrappedTermsEnum);
-
-        do {
-          BlockTermState termState = getTermState(wrappedTermsEnum);
-          if (termState.docFreq == 1) {
-            // Pulsed
-            int docID = getSingletonDocID(termState);
-            if (state.liveDocs == null || state.liveDocs.get(docID)) {
-              bitSet.set(docID);
-              //System.out.println("term: " + termsEnum.term() + " pulsed: docID=" + docID);
-            }
-          } else {
-            termStats.add((long) termState.docFreq);
-            termStats.add(getDocTermStartFP(termState));
-            //System.out.println("term: " + termsEnum.term() + " docFreq=" + termState.docFreq + " startFP=" + getDocTermStartFP(termState));
-          }
-        } while (termsEnum.next() != null);
-      } else if (blockTreeIntersectEnum.isInstance(termsEnum)) {
-        do {
-          BlockTermState termState = getIntersectTermState(termsEnum);
-          if (termState.docFreq == 1) {
-            // Pulsed
-            int docID = getSingletonDocID(termState);
-            if (state.liveDocs == null || state.liveDocs.get(docID)) {
-              bitSet.set(docID);
-            }
-          } else {
-            termStats.add((long) termState.docFreq);
-            termStats.add(getDocTermStartFP(termState));
-            //System.out.println("term: " + termsEnum.term().utf8ToString() + " docFreq=" + termState.docFreq + " startFP=" + getDocTermStartFP(termState));
-          }
-        } while (termsEnum.next() != null);
-      } else {
-        throw new IllegalArgumentException("can only handle FilteredTermsEnum; got " + termsEnum);
+      for(int i=0;i<numSingletons;i++) {
+        int docID = singletonDocIDs[i];
+        // liveDocsBytes, not liveDocs, since it also has the
+        // filter; a cached filter is applied to all bits by
+        // fillMultiTermFilter below:
+        if (state.filterBitmap != 0 || state.liveDocsBytes == null || (state.liveDocsBytes[docID >> 3] & (1 << (docID & 7))) != 0) {
+          bitSet.set(docID);
+        }
       }
 
-      if (!termStats.isEmpty()) {
+      if (termStatsArray.length != 0 || state.filterBitmap != 0) {
         long[] bitSetBits = (long[]) getFieldObject(bitSet, "org.apache.lucene.util.FixedBitSet", "bits");
-        long[] termStatsArray = new long[termStats.size()];
-        for(int i=0;i<termStatsArray.length;i++) { 
-          termStatsArray[i] = termStats.get(i);
-        }
-        IndexInput docIn = getDocIn(docsEnum);
         //System.out.println(termStatsArray.length + " terms to MTQ");
-        fillMultiTermFilter(bitSetBits, state.liveDocsBytes, getMMapAddress(docIn), termStatsArray, state.docsOnly);
+        fillMultiTermFilter(bitSetBits, state.liveDocsBytes, state.filterBitmap, dict.docAddress, termStatsArray, state.docsOnly, multiTermFilterThreads,
+                            multiTermFilterMinPostingsPerThread);
       }
 
       if (scoreDocs.size() < topN) {
@@ -934,92 +3231,6 @@ public class NativeSearch {
     return new SearchResult(new TopDocs(totalHits, scoreDocs.toArray(new ScoreDoc[scoreDocs.size()]), scoreDocs.isEmpty() ? Float.NaN : constantScore));
   }
 
-  static final Field blockTermStateDocStartFPField;
-  static final Field blockTermStateSingletonDocIDField;
-  static final Field blockTreeCurrentFrameField;
-  static final Method decodeMetaDataMethod;
-  static final Method intersectDecodeMetaDataMethod;
-  static final Field frameStateField;
-  static final Class blockTreeIntersectEnum;
-  static final Field blockTreeIntersectCurrentFrameField;
-  static final Field intersectFrameStateField;
-  static final Field blockDocsEnumSingletonDocIDField;
-  static final Field blockDocsEnumTotalTermFreqField;
-
-  static {
-    try {
-      Class<?> x;
-      blockTermStateDocStartFPField = getField("org.apache.lucene.codecs.lucene41.Lucene41PostingsReader$IntBlockTermState",
-                                               "docStartFP");
-
-      blockTermStateSingletonDocIDField = getField("org.apache.lucene.codecs.lucene41.Lucene41PostingsReader$IntBlockTermState",
-                                               "singletonDocID");
-
-      blockTreeCurrentFrameField = getField("org.apache.lucene.codecs.BlockTreeTermsReader$FieldReader$SegmentTermsEnum",
-                                            "currentFrame");
-
-      decodeMetaDataMethod = getMethod("org.apache.lucene.codecs.BlockTreeTermsReader$FieldReader$SegmentTermsEnum$Frame",
-                                       "decodeMetaData");
-      frameStateField = getField("org.apache.lucene.codecs.BlockTreeTermsReader$FieldReader$SegmentTermsEnum$Frame",
-                                 "state");
-
-      blockTreeIntersectEnum = Class.forName("org.apache.lucene.codecs.BlockTreeTermsReader$FieldReader$IntersectEnum");
-      blockTreeIntersectCurrentFrameField = getField("org.apache.lucene.codecs.BlockTreeTermsReader$FieldReader$IntersectEnum",
-                                                     "currentFrame");
-
-      intersectDecodeMetaDataMethod = getMethod("org.apache.lucene.codecs.BlockTreeTermsReader$FieldReader$IntersectEnum$Frame",
-                                                "decodeMetaData");
-      intersectFrameStateField = getField("org.apache.lucene.codecs.BlockTreeTermsReader$FieldReader$IntersectEnum$Frame",
-                                          "termState");
-
-      blockDocsEnumSingletonDocIDField = getField("org.apache.lucene.codecs.lucene41.Lucene41PostingsReader$BlockDocsEnum",
-                                                  "singletonDocID");
-
-      blockDocsEnumTotalTermFreqField = getField("org.apache.lucene.codecs.lucene41.Lucene41PostingsReader$BlockDocsEnum",
-                                                 "totalTermFreq");
-    } catch (Exception e) {
-      throw new IllegalStateException("reflection failed", e);
-    }
-  }
-
-  private static long getDocTermStartFP(BlockTermState state) {
-    try {
-      return blockTermStateDocStartFPField.getLong(state);
-    } catch (Exception e) {
-      throw new IllegalStateException("reflection failed");
-    }
-  }
-
-  private static int getSingletonDocID(BlockTermState state) {
-    try {
-      return blockTermStateSingletonDocIDField.getInt(state);
-    } catch (Exception e) {
-      throw new IllegalStateException("reflection failed", e);
-    }
-  }
-
-  private static BlockTermState getTermState(TermsEnum termsEnum) {
-    //System.out.println("TE: " + termsEnum);
-    try {
-      Object o = blockTreeCurrentFrameField.get(termsEnum);
-      decodeMetaDataMethod.invoke(o);
-      return (BlockTermState) frameStateField.get(o);
-    } catch (Exception e) {
-      throw new IllegalStateException("reflection failed", e);
-    }
-  }
-
-  private static BlockTermState getIntersectTermState(TermsEnum termsEnum) {
-    //System.out.println("TE: " + termsEnum);
-    try {
-      Object o = blockTreeIntersectCurrentFrameField.get(termsEnum);
-      intersectDecodeMetaDataMethod.invoke(o);
-      return (BlockTermState) intersectFrameStateField.get(o);
-    } catch (Exception e) {
-      throw new IllegalStateException("reflection failed", e);
-    }
-  }
-
   private static Object getFieldObject(Object o, String className, String fieldName) {
     try {
       Class<?> x = Class.forName(className);
@@ -1097,19 +3308,9 @@ public class NativeSearch {
     }
   }
 
-  private static TermsEnum getActualTEnum(TermsEnum termsEnum) {
-    try {
-      Class<?> x = Class.forName("org.apache.lucene.index.FilteredTermsEnum");
-      Field f = x.getDeclaredField("tenum");
-      f.setAccessible(true);
-      return (TermsEnum) f.get(termsEnum);
-    } catch (Exception e) {
-      throw new RuntimeException("failed to extract actual tenum", e);
-    }
-  }
-
-  private static SearchResult _searchTermQuery(IndexSearcher searcher, TermQuery query, int topN, float constantScore,
-                                               int dsNumDims, int[] dsTermsPerDim, String dsField, List<BytesRef> dsTerms) throws IOException {
+  private static SearchResult _searchTermQuery(IndexSearcher searcher, TermQuery query, Filter filter, int topN, float constantScore, NativeSort sort,
+                                               NativeGrouping grouping, int dsNumDims, int[] dsTermsPerDim, String dsField, List<BytesRef> dsTerms,
+                                               NativeFacetCounts dsFacets) throws IOException {
 
     List<AtomicReaderContext> leaves = searcher.getIndexReader().leaves();
     //System.out.println("_searchTermQuery: " + leaves.size() + " segments; query=" + query);
@@ -1126,12 +3327,37 @@ public class NativeSearch {
 
     Weight w = searcher.createNormalizedWeight(query);
 
+    List<BytesRef> queryTerms = Collections.singletonList(term.bytes());
+    int[] lookupDocFreqs = new int[1];
+    long[] lookupTotalTermFreqs = new long[1];
+    long[] lookupDocTermStartFPs = new long[1];
+    long[] lookupPosTermStartFPs = new long[1];
+    int[] lookupSingletonDocIDs = new int[1];
+
     float[] topScores;
-    if (constantScore < 0.0f) {
+    long[] topSortValues;
+    if (sort != null) {
+      if (constantScore >= 0.0f && sort.needsScores()) {
+        throw new IllegalArgumentException("cannot sort a constant score query by score");
+      }
+      // Hits are only scored when a SortField is SCORE, and
+      // then their scores are kept in topSortValues:
+      topScores = null;
+      topSortValues = sort.newTopValues(topN);
+    } else if (grouping != null) {
+      if (constantScore >= 0.0f) {
+        throw new IllegalArgumentException("cannot group a constant score query");
+      }
+      // Each segment's top groups; setNextReader resets it:
+      topScores = new float[topN+1];
+      topSortValues = null;
+    } else if (constantScore < 0.0f) {
       topScores = new float[topN+1];
       Arrays.fill(topScores, Float.MIN_VALUE);
+      topSortValues = null;
     } else {
       topScores = null;
+      topSortValues = null;
     }
 
     int[] topDocIDs = new int[topN+1];
@@ -1145,7 +3371,7 @@ public class NativeSearch {
 
     for(int readerIDX=0;readerIDX<leaves.size();readerIDX++) {
       AtomicReaderContext ctx = leaves.get(readerIDX);
-      SegmentState state = new SegmentState(ctx, field);
+      SegmentState state = new SegmentState(ctx, field, filter);
       //System.out.println("  seg=" + readerIDX + " base=" + ctx.docBase);
       if (state.normBytes == null) {
         throw new IllegalArgumentException("cannot handle omitNorms field");
@@ -1156,45 +3382,64 @@ public class NativeSearch {
 
       Scorer scorer = w.scorer(ctx, true, false, state.liveDocs);
       if (scorer != null) {
+        if (sort != null) {
+          sort.setNextReader(state.reader);
+        }
+        if (grouping != null) {
+          grouping.setNextReader(state.reader, topDocIDs, topScores);
+        }
 
         //System.out.println("    got scorer");
+        // Only the weight comes from the scorer; the term's
+        // metadata is read natively from the terms dict:
         float termWeight = getTermScorerTermWeight(scorer);
 
+        NativeTermsDict dict = new NativeTermsDict(state.reader.terms(field), state.reader.getFieldInfos().fieldInfo(field),
+                                                   getTermStateCache(state.reader, field));
+        dict.lookup(queryTerms, lookupDocFreqs, lookupTotalTermFreqs, lookupDocTermStartFPs, lookupPosTermStartFPs, lookupSingletonDocIDs);
+
+        int docFreq = lookupDocFreqs[0];
+        long docTermStartFP = lookupDocTermStartFPs[0];
+        assert docFreq > 0;
+
         int singletonDocID;
         long totalTermFreq;
-
         long address;
-        DocsEnum docsEnum = unwrap(getDocsEnum(scorer));
-        if (docsEnum.getClass().getName().indexOf("Lucene41PostingsReader") == -1) {
-          throw new IllegalArgumentException("must use Lucene41PostingsFormat; got " + docsEnum.getClass().getName());
-        }
-
-        int docFreq = getDocFreq(docsEnum);
-        long docTermStartFP = getDocTermStartFP(docsEnum);
-          
         if (docFreq > 1) {
-          IndexInput docIn = getDocIn(docsEnum);
-          address = getMMapAddress(docIn);
+          address = dict.docAddress;
           singletonDocID = -1;
           totalTermFreq = 0;
         } else {
           // Pulsed
           address = 0;
-          singletonDocID = getSingletonDocID(docsEnum);
-          totalTermFreq = getTotalTermFreq(docsEnum);;
+          singletonDocID = lookupSingletonDocIDs[0];
+          totalTermFreq = lookupTotalTermFreqs[0];
           assert singletonDocID >= 0;
           assert singletonDocID < state.maxDoc;
         }
 
-        DrillSidewaysState dsState = new DrillSidewaysState(state, dsNumDims, dsTermsPerDim, dsField, dsTerms);
+        DrillSidewaysState dsState = new DrillSidewaysState(state, dsNumDims, dsTermsPerDim, dsField, dsTerms, dsFacets);
         dsStates.add(dsState);
 
         //System.out.println("    singletonDocID=" + singletonDocID + " liveDocs=" + state.liveDocsBytes + " docFreq=" + docFreq + " docsOnly=" + state.docsOnly);
         totalHits += searchSegmentTermQuery(topDocIDs,
                                             topScores,
+                                            topSortValues,
+                                            sort == null ? null : sort.keys,
+                                            sort == null ? null : sort.reverse,
+                                            sort == null ? null : sort.dvAddresses,
+                                            sort == null ? null : sort.dvFormats,
+                                            sort == null ? null : sort.afterValues,
+                                            sort == null ? 0 : sort.afterDocID,
+                                            sort != null && sort.docsInSortOrder,
+                                            grouping == null ? null : grouping.topGroupOrds,
+                                            grouping == null ? null : grouping.ordCounts,
+                                            grouping == null ? 0 : grouping.dvAddress,
+                                            grouping == null ? 0 : grouping.dvFormat,
                                             state.maxDoc,
                                             ctx.docBase,
                                             state.liveDocsBytes,
+                                            state.filterBitmap,
                                             state.docsOnly,
                                             termWeight,
                                             state.normBytes,
@@ -1209,18 +3454,31 @@ public class NativeSearch {
                                             dsState.termsPerDim,
                                             dsState.ddBitsArray,
                                             dsState.dsBitsArrays,
+                                            dsState.facetCounts,
+                                            dsState.facetAddresses,
+                                            dsState.facetAddressFormat,
+                                            dsState.facetAddressBitsPerValue,
+                                            dsState.facetBytes,
                                             dsState.singletonDocIDs,
                                             dsState.docFreqs,
                                             dsState.docTermStartFPs,
                                             dsState.address);
-
+        if (grouping != null) {
+          grouping.finishSegment(topDocIDs, topScores);
+        }
       }
     }
 
+    if (grouping != null) {
+      return new SearchResult(grouping.getTopGroups(topN, totalHits));
+    }
+    if (sort != null) {
+      return new SearchResult(buildTopFieldDocs(topDocIDs, topSortValues, totalHits, topN, sort), dsStates);
+    }
     return new SearchResult(buildTopDocs(topDocIDs, topScores, totalHits, topN, constantScore), dsStates);
   }
 
-  private static SearchResult _searchPhraseQuery(IndexSearcher searcher, PhraseQuery query, int topN, float constantScore) throws IOException {
+  private static SearchResult _searchPhraseQuery(IndexSearcher searcher, PhraseQuery query, Filter filter, int topN, float constantScore) throws IOException {
 
     if (query.getSlop() != 0) {
       throw new IllegalArgumentException("can only handle slop=0; got " + query.getSlop());
@@ -1237,6 +3495,17 @@ public class NativeSearch {
 
     String field = (String) getFieldObject(query, "org.apache.lucene.search.PhraseQuery", "field");
 
+    // Only a phrase with no holes can use the common-grams
+    // sidecar:
+    Term[] phraseTerms = query.getTerms();
+    int[] phrasePositions = query.getPositions();
+    boolean phraseIsConsecutive = phraseTerms.length > 1;
+    for(int i=1;i<phrasePositions.length;i++) {
+      if (phrasePositions[i] != phrasePositions[0] + i) {
+        phraseIsConsecutive = false;
+      }
+    }
+
     Weight w = searcher.createNormalizedWeight(query);
 
     float[] topScores;
@@ -1256,7 +3525,7 @@ public class NativeSearch {
 
     for(int readerIDX=0;readerIDX<leaves.size();readerIDX++) {
       AtomicReaderContext ctx = leaves.get(readerIDX);
-      SegmentState state = new SegmentState(ctx, field);
+      SegmentState state = new SegmentState(ctx, field, filter);
       if (state.normBytes == null) {
         throw new IllegalArgumentException("cannot handle omitNorms field");
       }
@@ -1274,52 +3543,94 @@ public class NativeSearch {
       if (scorer != null) {
 
         //System.out.println("    got scorer");
+        // Only the weight comes from the scorer; the terms'
+        // metadata is read natively from the terms dict:
         float termWeight = getExactPhraseScorerTermWeight(scorer);
 
-        Object[] chunkStates = (Object[]) getFieldObject(scorer, "org.apache.lucene.search.ExactPhraseScorer", "chunkStates");
-
-        long[] docTermStartFPs = new long[chunkStates.length];
-        long[] posTermStartFPs = new long[chunkStates.length];
-        int[] singletonDocIDs = new int[chunkStates.length];
-        int[] docFreqs = new int[chunkStates.length];
-        int[] posOffsets = new int[chunkStates.length];
-        long[] totalTermFreqs = new long[chunkStates.length];
-        long docFreqAddress = 0;
-        long posAddress = 0;
-
-        for(int i=0;i<chunkStates.length;i++) {
-          DocsAndPositionsEnum posEnum = (DocsAndPositionsEnum) getFieldObject(chunkStates[i],
-                                                                               "org.apache.lucene.search.ExactPhraseScorer$ChunkState",
-                                                                               "posEnum");
-          posOffsets[i] = getIntField(chunkStates[i],
-                                      "org.apache.lucene.search.ExactPhraseScorer$ChunkState",
-                                      "offset");
-          //System.out.println("posOffset=" + posOffsets[i]);
-          if (posEnum.getClass().getName().indexOf("Lucene41PostingsReader") == -1 ||
-              posEnum.getClass().getName().indexOf("BlockDocsAndPositionsEnum") == -1) {
-            throw new IllegalArgumentException("must use Lucene41PostingsFormat; got " + posEnum.getClass().getName());
-          }
-
-          docFreqs[i] = getIntField(posEnum, "org.apache.lucene.codecs.lucene41.Lucene41PostingsReader$BlockDocsAndPositionsEnum", "docFreq");
-          totalTermFreqs[i] = getLongField(posEnum, "org.apache.lucene.codecs.lucene41.Lucene41PostingsReader$BlockDocsAndPositionsEnum", "totalTermFreq");
-          docTermStartFPs[i] = getLongField(posEnum, "org.apache.lucene.codecs.lucene41.Lucene41PostingsReader$BlockDocsAndPositionsEnum", "docTermStartFP");
-          posTermStartFPs[i] = getLongField(posEnum, "org.apache.lucene.codecs.lucene41.Lucene41PostingsReader$BlockDocsAndPositionsEnum", "posTermStartFP");
-
-          if (posAddress == 0) {
-            IndexInput posIn = (IndexInput) getFieldObject(posEnum, "org.apache.lucene.codecs.lucene41.Lucene41PostingsReader$BlockDocsAndPositionsEnum", "posIn");
-            posAddress = getMMapAddress(unwrap(posIn));
+        NativeTermsDict dict = new NativeTermsDict(state.reader.terms(field), fieldInfo, getTermStateCache(state.reader, field));
+        PhrasePostings phrase = getPhrasePostings(dict, phraseTerms, phrasePositions, state.maxDoc);
+        int numTerms = phrase.docFreqs.length;
+        long[] docTermStartFPs = phrase.docTermStartFPs;
+        long[] posTermStartFPs = phrase.posTermStartFPs;
+        int[] singletonDocIDs = phrase.singletonDocIDs;
+        int[] docFreqs = phrase.docFreqs;
+        int[] posOffsets = phrase.posOffsets;
+        long[] totalTermFreqs = phrase.totalTermFreqs;
+        long docFreqAddress = phrase.docFreqAddress;
+        long posAddress = phrase.posAddress;
+
+        CommonGrams.SegmentBigrams bigrams = phraseIsConsecutive ? CommonGrams.getSegmentBigrams(state.reader, field) : null;
+        if (bigrams != null) {
+          // Fold in the base address, since bigram postings
+          // come from the sidecar files instead:
+          for(int i=0;i<numTerms;i++) {
+            docTermStartFPs[i] += docFreqAddress;
+            posTermStartFPs[i] += posAddress;
           }
-          if (docFreqs[i] > 1) {
-            singletonDocIDs[i] = -1;
-            if (docFreqAddress == 0) {
-              IndexInput docIn = (IndexInput) getFieldObject(posEnum, "org.apache.lucene.codecs.lucene41.Lucene41PostingsReader$BlockDocsAndPositionsEnum", "startDocIn");
-              docFreqAddress = getMMapAddress(unwrap(docIn));
+          PhrasePostings postings = rewriteCommonGrams(bigrams, phraseTerms, phrasePositions[0],
+                                                       singletonDocIDs, totalTermFreqs, docFreqs,
+                                                       docTermStartFPs, posTermStartFPs, posOffsets);
+          if (postings != null) {
+            if (postings.docFreqs.length == 1) {
+              // Phrase was a single bigram: the phrase freq is
+              // just the bigram's freq, so score it like a
+              // TermQuery with the phrase's weight:
+              totalHits += searchSegmentTermQuery(topDocIDs,
+                                                  topScores,
+                                                  null,
+                                                  null,
+                                                  null,
+                                                  null,
+                                                  null,
+                                                  null,
+                                                  0,
+                                                  false,
+                                                  null,
+                                                  null,
+                                                  0,
+                                                  0,
+                                                  state.maxDoc,
+                                                  ctx.docBase,
+                                                  state.liveDocsBytes,
+                                                  state.filterBitmap,
+                                                  false,
+                                                  termWeight,
+                                                  state.normBytes,
+                                                  normTable,
+                                                  -1,
+                                                  postings.totalTermFreqs[0],
+                                                  postings.docFreqs[0],
+                                                  postings.docTermStartFPs[0],
+                                                  0,
+                                                  0, null, null, null, null, null, null, 0, 0, null, null, null, null, 0);
+            } else {
+              totalHits += searchSegmentExactPhraseQuery(topDocIDs,
+                                                         topScores,
+                                                         state.maxDoc,
+                                                         ctx.docBase,
+                                                         state.liveDocsBytes,
+                                                         state.filterBitmap,
+                                                         termWeight,
+                                                         state.normBytes,
+                                                         normTable,
+                                                         postings.singletonDocIDs,
+                                                         postings.totalTermFreqs,
+                                                         postings.docFreqs,
+                                                         postings.docTermStartFPs,
+                                                         postings.posTermStartFPs,
+                                                         postings.posOffsets,
+                                                         0,
+                                                         0,
+                                                         indexHasPayloads,
+                                                         indexHasOffsets);
             }
-          } else {
-            // Pulsed
-            singletonDocIDs[i] = getIntField(posEnum, "org.apache.lucene.codecs.lucene41.Lucene41PostingsReader$BlockDocsAndPositionsEnum", "singletonDocID");
-            assert singletonDocIDs[i] >= 0;
-            assert singletonDocIDs[i] < state.maxDoc;
+            continue;
+          }
+
+          // No bigrams applied; undo base address:
+          for(int i=0;i<numTerms;i++) {
+            docTermStartFPs[i] -= docFreqAddress;
+            posTermStartFPs[i] -= posAddress;
           }
         }
 
@@ -1329,6 +3640,7 @@ public class NativeSearch {
                                                    state.maxDoc,
                                                    ctx.docBase,
                                                    state.liveDocsBytes,
+                                                   state.filterBitmap,
                                                    termWeight,
                                                    state.normBytes,
                                                    normTable,
@@ -1348,8 +3660,324 @@ public class NativeSearch {
     return new SearchResult(buildTopDocs(topDocIDs, topScores, totalHits, topN, constantScore));
   }
 
-  private static SearchResult _searchBooleanQuery(IndexSearcher searcher, BooleanQuery query, int topN, float constantScore,
-                                                  int dsNumDims, int[] dsTermsPerDim, String dsField, List<BytesRef> dsTerms) throws IOException {
+  // Must match SPAN_* in common.h:
+  private static final int SPAN_TERM = 0;
+  private static final int SPAN_OR = 1;
+  private static final int SPAN_NEAR_ORDERED = 2;
+  private static final int SPAN_NEAR_UNORDERED = 3;
+
+  /** SpanQuery flattened in pre-order, for
+   *  searchSegmentSpanQuery. */
+  private static class SpanTree {
+    int[] nodeTypes = new int[8];
+    int[] nodeArgs = new int[8];
+    int[] nodeChildCounts = new int[8];
+    int numNodes;
+    final List<Term> leaves = new ArrayList<Term>();
+
+    void add(SpanQuery query) {
+      if (numNodes == nodeTypes.length) {
+        nodeTypes = ArrayUtil.grow(nodeTypes);
+        nodeArgs = ArrayUtil.grow(nodeArgs, nodeTypes.length);
+        nodeChildCounts = ArrayUtil.grow(nodeChildCounts, nodeTypes.length);
+      }
+      int node = numNodes++;
+
+      // Exact class checks: subclasses (e.g. PayloadNearQuery)
+      // score differently:
+      if (query.getClass() == SpanTermQuery.class) {
+        // Native code tracks which leaves a doc has in a 32
+        // bit mask:
+        if (leaves.size() == 32) {
+          throw new IllegalArgumentException("can only handle up to 32 SpanTermQuery leaves");
+        }
+        nodeTypes[node] = SPAN_TERM;
+        nodeArgs[node] = leaves.size();
+        leaves.add(((SpanTermQuery) query).getTerm());
+      } else if (query.getClass() == SpanOrQuery.class) {
+        SpanQuery[] clauses = ((SpanOrQuery) query).getClauses();
+        nodeTypes[node] = SPAN_OR;
+        nodeChildCounts[node] = clauses.length;
+        for(SpanQuery clause : clauses) {
+          add(clause);
+        }
+      } else if (query.getClass() == SpanNearQuery.class) {
+        SpanNearQuery near = (SpanNearQuery) query;
+        SpanQuery[] clauses = near.getClauses();
+        nodeTypes[node] = near.isInOrder() ? SPAN_NEAR_ORDERED : SPAN_NEAR_UNORDERED;
+        nodeArgs[node] = near.getSlop();
+        nodeChildCounts[node] = clauses.length;
+        for(SpanQuery clause : clauses) {
+          add(clause);
+        }
+      } else {
+        throw new IllegalArgumentException("can only handle SpanTermQuery, SpanOrQuery and SpanNearQuery; got: " + query.getClass());
+      }
+    }
+  }
+
+  private static SearchResult _searchSpanQuery(IndexSearcher searcher, SpanQuery query, Filter filter, int topN, float constantScore) throws IOException {
+
+    List<AtomicReaderContext> leaves = searcher.getIndexReader().leaves();
+    Similarity sim = searcher.getSimilarity();
+
+    if (!(sim instanceof DefaultSimilarity)) {
+      throw new IllegalArgumentException("searcher.getSimilarity() must be DefaultSimilarity; got: " + sim);
+    }
+
+    String field = query.getField();
+
+    SpanTree tree = new SpanTree();
+    tree.add(query);
+    int[] nodeTypes = Arrays.copyOf(tree.nodeTypes, tree.numNodes);
+    int[] nodeArgs = Arrays.copyOf(tree.nodeArgs, tree.numNodes);
+    int[] nodeChildCounts = Arrays.copyOf(tree.nodeChildCounts, tree.numNodes);
+    int numLeaves = tree.leaves.size();
+    List<BytesRef> leafTerms = new ArrayList<BytesRef>();
+    for(Term term : tree.leaves) {
+      leafTerms.add(term.bytes());
+    }
+
+    Weight w = searcher.createNormalizedWeight(query);
+
+    float[] topScores;
+    if (constantScore < 0.0f) {
+      topScores = new float[topN+1];
+      Arrays.fill(topScores, Float.MIN_VALUE);
+    } else {
+      topScores = null;
+    }
+
+    int[] topDocIDs = new int[topN+1];
+    Arrays.fill(topDocIDs, Integer.MAX_VALUE);
+
+    int totalHits = 0;
+
+    float[] normTable = getNormTable();
+
+    for(int readerIDX=0;readerIDX<leaves.size();readerIDX++) {
+      AtomicReaderContext ctx = leaves.get(readerIDX);
+      SegmentState state = new SegmentState(ctx, field, filter);
+      if (state.normBytes == null) {
+        throw new IllegalArgumentException("cannot handle omitNorms field");
+      }
+      if (state.skip) {
+        continue;
+      }
+
+      FieldInfo fieldInfo = state.reader.getFieldInfos().fieldInfo(field);
+      if (fieldInfo.getIndexOptions().compareTo(FieldInfo.IndexOptions.DOCS_AND_FREQS_AND_POSITIONS) < 0) {
+        throw new IllegalArgumentException("field=" + field + " was indexed without positions");
+      }
+
+      boolean indexHasOffsets = fieldInfo.getIndexOptions().compareTo(FieldInfo.IndexOptions.DOCS_AND_FREQS_AND_POSITIONS_AND_OFFSETS) >= 0;
+      
+      boolean indexHasPayloads = fieldInfo.hasPayloads();
+
+      Scorer scorer = w.scorer(ctx, true, false, state.liveDocs);
+      Terms terms = state.reader.terms(field);
+      if (scorer == null || terms == null) {
+        continue;
+      }
+
+      float spanWeight = getSpanScorerWeight(scorer);
+
+      NativeTermsDict dict = new NativeTermsDict(terms, fieldInfo, getTermStateCache(state.reader, field));
+      int[] singletonDocIDs = new int[numLeaves];
+      long[] totalTermFreqs = new long[numLeaves];
+      int[] docFreqs = new int[numLeaves];
+      long[] docTermStartFPs = new long[numLeaves];
+      long[] posTermStartFPs = new long[numLeaves];
+      if (dict.lookup(leafTerms, docFreqs, totalTermFreqs, docTermStartFPs, posTermStartFPs, singletonDocIDs) == 0) {
+        // None of the leaf terms occur in this segment
+        continue;
+      }
+
+      totalHits += searchSegmentSpanQuery(topDocIDs,
+                                          topScores,
+                                          state.maxDoc,
+                                          ctx.docBase,
+                                          state.liveDocsBytes,
+                                          state.filterBitmap,
+                                          spanWeight,
+                                          state.normBytes,
+                                          normTable,
+                                          nodeTypes,
+                                          nodeArgs,
+                                          nodeChildCounts,
+                                          singletonDocIDs,
+                                          totalTermFreqs,
+                                          docFreqs,
+                                          docTermStartFPs,
+                                          posTermStartFPs,
+                                          dict.docAddress,
+                                          dict.posAddress,
+                                          indexHasPayloads,
+                                          indexHasOffsets);
+    }
+
+    return new SearchResult(buildTopDocs(topDocIDs, topScores, totalHits, topN, constantScore));
+  }
+
+  private static class PhrasePostings {
+    int[] singletonDocIDs;
+    long[] totalTermFreqs;
+    int[] docFreqs;
+    long[] docTermStartFPs;
+    long[] posTermStartFPs;
+    int[] posOffsets;
+    long docFreqAddress;
+    long posAddress;
+
+    PhrasePostings(int count) {
+      singletonDocIDs = new int[count];
+      totalTermFreqs = new long[count];
+      docFreqs = new int[count];
+      docTermStartFPs = new long[count];
+      posTermStartFPs = new long[count];
+      posOffsets = new int[count];
+    }
+  }
+
+  /** Resolves the exact phrase's terms in the segment's
+   *  terms dict, ordered like ExactPhraseScorer's chunk
+   *  states: rarest postings first. */
+  private static PhrasePostings getPhrasePostings(NativeTermsDict dict, Term[] terms, int[] positions, int maxDoc) {
+    int numTerms = terms.length;
+    List<BytesRef> termBytes = new ArrayList<BytesRef>(numTerms);
+    for(Term term : terms) {
+      termBytes.add(term.bytes());
+    }
+    PhrasePostings postings = new PhrasePostings(numTerms);
+    dict.lookup(termBytes, postings.docFreqs, postings.totalTermFreqs, postings.docTermStartFPs, postings.posTermStartFPs, postings.singletonDocIDs);
+
+    long[] order = new long[numTerms];
+    for(int i=0;i<numTerms;i++) {
+      assert postings.docFreqs[i] > 0;
+      order[i] = (((long) postings.docFreqs[i]) << 32) | i;
+    }
+    Arrays.sort(order);
+    PhrasePostings sorted = new PhrasePostings(numTerms);
+    for(int i=0;i<numTerms;i++) {
+      int j = (int) order[i];
+      sorted.singletonDocIDs[i] = postings.singletonDocIDs[j];
+      sorted.docFreqs[i] = postings.docFreqs[j];
+      sorted.totalTermFreqs[i] = postings.totalTermFreqs[j];
+      sorted.docTermStartFPs[i] = postings.docTermStartFPs[j];
+      sorted.posTermStartFPs[i] = postings.posTermStartFPs[j];
+      sorted.posOffsets[i] = -positions[j];
+      assert sorted.singletonDocIDs[i] < maxDoc;
+    }
+    sorted.docFreqAddress = dict.docAddress;
+    sorted.posAddress = dict.posAddress;
+    return sorted;
+  }
+
+  /** Replaces adjacent pairs of phrase terms with bigram
+   *  postings from the common-grams sidecar, keeping the
+   *  unigram postings for any term not covered by a
+   *  bigram.  The phrase matches (and phrase freq) are
+   *  unchanged since a bigram at position p is exactly
+   *  word1 at p and word2 at p+1.  Incoming and returned
+   *  start FPs are absolute addresses.  Returns null if no
+   *  bigram applies. */
+  private static PhrasePostings rewriteCommonGrams(CommonGrams.SegmentBigrams bigrams, Term[] terms, int firstPosition,
+                                                   int[] singletonDocIDs, long[] totalTermFreqs, int[] docFreqs,
+                                                   long[] docTermStartFPs, long[] posTermStartFPs, int[] posOffsets) {
+    int numTerms = terms.length;
+
+    // ExactPhraseScorer sorts its terms by docFreq; map back
+    // to phrase order:
+    int[] termToSub = new int[numTerms];
+    for(int i=0;i<numTerms;i++) {
+      termToSub[-posOffsets[i] - firstPosition] = i;
+    }
+
+    boolean[] covered = new boolean[numTerms];
+    int[] bigramStarts = new int[numTerms];
+    long[][] bigramStats = new long[numTerms][];
+    int numBigrams = 0;
+    for(int i=0;i<numTerms;i++) {
+      if (covered[i]) {
+        continue;
+      }
+      int start = i;
+      long[] stats = null;
+      if (i+1 < numTerms) {
+        stats = bigrams.get(terms[i].bytes(), terms[i+1].bytes());
+      }
+      if (stats == null && i > 0) {
+        start = i-1;
+        stats = bigrams.get(terms[i-1].bytes(), terms[i].bytes());
+      }
+      if (stats != null) {
+        covered[start] = true;
+        covered[start+1] = true;
+        bigramStarts[numBigrams] = start;
+        bigramStats[numBigrams] = stats;
+        numBigrams++;
+      }
+    }
+
+    if (numBigrams == 0) {
+      return null;
+    }
+
+    int numUnigrams = 0;
+    for(int i=0;i<numTerms;i++) {
+      if (!covered[i]) {
+        numUnigrams++;
+      }
+    }
+
+    PhrasePostings postings = new PhrasePostings(numBigrams + numUnigrams);
+    int upto = 0;
+    for(int i=0;i<numBigrams;i++) {
+      long[] stats = bigramStats[i];
+      postings.singletonDocIDs[upto] = -1;
+      postings.docFreqs[upto] = (int) stats[0];
+      postings.totalTermFreqs[upto] = stats[1];
+      postings.docTermStartFPs[upto] = bigrams.docAddress + stats[2];
+      postings.posTermStartFPs[upto] = bigrams.posAddress + stats[3];
+      postings.posOffsets[upto] = -(firstPosition + bigramStarts[i]);
+      upto++;
+    }
+    for(int i=0;i<numTerms;i++) {
+      if (!covered[i]) {
+        int sub = termToSub[i];
+        postings.singletonDocIDs[upto] = singletonDocIDs[sub];
+        postings.docFreqs[upto] = docFreqs[sub];
+        postings.totalTermFreqs[upto] = totalTermFreqs[sub];
+        postings.docTermStartFPs[upto] = docTermStartFPs[sub];
+        postings.posTermStartFPs[upto] = posTermStartFPs[sub];
+        postings.posOffsets[upto] = posOffsets[sub];
+        upto++;
+      }
+    }
+
+    // Lead with the rarest postings, like ExactPhraseScorer:
+    long[] order = new long[upto];
+    for(int i=0;i<upto;i++) {
+      order[i] = (((long) postings.docFreqs[i]) << 32) | i;
+    }
+    Arrays.sort(order);
+    PhrasePostings sorted = new PhrasePostings(upto);
+    for(int i=0;i<upto;i++) {
+      int j = (int) order[i];
+      sorted.singletonDocIDs[i] = postings.singletonDocIDs[j];
+      sorted.docFreqs[i] = postings.docFreqs[j];
+      sorted.totalTermFreqs[i] = postings.totalTermFreqs[j];
+      sorted.docTermStartFPs[i] = postings.docTermStartFPs[j];
+      sorted.posTermStartFPs[i] = postings.posTermStartFPs[j];
+      sorted.posOffsets[i] = postings.posOffsets[j];
+    }
+
+    return sorted;
+  }
+
+  private static SearchResult _searchBooleanQuery(IndexSearcher searcher, BooleanQuery query, Filter filter, int topN, float constantScore, NativeSort sort,
+                                                  NativeGrouping grouping, int dsNumDims, int[] dsTermsPerDim, String dsField, List<BytesRef> dsTerms,
+                                                  NativeFacetCounts dsFacets) throws IOException {
 
     List<AtomicReaderContext> leaves = searcher.getIndexReader().leaves();
     Similarity sim = searcher.getSimilarity();
@@ -1366,6 +3994,12 @@ public class NativeSearch {
 
     BooleanClause[] clauses = query.getClauses();
     if (clauses.length == 0) {
+      if (grouping != null) {
+        return new SearchResult(grouping.getTopGroups(topN, 0));
+      }
+      if (sort != null) {
+        return new SearchResult(new TopFieldDocs(0, new ScoreDoc[0], sort.sort.getSort(), Float.NaN));
+      }
       return new SearchResult(new TopDocs(0, new ScoreDoc[0]));
     }
 
@@ -1373,6 +4007,7 @@ public class NativeSearch {
     String[] terms = new String[clauses.length];
     final BooleanClause.Occur[] occurs = new BooleanClause.Occur[clauses.length];
     int numMustNotTop = 0;
+    boolean hasPhraseClauses = false;
     for(int i=0;i<clauses.length;i++) {
       BooleanClause clause = clauses[i];
       occurs[i] = clause.getOccur();
@@ -1380,17 +4015,27 @@ public class NativeSearch {
         numMustNotTop++;
       }
       
-      if (!(clause.getQuery() instanceof TermQuery)) {
-        throw new IllegalArgumentException("sub-queries must be TermQuery; got: " + clause.getQuery());
+      Term term;
+      if (clause.getQuery() instanceof TermQuery) {
+        term = ((TermQuery) clause.getQuery()).getTerm();
+      } else if (clause.getQuery() instanceof PhraseQuery) {
+        PhraseQuery pq = (PhraseQuery) clause.getQuery();
+        if (pq.getSlop() != 0) {
+          throw new IllegalArgumentException("PhraseQuery sub-queries can only handle slop=0; got " + pq.getSlop());
+        }
+        // Phrase is scored against the same norms, so it
+        // must be on the same field:
+        term = pq.getTerms()[0];
+        hasPhraseClauses = true;
+      } else {
+        throw new IllegalArgumentException("sub-queries must be TermQuery or PhraseQuery; got: " + clause.getQuery());
       }
-      TermQuery tq = (TermQuery) clause.getQuery();
-      Term term = tq.getTerm();
       if (i == 0) {
         field = term.field();
       } else if (!field.equals(term.field())) {
-        throw new IllegalArgumentException("all sub-queries must be TermQuery against the same field; got both field=" + field + " and field=" + term.field());
+        throw new IllegalArgumentException("all sub-queries must be TermQuery or PhraseQuery against the same field; got both field=" + field + " and field=" + term.field());
       }
-      terms[i] = term.text();
+      terms[i] = clause.getQuery().toString(field);
     }
 
     int maxCoord = clauses.length-numMustNotTop;
@@ -1412,11 +4057,29 @@ public class NativeSearch {
     List<Weight> subWeights = getBooleanSubWeights(w);
 
     float[] topScores;
-    if (constantScore < 0.0f) {
+    long[] topSortValues;
+    if (sort != null) {
+      if (constantScore >= 0.0f && sort.needsScores()) {
+        throw new IllegalArgumentException("cannot sort a constant score query by score");
+      }
+      // Hits are only scored when a SortField is SCORE, and
+      // then their scores are kept in topSortValues:
+      topScores = null;
+      topSortValues = sort.newTopValues(topN);
+    } else if (grouping != null) {
+      if (constantScore >= 0.0f) {
+        throw new IllegalArgumentException("cannot group a constant score query");
+      }
+      // Each segment's top groups; setNextReader resets it:
+      topScores = new float[topN+1];
+      topSortValues = null;
+    } else if (constantScore < 0.0f) {
       topScores = new float[topN+1];
       Arrays.fill(topScores, Float.MIN_VALUE);
+      topSortValues = null;
     } else {
       topScores = null;
+      topSortValues = null;
     }
 
     int[] topDocIDs = new int[topN+1];
@@ -1429,7 +4092,7 @@ public class NativeSearch {
     for(int readerIDX=0;readerIDX<leaves.size();readerIDX++) {
 
       AtomicReaderContext ctx = leaves.get(readerIDX);
-      SegmentState state = new SegmentState(ctx, field);
+      SegmentState state = new SegmentState(ctx, field, filter);
       if (state.docsOnly) {
         throw new IllegalArgumentException("cannot handle DOCS_ONLY field");
       }
@@ -1441,6 +4104,7 @@ public class NativeSearch {
       }
 
       List<Scorer> scorers = new ArrayList<Scorer>();
+      List<Query> scorerQueries = new ArrayList<Query>();
       final List<BooleanClause.Occur> occursList = new ArrayList<BooleanClause.Occur>();
       int numMust = 0;
       int numMustNot = 0;
@@ -1448,6 +4112,7 @@ public class NativeSearch {
         Scorer scorer = subWeights.get(i).scorer(ctx, true, false, state.liveDocs);
         if (scorer != null) {
           scorers.add(scorer);
+          scorerQueries.add(clauses[i].getQuery());
           occursList.add(occurs[i]);
           if (occurs[i] == BooleanClause.Occur.MUST) {
             numMust++;
@@ -1470,29 +4135,69 @@ public class NativeSearch {
         final long[] totalTermFreqs = new long[scorers.size()];
         final int[] docFreqs = new int[scorers.size()];
         final long[] docTermStartFPs = new long[scorers.size()];
+        final PhrasePostings[] phrases = hasPhraseClauses ? new PhrasePostings[scorers.size()] : null;
         long address = 0;
+        long posAddress = 0;
 
+        // Only the weights come from the scorers; the terms'
+        // metadata is read natively from the terms dict, for
+        // all term clauses in one call:
+        NativeTermsDict dict = new NativeTermsDict(state.reader.terms(field), state.reader.getFieldInfos().fieldInfo(field),
+                                                   getTermStateCache(state.reader, field));
+        List<BytesRef> clauseTerms = new ArrayList<BytesRef>();
         for(int i=0;i<scorers.size();i++) {
-          Scorer scorer = scorers.get(i);
-          termWeights[i] = getTermScorerTermWeight(scorer);
-          DocsEnum docsEnum = unwrap(getDocsEnum(scorer));
-          if (docsEnum.getClass().getName().indexOf("Lucene41PostingsReader") == -1) {
-            throw new IllegalArgumentException("must use Lucene41PostingsFormat; got " + docsEnum.getClass().getName());
+          if (!isExactPhraseScorer(scorers.get(i))) {
+            Query q = scorerQueries.get(i);
+            // A single term PhraseQuery rewrites to a TermQuery:
+            Term term = q instanceof TermQuery ? ((TermQuery) q).getTerm() : ((PhraseQuery) q).getTerms()[0];
+            clauseTerms.add(term.bytes());
           }
+        }
+        int[] clauseDocFreqs = new int[clauseTerms.size()];
+        long[] clauseTotalTermFreqs = new long[clauseTerms.size()];
+        long[] clauseDocTermStartFPs = new long[clauseTerms.size()];
+        long[] clausePosTermStartFPs = new long[clauseTerms.size()];
+        int[] clauseSingletonDocIDs = new int[clauseTerms.size()];
+        dict.lookup(clauseTerms, clauseDocFreqs, clauseTotalTermFreqs, clauseDocTermStartFPs, clausePosTermStartFPs, clauseSingletonDocIDs);
+        int termUpto = 0;
+
+        for(int i=0;i<scorers.size();i++) {
+          Scorer scorer = scorers.get(i);
+          if (isExactPhraseScorer(scorer)) {
+            termWeights[i] = getExactPhraseScorerTermWeight(scorer);
+            PhraseQuery pq = (PhraseQuery) scorerQueries.get(i);
+            PhrasePostings phrase = getPhrasePostings(dict, pq.getTerms(), pq.getPositions(), state.maxDoc);
+            phrases[i] = phrase;
+            if (address == 0) {
+              address = phrase.docFreqAddress;
+            }
+            posAddress = phrase.posAddress;
 
-          docFreqs[i] = getDocFreq(docsEnum);
-          docTermStartFPs[i] = getDocTermStartFP(docsEnum);
+            // Phrase can match no more docs than its rarest
+            // term; we use this to sort the clauses:
+            int minDocFreq = Integer.MAX_VALUE;
+            for(int docFreq : phrase.docFreqs) {
+              minDocFreq = Math.min(minDocFreq, docFreq);
+            }
+            docFreqs[i] = minDocFreq;
+            singletonDocIDs[i] = -1;
+            continue;
+          }
+          termWeights[i] = getTermScorerTermWeight(scorer);
+          int term = termUpto++;
+          docFreqs[i] = clauseDocFreqs[term];
+          docTermStartFPs[i] = clauseDocTermStartFPs[term];
+          assert docFreqs[i] > 0;
           
           if (docFreqs[i] > 1) {
-            IndexInput docIn = getDocIn(docsEnum);
             if (address == 0) {
-              address = getMMapAddress(docIn);
+              address = dict.docAddress;
             }
             singletonDocIDs[i] = -1;
           } else {
             // Pulsed
-            singletonDocIDs[i] = getSingletonDocID(docsEnum);
-            totalTermFreqs[i] = getTotalTermFreq(docsEnum);
+            singletonDocIDs[i] = clauseSingletonDocIDs[term];
+            totalTermFreqs[i] = clauseTotalTermFreqs[term];
             assert singletonDocIDs[i] >= 0;
           }
         }
@@ -1571,6 +4276,12 @@ public class NativeSearch {
             termWeights[i] = termWeights[j];
             termWeights[j] = z;
 
+            if (phrases != null) {
+              PhrasePostings p = phrases[i];
+              phrases[i] = phrases[j];
+              phrases[j] = p;
+            }
+
             BooleanClause.Occur o = occursList.get(i);
             occursList.set(i, occursList.get(j));
             occursList.set(j, o);
@@ -1602,9 +4313,62 @@ public class NativeSearch {
           }
         }.mergeSort(0, scorers.size()-1);
 
-        DrillSidewaysState dsState = new DrillSidewaysState(state, dsNumDims, dsTermsPerDim, dsField, dsTerms);
+        DrillSidewaysState dsState = new DrillSidewaysState(state, dsNumDims, dsTermsPerDim, dsField, dsTerms, dsFacets);
         dsStates.add(dsState);
 
+        if (sort != null) {
+          sort.setNextReader(state.reader);
+        }
+        if (grouping != null) {
+          grouping.setNextReader(state.reader, topDocIDs, topScores);
+        }
+
+        // Flatten the phrase clauses' per-term postings, in
+        // clause order:
+        int[] phraseTermCounts = null;
+        int[] phraseSingletonDocIDs = null;
+        long[] phraseTotalTermFreqs = null;
+        int[] phraseDocFreqs = null;
+        long[] phraseDocTermStartFPs = null;
+        long[] phrasePosTermStartFPs = null;
+        int[] phrasePosOffsets = null;
+        boolean indexHasPayloads = false;
+        boolean indexHasOffsets = false;
+        if (phrases != null) {
+          phraseTermCounts = new int[scorers.size()];
+          int numPhraseTerms = 0;
+          for(int i=0;i<scorers.size();i++) {
+            if (phrases[i] != null) {
+              phraseTermCounts[i] = phrases[i].docFreqs.length;
+              numPhraseTerms += phraseTermCounts[i];
+            }
+          }
+          phraseSingletonDocIDs = new int[numPhraseTerms];
+          phraseTotalTermFreqs = new long[numPhraseTerms];
+          phraseDocFreqs = new int[numPhraseTerms];
+          phraseDocTermStartFPs = new long[numPhraseTerms];
+          phrasePosTermStartFPs = new long[numPhraseTerms];
+          phrasePosOffsets = new int[numPhraseTerms];
+          int upto = 0;
+          for(int i=0;i<scorers.size();i++) {
+            PhrasePostings phrase = phrases[i];
+            if (phrase != null) {
+              int count = phraseTermCounts[i];
+              System.arraycopy(phrase.singletonDocIDs, 0, phraseSingletonDocIDs, upto, count);
+              System.arraycopy(phrase.totalTermFreqs, 0, phraseTotalTermFreqs, upto, count);
+              System.arraycopy(phrase.docFreqs, 0, phraseDocFreqs, upto, count);
+              System.arraycopy(phrase.docTermStartFPs, 0, phraseDocTermStartFPs, upto, count);
+              System.arraycopy(phrase.posTermStartFPs, 0, phrasePosTermStartFPs, upto, count);
+              System.arraycopy(phrase.posOffsets, 0, phrasePosOffsets, upto, count);
+              upto += count;
+            }
+          }
+
+          FieldInfo fieldInfo = state.reader.getFieldInfos().fieldInfo(field);
+          indexHasOffsets = fieldInfo.getIndexOptions().compareTo(FieldInfo.IndexOptions.DOCS_AND_FREQS_AND_POSITIONS_AND_OFFSETS) >= 0;
+          indexHasPayloads = fieldInfo.hasPayloads();
+        }
+
         /*
         System.out.println("numMustNot=" + numMustNot);
         for(int i=0;i<scorers.size();i++) {
@@ -1616,9 +4380,22 @@ public class NativeSearch {
         //System.out.println("send startFPs=" + Arrays.toString(dsState.docTermStartFPs));
         totalHits += searchSegmentBooleanQuery(topDocIDs,
                                                topScores,
+                                               topSortValues,
+                                               sort == null ? null : sort.keys,
+                                               sort == null ? null : sort.reverse,
+                                               sort == null ? null : sort.dvAddresses,
+                                               sort == null ? null : sort.dvFormats,
+                                               sort == null ? null : sort.afterValues,
+                                               sort == null ? 0 : sort.afterDocID,
+                                               sort != null && sort.docsInSortOrder,
+                                               grouping == null ? null : grouping.topGroupOrds,
+                                               grouping == null ? null : grouping.ordCounts,
+                                               grouping == null ? 0 : grouping.dvAddress,
+                                               grouping == null ? 0 : grouping.dvFormat,
                                                state.maxDoc,
                                                ctx.docBase,
                                                state.liveDocsBytes,
+                                               state.filterBitmap,
                                                termWeights,
                                                state.normBytes,
                                                normTable,
@@ -1635,15 +4412,39 @@ public class NativeSearch {
                                                dsState.termsPerDim,
                                                dsState.ddBitsArray,
                                                dsState.dsBitsArrays,
+                                               dsState.facetCounts,
+                                               dsState.facetAddresses,
+                                               dsState.facetAddressFormat,
+                                               dsState.facetAddressBitsPerValue,
+                                               dsState.facetBytes,
                                                dsState.singletonDocIDs,
                                                dsState.docFreqs,
                                                dsState.docTermStartFPs,
-                                               dsState.address);
+                                               dsState.address,
+                                               phraseTermCounts,
+                                               phraseSingletonDocIDs,
+                                               phraseTotalTermFreqs,
+                                               phraseDocFreqs,
+                                               phraseDocTermStartFPs,
+                                               phrasePosTermStartFPs,
+                                               phrasePosOffsets,
+                                               posAddress,
+                                               indexHasPayloads,
+                                               indexHasOffsets);
+        if (grouping != null) {
+          grouping.finishSegment(topDocIDs, topScores);
+        }
       } else {
-        dsStates.add(new DrillSidewaysState(state, dsNumDims, dsTermsPerDim, dsField, dsTerms));
+        dsStates.add(new DrillSidewaysState(state, dsNumDims, dsTermsPerDim, dsField, dsTerms, dsFacets));
       }
     }
 
+    if (grouping != null) {
+      return new SearchResult(grouping.getTopGroups(topN, totalHits));
+    }
+    if (sort != null) {
+      return new SearchResult(buildTopFieldDocs(topDocIDs, topSortValues, totalHits, topN, sort), dsStates);
+    }
     return new SearchResult(buildTopDocs(topDocIDs, topScores, totalHits, topN, constantScore), dsStates);
   }
 
@@ -1686,6 +4487,75 @@ public class NativeSearch {
     return new TopDocs(totalHits, scoreDocs, maxScore);
   }
 
+  /** Like buildTopDocs, for a PQ sorted by sort; hits are
+   *  not scored, same as IndexSearcher's sorted search, but
+   *  a SCORE SortField's value is the hit's score. */
+  private static TopFieldDocs buildTopFieldDocs(int[] topDocIDs, long[] topSortValues, int totalHits, int topN, NativeSort sort) {
+    int numKeys = sort.keys.length;
+
+    // With searchAfter, fewer than min(totalHits, topN) hits
+    // may have been collected:
+    int numHits = 0;
+    for(int i=1;i<=topN;i++) {
+      if (topDocIDs[i] != Integer.MAX_VALUE) {
+        numHits++;
+      }
+    }
+    FieldDoc[] fieldDocs = new FieldDoc[numHits];
+
+    int heapSize = topN;
+
+    // Pop off any remaining sentinel values first:
+    for(int i=0;i<topN-fieldDocs.length;i++) {
+      System.arraycopy(topSortValues, heapSize*numKeys, topSortValues, numKeys, numKeys);
+      topDocIDs[1] = topDocIDs[heapSize];
+      heapSize--;
+      downHeap(heapSize, topDocIDs, topSortValues, sort);
+    }
+
+    for(int i=fieldDocs.length-1;i>=0;i--) {
+      Object[] fields = new Object[numKeys];
+      for(int j=0;j<numKeys;j++) {
+        fields[j] = sort.toFieldValue(j, topSortValues[numKeys+j]);
+      }
+      fieldDocs[i] = new FieldDoc(topDocIDs[1], Float.NaN, fields);
+      System.arraycopy(topSortValues, heapSize*numKeys, topSortValues, numKeys, numKeys);
+      topDocIDs[1] = topDocIDs[heapSize];
+      heapSize--;
+      downHeap(heapSize, topDocIDs, topSortValues, sort);
+    }
+
+    return new TopFieldDocs(totalHits, fieldDocs, sort.sort.getSort(), Float.NaN);
+  }
+
+  private static void downHeap(int heapSize, int[] topDocIDs, long[] topSortValues, NativeSort sort) {
+    int numKeys = sort.keys.length;
+    int i = 1;
+    // save top node
+    int savDocID = topDocIDs[i];
+    long[] savValues = new long[numKeys];
+    System.arraycopy(topSortValues, i*numKeys, savValues, 0, numKeys);
+    int j = i << 1;            // find smaller child
+    int k = j + 1;
+    if (k <= heapSize && sort.lessThan(topDocIDs[k], topSortValues, k*numKeys, topDocIDs[j], topSortValues, j*numKeys)) {
+      j = k;
+    }
+    while (j <= heapSize && sort.lessThan(topDocIDs[j], topSortValues, j*numKeys, savDocID, savValues, 0)) {
+      // shift up child
+      topDocIDs[i] = topDocIDs[j];
+      System.arraycopy(topSortValues, j*numKeys, topSortValues, i*numKeys, numKeys);
+      i = j;
+      j = i << 1;
+      k = j + 1;
+      if (k <= heapSize && sort.lessThan(topDocIDs[k], topSortValues, k*numKeys, topDocIDs[j], topSortValues, j*numKeys)) {
+        j = k;
+      }
+    }
+    // install saved node
+    topDocIDs[i] = savDocID;
+    System.arraycopy(savValues, 0, topSortValues, i*numKeys, numKeys);
+  }
+
   private static boolean lessThan(int docID1, float score1, int docID2, float score2) {
     if (score1 < score2) {
       return true;
@@ -1755,7 +4625,7 @@ public class NativeSearch {
   }
 
   // Needed only when running Lucene tests:
-  private static IndexInput unwrap(IndexInput in) {
+  static IndexInput unwrap(IndexInput in) {
     try {
       String className = in.getClass().getSimpleName();
       if (className.equals("MockIndexInputWrapper") ||
@@ -1774,7 +4644,7 @@ public class NativeSearch {
   }
 
   // Needed only when running Lucene tests:
-  private static Directory unwrap(Directory dir) {
+  static Directory unwrap(Directory dir) {
     try {
       //System.out.println("unwrap: dir=" + dir);
       String className = dir.getClass().getSimpleName();
@@ -1792,23 +4662,6 @@ public class NativeSearch {
     }
   }
 
-  // Needed only when running Lucene tests:
-  private static DocsEnum unwrap(DocsEnum docsEnum) {
-    try {
-      String className = docsEnum.getClass().getSimpleName();
-      if (className.equals("AssertingDocsEnum")) {
-        Class<?> x = Class.forName("org.apache.lucene.index.FilterAtomicReader$FilterDocsEnum");
-        Field f = x.getDeclaredField("in");
-        f.setAccessible(true);
-        return (DocsEnum) f.get(docsEnum);
-      } else {
-        return docsEnum;
-      }
-    } catch (Exception e) {
-      throw new IllegalStateException("reflection failed", e);
-    }
-  }
-
   // nocommit we can move most of the reflection lookups to
   // static:
 
@@ -1823,7 +4676,7 @@ public class NativeSearch {
     }
   }
 
-  private static long getMMapAddress(IndexInput in) {
+  static long getMMapAddress(IndexInput in) {
     try {
       Class<?> x = Class.forName("org.apache.lucene.store.NativeMMapDirectory$NativeMMapIndexInput");
       Field f = x.getDeclaredField("address");
@@ -1834,6 +4687,10 @@ public class NativeSearch {
     }
   }
 
+  private static boolean isExactPhraseScorer(Scorer scorer) {
+    return scorer.getClass().getName().equals("org.apache.lucene.search.ExactPhraseScorer");
+  }
+
   private static float getExactPhraseScorerTermWeight(Scorer scorer) {
     try {
       Class<?> x = Class.forName("org.apache.lucene.search.ExactPhraseScorer");
@@ -1868,72 +4725,27 @@ public class NativeSearch {
     }
   }
 
-  private static byte[] getLiveDocsBits(Bits bits) {
-    try {
-      Class<?> x = Class.forName("org.apache.lucene.codecs.lucene40.BitVector");
-      Field f = x.getDeclaredField("bits");
-      f.setAccessible(true);
-      return (byte[]) f.get(bits);
-    } catch (Exception e) {
-      throw new IllegalStateException("reflection failed", e);
-    }
-  }
-
-  private static DocsEnum getDocsEnum(Scorer scorer) {
-    try {
-      Class<?> x = Class.forName("org.apache.lucene.search.TermScorer");
-      Field f = x.getDeclaredField("docsEnum");
-      f.setAccessible(true);
-      return (DocsEnum) f.get(scorer);
-    } catch (Exception e) {
-      throw new IllegalStateException("reflection failed", e);
-    }
-  }
-
-  private static int getDocFreq(DocsEnum docsEnum) {
-    try {
-      Class<?> x = Class.forName("org.apache.lucene.codecs.lucene41.Lucene41PostingsReader$BlockDocsEnum");
-      Field f = x.getDeclaredField("docFreq");
-      f.setAccessible(true);
-      return f.getInt(docsEnum);
-    } catch (Exception e) {
-      throw new IllegalStateException("reflection failed", e);
-    }
-  }
-  
-  private static long getTotalTermFreq(DocsEnum docsEnum) {
-    try {
-      return blockDocsEnumTotalTermFreqField.getLong(docsEnum);
-    } catch (Exception e) {
-      throw new IllegalStateException("reflection failed", e);
-    }
-  }
-
-  private static IndexInput getDocIn(DocsEnum docsEnum) {
+  private static float getSpanScorerWeight(Scorer scorer) {
     try {
-      final Class<?> x = Class.forName("org.apache.lucene.codecs.lucene41.Lucene41PostingsReader$BlockDocsEnum");
-      final Field f = x.getDeclaredField("startDocIn");
+      Class<?> x = Class.forName("org.apache.lucene.search.spans.SpanScorer");
+      Field f = x.getDeclaredField("docScorer");
       f.setAccessible(true);
-      return unwrap((IndexInput) f.get(docsEnum));
+      Object o = f.get(scorer);
+      Class<?> y = Class.forName("org.apache.lucene.search.similarities.TFIDFSimilarity$SloppyTFIDFDocScorer");
+      Field weightsField = y.getDeclaredField("weightValue");
+      weightsField.setAccessible(true);
+      return weightsField.getFloat(o);
     } catch (Exception e) {
       throw new IllegalStateException("reflection failed", e);
     }
   }
 
-  private static long getDocTermStartFP(DocsEnum docsEnum) {
+  private static byte[] getLiveDocsBits(Bits bits) {
     try {
-      final Class<?> x = Class.forName("org.apache.lucene.codecs.lucene41.Lucene41PostingsReader$BlockDocsEnum");
-      final Field f = x.getDeclaredField("docTermStartFP");
+      Class<?> x = Class.forName("org.apache.lucene.codecs.lucene40.BitVector");
+      Field f = x.getDeclaredField("bits");
       f.setAccessible(true);
-      return f.getLong(docsEnum);
-    } catch (Exception e) {
-      throw new IllegalStateException("reflection failed", e);
-    }
-  }
-
-  private static int getSingletonDocID(DocsEnum docsEnum) {
-    try {
-      return blockDocsEnumSingletonDocIDField.getInt(docsEnum);
+      return (byte[]) f.get(bits);
     } catch (Exception e) {
       throw new IllegalStateException("reflection failed", e);
     }
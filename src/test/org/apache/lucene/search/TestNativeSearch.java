@@ -20,20 +20,33 @@ package org.apache.lucene.search;
 import java.io.File;
 import java.io.IOException;
 import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.HashSet;
 import java.util.List;
+import java.util.Set;
 
 import org.apache.lucene.analysis.MockAnalyzer;
 import org.apache.lucene.codecs.Codec;
 import org.apache.lucene.codecs.DocValuesFormat;
 import org.apache.lucene.codecs.lucene42.Lucene42Codec;
 import org.apache.lucene.document.Document;
+import org.apache.lucene.document.DoubleField;
 import org.apache.lucene.document.Field;
 import org.apache.lucene.document.FieldType;
 import org.apache.lucene.document.IntField;
+import org.apache.lucene.document.LongField;
+import org.apache.lucene.document.NumericDocValuesField;
+import org.apache.lucene.document.SortedDocValuesField;
 import org.apache.lucene.document.StringField;
 import org.apache.lucene.document.TextField;
+import org.apache.lucene.facet.associations.AssociationsFacetFields;
+import org.apache.lucene.facet.associations.CategoryAssociationsContainer;
+import org.apache.lucene.facet.associations.CategoryFloatAssociation;
+import org.apache.lucene.facet.associations.SumFloatAssociationFacetRequest;
+import org.apache.lucene.facet.associations.SumFloatAssociationFacetsAggregator;
 import org.apache.lucene.facet.index.FacetFields;
 import org.apache.lucene.facet.params.CategoryListParams;
+import org.apache.lucene.facet.params.FacetIndexingParams;
 import org.apache.lucene.facet.params.FacetSearchParams;
 import org.apache.lucene.facet.search.CountFacetRequest;
 import org.apache.lucene.facet.search.DrillDownQuery;
@@ -41,18 +54,32 @@ import org.apache.lucene.facet.search.DrillSideways.DrillSidewaysResult;
 import org.apache.lucene.facet.search.DrillSideways;
 import org.apache.lucene.facet.search.FacetResult;
 import org.apache.lucene.facet.search.FacetResultNode;
+import org.apache.lucene.facet.search.FacetsAccumulator;
+import org.apache.lucene.facet.search.FacetsAggregator;
+import org.apache.lucene.facet.search.SumScoreFacetRequest;
+import org.apache.lucene.facet.search.SumScoreFacetsAggregator;
 import org.apache.lucene.facet.taxonomy.CategoryPath;
 import org.apache.lucene.facet.taxonomy.TaxonomyReader;
 import org.apache.lucene.facet.taxonomy.directory.DirectoryTaxonomyReader;
 import org.apache.lucene.facet.taxonomy.directory.DirectoryTaxonomyWriter;
+import org.apache.lucene.index.AtomicReaderContext;
 import org.apache.lucene.index.DirectoryReader;
 import org.apache.lucene.index.FieldInfo;
 import org.apache.lucene.index.IndexReader;
 import org.apache.lucene.index.IndexWriter;
 import org.apache.lucene.index.IndexWriterConfig;
+import org.apache.lucene.index.SegmentReader;
 import org.apache.lucene.index.Term;
+import org.apache.lucene.search.grouping.GroupDocs;
+import org.apache.lucene.search.grouping.GroupingSearch;
+import org.apache.lucene.search.grouping.TopGroups;
+import org.apache.lucene.search.spans.SpanNearQuery;
+import org.apache.lucene.search.spans.SpanOrQuery;
+import org.apache.lucene.search.spans.SpanQuery;
+import org.apache.lucene.search.spans.SpanTermQuery;
 import org.apache.lucene.store.Directory;
 import org.apache.lucene.store.NativeMMapDirectory;
+import org.apache.lucene.util.BytesRef;
 import org.apache.lucene.util.LuceneTestCase;
 import org.apache.lucene.util._TestUtil;
 
@@ -81,6 +108,60 @@ public class TestNativeSearch extends LuceneTestCase {
     }
   }
 
+  private static final String[] WORDS = new String[] {"foo", "bar", "baz", "the"};
+
+  /** Returns a writer using Lucene42Codec, on a new
+   *  NativeMMapDirectory. */
+  private IndexWriter newNativeWriter() throws IOException {
+    File tmpDir = _TestUtil.getTempDir("nativesearch");
+    Directory dir = new NativeMMapDirectory(tmpDir);
+    IndexWriterConfig iwc = new IndexWriterConfig(TEST_VERSION_CURRENT, new MockAnalyzer(random()));
+    iwc.setCodec(Codec.forName("Lucene42"));
+    return new IndexWriter(dir, iwc);
+  }
+
+  /** Returns a doc with 1-20 random WORDS in "field", and
+   *  id=docUpto. */
+  private Document newWordsDoc(int docUpto) {
+    StringBuilder sb = new StringBuilder();
+    int numTokens = _TestUtil.nextInt(random(), 1, 20);
+    for(int i=0;i<numTokens;i++) {
+      sb.append(' ');
+      sb.append(WORDS[random().nextInt(WORDS.length)]);
+    }
+    Document doc = new Document();
+    doc.add(new TextField("field", sb.toString(), Field.Store.NO));
+    doc.add(new StringField("id", ""+docUpto, Field.Store.NO));
+    return doc;
+  }
+
+  /** Returns a writer on a new NativeMMapDirectory, whose
+   *  codec stores the default category list and any of the
+   *  extra fields with Facet42DocValuesFormat, so
+   *  NativeSearch can aggregate their facets. */
+  private IndexWriter newNativeFacetsWriter(String... facetFields) throws IOException {
+    File tmpDir = _TestUtil.getTempDir("nativesearch");
+    Directory dir = new NativeMMapDirectory(tmpDir);
+    IndexWriterConfig iwc = new IndexWriterConfig(TEST_VERSION_CURRENT, new MockAnalyzer(random()));
+    final Set<String> fields = new HashSet<String>(Arrays.asList(facetFields));
+    fields.add(CategoryListParams.DEFAULT_FIELD);
+    final Codec codec = new Lucene42Codec() {
+        private final DocValuesFormat facetsDVFormat = DocValuesFormat.forName("Facet42");
+        private final DocValuesFormat lucene42DVFormat = DocValuesFormat.forName("Lucene42");
+
+        @Override
+        public DocValuesFormat getDocValuesFormatForField(String field) {
+          if (fields.contains(field)) {
+            return facetsDVFormat;
+          } else {
+            return lucene42DVFormat;
+          }
+        }
+      };
+    iwc.setCodec(codec);
+    return new IndexWriter(dir, iwc);
+  }
+
   private void assertSameHits(IndexSearcher s, Query q) throws IOException {
 
     Query csq;
@@ -126,6 +207,19 @@ public class TestNativeSearch extends LuceneTestCase {
       FacetResult frExpected = expected.facetResults.get(i);
       FacetResult frActual = actual.facetResults.get(i);
       assertEquals(toSimpleString(frExpected), toSimpleString(frActual));
+      assertEquals(frExpected.getNumValidDescendants(), frActual.getNumValidDescendants());
+      assertSameValues(frExpected.getFacetResultNode(), frActual.getFacetResultNode());
+    }
+  }
+
+  /** toSimpleString truncates to int; sums must also match
+   *  exactly, since they're added in the same order. */
+  private static void assertSameValues(FacetResultNode expected, FacetResultNode actual) {
+    assertEquals(expected.label, actual.label);
+    assertEquals(expected.value, actual.value, 0.0);
+    assertEquals(expected.subResults.size(), actual.subResults.size());
+    for(int i=0;i<expected.subResults.size();i++) {
+      assertSameValues(expected.subResults.get(i), actual.subResults.get(i));
     }
   }
 
@@ -708,6 +802,29 @@ public class TestNativeSearch extends LuceneTestCase {
     IndexSearcher s = new IndexSearcher(r);
     assertSameHits(s, new PrefixQuery(new Term("field", "a")));
     assertSameHits(s, new WildcardQuery(new Term("field", "a*b")));
+    // Many-term rewrites walk deep into the terms dict:
+    assertSameHits(s, new PrefixQuery(new Term("field", "q")));
+    assertSameHits(s, new PrefixQuery(new Term("field", "zzzzzzzz")));
+    assertSameHits(s, new WildcardQuery(new Term("field", "*a")));
+    // Few enough matches to be merged as a sparse docID list:
+    assertSameHits(s, new PrefixQuery(new Term("field", "ab")));
+    assertSameHits(s, new WildcardQuery(new Term("field", "a?c*")));
+    assertSameHits(s, new RegexpQuery(new Term("field", "[a-c].*d")));
+    assertSameHits(s, new WildcardQuery(new Term("field", "*")));
+
+    NativeSearch.setMultiTermFilterThreads(4);
+    // Else this index is too small to use more than one
+    // thread:
+    int minPostingsPerThread = NativeSearch.multiTermFilterMinPostingsPerThread;
+    NativeSearch.multiTermFilterMinPostingsPerThread = _TestUtil.nextInt(random(), 1, 100);
+    try {
+      assertSameHits(s, new PrefixQuery(new Term("field", "a")));
+      assertSameHits(s, new WildcardQuery(new Term("field", "*a")));
+      assertSameHits(s, new WildcardQuery(new Term("field", "*")));
+    } finally {
+      NativeSearch.setMultiTermFilterThreads(1);
+      NativeSearch.multiTermFilterMinPostingsPerThread = minPostingsPerThread;
+    }
     r.close();
     dir.close();
   }
@@ -721,6 +838,11 @@ public class TestNativeSearch extends LuceneTestCase {
     Document doc = new Document();
     doc.add(new TextField("field", "lucene", Field.Store.NO));
     w.addDocument(doc);
+    for(String text : new String[] {"lucent lucene", "lucerne", "luce lucky", "bucene", "lucene lucene licene", "ulcene"}) {
+      doc = new Document();
+      doc.add(new TextField("field", text, Field.Store.NO));
+      w.addDocument(doc);
+    }
 
     IndexReader r = DirectoryReader.open(w, true);
     w.close();
@@ -728,6 +850,13 @@ public class TestNativeSearch extends LuceneTestCase {
     IndexSearcher s = new IndexSearcher(r);
     assertSameHits(s, new FuzzyQuery(new Term("field", "lucne"), 1));
     assertSameHits(s, new FuzzyQuery(new Term("field", "luce"), 2));
+    assertSameHits(s, new FuzzyQuery(new Term("field", "lucene"), 2, 2));
+    assertSameHits(s, new FuzzyQuery(new Term("field", "lucene"), 2, 0, 2, true));
+    assertSameHits(s, new FuzzyQuery(new Term("field", "lucene"), 1, 0, 50, false));
+    assertSameHits(s, new FuzzyQuery(new Term("field", "lu"), 2));
+    FuzzyQuery fq = new FuzzyQuery(new Term("field", "lucen"));
+    fq.setBoost(3.0f);
+    assertSameHits(s, fq);
     r.close();
     dir.close();
   }
@@ -741,6 +870,8 @@ public class TestNativeSearch extends LuceneTestCase {
     for(int i=0;i<1717;i++) {
       Document doc = new Document();
       doc.add(new IntField("field", i, Field.Store.NO));
+      doc.add(new LongField("long", (i-800) * 1000000007L, Field.Store.NO));
+      doc.add(new DoubleField("double", (i-800) * 0.25, Field.Store.NO));
       w.addDocument(doc);
     }
 
@@ -749,6 +880,13 @@ public class TestNativeSearch extends LuceneTestCase {
 
     IndexSearcher s = new IndexSearcher(r);
     assertSameHits(s, NumericRangeQuery.newIntRange("field", 17, 1700, true, true));
+    assertSameHits(s, NumericRangeQuery.newIntRange("field", 17, 1700, false, false));
+    assertSameHits(s, NumericRangeQuery.newIntRange("field", null, 100, true, true));
+    assertSameHits(s, NumericRangeQuery.newIntRange("field", 1000, null, false, true));
+    assertSameHits(s, NumericRangeQuery.newIntRange("field", 8, 1000, 1010, true, true));
+    assertSameHits(s, NumericRangeQuery.newIntRange("field", Integer.MAX_VALUE, null, false, true));
+    assertSameHits(s, NumericRangeQuery.newLongRange("long", -17000000000L, 500000000000L, true, false));
+    assertSameHits(s, NumericRangeQuery.newDoubleRange("double", -10.5, null, true, true));
     r.close();
     dir.close();
   }
@@ -976,154 +1114,1485 @@ public class TestNativeSearch extends LuceneTestCase {
     dir.close();
   }
 
-  private void add(FacetFields facetFields, Document doc, String ... categoryPaths) throws IOException {
-    List<CategoryPath> paths = new ArrayList<CategoryPath>();
-    for(String categoryPath : categoryPaths) {
-      paths.add(new CategoryPath(categoryPath, '/'));
+  public void testBooleanQueryWithPhraseClauses() throws Exception {
+    IndexWriter w = newNativeWriter();
+    Directory dir = w.getDirectory();
+    int numDocs = atLeast(2000);
+    for(int docUpto=0;docUpto<numDocs;docUpto++) {
+      Document doc = newWordsDoc(docUpto);
+      w.addDocument(doc);
     }
-    facetFields.addFields(doc, paths);
+    w.deleteDocuments(new Term("id", "17"));
+
+    IndexReader r = DirectoryReader.open(w, true);
+    w.close();
+
+    IndexSearcher s = new IndexSearcher(r);
+    BooleanClause.Occur[][] occurs = new BooleanClause.Occur[][] {
+      {BooleanClause.Occur.MUST, BooleanClause.Occur.MUST},
+      {BooleanClause.Occur.SHOULD, BooleanClause.Occur.SHOULD},
+      {BooleanClause.Occur.MUST, BooleanClause.Occur.SHOULD},
+      {BooleanClause.Occur.SHOULD, BooleanClause.Occur.MUST},
+      {BooleanClause.Occur.SHOULD, BooleanClause.Occur.MUST_NOT},
+      {BooleanClause.Occur.MUST, BooleanClause.Occur.MUST_NOT}};
+    for(BooleanClause.Occur[] occur : occurs) {
+      PhraseQuery pq = new PhraseQuery();
+      pq.add(new Term("field", "bar"));
+      pq.add(new Term("field", "baz"));
+      BooleanQuery bq = new BooleanQuery();
+      bq.add(new TermQuery(new Term("field", "foo")), occur[0]);
+      bq.add(pq, occur[1]);
+      assertSameHits(s, bq);
+
+      // Phrase-only BQ, and 3-term phrase:
+      PhraseQuery pq2 = new PhraseQuery();
+      pq2.add(new Term("field", "the"));
+      pq2.add(new Term("field", "foo"));
+      pq2.add(new Term("field", "the"));
+      bq = new BooleanQuery();
+      bq.add(pq2, occur[0]);
+      bq.add(pq, occur[1]);
+      assertSameHits(s, bq);
+    }
+    r.close();
+    dir.close();
   }
 
-  public void testDrillSideways() throws Exception {
+  public void testCommonGramsPhraseQuery() throws Exception {
     File tmpDir = _TestUtil.getTempDir("nativesearch");
     Directory dir = new NativeMMapDirectory(tmpDir);
     IndexWriterConfig iwc = new IndexWriterConfig(TEST_VERSION_CURRENT, new MockAnalyzer(random()));
-    final Codec codec = new Lucene42Codec() {
-        private final DocValuesFormat facetsDVFormat = DocValuesFormat.forName("Facet42");
-        private final DocValuesFormat lucene42DVFormat = DocValuesFormat.forName("Lucene42");
-
-        @Override
-        public DocValuesFormat getDocValuesFormatForField(String field) {
-          if (field.equals(CategoryListParams.DEFAULT_FIELD)) {
-            return facetsDVFormat;
-          } else {
-            return lucene42DVFormat;
-          }
-        }
-      };
-    iwc.setCodec(codec);
+    iwc.setCodec(Codec.forName("Lucene42"));
     IndexWriter w = new IndexWriter(dir, iwc);
+    String[] words = new String[] {"to", "be", "or", "not", "foo"};
+    int numDocs = atLeast(300);
+    for(int docUpto=0;docUpto<numDocs;docUpto++) {
+      StringBuilder sb = new StringBuilder();
+      int numTokens = _TestUtil.nextInt(random(), 1, 200);
+      for(int i=0;i<numTokens;i++) {
+        sb.append(' ');
+        sb.append(words[random().nextInt(words.length)]);
+      }
+      Document doc = new Document();
+      doc.add(new TextField("field", sb.toString(), Field.Store.NO));
+      doc.add(new StringField("id", ""+docUpto, Field.Store.NO));
+      w.addDocument(doc);
+    }
+    w.deleteDocuments(new Term("id", "7"));
 
-    Directory taxoDir = newDirectory();
-    DirectoryTaxonomyWriter taxoWriter = new DirectoryTaxonomyWriter(taxoDir, IndexWriterConfig.OpenMode.CREATE);
+    IndexReader r = DirectoryReader.open(w, true);
+    w.close();
 
-    FacetFields facetFields = new FacetFields(taxoWriter);
+    CommonGrams.build(r, "field", Arrays.asList("to", "be", "or", "not"));
 
-    Document doc = new Document();
-    doc.add(new TextField("field", "x", Field.Store.NO));
-    add(facetFields, doc, "vendor/Intel", "speed/Fast");
-    w.addDocument(doc);
-    doc = new Document();
-    doc.add(new TextField("field", "x y", Field.Store.NO));
-    add(facetFields, doc, "vendor/AMD", "speed/Slow");
-    w.addDocument(doc);
+    IndexSearcher s = new IndexSearcher(r);
+    String[][] phrases = new String[][] {
+      {"to", "be"},
+      {"to", "be", "or"},
+      {"to", "be", "or", "not", "to", "be"},
+      {"foo", "to", "be"},
+      {"be", "foo", "not"},
+      {"foo", "foo"}};
+    for(String[] phrase : phrases) {
+      PhraseQuery q = new PhraseQuery();
+      for(String word : phrase) {
+        q.add(new Term("field", word));
+      }
+      assertSameHits(s, q);
+    }
+    Set<String> oldSegNames = new HashSet<String>();
+    for(AtomicReaderContext ctx : r.leaves()) {
+      oldSegNames.add(((SegmentReader) ctx.reader()).getSegmentName());
+    }
+    r.close();
 
-    IndexReader r = DirectoryReader.open(w, true);
+    // Merge away the segments; rebuilding must delete their
+    // sidecars:
+    iwc = new IndexWriterConfig(TEST_VERSION_CURRENT, new MockAnalyzer(random()));
+    iwc.setCodec(Codec.forName("Lucene42"));
+    w = new IndexWriter(dir, iwc);
+    w.addDocument(new Document());
+    w.forceMerge(1);
     w.close();
+    r = DirectoryReader.open(dir);
+    CommonGrams.build(r, "field", Arrays.asList("to", "be", "or", "not"));
+    String segName = ((SegmentReader) r.leaves().get(0).reader()).getSegmentName();
+    assertFalse(oldSegNames.contains(segName));
+    for(String fileName : dir.listAll()) {
+      String cgSegName = CommonGrams.segmentName(fileName);
+      if (cgSegName != null) {
+        assertEquals(segName, cgSegName);
+      }
+    }
+    s = new IndexSearcher(r);
+    for(String[] phrase : phrases) {
+      PhraseQuery q = new PhraseQuery();
+      for(String word : phrase) {
+        q.add(new Term("field", word));
+      }
+      assertSameHits(s, q);
+    }
+    r.close();
+    dir.close();
+  }
 
-    TaxonomyReader taxoReader = new DirectoryTaxonomyReader(taxoWriter);
-    taxoWriter.close();
+  private void add(FacetFields facetFields, Document doc, String ... categoryPaths) throws IOException {
+    List<CategoryPath> paths = new ArrayList<CategoryPath>();
+    for(String categoryPath : categoryPaths) {
+      paths.add(new CategoryPath(categoryPath, '/'));
+    }
+    facetFields.addFields(doc, paths);
+  }
 
-    IndexSearcher s = new IndexSearcher(r);
+  public void testSpanQueries() throws Exception {
+    IndexWriter w = newNativeWriter();
+    Directory dir = w.getDirectory();
+    int numDocs = atLeast(2000);
+    for(int docUpto=0;docUpto<numDocs;docUpto++) {
+      Document doc = newWordsDoc(docUpto);
+      w.addDocument(doc);
+    }
+    w.deleteDocuments(new Term("id", "17"));
 
-    FacetSearchParams fsp = new FacetSearchParams(
-                                new CountFacetRequest(new CategoryPath("vendor"), 10),
-                                new CountFacetRequest(new CategoryPath("speed"), 10));
+    IndexReader r = DirectoryReader.open(w, true);
+    w.close();
 
-    DrillSideways ds = new DrillSideways(s, taxoReader);
-    BooleanQuery bq = new BooleanQuery();
-    bq.add(new TermQuery(new Term("field", "x")), BooleanClause.Occur.SHOULD);
-    bq.add(new TermQuery(new Term("field", "x")), BooleanClause.Occur.SHOULD);
+    IndexSearcher s = new IndexSearcher(r);
+    SpanQuery foo = new SpanTermQuery(new Term("field", "foo"));
+    SpanQuery bar = new SpanTermQuery(new Term("field", "bar"));
+    SpanQuery baz = new SpanTermQuery(new Term("field", "baz"));
+    SpanQuery missing = new SpanTermQuery(new Term("field", "missing"));
+    assertSameHits(s, foo);
+    assertSameHits(s, new SpanOrQuery(bar, baz, missing));
+    for(int slop=0;slop<4;slop++) {
+      assertSameHits(s, new SpanNearQuery(new SpanQuery[] {foo, bar}, slop, true));
+      assertSameHits(s, new SpanNearQuery(new SpanQuery[] {foo, bar, baz}, slop, true));
+      assertSameHits(s, new SpanNearQuery(new SpanQuery[] {foo, bar}, slop, false));
+      assertSameHits(s, new SpanNearQuery(new SpanQuery[] {foo, bar, foo}, slop, false));
+
+      // Nested:
+      SpanQuery near = new SpanNearQuery(new SpanQuery[] {bar, baz}, slop, false);
+      assertSameHits(s, new SpanNearQuery(new SpanQuery[] {foo, new SpanOrQuery(near, baz)}, slop, true));
+      assertSameHits(s, new SpanNearQuery(new SpanQuery[] {near, foo}, slop, false));
+    }
+    r.close();
+    dir.close();
+  }
 
-    DrillDownQuery ddq;
-    DrillSidewaysResult dsResult;
+  public void testSpanOrInterleaved() throws Exception {
+    IndexWriter w = newNativeWriter();
+    Directory dir = w.getDirectory();
+    // Docs with only baz come before and after docs with
+    // both bar and baz, so the chunk visits baz's docs out
+    // of docID order unless they are sorted:
+    String[] docs = new String[] {
+      "baz x baz foo",
+      "bar baz baz",
+      "foo baz",
+      "bar",
+      "x baz bar baz foo",
+      "baz baz baz",
+      "baz foo bar"};
+    for(String text : docs) {
+      Document doc = new Document();
+      doc.add(new TextField("field", text, Field.Store.NO));
+      w.addDocument(doc);
+    }
 
-    ddq = new DrillDownQuery(fsp.indexingParams, bq);
-    ddq.add(new CategoryPath("vendor", "Intel"));
-    dsResult = NativeSearch.drillSidewaysSearchNative(ds, ddq, 10, fsp);
-    assertEquals(1, dsResult.hits.totalHits);
-    assertEquals(0, dsResult.hits.scoreDocs[0].doc);
-    assertEquals(2, dsResult.facetResults.size());
-    assertEquals("vendor (0)\n  AMD (1)\n  Intel (1)\n", toSimpleString(dsResult.facetResults.get(0)));
-    assertEquals("speed (0)\n  Fast (1)\n", toSimpleString(dsResult.facetResults.get(1)));
+    IndexReader r = DirectoryReader.open(w, true);
+    w.close();
 
-    assertSameHits(ds, ddq, fsp);
+    IndexSearcher s = new IndexSearcher(r);
+    SpanQuery foo = new SpanTermQuery(new Term("field", "foo"));
+    SpanQuery bar = new SpanTermQuery(new Term("field", "bar"));
+    SpanQuery baz = new SpanTermQuery(new Term("field", "baz"));
+    SpanQuery or = new SpanOrQuery(bar, baz);
+    assertSameHits(s, or);
+    for(int slop=0;slop<3;slop++) {
+      assertSameHits(s, new SpanNearQuery(new SpanQuery[] {or, foo}, slop, true));
+      assertSameHits(s, new SpanNearQuery(new SpanQuery[] {baz, or}, slop, false));
+    }
+    r.close();
+    dir.close();
+  }
 
-    // Multi-select:
-    //System.out.println("now test multiselect");
-    ddq = new DrillDownQuery(fsp.indexingParams, bq);
-    ddq.add(new CategoryPath("vendor", "Intel"), new CategoryPath("vendor", "AMD"));
-    //System.out.println("ddq: " + ddq);
-    assertSameHits(ds, ddq, fsp);
+  public void testTermStateCache() throws Exception {
+    File tmpDir = _TestUtil.getTempDir("nativesearch");
+    Directory dir = new NativeMMapDirectory(tmpDir);
+    IndexWriterConfig iwc = new IndexWriterConfig(TEST_VERSION_CURRENT, new MockAnalyzer(random()));
+    iwc.setCodec(Codec.forName("Lucene42"));
+    IndexWriter w = new IndexWriter(dir, iwc);
+    int numWords = 200;
+    int numDocs = atLeast(1000);
+    for(int docUpto=0;docUpto<numDocs;docUpto++) {
+      StringBuilder sb = new StringBuilder();
+      int numTokens = _TestUtil.nextInt(random(), 1, 20);
+      for(int i=0;i<numTokens;i++) {
+        sb.append(" w");
+        sb.append(random().nextInt(numWords));
+      }
+      Document doc = new Document();
+      doc.add(new TextField("field", sb.toString(), Field.Store.NO));
+      w.addDocument(doc);
+    }
 
-    dsResult = NativeSearch.drillSidewaysSearchNative(ds, ddq, 10, fsp);
-    assertEquals(2, dsResult.hits.totalHits);
-    assertEquals(0, dsResult.hits.scoreDocs[0].doc);
-    assertEquals(2, dsResult.facetResults.size());
-    assertEquals("vendor (0)\n  AMD (1)\n  Intel (1)\n", toSimpleString(dsResult.facetResults.get(0)));
-    assertEquals("speed (0)\n  Slow (1)\n  Fast (1)\n", toSimpleString(dsResult.facetResults.get(1)));
+    // Tiny cache, so terms are constantly evicted:
+    NativeSearch.setTermStateCacheSize(8);
+    IndexReader r = DirectoryReader.open(w, true);
+    w.close();
+    try {
+      IndexSearcher s = new IndexSearcher(r);
+      for(int iter=0;iter<100;iter++) {
+        List<SpanQuery> clauses = new ArrayList<SpanQuery>();
+        int numClauses = _TestUtil.nextInt(random(), 1, 10);
+        for(int i=0;i<numClauses;i++) {
+          // Sometimes a missing term:
+          clauses.add(new SpanTermQuery(new Term("field", "w" + random().nextInt(numWords+20))));
+        }
+        SpanQuery q = new SpanOrQuery(clauses.toArray(new SpanQuery[clauses.size()]));
+        assertSameHits(s, q);
+        // Again, now likely from the cache:
+        assertSameHits(s, q);
+      }
+    } finally {
+      NativeSearch.setTermStateCacheSize(8192);
+    }
+    r.close();
+    dir.close();
+  }
 
-    // Two drill-downs:
-    //System.out.println("\nTEST: now test double drilldown");
-    ddq = new DrillDownQuery(fsp.indexingParams, bq);
-    ddq.add(new CategoryPath("vendor", "Intel"));
-    ddq.add(new CategoryPath("speed", "Fast"));
-    //System.out.println("ddq: " + ddq);
-    assertSameHits(ds, ddq, fsp);
+  public void testHeavyDeletes() throws Exception {
+    IndexWriter w = newNativeWriter();
+    Directory dir = w.getDirectory();
+    int numDocs = atLeast(3000);
+    for(int docUpto=0;docUpto<numDocs;docUpto++) {
+      Document doc = newWordsDoc(docUpto);
+      w.addDocument(doc);
+    }
+    for(int docUpto=0;docUpto<numDocs;docUpto++) {
+      // Delete most docs, and all docs in one whole chunk:
+      if (random().nextInt(4) != 0 || (docUpto >= 1024 && docUpto < 2048)) {
+        w.deleteDocuments(new Term("id", ""+docUpto));
+      }
+    }
 
-    dsResult = NativeSearch.drillSidewaysSearchNative(ds, ddq, 10, fsp);
-    assertEquals(1, dsResult.hits.totalHits);
-    assertEquals(0, dsResult.hits.scoreDocs[0].doc);
-    assertEquals(2, dsResult.facetResults.size());
-    assertEquals("vendor (0)\n  Intel (1)\n", toSimpleString(dsResult.facetResults.get(0)));
-    assertEquals("speed (0)\n  Fast (1)\n", toSimpleString(dsResult.facetResults.get(1)));
+    IndexReader r = DirectoryReader.open(w, true);
+    w.close();
+    IndexSearcher s = new IndexSearcher(r);
 
-    // SHOULD + MUST_NOT
-    //System.out.println("TEST: should + must_not");
-    bq = new BooleanQuery();
-    bq.add(new TermQuery(new Term("field", "x")), BooleanClause.Occur.SHOULD);
-    bq.add(new TermQuery(new Term("field", "y")), BooleanClause.Occur.MUST_NOT);
-    ddq = new DrillDownQuery(fsp.indexingParams, bq);
-    ddq.add(new CategoryPath("vendor", "Intel"));
-    //System.out.println("ddq: " + ddq);
-    assertSameHits(ds, ddq, fsp);
+    BooleanQuery bq = new BooleanQuery();
+    for(String word : WORDS) {
+      bq.add(new TermQuery(new Term("field", word)), BooleanClause.Occur.SHOULD);
+    }
+    assertSameHits(s, bq);
 
-    dsResult = NativeSearch.drillSidewaysSearchNative(ds, ddq, 10, fsp);
-    assertEquals(1, dsResult.hits.totalHits);
-    assertEquals(0, dsResult.hits.scoreDocs[0].doc);
-    assertEquals(2, dsResult.facetResults.size());
-    assertEquals("vendor (0)\n  Intel (1)\n", toSimpleString(dsResult.facetResults.get(0)));
-    assertEquals("speed (0)\n  Fast (1)\n", toSimpleString(dsResult.facetResults.get(1)));
+    bq = new BooleanQuery();
+    bq.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.MUST);
+    bq.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.MUST);
+    bq.add(new TermQuery(new Term("field", "baz")), BooleanClause.Occur.SHOULD);
+    assertSameHits(s, bq);
 
-    // SHOULD + MUST
-    //System.out.println("TEST: should + must_not");
     bq = new BooleanQuery();
-    bq.add(new TermQuery(new Term("field", "x")), BooleanClause.Occur.SHOULD);
-    bq.add(new TermQuery(new Term("field", "y")), BooleanClause.Occur.MUST);
-    ddq = new DrillDownQuery(fsp.indexingParams, bq);
-    ddq.add(new CategoryPath("vendor", "AMD"));
-    assertSameHits(ds, ddq, fsp);
+    bq.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.SHOULD);
+    bq.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.SHOULD);
+    bq.add(new TermQuery(new Term("field", "baz")), BooleanClause.Occur.MUST_NOT);
+    assertSameHits(s, bq);
 
-    // SHOULD + MUST + MUST_NOT
-    //System.out.println("TEST: should + must_not");
     bq = new BooleanQuery();
-    bq.add(new TermQuery(new Term("field", "x")), BooleanClause.Occur.SHOULD);
-    bq.add(new TermQuery(new Term("field", "x")), BooleanClause.Occur.MUST);
-    bq.add(new TermQuery(new Term("field", "y")), BooleanClause.Occur.MUST_NOT);
-    ddq = new DrillDownQuery(fsp.indexingParams, bq);
-    ddq.add(new CategoryPath("vendor", "AMD"));
-    assertSameHits(ds, ddq, fsp);
+    bq.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.MUST);
+    bq.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.SHOULD);
+    bq.add(new TermQuery(new Term("field", "baz")), BooleanClause.Occur.MUST_NOT);
+    assertSameHits(s, bq);
 
-    // TermQuery
-    Query tq = new TermQuery(new Term("field", "x"));
-    ddq = new DrillDownQuery(fsp.indexingParams, tq);
-    ddq.add(new CategoryPath("vendor", "AMD"));
-    assertSameHits(ds, ddq, fsp);
+    PhraseQuery pq = new PhraseQuery();
+    pq.add(new Term("field", "foo"));
+    pq.add(new Term("field", "bar"));
+    assertSameHits(s, pq);
 
-    taxoReader.close();
     r.close();
     dir.close();
-    taxoDir.close();
+  }
+
+  private void assertSameHits(IndexSearcher s, Query q, Filter filter) throws IOException {
+    assertSameHits(s.search(q, filter, 10), NativeSearch.searchNative(s, q, filter, 10));
+    int maxDoc = s.getIndexReader().maxDoc();
+    assertSameHits(s.search(q, filter, maxDoc), NativeSearch.searchNative(s, q, filter, maxDoc));
+  }
+
+  public void testFilter() throws Exception {
+    IndexWriter w = newNativeWriter();
+    Directory dir = w.getDirectory();
+    int numDocs = atLeast(5000);
+    for(int docUpto=0;docUpto<numDocs;docUpto++) {
+      Document doc = newWordsDoc(docUpto);
+      // Clustered, so most chunks have no accepted docs:
+      if ((docUpto >= 2100 && docUpto < 2400) || docUpto % 997 == 0) {
+        doc.add(new StringField("tenant", "a", Field.Store.NO));
+      }
+      if (docUpto % 3 != 0) {
+        doc.add(new StringField("tenant", "b", Field.Store.NO));
+      }
+      w.addDocument(doc);
+    }
+    w.deleteDocuments(new Term("id", "2200"));
+
+    IndexReader r = DirectoryReader.open(w, true);
+    w.close();
+
+    IndexSearcher s = new IndexSearcher(r);
+    Filter filter = new QueryWrapperFilter(new TermQuery(new Term("tenant", "a")));
+    Filter cachingFilter = new CachingWrapperFilter(filter);
+    Filter emptyFilter = new QueryWrapperFilter(new TermQuery(new Term("tenant", "missing")));
+    Filter denseFilter = new QueryWrapperFilter(new TermQuery(new Term("tenant", "b")));
+
+    BooleanQuery should = new BooleanQuery();
+    should.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.SHOULD);
+    should.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.SHOULD);
+
+    BooleanQuery must = new BooleanQuery();
+    must.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.MUST);
+    must.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.MUST);
+    must.add(new TermQuery(new Term("field", "baz")), BooleanClause.Occur.SHOULD);
+
+    BooleanQuery mustNot = new BooleanQuery();
+    mustNot.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.SHOULD);
+    mustNot.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.MUST_NOT);
+
+    BooleanQuery mustMustNot = new BooleanQuery();
+    mustMustNot.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.MUST);
+    mustMustNot.add(new TermQuery(new Term("field", "baz")), BooleanClause.Occur.SHOULD);
+    mustMustNot.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.MUST_NOT);
+
+    PhraseQuery pq = new PhraseQuery();
+    pq.add(new Term("field", "foo"));
+    pq.add(new Term("field", "bar"));
+
+    long ramBytesUsed = NativeSearch.getFilterCacheRamBytesUsed();
+
+    try {
+      // First without, then with, the native filter cache:
+      for(long maxBytes : new long[] {0, 64*1024*1024}) {
+        NativeSearch.setFilterCacheMaxBytes(maxBytes);
+        for(Filter f : new Filter[] {filter, cachingFilter, emptyFilter, denseFilter}) {
+          assertSameHits(s, new TermQuery(new Term("field", "foo")), f);
+          assertSameHits(s, should, f);
+          assertSameHits(s, must, f);
+          assertSameHits(s, mustNot, f);
+          assertSameHits(s, mustMustNot, f);
+          assertSameHits(s, new ConstantScoreQuery(should), f);
+          assertSameHits(s, pq, f);
+          assertSameHits(s, new SpanNearQuery(new SpanQuery[] {new SpanTermQuery(new Term("field", "foo")),
+                                                               new SpanTermQuery(new Term("field", "bar"))}, 1, true), f);
+          assertSameHits(s, new PrefixQuery(new Term("field", "ba")), f);
+          assertSameHits(s, new FuzzyQuery(new Term("field", "baa")), f);
+        }
+      }
+      assertTrue(NativeSearch.getFilterCacheRamBytesUsed() > ramBytesUsed);
+
+      // Evicts everything, but hits don't change:
+      NativeSearch.setFilterCacheMaxBytes(1);
+      assertEquals(ramBytesUsed, NativeSearch.getFilterCacheRamBytesUsed());
+      assertSameHits(s, should, filter);
+      NativeSearch.setFilterCacheMaxBytes(64*1024*1024);
+      assertSameHits(s, should, filter);
+      assertTrue(NativeSearch.getFilterCacheRamBytesUsed() > ramBytesUsed);
+    } finally {
+      NativeSearch.setFilterCacheMaxBytes(64*1024*1024);
+    }
+
+    // Closing the reader frees its cached bitmaps:
+    r.close();
+    assertEquals(ramBytesUsed, NativeSearch.getFilterCacheRamBytesUsed());
+    dir.close();
+  }
+
+  private void assertSameHits(IndexSearcher s, Query q, Filter filter, Sort sort) throws IOException {
+    int maxDoc = s.getIndexReader().maxDoc();
+    for(int topN : new int[] {10, maxDoc}) {
+      TopFieldDocs expected = s.search(q, filter, topN, sort);
+      TopFieldDocs actual = NativeSearch.searchNative(s, q, filter, topN, sort);
+      assertEquals(expected.totalHits, actual.totalHits);
+      assertEquals(expected.scoreDocs.length, actual.scoreDocs.length);
+      assertSameFieldDocs(expected, actual);
+    }
+  }
+
+  private void assertSameFieldDocs(TopDocs expected, TopDocs actual) {
+    assertEquals(expected.scoreDocs.length, actual.scoreDocs.length);
+    for(int i=0;i<expected.scoreDocs.length;i++) {
+      assertEquals("hit " + i, expected.scoreDocs[i].doc, actual.scoreDocs[i].doc);
+      Object[] expectedFields = ((FieldDoc) expected.scoreDocs[i]).fields;
+      Object[] actualFields = ((FieldDoc) actual.scoreDocs[i]).fields;
+      assertEquals(expectedFields.length, actualFields.length);
+      for(int j=0;j<expectedFields.length;j++) {
+        if (expectedFields[j] instanceof Float) {
+          // Scores may differ in the last bits, same as assertSameHits(TopDocs,TopDocs):
+          assertEquals("hit " + i, ((Float) expectedFields[j]).floatValue(), ((Float) actualFields[j]).floatValue(), 0.00001f);
+        } else {
+          assertEquals("hit " + i, expectedFields[j], actualFields[j]);
+        }
+      }
+    }
+  }
+
+  public void testSortByDocValues() throws Exception {
+    IndexWriter w = newNativeWriter();
+    Directory dir = w.getDirectory();
+    int numDocs = atLeast(5000);
+    for(int docUpto=0;docUpto<numDocs;docUpto++) {
+      Document doc = newWordsDoc(docUpto);
+      if (docUpto % 3 != 0) {
+        doc.add(new StringField("tenant", "b", Field.Store.NO));
+      }
+      // Many unique values, so it's delta compressed:
+      doc.add(new NumericDocValuesField("price", random().nextLong() >> random().nextInt(64)));
+      // Few unique values, so it's table compressed:
+      doc.add(new NumericDocValuesField("rating", 1000000007L * random().nextInt(20)));
+      // Fits in a byte, so it's uncompressed; some docs
+      // have no value:
+      if (docUpto % 7 != 0) {
+        doc.add(new NumericDocValuesField("small", random().nextInt(256) - 128));
+      }
+      w.addDocument(doc);
+      if (docUpto == numDocs/2) {
+        w.commit();
+      }
+    }
+    w.deleteDocuments(new Term("id", "17"));
+
+    IndexReader r = DirectoryReader.open(w, true);
+    w.close();
+    IndexSearcher s = new IndexSearcher(r);
+
+    BooleanQuery should = new BooleanQuery();
+    should.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.SHOULD);
+    should.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.SHOULD);
+
+    BooleanQuery must = new BooleanQuery();
+    must.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.MUST);
+    must.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.MUST);
+    must.add(new TermQuery(new Term("field", "baz")), BooleanClause.Occur.SHOULD);
+
+    BooleanQuery mustNot = new BooleanQuery();
+    mustNot.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.SHOULD);
+    mustNot.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.MUST_NOT);
+
+    BooleanQuery mustMustNot = new BooleanQuery();
+    mustMustNot.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.MUST);
+    mustMustNot.add(new TermQuery(new Term("field", "baz")), BooleanClause.Occur.SHOULD);
+    mustMustNot.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.MUST_NOT);
+
+    Filter filter = new QueryWrapperFilter(new TermQuery(new Term("tenant", "b")));
+
+    for(Sort sort : new Sort[] {new Sort(new SortField("price", SortField.Type.LONG)),
+                                new Sort(new SortField("price", SortField.Type.LONG, true)),
+                                new Sort(new SortField("rating", SortField.Type.LONG, true)),
+                                new Sort(new SortField("small", SortField.Type.INT)),
+                                new Sort(new SortField("price", SortField.Type.INT))}) {
+      for(Filter f : new Filter[] {null, filter}) {
+        assertSameHits(s, new TermQuery(new Term("field", "foo")), f, sort);
+        assertSameHits(s, should, f, sort);
+        assertSameHits(s, must, f, sort);
+        assertSameHits(s, mustNot, f, sort);
+        assertSameHits(s, mustMustNot, f, sort);
+      }
+    }
+
+    try {
+      NativeSearch.searchNative(s, should, null, 10, new Sort(new SortField("price", SortField.Type.DOUBLE)));
+      fail("should have hit IllegalArgumentException");
+    } catch (IllegalArgumentException iae) {
+      // expected
+    }
+
+    r.close();
+    dir.close();
+  }
+
+  public void testMultiKeySortAndSearchAfter() throws Exception {
+    IndexWriter w = newNativeWriter();
+    Directory dir = w.getDirectory();
+    int numDocs = atLeast(5000);
+    for(int docUpto=0;docUpto<numDocs;docUpto++) {
+      Document doc = newWordsDoc(docUpto);
+      // Few boost tiers, so there are many ties:
+      doc.add(new NumericDocValuesField("tier", random().nextInt(4)));
+      doc.add(new NumericDocValuesField("price", random().nextInt(100)));
+      w.addDocument(doc);
+      if (docUpto == numDocs/2) {
+        w.commit();
+      }
+    }
+    w.deleteDocuments(new Term("id", "17"));
+
+    IndexReader r = DirectoryReader.open(w, true);
+    w.close();
+    IndexSearcher s = new IndexSearcher(r);
+
+    BooleanQuery should = new BooleanQuery();
+    should.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.SHOULD);
+    should.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.SHOULD);
+
+    BooleanQuery must = new BooleanQuery();
+    must.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.MUST);
+    must.add(new TermQuery(new Term("field", "baz")), BooleanClause.Occur.SHOULD);
+
+    BooleanQuery mustNot = new BooleanQuery();
+    mustNot.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.SHOULD);
+    mustNot.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.MUST_NOT);
+
+    BooleanQuery mustMustNot = new BooleanQuery();
+    mustMustNot.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.MUST);
+    mustMustNot.add(new TermQuery(new Term("field", "baz")), BooleanClause.Occur.SHOULD);
+    mustMustNot.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.MUST_NOT);
+
+    Filter filter = new QueryWrapperFilter(new TermQuery(new Term("field", "the")));
+
+    Query[] queries = new Query[] {new TermQuery(new Term("field", "foo")), should, must, mustNot, mustMustNot};
+
+    for(Sort sort : new Sort[] {new Sort(new SortField("tier", SortField.Type.INT, true), SortField.FIELD_SCORE),
+                                new Sort(new SortField("tier", SortField.Type.LONG), new SortField(null, SortField.Type.SCORE, true), SortField.FIELD_DOC),
+                                new Sort(new SortField("tier", SortField.Type.INT), new SortField("price", SortField.Type.LONG, true), new SortField(null, SortField.Type.DOC, true)),
+                                new Sort(SortField.FIELD_SCORE, new SortField("price", SortField.Type.INT))}) {
+      for(Filter f : new Filter[] {null, filter}) {
+        for(Query q : queries) {
+          assertSameHits(s, q, f, sort);
+
+          // Page through the first few pages:
+          FieldDoc expectedAfter = null;
+          FieldDoc actualAfter = null;
+          for(int page=0;page<5;page++) {
+            TopDocs expected = s.searchAfter(expectedAfter, q, f, 10, sort);
+            TopFieldDocs actual = NativeSearch.searchAfterNative(s, actualAfter, q, f, 10, sort);
+            assertEquals(expected.totalHits, actual.totalHits);
+            assertSameFieldDocs(expected, actual);
+            if (expected.scoreDocs.length == 0) {
+              break;
+            }
+            expectedAfter = (FieldDoc) expected.scoreDocs[expected.scoreDocs.length-1];
+            actualAfter = (FieldDoc) actual.scoreDocs[actual.scoreDocs.length-1];
+          }
+        }
+      }
+    }
+
+    try {
+      NativeSearch.searchNative(s, should, null, 10,
+                                new Sort(new SortField("tier", SortField.Type.INT), new SortField("price", SortField.Type.INT),
+                                         SortField.FIELD_SCORE, SortField.FIELD_DOC));
+      fail("should have hit IllegalArgumentException");
+    } catch (IllegalArgumentException iae) {
+      // expected
+    }
+
+    r.close();
+    dir.close();
+  }
+
+  public void testEarlyTerminateSortedSegments() throws Exception {
+    IndexWriter w = newNativeWriter();
+    Directory dir = w.getDirectory();
+    int numDocs = atLeast(5000);
+    // Docs are added in popularity order, with ties, so each
+    // segment is sorted by it:
+    long popularity = 0;
+    for(int docUpto=0;docUpto<numDocs;docUpto++) {
+      Document doc = newWordsDoc(docUpto);
+      popularity += random().nextInt(3);
+      doc.add(new NumericDocValuesField("popularity", popularity));
+      w.addDocument(doc);
+      if (docUpto == numDocs/2) {
+        w.commit();
+      }
+    }
+    w.deleteDocuments(new Term("id", "17"));
+
+    IndexReader r = DirectoryReader.open(w, true);
+    w.close();
+    IndexSearcher s = new IndexSearcher(r);
+
+    BooleanQuery should = new BooleanQuery();
+    should.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.SHOULD);
+    should.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.SHOULD);
+
+    BooleanQuery must = new BooleanQuery();
+    must.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.MUST);
+    must.add(new TermQuery(new Term("field", "baz")), BooleanClause.Occur.SHOULD);
+
+    BooleanQuery mustNot = new BooleanQuery();
+    mustNot.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.SHOULD);
+    mustNot.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.MUST_NOT);
+
+    BooleanQuery mustMustNot = new BooleanQuery();
+    mustMustNot.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.MUST);
+    mustMustNot.add(new TermQuery(new Term("field", "baz")), BooleanClause.Occur.SHOULD);
+    mustMustNot.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.MUST_NOT);
+
+    Filter filter = new QueryWrapperFilter(new TermQuery(new Term("field", "the")));
+    Sort sort = new Sort(new SortField("popularity", SortField.Type.LONG));
+
+    for(Filter f : new Filter[] {null, filter}) {
+      for(Query q : new Query[] {new TermQuery(new Term("field", "foo")), should, must, mustNot, mustMustNot}) {
+        FieldDoc expectedAfter = null;
+        FieldDoc actualAfter = null;
+        for(int page=0;page<3;page++) {
+          TopDocs expected = s.searchAfter(expectedAfter, q, f, 10, sort);
+          TopFieldDocs actual = NativeSearch.searchAfterNative(s, actualAfter, q, f, 10, sort, true);
+          // Only a lower bound, since most docs are never visited:
+          assertTrue(actual.totalHits <= expected.totalHits);
+          assertTrue(actual.totalHits >= actual.scoreDocs.length);
+          assertSameFieldDocs(expected, actual);
+          if (expected.scoreDocs.length == 0) {
+            break;
+          }
+          expectedAfter = (FieldDoc) expected.scoreDocs[expected.scoreDocs.length-1];
+          actualAfter = (FieldDoc) actual.scoreDocs[actual.scoreDocs.length-1];
+        }
+      }
+    }
+
+    r.close();
+    dir.close();
+  }
+
+  public void testEarlyTerminateSeveralShould() throws Exception {
+    IndexWriter w = newNativeWriter();
+    Directory dir = w.getDirectory();
+    // Sorted by docID; the first docs only match the second
+    // SHOULD clause, so with slots in clause order the first
+    // clause's docs fill the queue and collection stops
+    // before reaching them:
+    int numDocs = atLeast(200);
+    for(int docUpto=0;docUpto<numDocs;docUpto++) {
+      Document doc = new Document();
+      String text;
+      if (docUpto < 20) {
+        text = "bar";
+      } else if (docUpto % 2 == 0) {
+        text = "foo";
+      } else {
+        text = "foo bar baz";
+      }
+      doc.add(new TextField("field", text, Field.Store.NO));
+      doc.add(new NumericDocValuesField("popularity", docUpto));
+      w.addDocument(doc);
+    }
+
+    IndexReader r = DirectoryReader.open(w, true);
+    w.close();
+    IndexSearcher s = new IndexSearcher(r);
+
+    BooleanQuery should = new BooleanQuery();
+    should.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.SHOULD);
+    should.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.SHOULD);
+
+    BooleanQuery mustNot = new BooleanQuery();
+    mustNot.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.SHOULD);
+    mustNot.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.SHOULD);
+    mustNot.add(new TermQuery(new Term("field", "baz")), BooleanClause.Occur.MUST_NOT);
+
+    Sort sort = new Sort(new SortField("popularity", SortField.Type.LONG));
+    for(Query q : new Query[] {should, mustNot}) {
+      TopDocs expected = s.search(q, null, 10, sort);
+      TopFieldDocs actual = NativeSearch.searchAfterNative(s, null, q, null, 10, sort, true);
+      assertSameFieldDocs(expected, actual);
+      assertEquals(0, actual.scoreDocs[0].doc);
+    }
+
+    r.close();
+    dir.close();
+  }
+
+  public void testGroupByDocValues() throws Exception {
+    IndexWriter w = newNativeWriter();
+    Directory dir = w.getDirectory();
+    int numDocs = atLeast(3000);
+    for(int docUpto=0;docUpto<numDocs;docUpto++) {
+      Document doc = newWordsDoc(docUpto);
+      // Few groups, so most hits collapse:
+      doc.add(new SortedDocValuesField("host", new BytesRef("host" + random().nextInt(50))));
+      w.addDocument(doc);
+      if (docUpto == numDocs/2) {
+        w.commit();
+      }
+    }
+    w.deleteDocuments(new Term("id", "17"));
+
+    IndexReader r = DirectoryReader.open(w, true);
+    w.close();
+    IndexSearcher s = new IndexSearcher(r);
+
+    BooleanQuery should = new BooleanQuery();
+    should.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.SHOULD);
+    should.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.SHOULD);
+
+    BooleanQuery must = new BooleanQuery();
+    must.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.MUST);
+    must.add(new TermQuery(new Term("field", "baz")), BooleanClause.Occur.SHOULD);
+
+    BooleanQuery mustNot = new BooleanQuery();
+    mustNot.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.SHOULD);
+    mustNot.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.MUST_NOT);
+
+    BooleanQuery mustMustNot = new BooleanQuery();
+    mustMustNot.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.MUST);
+    mustMustNot.add(new TermQuery(new Term("field", "baz")), BooleanClause.Occur.SHOULD);
+    mustMustNot.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.MUST_NOT);
+
+    Filter filter = new QueryWrapperFilter(new TermQuery(new Term("field", "the")));
+    GroupingSearch groupingSearch = new GroupingSearch("host");
+    groupingSearch.setGroupDocsLimit(1);
+
+    for(Filter f : new Filter[] {null, filter}) {
+      for(Query q : new Query[] {new TermQuery(new Term("field", "foo")), should, must, mustNot, mustMustNot}) {
+        TopGroups<BytesRef> expected = groupingSearch.search(s, f, q, 0, 10);
+        TopGroups<BytesRef> actual = NativeSearch.groupSearchNative(s, q, f, "host", 10);
+        assertSameGroups(expected, actual);
+      }
+    }
+
+    r.close();
+    dir.close();
+  }
+
+  public void testGroupTiesSeveralShould() throws Exception {
+    IndexWriter w = newNativeWriter();
+    Directory dir = w.getDirectory();
+    // Every hit has the same score; the docs matching only
+    // the second SHOULD clause come first, so each group's
+    // best doc is one of them:
+    for(int docUpto=0;docUpto<40;docUpto++) {
+      Document doc = new Document();
+      doc.add(new TextField("field", docUpto < 20 ? "bar" : "foo", Field.Store.NO));
+      doc.add(new SortedDocValuesField("host", new BytesRef("host" + (docUpto % 2))));
+      w.addDocument(doc);
+    }
+
+    IndexReader r = DirectoryReader.open(w, true);
+    w.close();
+    IndexSearcher s = new IndexSearcher(r);
+
+    BooleanQuery should = new BooleanQuery();
+    should.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.SHOULD);
+    should.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.SHOULD);
+
+    GroupingSearch groupingSearch = new GroupingSearch("host");
+    groupingSearch.setGroupDocsLimit(1);
+    TopGroups<BytesRef> expected = groupingSearch.search(s, null, should, 0, 10);
+    TopGroups<BytesRef> actual = NativeSearch.groupSearchNative(s, should, null, "host", 10);
+    assertSameGroups(expected, actual);
+    assertEquals(0, actual.groups[0].scoreDocs[0].doc);
+    assertEquals(1, actual.groups[1].scoreDocs[0].doc);
+
+    r.close();
+    dir.close();
+  }
+
+  private void assertSameGroups(TopGroups<BytesRef> expected, TopGroups<BytesRef> actual) {
+    assertEquals(expected.totalHitCount, actual.totalHitCount);
+    assertEquals(expected.totalGroupedHitCount, actual.totalGroupedHitCount);
+    assertEquals(expected.groups.length, actual.groups.length);
+    for(int i=0;i<expected.groups.length;i++) {
+      GroupDocs<BytesRef> expectedGroup = expected.groups[i];
+      GroupDocs<BytesRef> actualGroup = actual.groups[i];
+      assertEquals(expectedGroup.groupValue, actualGroup.groupValue);
+      assertEquals(expectedGroup.totalHits, actualGroup.totalHits);
+      assertEquals(1, actualGroup.scoreDocs.length);
+      assertEquals(expectedGroup.scoreDocs[0].doc, actualGroup.scoreDocs[0].doc);
+      assertEquals(expectedGroup.scoreDocs[0].score, actualGroup.scoreDocs[0].score, 0.00001f);
+    }
+  }
+
+  public void testTermStateCacheAcrossMerges() throws Exception {
+    IndexWriter w = newNativeWriter();
+    Directory dir = w.getDirectory();
+
+    List<Query> queries = new ArrayList<Query>();
+    for(String word : WORDS) {
+      queries.add(new TermQuery(new Term("field", word)));
+    }
+    // Rare terms, often pulsed into the terms dict:
+    queries.add(new TermQuery(new Term("field", "u7")));
+    queries.add(new TermQuery(new Term("field", "missing")));
+
+    BooleanQuery bq = new BooleanQuery();
+    bq.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.SHOULD);
+    bq.add(new TermQuery(new Term("field", "u3")), BooleanClause.Occur.SHOULD);
+    queries.add(bq);
+
+    bq = new BooleanQuery();
+    bq.add(new TermQuery(new Term("field", "foo")), BooleanClause.Occur.MUST);
+    bq.add(new TermQuery(new Term("field", "bar")), BooleanClause.Occur.SHOULD);
+    bq.add(new TermQuery(new Term("field", "the")), BooleanClause.Occur.MUST_NOT);
+    queries.add(bq);
+
+    PhraseQuery pq = new PhraseQuery();
+    pq.add(new Term("field", "foo"));
+    pq.add(new Term("field", "bar"));
+    queries.add(pq);
+
+    bq = new BooleanQuery();
+    bq.add(pq, BooleanClause.Occur.SHOULD);
+    bq.add(new TermQuery(new Term("field", "baz")), BooleanClause.Occur.SHOULD);
+    queries.add(bq);
+
+    // Small caches, so hot terms are sometimes evicted:
+    NativeSearch.setTermStateCacheSize(_TestUtil.nextInt(random(), 8, 64));
+    try {
+      int docUpto = 0;
+      int numRounds = atLeast(4);
+      for(int round=0;round<numRounds;round++) {
+        int numDocs = _TestUtil.nextInt(random(), 100, 500);
+        for(int i=0;i<numDocs;i++) {
+          Document doc = newWordsDoc(docUpto++);
+          if (random().nextInt(20) == 7) {
+            doc.add(new TextField("field", "u" + random().nextInt(10), Field.Store.NO));
+          }
+          w.addDocument(doc);
+        }
+        for(int i=0;i<numDocs/20;i++) {
+          w.deleteDocuments(new Term("id", "" + random().nextInt(docUpto)));
+        }
+        if (random().nextBoolean()) {
+          // Merged segments are new cores, with new caches:
+          w.forceMerge(_TestUtil.nextInt(random(), 1, 3));
+        }
+
+        IndexReader r = DirectoryReader.open(w, true);
+        IndexSearcher s = new IndexSearcher(r);
+        for(Query q : queries) {
+          assertSameHits(s, q);
+          // Again, now likely from the cache:
+          assertSameHits(s, q);
+        }
+        r.close();
+      }
+    } finally {
+      NativeSearch.setTermStateCacheSize(8192);
+    }
+
+    w.close();
+    dir.close();
+  }
+
+  public void testDrillSideways() throws Exception {
+    File tmpDir = _TestUtil.getTempDir("nativesearch");
+    Directory dir = new NativeMMapDirectory(tmpDir);
+    IndexWriterConfig iwc = new IndexWriterConfig(TEST_VERSION_CURRENT, new MockAnalyzer(random()));
+    final Codec codec = new Lucene42Codec() {
+        private final DocValuesFormat facetsDVFormat = DocValuesFormat.forName("Facet42");
+        private final DocValuesFormat lucene42DVFormat = DocValuesFormat.forName("Lucene42");
+
+        @Override
+        public DocValuesFormat getDocValuesFormatForField(String field) {
+          if (field.equals(CategoryListParams.DEFAULT_FIELD)) {
+            return facetsDVFormat;
+          } else {
+            return lucene42DVFormat;
+          }
+        }
+      };
+    iwc.setCodec(codec);
+    IndexWriter w = new IndexWriter(dir, iwc);
+
+    Directory taxoDir = newDirectory();
+    DirectoryTaxonomyWriter taxoWriter = new DirectoryTaxonomyWriter(taxoDir, IndexWriterConfig.OpenMode.CREATE);
+
+    FacetFields facetFields = new FacetFields(taxoWriter);
+
+    Document doc = new Document();
+    doc.add(new TextField("field", "x", Field.Store.NO));
+    add(facetFields, doc, "vendor/Intel", "speed/Fast");
+    w.addDocument(doc);
+    doc = new Document();
+    doc.add(new TextField("field", "x y", Field.Store.NO));
+    add(facetFields, doc, "vendor/AMD", "speed/Slow");
+    w.addDocument(doc);
+
+    IndexReader r = DirectoryReader.open(w, true);
+    w.close();
+
+    TaxonomyReader taxoReader = new DirectoryTaxonomyReader(taxoWriter);
+    taxoWriter.close();
+
+    IndexSearcher s = new IndexSearcher(r);
+
+    FacetSearchParams fsp = new FacetSearchParams(
+                                new CountFacetRequest(new CategoryPath("vendor"), 10),
+                                new CountFacetRequest(new CategoryPath("speed"), 10));
+
+    DrillSideways ds = new DrillSideways(s, taxoReader);
+    BooleanQuery bq = new BooleanQuery();
+    bq.add(new TermQuery(new Term("field", "x")), BooleanClause.Occur.SHOULD);
+    bq.add(new TermQuery(new Term("field", "x")), BooleanClause.Occur.SHOULD);
+
+    DrillDownQuery ddq;
+    DrillSidewaysResult dsResult;
+
+    ddq = new DrillDownQuery(fsp.indexingParams, bq);
+    ddq.add(new CategoryPath("vendor", "Intel"));
+    dsResult = NativeSearch.drillSidewaysSearchNative(ds, ddq, 10, fsp);
+    assertEquals(1, dsResult.hits.totalHits);
+    assertEquals(0, dsResult.hits.scoreDocs[0].doc);
+    assertEquals(2, dsResult.facetResults.size());
+    assertEquals("vendor (0)\n  AMD (1)\n  Intel (1)\n", toSimpleString(dsResult.facetResults.get(0)));
+    assertEquals("speed (0)\n  Fast (1)\n", toSimpleString(dsResult.facetResults.get(1)));
+
+    assertSameHits(ds, ddq, fsp);
+
+    // Multi-select:
+    //System.out.println("now test multiselect");
+    ddq = new DrillDownQuery(fsp.indexingParams, bq);
+    ddq.add(new CategoryPath("vendor", "Intel"), new CategoryPath("vendor", "AMD"));
+    //System.out.println("ddq: " + ddq);
+    assertSameHits(ds, ddq, fsp);
+
+    dsResult = NativeSearch.drillSidewaysSearchNative(ds, ddq, 10, fsp);
+    assertEquals(2, dsResult.hits.totalHits);
+    assertEquals(0, dsResult.hits.scoreDocs[0].doc);
+    assertEquals(2, dsResult.facetResults.size());
+    assertEquals("vendor (0)\n  AMD (1)\n  Intel (1)\n", toSimpleString(dsResult.facetResults.get(0)));
+    assertEquals("speed (0)\n  Slow (1)\n  Fast (1)\n", toSimpleString(dsResult.facetResults.get(1)));
+
+    // Two drill-downs:
+    //System.out.println("\nTEST: now test double drilldown");
+    ddq = new DrillDownQuery(fsp.indexingParams, bq);
+    ddq.add(new CategoryPath("vendor", "Intel"));
+    ddq.add(new CategoryPath("speed", "Fast"));
+    //System.out.println("ddq: " + ddq);
+    assertSameHits(ds, ddq, fsp);
+
+    dsResult = NativeSearch.drillSidewaysSearchNative(ds, ddq, 10, fsp);
+    assertEquals(1, dsResult.hits.totalHits);
+    assertEquals(0, dsResult.hits.scoreDocs[0].doc);
+    assertEquals(2, dsResult.facetResults.size());
+    assertEquals("vendor (0)\n  Intel (1)\n", toSimpleString(dsResult.facetResults.get(0)));
+    assertEquals("speed (0)\n  Fast (1)\n", toSimpleString(dsResult.facetResults.get(1)));
+
+    // SHOULD + MUST_NOT
+    //System.out.println("TEST: should + must_not");
+    bq = new BooleanQuery();
+    bq.add(new TermQuery(new Term("field", "x")), BooleanClause.Occur.SHOULD);
+    bq.add(new TermQuery(new Term("field", "y")), BooleanClause.Occur.MUST_NOT);
+    ddq = new DrillDownQuery(fsp.indexingParams, bq);
+    ddq.add(new CategoryPath("vendor", "Intel"));
+    //System.out.println("ddq: " + ddq);
+    assertSameHits(ds, ddq, fsp);
+
+    dsResult = NativeSearch.drillSidewaysSearchNative(ds, ddq, 10, fsp);
+    assertEquals(1, dsResult.hits.totalHits);
+    assertEquals(0, dsResult.hits.scoreDocs[0].doc);
+    assertEquals(2, dsResult.facetResults.size());
+    assertEquals("vendor (0)\n  Intel (1)\n", toSimpleString(dsResult.facetResults.get(0)));
+    assertEquals("speed (0)\n  Fast (1)\n", toSimpleString(dsResult.facetResults.get(1)));
+
+    // SHOULD + MUST
+    //System.out.println("TEST: should + must_not");
+    bq = new BooleanQuery();
+    bq.add(new TermQuery(new Term("field", "x")), BooleanClause.Occur.SHOULD);
+    bq.add(new TermQuery(new Term("field", "y")), BooleanClause.Occur.MUST);
+    ddq = new DrillDownQuery(fsp.indexingParams, bq);
+    ddq.add(new CategoryPath("vendor", "AMD"));
+    assertSameHits(ds, ddq, fsp);
+
+    // SHOULD + MUST + MUST_NOT
+    //System.out.println("TEST: should + must_not");
+    bq = new BooleanQuery();
+    bq.add(new TermQuery(new Term("field", "x")), BooleanClause.Occur.SHOULD);
+    bq.add(new TermQuery(new Term("field", "x")), BooleanClause.Occur.MUST);
+    bq.add(new TermQuery(new Term("field", "y")), BooleanClause.Occur.MUST_NOT);
+    ddq = new DrillDownQuery(fsp.indexingParams, bq);
+    ddq.add(new CategoryPath("vendor", "AMD"));
+    assertSameHits(ds, ddq, fsp);
+
+    // TermQuery
+    Query tq = new TermQuery(new Term("field", "x"));
+    ddq = new DrillDownQuery(fsp.indexingParams, tq);
+    ddq.add(new CategoryPath("vendor", "AMD"));
+    assertSameHits(ds, ddq, fsp);
+
+    taxoReader.close();
+    r.close();
+    dir.close();
+    taxoDir.close();
+  }
+
+  public void testDrillSidewaysFused() throws Exception {
+    IndexWriter w = newNativeFacetsWriter();
+    Directory dir = w.getDirectory();
+
+    Directory taxoDir = newDirectory();
+    DirectoryTaxonomyWriter taxoWriter = new DirectoryTaxonomyWriter(taxoDir, IndexWriterConfig.OpenMode.CREATE);
+
+    FacetFields facetFields = new FacetFields(taxoWriter);
+
+    String[] words = new String[] {"x", "y", "z"};
+    int numDocs = atLeast(3000);
+    for(int docUpto=0;docUpto<numDocs;docUpto++) {
+      Document doc = new Document();
+      doc.add(new TextField("field", words[random().nextInt(words.length)] + " " + words[random().nextInt(words.length)], Field.Store.NO));
+      add(facetFields, doc,
+          "vendor/V" + random().nextInt(20),
+          "speed/S" + random().nextInt(5));
+      w.addDocument(doc);
+      if (docUpto == numDocs/2) {
+        w.commit();
+      }
+    }
+
+    IndexReader r = DirectoryReader.open(w, true);
+    w.close();
+
+    TaxonomyReader taxoReader = new DirectoryTaxonomyReader(taxoWriter);
+    taxoWriter.close();
+
+    IndexSearcher s = new IndexSearcher(r);
+
+    FacetSearchParams fsp = new FacetSearchParams(
+                                new CountFacetRequest(new CategoryPath("vendor"), 10),
+                                new CountFacetRequest(new CategoryPath("speed"), 10));
+
+    DrillSideways ds = new DrillSideways(s, taxoReader);
+
+    BooleanQuery should = new BooleanQuery();
+    should.add(new TermQuery(new Term("field", "x")), BooleanClause.Occur.SHOULD);
+    should.add(new TermQuery(new Term("field", "y")), BooleanClause.Occur.SHOULD);
+
+    BooleanQuery must = new BooleanQuery();
+    must.add(new TermQuery(new Term("field", "x")), BooleanClause.Occur.MUST);
+    must.add(new TermQuery(new Term("field", "y")), BooleanClause.Occur.SHOULD);
+
+    BooleanQuery mustNot = new BooleanQuery();
+    mustNot.add(new TermQuery(new Term("field", "x")), BooleanClause.Occur.SHOULD);
+    mustNot.add(new TermQuery(new Term("field", "z")), BooleanClause.Occur.MUST_NOT);
+
+    BooleanQuery mustMustNot = new BooleanQuery();
+    mustMustNot.add(new TermQuery(new Term("field", "x")), BooleanClause.Occur.MUST);
+    mustMustNot.add(new TermQuery(new Term("field", "y")), BooleanClause.Occur.SHOULD);
+    mustMustNot.add(new TermQuery(new Term("field", "z")), BooleanClause.Occur.MUST_NOT);
+
+    // Each comparison must count facets in the search
+    // kernels, not from bitsets afterwards:
+    NativeSearch.requireFusedFacets = true;
+    try {
+      for(Query q : new Query[] {new TermQuery(new Term("field", "x")), should, must, mustNot, mustMustNot}) {
+        DrillDownQuery ddq = new DrillDownQuery(fsp.indexingParams, q);
+        ddq.add(new CategoryPath("vendor", "V3"));
+        assertSameHits(ds, ddq, fsp);
+
+        // Multi-select:
+        ddq = new DrillDownQuery(fsp.indexingParams, q);
+        ddq.add(new CategoryPath("vendor", "V3"), new CategoryPath("vendor", "V11"));
+        assertSameHits(ds, ddq, fsp);
+
+        // Two drill-downs:
+        ddq = new DrillDownQuery(fsp.indexingParams, q);
+        ddq.add(new CategoryPath("vendor", "V3"), new CategoryPath("vendor", "V11"));
+        ddq.add(new CategoryPath("speed", "S2"));
+        assertSameHits(ds, ddq, fsp);
+      }
+    } finally {
+      NativeSearch.requireFusedFacets = false;
+    }
+
+    taxoReader.close();
+    r.close();
+    dir.close();
+    taxoDir.close();
+  }
+
+  public void testDrillSidewaysSparseFacets() throws Exception {
+    IndexWriter w = newNativeFacetsWriter();
+    Directory dir = w.getDirectory();
+
+    Directory taxoDir = newDirectory();
+    DirectoryTaxonomyWriter taxoWriter = new DirectoryTaxonomyWriter(taxoDir, IndexWriterConfig.OpenMode.CREATE);
+
+    FacetFields facetFields = new FacetFields(taxoWriter);
+
+    // Every doc adds a new id ord, so the taxonomy is far
+    // larger than the handful of ords the rare hits touch,
+    // and their counts stay sparse:
+    int numDocs = atLeast(5000);
+    int numRare = 0;
+    for(int docUpto=0;docUpto<numDocs;docUpto++) {
+      Document doc = new Document();
+      String text = random().nextBoolean() ? "x" : "y";
+      if (random().nextInt(1000) == 17 || (docUpto == numDocs-1 && numRare == 0)) {
+        text += " rare";
+        numRare++;
+      }
+      doc.add(new TextField("field", text, Field.Store.NO));
+      add(facetFields, doc,
+          "vendor/V" + random().nextInt(20),
+          "speed/S" + random().nextInt(5),
+          "id/" + docUpto);
+      w.addDocument(doc);
+      if (docUpto == numDocs/2) {
+        w.commit();
+      }
+    }
+
+    IndexReader r = DirectoryReader.open(w, true);
+    w.close();
+
+    TaxonomyReader taxoReader = new DirectoryTaxonomyReader(taxoWriter);
+    taxoWriter.close();
+    assertTrue(taxoReader.getSize() > numDocs);
+
+    IndexSearcher s = new IndexSearcher(r);
+
+    FacetSearchParams fsp = new FacetSearchParams(
+                                new CountFacetRequest(new CategoryPath("vendor"), 10),
+                                new CountFacetRequest(new CategoryPath("speed"), 10),
+                                new CountFacetRequest(new CategoryPath("id"), 10));
+
+    DrillSideways ds = new DrillSideways(s, taxoReader);
+
+    BooleanQuery should = new BooleanQuery();
+    should.add(new TermQuery(new Term("field", "rare")), BooleanClause.Occur.SHOULD);
+    should.add(new TermQuery(new Term("field", "missing")), BooleanClause.Occur.SHOULD);
+
+    BooleanQuery must = new BooleanQuery();
+    must.add(new TermQuery(new Term("field", "rare")), BooleanClause.Occur.MUST);
+    must.add(new TermQuery(new Term("field", "x")), BooleanClause.Occur.SHOULD);
+
+    NativeSearch.requireFusedFacets = true;
+    try {
+      for(Query q : new Query[] {new TermQuery(new Term("field", "rare")), should, must}) {
+        DrillDownQuery ddq = new DrillDownQuery(fsp.indexingParams, q);
+        ddq.add(new CategoryPath("vendor", "V3"), new CategoryPath("vendor", "V11"));
+        assertSameHits(ds, ddq, fsp);
+
+        ddq = new DrillDownQuery(fsp.indexingParams, q);
+        ddq.add(new CategoryPath("speed", "S2"));
+        ddq.add(new CategoryPath("vendor", "V3"));
+        assertSameHits(ds, ddq, fsp);
+      }
+    } finally {
+      NativeSearch.requireFusedFacets = false;
+    }
+
+    taxoReader.close();
+    r.close();
+    dir.close();
+    taxoDir.close();
+  }
+
+  public void testDrillSidewaysManyDocs() throws Exception {
+    IndexWriter w = newNativeFacetsWriter();
+    Directory dir = w.getDirectory();
+
+    Directory taxoDir = newDirectory();
+    DirectoryTaxonomyWriter taxoWriter = new DirectoryTaxonomyWriter(taxoDir, IndexWriterConfig.OpenMode.CREATE);
+
+    FacetFields facetFields = new FacetFields(taxoWriter);
+
+    // Enough docs and ords that the segments' facet
+    // docToAddress need different bitsPerValue (and so
+    // different packed formats):
+    String[] words = new String[] {"x", "y", "z"};
+    int numDocs = atLeast(10000);
+    for(int docUpto=0;docUpto<numDocs;docUpto++) {
+      Document doc = new Document();
+      doc.add(new TextField("field", words[random().nextInt(words.length)] + " " + words[random().nextInt(words.length)], Field.Store.NO));
+      add(facetFields, doc,
+          "vendor/V" + random().nextInt(500),
+          "speed/S" + random().nextInt(20),
+          "size/" + random().nextInt(1000));
+      w.addDocument(doc);
+      if (docUpto == 1000) {
+        w.commit();
+      }
+    }
+
+    IndexReader r = DirectoryReader.open(w, true);
+    w.close();
+
+    TaxonomyReader taxoReader = new DirectoryTaxonomyReader(taxoWriter);
+    taxoWriter.close();
+
+    IndexSearcher s = new IndexSearcher(r);
+
+    FacetSearchParams fsp = new FacetSearchParams(
+                                new CountFacetRequest(new CategoryPath("vendor"), 10),
+                                new CountFacetRequest(new CategoryPath("speed"), 10),
+                                new CountFacetRequest(new CategoryPath("size"), 10));
+
+    DrillSideways ds = new DrillSideways(s, taxoReader);
+
+    // Drill-down hits are sparse, so their native counts stay
+    // hashed, and sideways hits dense:
+    for(Query q : new Query[] {new TermQuery(new Term("field", "x")), new TermQuery(new Term("field", "y"))}) {
+      DrillDownQuery ddq = new DrillDownQuery(fsp.indexingParams, q);
+      ddq.add(new CategoryPath("speed", "S3"));
+      assertSameHits(ds, ddq, fsp);
+
+      ddq = new DrillDownQuery(fsp.indexingParams, q);
+      ddq.add(new CategoryPath("vendor", "V7"), new CategoryPath("vendor", "V8"));
+      ddq.add(new CategoryPath("speed", "S3"));
+      assertSameHits(ds, ddq, fsp);
+    }
+
+    // Counted from the hit bitsets, across all segments;
+    // else this index is too small to use more than one
+    // thread:
+    NativeSearch.setFacetCountThreads(4);
+    int minHitsPerThread = NativeSearch.facetCountMinHitsPerThread;
+    NativeSearch.facetCountMinHitsPerThread = _TestUtil.nextInt(random(), 1, 1000);
+    try {
+      for(Query q : new Query[] {new TermQuery(new Term("field", "x")), new TermQuery(new Term("field", "y"))}) {
+        DrillDownQuery ddq = new DrillDownQuery(fsp.indexingParams, q);
+        ddq.add(new CategoryPath("speed", "S3"));
+        assertSameHits(ds, ddq, fsp);
+
+        ddq = new DrillDownQuery(fsp.indexingParams, q);
+        ddq.add(new CategoryPath("vendor", "V7"), new CategoryPath("vendor", "V8"));
+        ddq.add(new CategoryPath("speed", "S3"));
+        assertSameHits(ds, ddq, fsp);
+      }
+    } finally {
+      NativeSearch.setFacetCountThreads(1);
+      NativeSearch.facetCountMinHitsPerThread = minHitsPerThread;
+    }
+
+    taxoReader.close();
+    r.close();
+    dir.close();
+    taxoDir.close();
+  }
+
+  public void testDrillSidewaysHierarchical() throws Exception {
+    IndexWriter w = newNativeFacetsWriter();
+    Directory dir = w.getDirectory();
+
+    Directory taxoDir = newDirectory();
+    DirectoryTaxonomyWriter taxoWriter = new DirectoryTaxonomyWriter(taxoDir, IndexWriterConfig.OpenMode.CREATE);
+
+    // Only leaf ords are indexed, so counts must be rolled
+    // up to their ancestors:
+    FacetIndexingParams fip = new FacetIndexingParams(new CategoryListParams() {
+        @Override
+        public OrdinalPolicy getOrdinalPolicy(String dimension) {
+          return OrdinalPolicy.NO_PARENTS;
+        }
+      });
+    FacetFields facetFields = new FacetFields(taxoWriter, fip);
+
+    String[] words = new String[] {"x", "y"};
+    String[] locations = new String[] {"US/CA/SF", "US/CA/LA", "US/NY", "DE/BE", "DE/HH", "FR"};
+    int numDocs = atLeast(300);
+    for(int docUpto=0;docUpto<numDocs;docUpto++) {
+      Document doc = new Document();
+      doc.add(new TextField("field", words[random().nextInt(words.length)], Field.Store.NO));
+      add(facetFields, doc,
+          "location/" + locations[random().nextInt(locations.length)],
+          "speed/S" + random().nextInt(5));
+      w.addDocument(doc);
+    }
+
+    IndexReader r = DirectoryReader.open(w, true);
+    w.close();
+
+    TaxonomyReader taxoReader = new DirectoryTaxonomyReader(taxoWriter);
+    taxoWriter.close();
+
+    IndexSearcher s = new IndexSearcher(r);
+    DrillSideways ds = new DrillSideways(s, taxoReader);
+
+    // Top children are picked natively:
+    FacetSearchParams fsp = new FacetSearchParams(fip,
+                                new CountFacetRequest(new CategoryPath("location"), 2),
+                                new CountFacetRequest(new CategoryPath("speed"), 10));
+    DrillDownQuery ddq = new DrillDownQuery(fip, new TermQuery(new Term("field", "x")));
+    ddq.add(new CategoryPath("speed", "S1"));
+    assertSameHits(ds, ddq, fsp);
+
+    ddq = new DrillDownQuery(fip, new TermQuery(new Term("field", "x")));
+    ddq.add(new CategoryPath("location", "US"));
+    assertSameHits(ds, ddq, fsp);
+
+    // Deeper requests fall back to the accumulator:
+    CountFacetRequest deep = new CountFacetRequest(new CategoryPath("location"), 10);
+    deep.setDepth(2);
+    fsp = new FacetSearchParams(fip, deep, new CountFacetRequest(new CategoryPath("speed"), 10));
+    ddq = new DrillDownQuery(fip, new TermQuery(new Term("field", "y")));
+    ddq.add(new CategoryPath("speed", "S2"));
+    assertSameHits(ds, ddq, fsp);
+
+    taxoReader.close();
+    r.close();
+    dir.close();
+    taxoDir.close();
+  }
+
+  public void testDrillSidewaysSumScore() throws Exception {
+    IndexWriter w = newNativeFacetsWriter();
+    Directory dir = w.getDirectory();
+
+    Directory taxoDir = newDirectory();
+    DirectoryTaxonomyWriter taxoWriter = new DirectoryTaxonomyWriter(taxoDir, IndexWriterConfig.OpenMode.CREATE);
+
+    FacetFields facetFields = new FacetFields(taxoWriter);
+
+    String[] words = new String[] {"x", "y", "z"};
+    int numDocs = atLeast(1000);
+    for(int docUpto=0;docUpto<numDocs;docUpto++) {
+      Document doc = new Document();
+      StringBuilder sb = new StringBuilder();
+      int numTokens = _TestUtil.nextInt(random(), 1, 5);
+      for(int i=0;i<numTokens;i++) {
+        sb.append(' ');
+        sb.append(words[random().nextInt(words.length)]);
+      }
+      doc.add(new TextField("field", sb.toString(), Field.Store.NO));
+      add(facetFields, doc,
+          "vendor/V" + random().nextInt(20),
+          "speed/S" + random().nextInt(5));
+      w.addDocument(doc);
+    }
+
+    IndexReader r = DirectoryReader.open(w, true);
+    w.close();
+
+    final TaxonomyReader taxoReader = new DirectoryTaxonomyReader(taxoWriter);
+    taxoWriter.close();
+
+    final IndexSearcher s = new IndexSearcher(r);
+
+    FacetSearchParams fsp = new FacetSearchParams(
+                                new SumScoreFacetRequest(new CategoryPath("vendor"), 10),
+                                new SumScoreFacetRequest(new CategoryPath("speed"), 10));
+
+    // Each hit's score is summed into its ords:
+    DrillSideways ds = new DrillSideways(s, taxoReader) {
+        @Override
+        protected FacetsAccumulator getDrillDownAccumulator(FacetSearchParams fsp) {
+          return new SumScoreFacetsAccumulator(fsp, s.getIndexReader(), taxoReader);
+        }
+
+        @Override
+        protected FacetsAccumulator getDrillSidewaysAccumulator(String dim, FacetSearchParams fsp) {
+          return new SumScoreFacetsAccumulator(fsp, s.getIndexReader(), taxoReader);
+        }
+      };
+
+    BooleanQuery bq = new BooleanQuery();
+    bq.add(new TermQuery(new Term("field", "x")), BooleanClause.Occur.SHOULD);
+    bq.add(new TermQuery(new Term("field", "y")), BooleanClause.Occur.SHOULD);
+    DrillDownQuery ddq = new DrillDownQuery(fsp.indexingParams, bq);
+    ddq.add(new CategoryPath("speed", "S3"));
+    assertSameHits(ds, ddq, fsp);
+
+    ddq = new DrillDownQuery(fsp.indexingParams, new TermQuery(new Term("field", "z")));
+    ddq.add(new CategoryPath("vendor", "V7"), new CategoryPath("vendor", "V8"));
+    ddq.add(new CategoryPath("speed", "S1"));
+    assertSameHits(ds, ddq, fsp);
+
+    taxoReader.close();
+    r.close();
+    dir.close();
+    taxoDir.close();
+  }
+
+  private static class SumScoreFacetsAccumulator extends FacetsAccumulator {
+    public SumScoreFacetsAccumulator(FacetSearchParams fsp, IndexReader reader, TaxonomyReader taxoReader) {
+      super(fsp, reader, taxoReader);
+    }
+
+    @Override
+    public FacetsAggregator getAggregator() {
+      return new SumScoreFacetsAggregator();
+    }
+  }
+
+  public void testDrillSidewaysSumFloatAssociation() throws Exception {
+    // The associations are indexed in their own field:
+    IndexWriter w = newNativeFacetsWriter(CategoryListParams.DEFAULT_FIELD + CategoryFloatAssociation.ASSOCIATION_LIST_ID);
+    Directory dir = w.getDirectory();
+
+    Directory taxoDir = newDirectory();
+    DirectoryTaxonomyWriter taxoWriter = new DirectoryTaxonomyWriter(taxoDir, IndexWriterConfig.OpenMode.CREATE);
+
+    AssociationsFacetFields facetFields = new AssociationsFacetFields(taxoWriter);
+
+    String[] words = new String[] {"x", "y", "z"};
+    int numDocs = atLeast(1000);
+    for(int docUpto=0;docUpto<numDocs;docUpto++) {
+      Document doc = new Document();
+      doc.add(new TextField("field", words[random().nextInt(words.length)] + " " + words[random().nextInt(words.length)], Field.Store.NO));
+      CategoryAssociationsContainer associations = new CategoryAssociationsContainer();
+      associations.setAssociation(new CategoryPath("vendor", "V" + random().nextInt(20)),
+                                  new CategoryFloatAssociation(random().nextFloat()));
+      associations.setAssociation(new CategoryPath("speed", "S" + random().nextInt(5)),
+                                  new CategoryFloatAssociation(100*random().nextFloat()));
+      facetFields.addFields(doc, associations);
+      w.addDocument(doc);
+      if (docUpto == numDocs/2) {
+        w.commit();
+      }
+    }
+
+    IndexReader r = DirectoryReader.open(w, true);
+    w.close();
+
+    final TaxonomyReader taxoReader = new DirectoryTaxonomyReader(taxoWriter);
+    taxoWriter.close();
+
+    final IndexSearcher s = new IndexSearcher(r);
+
+    FacetSearchParams fsp = new FacetSearchParams(
+                                new SumFloatAssociationFacetRequest(new CategoryPath("vendor"), 10),
+                                new SumFloatAssociationFacetRequest(new CategoryPath("speed"), 10));
+
+    // Each hit's association values are summed into its ords:
+    DrillSideways ds = new DrillSideways(s, taxoReader) {
+        @Override
+        protected FacetsAccumulator getDrillDownAccumulator(FacetSearchParams fsp) {
+          return new SumFloatAssociationFacetsAccumulator(fsp, s.getIndexReader(), taxoReader);
+        }
+
+        @Override
+        protected FacetsAccumulator getDrillSidewaysAccumulator(String dim, FacetSearchParams fsp) {
+          return new SumFloatAssociationFacetsAccumulator(fsp, s.getIndexReader(), taxoReader);
+        }
+      };
+
+    BooleanQuery bq = new BooleanQuery();
+    bq.add(new TermQuery(new Term("field", "x")), BooleanClause.Occur.SHOULD);
+    bq.add(new TermQuery(new Term("field", "y")), BooleanClause.Occur.SHOULD);
+
+    NativeSearch.requireFusedFacets = true;
+    try {
+      for(Query q : new Query[] {new TermQuery(new Term("field", "z")), bq}) {
+        DrillDownQuery ddq = new DrillDownQuery(fsp.indexingParams, q);
+        ddq.add(new CategoryPath("speed", "S3"));
+        assertSameHits(ds, ddq, fsp);
+
+        ddq = new DrillDownQuery(fsp.indexingParams, q);
+        ddq.add(new CategoryPath("vendor", "V7"), new CategoryPath("vendor", "V8"));
+        ddq.add(new CategoryPath("speed", "S1"));
+        assertSameHits(ds, ddq, fsp);
+      }
+    } finally {
+      NativeSearch.requireFusedFacets = false;
+    }
+
+    taxoReader.close();
+    r.close();
+    dir.close();
+    taxoDir.close();
+  }
+
+  private static class SumFloatAssociationFacetsAccumulator extends FacetsAccumulator {
+    public SumFloatAssociationFacetsAccumulator(FacetSearchParams fsp, IndexReader reader, TaxonomyReader taxoReader) {
+      super(fsp, reader, taxoReader);
+    }
+
+    @Override
+    public FacetsAggregator getAggregator() {
+      return new SumFloatAssociationFacetsAggregator();
+    }
   }
 
   // Poached from FacetTestUtils.java: